@@ -443,10 +443,13 @@ WorldCreator::InitFromBspMap(
                     }
                 }
                 // Construct CollisionModel object
+                std::vector<CollisionModel::SectionBvhNode> section_bvh =
+                    coll::Create_CollisionModelSectionBvh(section_aabbs);
                 xprop_coll_models[mdl_path] = CollisionModel {
                     .section_tri_meshes = std::move(section_tri_meshes),
                     .section_planes     = std::move(section_planes),
-                    .section_aabbs      = std::move(section_aabbs)
+                    .section_aabbs      = std::move(section_aabbs),
+                    .section_bvh        = std::move(section_bvh)
                 };
             }
             else { // If parsing failed for other reasons, get error msg
@@ -517,6 +520,8 @@ WorldCreator::InitFromBspMap(
     // Precompute collision caches of each solid prop (static or dynamic).
     // MUST HAPPEN AFTER COLL MODEL CREATION!
     Debug{} << "Creating collision caches of static props";
+    // Lets prop sections with identical bevel plane LUTs share one LUT
+    XPropSectionBevelPlaneLutPool bevel_lut_pool;
     // Keys are indices into BspMap::static_props, values are the caches.
     std::map<uint32_t, CollisionCache_XProp> coll_caches_sprop;
     for (size_t sprop_idx = 0; sprop_idx < bsp_map->static_props.size(); sprop_idx++) {
@@ -532,7 +537,7 @@ WorldCreator::InitFromBspMap(
             continue; // No collision model
         const CollisionModel& cmodel = coll_model_it->second;
 
-        auto sprop_coll_cache = coll::Create_CollisionCache_StaticProp(sprop, cmodel);
+        auto sprop_coll_cache = coll::Create_CollisionCache_StaticProp(sprop, cmodel, bevel_lut_pool);
         if (sprop_coll_cache == Corrade::Containers::NullOpt)
             continue; // Cache creation failed
         coll_caches_sprop[sprop_idx] = std::move(*sprop_coll_cache);
@@ -548,11 +553,19 @@ WorldCreator::InitFromBspMap(
             continue; // No collision model
         const CollisionModel& cmodel = coll_model_it->second;
 
-        auto dprop_coll_cache = coll::Create_CollisionCache_DynamicProp(dprop, cmodel);
+        auto dprop_coll_cache = coll::Create_CollisionCache_DynamicProp(dprop, cmodel, bevel_lut_pool);
         if (dprop_coll_cache == Corrade::Containers::NullOpt)
             continue; // Cache creation failed
         coll_caches_dprop[dprop_idx] = std::move(*dprop_coll_cache);
     }
+    Debug{} << "Prop sections share" << bevel_lut_pool.GetNumLuts() << "of"
+        << bevel_lut_pool.GetNumReferences() << "bevel plane LUTs, taking up"
+        << bevel_lut_pool.GetMemorySize() << "instead of"
+        << bevel_lut_pool.GetMemorySizeWithoutSharing() << "bytes";
+    Debug{} << "Compiling collision data of brushes";
+    CompiledBrushes compiled_brushes = coll::Create_CompiledBrushes(*bsp_map);
+    std::vector<CollisionCache_FuncBrush> coll_caches_funcbrush =
+        coll::Create_CollisionCaches_FuncBrush(*bsp_map);
 
 
 
@@ -716,20 +729,37 @@ WorldCreator::InitFromBspMap(
 
     // Create CollidableWorld object and move all collision structures into it.
     std::shared_ptr<CollidableWorld> c_world = std::make_shared<CollidableWorld>(bsp_map);
+    c_world->pImpl->compiled_brushes     = std::move(compiled_brushes);
     c_world->pImpl->hull_disp_coll_trees = std::move(hull_disp_coll_trees);
     c_world->pImpl->xprop_coll_models    = std::move(xprop_coll_models);
     c_world->pImpl->coll_caches_sprop    = std::move(coll_caches_sprop);
     c_world->pImpl->coll_caches_dprop    = std::move(coll_caches_dprop);
+    c_world->pImpl->coll_caches_funcbrush = std::move(coll_caches_funcbrush);
     // ...
 
     // BVH must be created *after* all other collision structures were created
     // and moved into the CollidableWorld object!
+    assert(c_world->pImpl->compiled_brushes     != Corrade::Containers::NullOpt);
     assert(c_world->pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
     assert(c_world->pImpl->xprop_coll_models    != Corrade::Containers::NullOpt);
     assert(c_world->pImpl->coll_caches_sprop    != Corrade::Containers::NullOpt);
     assert(c_world->pImpl->coll_caches_dprop    != Corrade::Containers::NullOpt);
+    assert(c_world->pImpl->coll_caches_funcbrush != Corrade::Containers::NullOpt);
     // ...
-    c_world->pImpl->bvh = BVH(*c_world);
+    // Map loads are interactive, prefer fast BVH construction over best BVH
+    // quality. See Benchmark::BvhBuildMethods() for the trade-off.
+    BVH::BuildOptions bvh_options;
+    bvh_options.split_method = BVH::BuildOptions::SplitMethod::BinnedSah;
+    bvh_options.sah_bin_cnt = 32;
+    c_world->pImpl->bvh = BVH(*c_world, bvh_options);
+    // func_brush entities and dynamic props can be toggled at runtime, they
+    // live in a separate BVH that is refitted instead of rebuilt
+    c_world->pImpl->dynamic_bvh = DynamicBVH(*c_world);
+
+    // Displacement collision caches are created during gameplay, let them be
+    // managed from now on
+    c_world->pImpl->disp_coll_cache_manager =
+        std::make_unique<DispCollCacheManager>(*c_world->pImpl->hull_disp_coll_trees);
 
 
     if (dest_errors)
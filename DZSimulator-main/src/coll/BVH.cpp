@@ -1,11 +1,20 @@
 #include "coll/BVH.h"
 
 #include <algorithm>
+#include <atomic>
+#include <bit>
 #include <cassert>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <stack>
 #include <span>
+#include <thread>
 #include <vector>
 
 #include <Tracy.hpp>
@@ -17,14 +26,15 @@
 
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
+#include "coll/CollidableWorld-brush.h"
 #include "coll/CollidableWorld-funcbrush.h"
 #include "coll/CollidableWorld-xprop.h"
 #include "coll/Debugger.h"
 #include "coll/SweptTrace.h"
-#include "csgo_parsing/BrushSeparation.h"
 #include "csgo_parsing/BspMap.h"
 #include "csgo_parsing/utils.h"
 #include "utils_3d.h"
+#include "CsgoConstants.h"
 
 using namespace coll;
 using namespace Magnum;
@@ -32,14 +42,16 @@ using namespace csgo_parsing;
 
 // @Optimization Is "Intel Embree" an option to speed up ray intersections?
 // @Optimization Look up BVH optimizations in https://github.com/brandonpelfrey/Fast-BVH
-// @Optimization Save memory: Store BVH AABB values as int16 (-32768 to 32767)
-//               instead of float. Increase exact AABB to nearest integers.
 
 #define PRINT_PREFIX "[BVH]"
 
-BVH::BVH(CollidableWorld& c_world)
+BVH::BVH(CollidableWorld& c_world) : BVH(c_world, BuildOptions{})
+{
+}
+
+BVH::BVH(CollidableWorld& c_world, const BuildOptions& options)
+    : build_options{ options }
 {
-    // @Optimization Is there potential to parallelize BVH creation?
     bool leaf_creation_success = CreateLeaves(c_world);
 
     total_leaf_cnt = leaves.size() - 1; // Don't count dummy leaf entry
@@ -68,17 +80,26 @@ BVH::BVH(CollidableWorld& c_world)
         }
     }
 
-    // Create root node
-    nodes.push_back({});
-    const uint32_t root_node_idx = 0;
-    Node& root_node = nodes[root_node_idx];
-    // Calc all-encompassing AABB
-    CalcAabbOfBvhLeaves(leaf_refs[0], &root_node.mins, &root_node.maxs);
+    unsigned int thread_cnt = build_options.num_threads;
+    if (thread_cnt == 0)
+        thread_cnt = Math::max(1U, std::thread::hardware_concurrency());
+#ifdef DZSIM_WEB_PORT
+    // Web build only has a small pool of pthreads that must not be exhausted
+    thread_cnt = 1;
+#endif
+    Debug{} << PRINT_PREFIX << "Building with" << thread_cnt << "thread(s)";
+    auto hierarchy_build_start = std::chrono::steady_clock::now();
+
+    // Leaf trace costs are needed many times while building the hierarchy
+    leaf_trace_costs.resize(leaves.size());
+    for (size_t i = 1; i < leaves.size(); i++) // Skip dummy leaf at index 0
+        leaf_trace_costs[i] = build_options.sah_use_leaf_trace_costs ?
+            GetSweptLeafTraceCost(leaves[i], c_world) : 1;
 
     // Sort leafs in the X, Y and Z leaf reference arrays along their respective
-    // axis
+    // axis. Each axis is sorted on its own thread if possible.
     Debug{} << PRINT_PREFIX << "Initial leaf sort along axes...";
-    for (int axis = 0; axis < 3; axis++) {
+    auto sort_leaf_refs_along_axis = [this, &leaf_refs](int axis) {
         std::sort(leaf_refs[axis].begin(), leaf_refs[axis].end(),
             [this, axis](uint32_t a, uint32_t b) { // Returns true if a is ordered before b
                 // Calculate a's and b's centroid position along the axis
@@ -89,7 +110,17 @@ BVH::BVH(CollidableWorld& c_world)
                 return a_axis_pos < b_axis_pos;
             }
         );
+    };
+    std::vector<std::thread> sort_threads;
+    for (int axis = 1; axis < 3; axis++) {
+        if (axis < (int)thread_cnt)
+            sort_threads.emplace_back(sort_leaf_refs_along_axis, axis);
+        else
+            sort_leaf_refs_along_axis(axis);
     }
+    sort_leaf_refs_along_axis(0);
+    for (std::thread& t : sort_threads)
+        t.join();
 
     // Assign the entire leaf range to the root node
     std::span<uint32_t> leaf_refs_sorted_along_axis[3] = {
@@ -99,47 +130,885 @@ BVH::BVH(CollidableWorld& c_world)
     };
 
     // Build BVH by iteratively splitting nodes down to the BVH leaves
-    CreateNodeHierarchy(root_node_idx, leaf_refs_sorted_along_axis, c_world);
+    CreateNodeHierarchy(leaf_refs_sorted_along_axis, thread_cnt);
+    assert(nodes.size() == final_node_cnt);
+
+    leaf_trace_costs.clear();
+    leaf_trace_costs.shrink_to_fit(); // Only needed during construction
+
+    auto hierarchy_build_end = std::chrono::steady_clock::now();
+    hierarchy_build_duration_ms = std::chrono::duration<float, std::milli>(
+        hierarchy_build_end - hierarchy_build_start).count();
+    Debug{} << PRINT_PREFIX << "Node hierarchy was built in"
+        << hierarchy_build_duration_ms << "ms";
 
     // Set information in each node about the leaves they contain.
     SetNodeContentsInfo();
 
     Debug{} << PRINT_PREFIX << nodes.size() << "nodes were constructed";
+
+    // Create compact depth-first representation used by traces
+    if (CreateFlatNodes()) {
+        Debug{} << PRINT_PREFIX << flat_nodes.size() << "flat nodes were "
+            "constructed, max depth:" << flat_max_depth;
+    }
+    else {
+        Debug{} << PRINT_PREFIX << "WARNING: Node hierarchy is too deep ("
+            << flat_max_depth << "levels ), flat nodes were not created.";
+    }
+
+    // Create 4-ary BVH used by traces
+    if (CreateNodes4()) {
+        Debug{} << PRINT_PREFIX << nodes4.size() << "4-ary nodes were "
+            "constructed, max depth:" << nodes4_max_depth;
+    }
+    else {
+        Debug{} << PRINT_PREFIX << "WARNING: 4-ary BVH is too deep ("
+            << nodes4_max_depth << "levels ), traces will use a slower "
+            "traversal method.";
+    }
+
+    // Optionally replace 4-ary BVH with its quantized version
+    if (build_options.quantize_node_bounds && !nodes4.empty()) {
+        if (CreateQNodes4()) {
+            Debug{} << PRINT_PREFIX << qnodes4.size() << "quantized 4-ary "
+                "nodes were constructed";
+            nodes4.clear();
+            nodes4.shrink_to_fit(); // Free memory of unused float version
+        }
+        else {
+            Debug{} << PRINT_PREFIX << "WARNING: Map coordinates exceed int16 "
+                "range, 4-ary BVH is not quantized.";
+        }
+    }
 }
 
-bool BVH::WasConstructedSuccessfully()
+bool BVH::WasConstructedSuccessfully() const
 {
     // A valid BVH must have at least one node and 2 leaves.
     return nodes.size() != 0 && total_leaf_cnt >= 2;
 }
 
-void BVH::DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world)
+void BVH::DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (!WasConstructedSuccessfully())
+        return; // Can't trace against non-existent BVH
+
+#if 0 // Debugging switch
+    // Trace against all leaves for debugging purposes
+    for (size_t i = 1; i < leaves.size(); i++)
+        DoSweptTraceAgainstLeaf(trace, leaves[i], c_world);
+    return;
+#endif
+
+    // Rays and player hulls get traversals and leaf kernels with compile-time
+    // extents, see coll/TraceShape.h.
+    // @Optimization The flat node and node hierarchy traversals don't have
+    //               shape-specialized versions, they're only fallbacks.
+    if (!qnodes4.empty()) {
+        DispatchTraceShape(trace->info, [&]<class Shape>() {
+            DoSweptTrace_Nodes4<QNode4, false, Shape>(trace, c_world, qnodes4, nullptr);
+        });
+    }
+    else if (!nodes4.empty()) {
+        DispatchTraceShape(trace->info, [&]<class Shape>() {
+            DoSweptTrace_Nodes4<Node4, false, Shape>(trace, c_world, nodes4, nullptr);
+        });
+    }
+    else if (!flat_nodes.empty()) DoSweptTrace_FlatNodes    (trace, c_world);
+    else                          DoSweptTrace_NodeHierarchy(trace, c_world);
+}
+
+void BVH::DoSweptTraceAnyHit(SweptTrace* trace, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (!WasConstructedSuccessfully())
+        return; // Can't trace against non-existent BVH
+
+    if (!qnodes4.empty()) {
+        DispatchTraceShape(trace->info, [&]<class Shape>() {
+            DoSweptTrace_Nodes4<QNode4, true, Shape>(trace, c_world, qnodes4, nullptr);
+        });
+    }
+    else if (!nodes4.empty()) {
+        DispatchTraceShape(trace->info, [&]<class Shape>() {
+            DoSweptTrace_Nodes4<Node4, true, Shape>(trace, c_world, nodes4, nullptr);
+        });
+    }
+    else {
+        DoSweptTrace(trace, c_world);
+    }
+}
+
+void BVH::LoadChildBoundsAlongAxis(const Node4& node, int axis,
+    simd::Float4* child_mins, simd::Float4* child_maxs)
+{
+    *child_mins = simd::Load4(node.child_mins[axis]);
+    *child_maxs = simd::Load4(node.child_maxs[axis]);
+}
+
+void BVH::LoadChildBoundsAlongAxis(const QNode4& node, int axis,
+    simd::Float4* child_mins, simd::Float4* child_maxs)
+{
+    // Dequantize. Integer values are exactly representable as float.
+    *child_mins = simd::LoadInt16x4(node.child_mins[axis]);
+    *child_maxs = simd::LoadInt16x4(node.child_maxs[axis]);
+}
+
+template<class Node4Type, bool ANY_HIT, class Shape>
+void BVH::DoSweptTrace_Nodes4(SweptTrace* trace, CollidableWorld& c_world,
+    const std::vector<Node4Type>& node4_arr, TraversalStats* stats) const
+{
+    // @Optimization Doing an intersection between the AABB that encloses the
+    //               trace sweep and the AABB of the root BVH node is possibly
+    //               cheaper than doing an accurate sweep against AABB of the
+    //               root BVH node.
+    const Node& root_node = nodes[0];
+    const ContentsMask contents_mask = trace->info.contents_mask;
+    if (!(root_node.contained_contents & contents_mask))
+        return;
+    float root_node_aabb_hit_fraction;
+    bool is_root_hit = trace->HitsAabbOnFullSweep(root_node.mins, root_node.maxs,
+        &root_node_aabb_hit_fraction);
+    if (!is_root_hit)
+        return;
+
+    // A leaf or a 4-ary node and its corresponding minimum collision time where
+    // the trace hits the leaf's/node's AABB.
+    struct TraversalCandidate {
+        int32_t node4_or_leaf_idx; // See Node4 struct for details
+        float aabb_hit_fraction; // When trace hits this leaf's/node's AABB
+    };
+    // CreateNodes4() made sure that this stack never overflows.
+    TraversalCandidate traversal_candidates[MAX_NODE4_TRAVERSAL_STACK_SIZE];
+    size_t traversal_candidate_cnt = 0;
+
+    traversal_candidates[traversal_candidate_cnt++] = {
+        .node4_or_leaf_idx = 0, // Root node idx
+        .aabb_hit_fraction = root_node_aabb_hit_fraction
+    };
+
+    // Trace values that are used in every child AABB test, for each axis
+    const Vector3 extents = Shape::GetExtents(trace->info);
+    simd::Float4 ray_start[3], ray_extents[3], inv_delta[3];
+    for (int axis = 0; axis < 3; axis++) {
+        ray_start  [axis] = simd::Splat4(trace->info.startpos[axis]);
+        ray_extents[axis] = simd::Splat4(extents[axis]);
+        inv_delta  [axis] = simd::Splat4(trace->info.invdelta[axis]);
+    }
+
+    // Efficiently traverse the BVH tree
+    while (traversal_candidate_cnt > 0) {
+        TraversalCandidate candidate = traversal_candidates[--traversal_candidate_cnt];
+
+        // Discard candidate if we already hit something before this candidate's
+        // AABB gets hit.
+        if (trace->results.fraction < candidate.aabb_hit_fraction)
+            continue;
+
+        // Traverse candidate
+        if (candidate.node4_or_leaf_idx < 0) { // If candidate is a leaf
+            int32_t leaf_idx = -candidate.node4_or_leaf_idx;
+            const Leaf& leaf = leaves[leaf_idx];
+
+            // @Optimization Make sure CDispCollTree code doesn't do the same
+            //               AABB check that we already do.
+            coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, leaf_idx);
+            DoSweptTraceAgainstLeaf<Shape>(trace, leaf, c_world);
+            coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+            if (stats) stats->visited_leaves++;
+            if (ANY_HIT && trace->results.DidHit())
+                return; // Any hit is good enough
+            continue;
+        }
+
+        const Node4Type& parent_node = node4_arr[candidate.node4_or_leaf_idx];
+        if (stats) stats->visited_nodes++;
+
+        // Children whose contents the trace doesn't collide with are skipped
+        // without looking at their AABB.
+        const std::array<ContentsMask, 4>& child_contents =
+            nodes4_child_contents[candidate.node4_or_leaf_idx];
+        int contents_match_mask = 0;
+        for (int i = 0; i < 4; i++)
+            if (child_contents[i] & contents_mask)
+                contents_match_mask |= 1 << i;
+        if (contents_match_mask == 0)
+            continue;
+
+        // Trace against all 4 child AABBs at once. This is the same
+        // computation that IsAabbHitByFullSweptTrace() does, see there.
+        simd::Float4 box_entry_t, box_exit_t;
+        for (int axis = 0; axis < 3; axis++) {
+            simd::Float4 hit_mins, hit_maxs;
+            LoadChildBoundsAlongAxis(parent_node, axis, &hit_mins, &hit_maxs);
+            hit_mins = simd::Sub(hit_mins, ray_start[axis]);
+            hit_maxs = simd::Sub(hit_maxs, ray_start[axis]);
+            if constexpr (!Shape::ALWAYS_RAY) { // Rays have zero extents
+                hit_mins = simd::Sub(hit_mins, ray_extents[axis]);
+                hit_maxs = simd::Add(hit_maxs, ray_extents[axis]);
+            }
+            hit_mins = simd::Mul(hit_mins, inv_delta[axis]);
+            hit_maxs = simd::Mul(hit_maxs, inv_delta[axis]);
+            simd::Float4 axis_entry_t = simd::Min(hit_mins, hit_maxs);
+            simd::Float4 axis_exit_t  = simd::Max(hit_mins, hit_maxs);
+            if (axis == 0) {
+                box_entry_t = axis_entry_t;
+                box_exit_t  = axis_exit_t;
+            }
+            else {
+                box_entry_t = simd::Max(box_entry_t, axis_entry_t);
+                box_exit_t  = simd::Min(box_exit_t,  axis_exit_t);
+            }
+        }
+        box_entry_t = simd::Max(box_entry_t, simd::Splat4(0.0f));
+        box_exit_t  = simd::Min(box_exit_t,  simd::Splat4(1.0f));
+
+        int hit_mask = simd::CmpLeMask(box_entry_t, box_exit_t) & contents_match_mask;
+        if (hit_mask == 0)
+            continue;
+
+        alignas(simd::FLOAT4_ALIGNMENT) float child_aabb_hit_fractions[4];
+        simd::Store4(child_aabb_hit_fractions, box_entry_t);
+
+        // Collect hit children, sorted by descending hit fraction
+        TraversalCandidate child_candidates[4];
+        size_t child_candidate_cnt = 0;
+        for (int i = 0; i < 4; i++) {
+            if (!(hit_mask & (1 << i)) || parent_node.children[i] == 0)
+                continue; // Skip children that aren't hit and unused child slots
+            TraversalCandidate new_candidate = {
+                .node4_or_leaf_idx = parent_node.children[i],
+                .aabb_hit_fraction = child_aabb_hit_fractions[i]
+            };
+            if constexpr (ANY_HIT) { // Order doesn't matter, don't sort
+                child_candidates[child_candidate_cnt++] = new_candidate;
+                continue;
+            }
+            size_t pos = child_candidate_cnt++;
+            while (pos > 0 && child_candidates[pos - 1].aabb_hit_fraction
+                                < new_candidate.aabb_hit_fraction) {
+                child_candidates[pos] = child_candidates[pos - 1];
+                pos--;
+            }
+            child_candidates[pos] = new_candidate;
+        }
+
+        // Children with smaller hit fractions are traversed before the others.
+        // This enables us to potentially discard children that are further
+        // away at a later point in time.
+        assert(traversal_candidate_cnt + child_candidate_cnt <= MAX_NODE4_TRAVERSAL_STACK_SIZE);
+        for (size_t i = 0; i < child_candidate_cnt; i++) // Closest child ends up on top of the stack
+            traversal_candidates[traversal_candidate_cnt++] = child_candidates[i];
+    }
+}
+
+// Inserts 2 zero bits between each of the lower 10 bits of x
+static uint32_t SpreadBitsForMortonCode(uint32_t x)
+{
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x <<  8)) & 0x0300F00F;
+    x = (x | (x <<  4)) & 0x030C30C3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+// Returns a key that places traces with the same direction octant and nearby
+// start positions close to each other when sorting by it.
+static uint64_t GetTraceCoherenceSortKey(const SweptTrace::Info& trace_info,
+    const Vector3& world_mins, const Vector3& world_maxs)
+{
+    uint64_t dir_octant = 0;
+    uint32_t morton_code = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        if (trace_info.delta[axis] < 0.0f)
+            dir_octant |= 1 << axis;
+
+        // Quantize start position to 10 bits within the world's AABB
+        float world_extent = world_maxs[axis] - world_mins[axis];
+        float rel_pos = world_extent > 0.0f ?
+            (trace_info.startpos[axis] - world_mins[axis]) / world_extent : 0.0f;
+        rel_pos = Math::clamp(rel_pos, 0.0f, 1.0f);
+        uint32_t quantized_pos = (uint32_t)(rel_pos * 1023.0f);
+        morton_code |= SpreadBitsForMortonCode(quantized_pos) << axis;
+    }
+    return (dir_octant << 30) | morton_code;
+}
+
+void BVH::DoSweptTraces(std::span<SweptTrace> traces, CollidableWorld& c_world) const
+{
+    std::vector<SweptTrace*> trace_ptrs;
+    trace_ptrs.reserve(traces.size());
+    for (SweptTrace& trace : traces)
+        trace_ptrs.push_back(&trace);
+    DoSweptTraces(std::span<SweptTrace* const>(trace_ptrs), c_world);
+}
+
+void BVH::DoSweptTraces(std::span<SweptTrace* const> traces, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (!WasConstructedSuccessfully())
+        return; // Can't trace against non-existent BVH
+
+    // Packets can only traverse the 4-ary BVH
+    if (qnodes4.empty() && nodes4.empty()) {
+        for (SweptTrace* trace : traces)
+            DoSweptTrace(trace, c_world);
+        return;
+    }
+
+    // Sort traces so that traces of the same packet are likely to visit the
+    // same nodes. The given trace order doesn't matter, every trace is
+    // independent of the others.
+    std::vector<std::pair<uint64_t, SweptTrace*>> sorted_traces;
+    sorted_traces.reserve(traces.size());
+    for (SweptTrace* trace : traces)
+        sorted_traces.emplace_back(
+            GetTraceCoherenceSortKey(trace->info, nodes[0].mins, nodes[0].maxs),
+            trace);
+    std::stable_sort(sorted_traces.begin(), sorted_traces.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<PacketLeafCandidate> candidates; // Reused by all packets
+    SweptTrace* packet[TRACE_PACKET_SIZE];
+    for (size_t first = 0; first < sorted_traces.size(); first += TRACE_PACKET_SIZE) {
+        size_t packet_size = Math::min(TRACE_PACKET_SIZE, sorted_traces.size() - first);
+        for (size_t i = 0; i < packet_size; i++)
+            packet[i] = sorted_traces[first + i].second;
+
+        std::span<SweptTrace* const> packet_span(packet, packet_size);
+        if (!qnodes4.empty()) DoSweptTracePacket_Nodes4(packet_span, c_world, qnodes4, &candidates);
+        else                  DoSweptTracePacket_Nodes4(packet_span, c_world, nodes4,  &candidates);
+    }
+}
+
+template<class Node4Type>
+void BVH::DoSweptTracePacket_Nodes4(std::span<SweptTrace* const> packet,
+    CollidableWorld& c_world, const std::vector<Node4Type>& node4_arr,
+    std::vector<PacketLeafCandidate>* candidates) const
+{
+    static_assert(TRACE_PACKET_SIZE <= 32, "Trace masks are 32 bits wide");
+    // 2 bits per 4-ary node level must fit into a traversal order key. Each
+    // level leaves at most 3 candidates behind on the traversal stack.
+    static_assert(2 * ((MAX_NODE4_TRAVERSAL_STACK_SIZE - 1) / 3) <= 64,
+        "4-ary BVH might be too deep for PacketLeafCandidate::traversal_order_key");
+    assert(packet.size() <= TRACE_PACKET_SIZE);
+    assert(3 * nodes4_max_depth + 1 <= MAX_NODE4_TRAVERSAL_STACK_SIZE);
+
+    // Trace values that are used in every child AABB test, for each axis
+    struct PacketTraceValues {
+        simd::Float4 ray_start[3], ray_extents[3], inv_delta[3];
+    };
+    PacketTraceValues trace_values[TRACE_PACKET_SIZE];
+
+    // Root node check, same as in DoSweptTrace_Nodes4()
+    const Node& root_node = nodes[0];
+    uint32_t root_trace_mask = 0; // Bit i is set if packet[i] hits the root node
+    for (size_t t = 0; t < packet.size(); t++) {
+        const SweptTrace& trace = *packet[t];
+        if (!(root_node.contained_contents & trace.info.contents_mask))
+            continue;
+        float root_node_aabb_hit_fraction;
+        if (!trace.HitsAabbOnFullSweep(root_node.mins, root_node.maxs,
+                                       &root_node_aabb_hit_fraction))
+            continue;
+        if (trace.results.fraction < root_node_aabb_hit_fraction)
+            continue;
+
+        root_trace_mask |= 1u << t;
+        for (int axis = 0; axis < 3; axis++) {
+            trace_values[t].ray_start  [axis] = simd::Splat4(trace.info.startpos[axis]);
+            trace_values[t].ray_extents[axis] = simd::Splat4(trace.info.extents [axis]);
+            trace_values[t].inv_delta  [axis] = simd::Splat4(trace.info.invdelta[axis]);
+        }
+    }
+    if (root_trace_mask == 0)
+        return;
+
+    // ---- Part 1: Find the leaves each trace must be traced against
+
+    // Unlike DoSweptTrace_Nodes4(), nodes can't be discarded during traversal
+    // because no leaf was traced against yet. Instead, leaves get discarded
+    // in part 2.
+    // @Optimization Long traces can collect many candidates this way. Process
+    //               them in multiple rounds of traversal with discarding?
+    candidates->clear();
+
+    struct PacketTraversalEntry {
+        int32_t  node4_idx;
+        uint32_t depth;      // Root node has depth 1
+        uint32_t trace_mask; // Bit i is set if packet[i] hits this node
+    };
+    // Same stack size as in DoSweptTrace_Nodes4(), since every traversal step
+    // again pops one node and pushes at most 4 children.
+    PacketTraversalEntry traversal_stack[MAX_NODE4_TRAVERSAL_STACK_SIZE];
+    uint64_t traversal_stack_keys[MAX_NODE4_TRAVERSAL_STACK_SIZE][TRACE_PACKET_SIZE];
+    size_t traversal_stack_size = 0;
+
+    traversal_stack[traversal_stack_size] = {
+        .node4_idx  = 0, // Root node idx
+        .depth      = 1,
+        .trace_mask = root_trace_mask
+    };
+    for (size_t t = 0; t < packet.size(); t++)
+        traversal_stack_keys[traversal_stack_size][t] = 0;
+    traversal_stack_size++;
+
+    while (traversal_stack_size > 0) {
+        traversal_stack_size--;
+        PacketTraversalEntry entry = traversal_stack[traversal_stack_size];
+        uint64_t parent_keys[TRACE_PACKET_SIZE];
+        for (size_t t = 0; t < packet.size(); t++)
+            parent_keys[t] = traversal_stack_keys[traversal_stack_size][t];
+
+        const Node4Type& parent_node = node4_arr[entry.node4_idx];
+        const std::array<ContentsMask, 4>& child_contents =
+            nodes4_child_contents[entry.node4_idx];
+        unsigned key_shift = 64 - 2 * entry.depth;
+
+        uint32_t child_trace_masks[4] = { 0, 0, 0, 0 };
+        uint64_t child_keys[4][TRACE_PACKET_SIZE];
+        float    child_aabb_hit_fractions[4][TRACE_PACKET_SIZE];
+
+        for (uint32_t mask = entry.trace_mask; mask != 0; mask &= mask - 1) {
+            int t = std::countr_zero(mask);
+            const PacketTraceValues& tv = trace_values[t];
+
+            // Skip children with contents the trace doesn't collide with.
+            // Unused child slots have no contents.
+            int contents_match_mask = 0;
+            for (int i = 0; i < 4; i++)
+                if (child_contents[i] & packet[t]->info.contents_mask)
+                    contents_match_mask |= 1 << i;
+            if (contents_match_mask == 0)
+                continue;
+
+            // Trace against all 4 child AABBs at once, same computation as in
+            // DoSweptTrace_Nodes4().
+            simd::Float4 box_entry_t, box_exit_t;
+            for (int axis = 0; axis < 3; axis++) {
+                simd::Float4 hit_mins, hit_maxs;
+                LoadChildBoundsAlongAxis(parent_node, axis, &hit_mins, &hit_maxs);
+                hit_mins = simd::Sub(hit_mins, tv.ray_start[axis]);
+                hit_maxs = simd::Sub(hit_maxs, tv.ray_start[axis]);
+                hit_mins = simd::Sub(hit_mins, tv.ray_extents[axis]);
+                hit_maxs = simd::Add(hit_maxs, tv.ray_extents[axis]);
+                hit_mins = simd::Mul(hit_mins, tv.inv_delta[axis]);
+                hit_maxs = simd::Mul(hit_maxs, tv.inv_delta[axis]);
+                simd::Float4 axis_entry_t = simd::Min(hit_mins, hit_maxs);
+                simd::Float4 axis_exit_t  = simd::Max(hit_mins, hit_maxs);
+                if (axis == 0) {
+                    box_entry_t = axis_entry_t;
+                    box_exit_t  = axis_exit_t;
+                }
+                else {
+                    box_entry_t = simd::Max(box_entry_t, axis_entry_t);
+                    box_exit_t  = simd::Min(box_exit_t,  axis_exit_t);
+                }
+            }
+            box_entry_t = simd::Max(box_entry_t, simd::Splat4(0.0f));
+            box_exit_t  = simd::Min(box_exit_t,  simd::Splat4(1.0f));
+
+            int hit_mask = simd::CmpLeMask(box_entry_t, box_exit_t) & contents_match_mask;
+            if (hit_mask == 0)
+                continue;
+
+            alignas(simd::FLOAT4_ALIGNMENT) float hit_fractions[4];
+            simd::Store4(hit_fractions, box_entry_t);
+
+            // DoSweptTrace_Nodes4() visits hit children in ascending order of
+            // their hit fractions. Among children with equal hit fractions,
+            // the one in the later child slot is visited first.
+            for (int i = 0; i < 4; i++) {
+                if (!(hit_mask & (1 << i)))
+                    continue;
+                uint64_t rank = 0;
+                for (int j = 0; j < 4; j++) {
+                    if (j == i || !(hit_mask & (1 << j)))
+                        continue;
+                    if (hit_fractions[j] < hit_fractions[i]
+                        || (hit_fractions[j] == hit_fractions[i] && j > i))
+                        rank++;
+                }
+                child_trace_masks[i] |= 1u << t;
+                child_keys[i][t] = parent_keys[t] | (rank << key_shift);
+                child_aabb_hit_fractions[i][t] = hit_fractions[i];
+            }
+        }
+
+        for (int i = 0; i < 4; i++) {
+            if (child_trace_masks[i] == 0)
+                continue;
+
+            if (parent_node.children[i] < 0) { // If child is a leaf
+                for (uint32_t mask = child_trace_masks[i]; mask != 0; mask &= mask - 1) {
+                    int t = std::countr_zero(mask);
+                    candidates->push_back({
+                        .traversal_order_key = child_keys[i][t],
+                        .leaf_idx            = -parent_node.children[i],
+                        .aabb_hit_fraction   = child_aabb_hit_fractions[i][t],
+                        .packet_trace_idx    = (uint32_t)t
+                    });
+                }
+                continue;
+            }
+
+            assert(traversal_stack_size < MAX_NODE4_TRAVERSAL_STACK_SIZE);
+            traversal_stack[traversal_stack_size] = {
+                .node4_idx  = parent_node.children[i],
+                .depth      = entry.depth + 1,
+                .trace_mask = child_trace_masks[i]
+            };
+            for (uint32_t mask = child_trace_masks[i]; mask != 0; mask &= mask - 1) {
+                int t = std::countr_zero(mask);
+                traversal_stack_keys[traversal_stack_size][t] = child_keys[i][t];
+            }
+            traversal_stack_size++;
+        }
+    }
+
+    // ---- Part 2: Trace against found leaves
+
+    // Bring each trace's leaves into the order DoSweptTrace_Nodes4() would
+    // visit them in. Tracing against them in that order and discarding the
+    // same leaves produces identical results, even if multiple leaves get hit
+    // at the exact same fraction.
+    std::sort(candidates->begin(), candidates->end(),
+        [](const PacketLeafCandidate& a, const PacketLeafCandidate& b) {
+            if (a.packet_trace_idx != b.packet_trace_idx)
+                return a.packet_trace_idx < b.packet_trace_idx;
+            return a.traversal_order_key < b.traversal_order_key;
+        });
+
+    // Range of each trace's leaves in candidates array
+    size_t candidates_begin[TRACE_PACKET_SIZE + 1];
+    size_t max_candidate_cnt = 0;
+    size_t cur_candidate = 0;
+    for (size_t t = 0; t < packet.size(); t++) {
+        candidates_begin[t] = cur_candidate;
+        while (cur_candidate < candidates->size()
+            && (*candidates)[cur_candidate].packet_trace_idx == t)
+            cur_candidate++;
+        max_candidate_cnt = Math::max(max_candidate_cnt, cur_candidate - candidates_begin[t]);
+    }
+    candidates_begin[packet.size()] = cur_candidate;
+
+    // Every trace traces against its n-th leaf in the n-th step. Within each
+    // step, leaves are grouped by type to keep the same collision code hot.
+    for (size_t step = 0; step < max_candidate_cnt; step++) {
+        for (int type = 0; type < Leaf::Type::COUNT; type++) {
+            for (size_t t = 0; t < packet.size(); t++) {
+                size_t candidate_idx = candidates_begin[t] + step;
+                if (candidate_idx >= candidates_begin[t + 1])
+                    continue; // Trace has no leaves left
+                const PacketLeafCandidate& candidate = (*candidates)[candidate_idx];
+                const Leaf& leaf = leaves[candidate.leaf_idx];
+                if (leaf.type != type)
+                    continue;
+
+                // Discard leaf if trace already hit something before this
+                // leaf's AABB gets hit. A leaf's AABB is never hit earlier
+                // than the AABBs of its parent nodes, so this also discards
+                // every leaf whose parent node DoSweptTrace_Nodes4() discards.
+                SweptTrace* trace = packet[t];
+                if (trace->results.fraction < candidate.aabb_hit_fraction)
+                    continue;
+
+                // Same shape-specialized leaf kernels as single traces
+                DispatchTraceShape(trace->info, [&]<class Shape>() {
+                    DoSweptTraceAgainstLeaf<Shape>(trace, leaf, c_world);
+                });
+            }
+        }
+    }
+}
+
+void BVH::GatherTraceCandidates(const Vector3& region_mins,
+    const Vector3& region_maxs, TraceQueryContext* context) const
+{
+    ZoneScoped;
+
+    context->Clear();
+    if (!WasConstructedSuccessfully())
+        return;
+
+    context->stats.num_gathers++;
+    context->region_mins = region_mins;
+    context->region_maxs = region_maxs;
+
+    Vector3 gather_margin{ TraceQueryContext::REGION_GATHER_MARGIN };
+    Vector3 gather_mins = region_mins - gather_margin;
+    Vector3 gather_maxs = region_maxs + gather_margin;
+
+    size_t candidate_cnt = 0;
+    auto add_candidate = [&](int32_t leaf_idx) {
+        size_t slot = candidate_cnt++ % 4;
+        if (slot == 0)
+            context->candidate_packs.push_back({}); // Zero-initialized, all slots unused
+        TraceQueryContext::CandidatePack& pack = context->candidate_packs.back();
+        const Leaf& leaf = leaves[leaf_idx];
+        for (int axis = 0; axis < 3; axis++) {
+            pack.mins[axis][slot] = leaf.mins[axis];
+            pack.maxs[axis][slot] = leaf.maxs[axis];
+        }
+        pack.leaf_indices[slot] = leaf_idx;
+        pack.contents[slot] = leaf.contents;
+    };
+
+    if (!AabbIntersectsAabb(gather_mins, gather_maxs, nodes[0].mins, nodes[0].maxs))
+        return;
+
+    // Stack entries are indices into the nodes array
+    std::stack<int32_t> nodes_to_traverse;
+    nodes_to_traverse.push(0); // Root node idx
+
+    while (!nodes_to_traverse.empty()) {
+        const Node& parent_node = nodes[nodes_to_traverse.top()];
+        nodes_to_traverse.pop();
+
+        for (int32_t child_idx : { parent_node.child_r, parent_node.child_l }) {
+            if (child_idx >= 0) { // If child is a node
+                const Node& child_node = nodes[child_idx];
+                if (AabbIntersectsAabb(gather_mins, gather_maxs, child_node.mins, child_node.maxs))
+                    nodes_to_traverse.push(child_idx);
+            }
+            else { // If child is a leaf
+                const Leaf& leaf = leaves[-child_idx];
+                if (AabbIntersectsAabb(gather_mins, gather_maxs, leaf.mins, leaf.maxs))
+                    add_candidate(-child_idx);
+            }
+        }
+    }
+
+    context->is_gathered = true;
+}
+
+void BVH::DoSweptTraceAgainstCandidates(SweptTrace* trace,
+    TraceQueryContext* context, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    assert(context->ContainsSweep(trace->info));
+
+    // Player movement traces mostly use the player hull shapes
+    DispatchTraceShape(trace->info, [&]<class Shape>() {
+        DoSweptTraceAgainstCandidates_OfShape<Shape>(trace, context, c_world);
+    });
+}
+
+template<class Shape>
+void BVH::DoSweptTraceAgainstCandidates_OfShape(SweptTrace* trace,
+    TraceQueryContext* context, CollidableWorld& c_world) const
+{
+    // Trace values that are used in every candidate AABB test, for each axis
+    const Vector3 extents = Shape::GetExtents(trace->info);
+    simd::Float4 ray_start[3], ray_extents[3], inv_delta[3];
+    for (int axis = 0; axis < 3; axis++) {
+        ray_start  [axis] = simd::Splat4(trace->info.startpos[axis]);
+        ray_extents[axis] = simd::Splat4(extents[axis]);
+        inv_delta  [axis] = simd::Splat4(trace->info.invdelta[axis]);
+    }
+
+    // Collect candidates whose AABB is hit
+    auto& candidate_hits = context->candidate_hits;
+    candidate_hits.clear();
+    for (const TraceQueryContext::CandidatePack& pack : context->candidate_packs) {
+        // Skip candidates with contents the trace doesn't collide with.
+        // Unused slots have no contents.
+        int contents_match_mask = 0;
+        for (int i = 0; i < 4; i++)
+            if (pack.contents[i] & trace->info.contents_mask)
+                contents_match_mask |= 1 << i;
+        if (contents_match_mask == 0)
+            continue;
+
+        // Trace against all 4 candidate AABBs at once. This is the same
+        // computation that DoSweptTrace_Nodes4() does, see there.
+        simd::Float4 box_entry_t, box_exit_t;
+        for (int axis = 0; axis < 3; axis++) {
+            simd::Float4 hit_mins = simd::Load4(pack.mins[axis]);
+            simd::Float4 hit_maxs = simd::Load4(pack.maxs[axis]);
+            hit_mins = simd::Sub(hit_mins, ray_start[axis]);
+            hit_maxs = simd::Sub(hit_maxs, ray_start[axis]);
+            if constexpr (!Shape::ALWAYS_RAY) { // Rays have zero extents
+                hit_mins = simd::Sub(hit_mins, ray_extents[axis]);
+                hit_maxs = simd::Add(hit_maxs, ray_extents[axis]);
+            }
+            hit_mins = simd::Mul(hit_mins, inv_delta[axis]);
+            hit_maxs = simd::Mul(hit_maxs, inv_delta[axis]);
+            simd::Float4 axis_entry_t = simd::Min(hit_mins, hit_maxs);
+            simd::Float4 axis_exit_t  = simd::Max(hit_mins, hit_maxs);
+            if (axis == 0) {
+                box_entry_t = axis_entry_t;
+                box_exit_t  = axis_exit_t;
+            }
+            else {
+                box_entry_t = simd::Max(box_entry_t, axis_entry_t);
+                box_exit_t  = simd::Min(box_exit_t,  axis_exit_t);
+            }
+        }
+        box_entry_t = simd::Max(box_entry_t, simd::Splat4(0.0f));
+        box_exit_t  = simd::Min(box_exit_t,  simd::Splat4(1.0f));
+
+        int hit_mask = simd::CmpLeMask(box_entry_t, box_exit_t) & contents_match_mask;
+        if (hit_mask == 0)
+            continue;
+
+        alignas(simd::FLOAT4_ALIGNMENT) float hit_fractions[4];
+        simd::Store4(hit_fractions, box_entry_t);
+        for (int i = 0; i < 4; i++) {
+            if (!(hit_mask & (1 << i)))
+                continue; // Skip candidates that aren't hit
+            candidate_hits.push_back({
+                .aabb_hit_fraction = hit_fractions[i],
+                .leaf_idx          = pack.leaf_indices[i]
+            });
+        }
+    }
+
+    // Trace against closer candidates first. This enables us to discard
+    // candidates that are further away at a later point in time.
+    std::sort(candidate_hits.begin(), candidate_hits.end(),
+        [](const TraceQueryContext::CandidateHit& a, const TraceQueryContext::CandidateHit& b) {
+            if (a.aabb_hit_fraction != b.aabb_hit_fraction)
+                return a.aabb_hit_fraction < b.aabb_hit_fraction;
+            return a.leaf_idx < b.leaf_idx;
+        });
+
+    for (const TraceQueryContext::CandidateHit& candidate : candidate_hits) {
+        // All remaining candidates get hit after something was already hit
+        if (trace->results.fraction < candidate.aabb_hit_fraction)
+            break;
+
+        const Leaf& leaf = leaves[candidate.leaf_idx];
+        coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, candidate.leaf_idx);
+        DoSweptTraceAgainstLeaf<Shape>(trace, leaf, c_world);
+        coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+    }
+}
+
+void BVH::DoSweptTrace_FlatNodes(SweptTrace* trace, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (flat_nodes.empty())
+        return;
+
+    // This traversal visits nodes and leaves in the exact same order as
+    // DoSweptTrace_NodeHierarchy() does, producing identical trace results.
+
+    const FlatNode& root_node = flat_nodes[0];
+    const ContentsMask contents_mask = trace->info.contents_mask;
+    if (!(root_node.contained_contents & contents_mask))
+        return;
+    float root_node_aabb_hit_fraction;
+    bool is_root_hit = trace->HitsAabbOnFullSweep(root_node.mins, root_node.maxs,
+        &root_node_aabb_hit_fraction);
+    if (!is_root_hit)
+        return;
+
+    // A flat node and its corresponding minimum collision time where the trace
+    // hits the flat node's AABB.
+    struct TraversalCandidate {
+        uint32_t flat_node_idx; // idx into flat_nodes
+        float aabb_hit_fraction; // When trace hits this flat node's AABB
+    };
+    // Each level of the hierarchy leaves at most one candidate behind on the
+    // stack, CreateFlatNodes() made sure that it never overflows.
+    TraversalCandidate traversal_candidates[MAX_FLAT_TRAVERSAL_STACK_SIZE];
+    size_t traversal_candidate_cnt = 0;
+
+    traversal_candidates[traversal_candidate_cnt++] = {
+        .flat_node_idx = 0, // Root node idx
+        .aabb_hit_fraction = root_node_aabb_hit_fraction
+    };
+
+    // Efficiently traverse the BVH tree
+    while (traversal_candidate_cnt > 0) {
+        TraversalCandidate candidate = traversal_candidates[--traversal_candidate_cnt];
+
+        // Discard candidate if we already hit something before this candidate's
+        // AABB gets hit.
+        if (trace->results.fraction < candidate.aabb_hit_fraction)
+            continue;
+
+        const FlatNode& flat_node = flat_nodes[candidate.flat_node_idx];
+
+        // Traverse candidate
+        if (flat_node.is_leaf) {
+            uint32_t leaf_idx = flat_node.leaf_idx;
+            const Leaf& leaf = leaves[leaf_idx];
+
+            // @Optimization Make sure CDispCollTree code doesn't do the same
+            //               AABB check that we already do.
+            coll::Debugger::DebugStart_BroadPhaseLeafHit(leaf, leaf_idx);
+            DoSweptTraceAgainstLeaf(trace, leaf, c_world);
+            coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+            continue;
+        }
+
+        // Trace against AABBs of candidate's children
+        uint32_t child_l_idx = candidate.flat_node_idx + 1; // Depth-first order
+        uint32_t child_r_idx = flat_node.child_r_idx;
+        const FlatNode& child_l = flat_nodes[child_l_idx];
+        const FlatNode& child_r = flat_nodes[child_r_idx];
+
+        // Children with contents the trace doesn't collide with are skipped
+        float child_l_aabb_hit_fraction;
+        float child_r_aabb_hit_fraction;
+        bool is_child_l_aabb_hit = (child_l.contained_contents & contents_mask)
+            && trace->HitsAabbOnFullSweep(child_l.mins, child_l.maxs, &child_l_aabb_hit_fraction);
+        bool is_child_r_aabb_hit = (child_r.contained_contents & contents_mask)
+            && trace->HitsAabbOnFullSweep(child_r.mins, child_r.maxs, &child_r_aabb_hit_fraction);
+
+        assert(traversal_candidate_cnt + 2 <= MAX_FLAT_TRAVERSAL_STACK_SIZE);
+        TraversalCandidate candidate_l = { child_l_idx, child_l_aabb_hit_fraction };
+        TraversalCandidate candidate_r = { child_r_idx, child_r_aabb_hit_fraction };
+
+        // The child with the smaller hit fraction is traversed before the other.
+        // This enables us to potentially discard the child that's further
+        // away at a later point in time.
+        if (is_child_l_aabb_hit && is_child_r_aabb_hit) {
+            if (child_l_aabb_hit_fraction < child_r_aabb_hit_fraction) {
+                traversal_candidates[traversal_candidate_cnt++] = candidate_r;
+                traversal_candidates[traversal_candidate_cnt++] = candidate_l; // <- Closer child on top of the stack
+            }
+            else {
+                traversal_candidates[traversal_candidate_cnt++] = candidate_l;
+                traversal_candidates[traversal_candidate_cnt++] = candidate_r; // <- Closer child on top of the stack
+            }
+        }
+        else if (is_child_l_aabb_hit) {
+            traversal_candidates[traversal_candidate_cnt++] = candidate_l;
+        }
+        else if (is_child_r_aabb_hit) {
+            traversal_candidates[traversal_candidate_cnt++] = candidate_r;
+        }
+    }
+}
+
+void BVH::DoSweptTrace_NodeHierarchy(SweptTrace* trace, CollidableWorld& c_world) const
 {
     ZoneScoped;
 
-    // @Optimization To improve BVH traversal time, build the BVH in a compact
-    //               and cache-friendly representation. E.g.: Nodes and leafs
-    //               can be stored in a single array, with *depth-first order*.
-    //               Note: After changing layout of the nodes array, take a look
-    //                     at possibly optimizing BVH::SetNodeContentsInfo().
-
     if (!WasConstructedSuccessfully())
         return; // Can't trace against non-existent BVH
     const Node& root_node = nodes[0];
 
-#if 0 // Debugging switch
-    // Trace against all leaves for debugging purposes
-    for (size_t i = 1; i < leaves.size(); i++)
-        DoSweptTraceAgainstLeaf(trace, leaves[i], c_world);
-    return;
-#endif
-
     // @Optimization Doing an intersection between the AABB that encloses the
     //               trace sweep and the AABB of the root BVH node is possibly
     //               cheaper than doing an accurate sweep against AABB of the
     //               root BVH node.
     // @Optimization We should probably assume that the root node is always hit,
     //               tracing outside the world's bounds should never happen.
+    const ContentsMask contents_mask = trace->info.contents_mask;
+    if (!(root_node.contained_contents & contents_mask))
+        return;
     float root_node_aabb_hit_fraction;
     bool is_root_hit = trace->HitsAabbOnFullSweep(root_node.mins, root_node.maxs,
         &root_node_aabb_hit_fraction);
@@ -191,15 +1060,22 @@ void BVH::DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world)
             for (int32_t child_idx : { parent_node.child_l, parent_node.child_r }) {
                 Vector3 child_mins;
                 Vector3 child_maxs;
+                ContentsMask child_contents;
                 if (child_idx < 0) { // If child is a leaf
                     child_mins = leaves[-child_idx].mins;
                     child_maxs = leaves[-child_idx].maxs;
+                    child_contents = leaves[-child_idx].contents;
                 }
                 else { // If child is a node
                     child_mins = nodes[child_idx].mins;
                     child_maxs = nodes[child_idx].maxs;
+                    child_contents = nodes[child_idx].contained_contents;
                 }
 
+                // Skip children with contents the trace doesn't collide with
+                if (!(child_contents & contents_mask))
+                    continue;
+
                 // @Optimization Doing an intersection between the AABB that
                 //               encloses the trace sweep and the AABB of BVH
                 //               nodes/leaves is possibly cheaper than doing an
@@ -237,6 +1113,78 @@ void BVH::DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world)
     }
 }
 
+bool BVH::IsHullInSolid(const SweptTrace::Info& hull,
+    CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (!WasConstructedSuccessfully())
+        return false;
+
+    const Vector3 hull_mins = hull.startpos - hull.extents;
+    const Vector3 hull_maxs = hull.startpos + hull.extents;
+    const ContentsMask contents_mask = hull.contents_mask;
+
+    // Unlike traces, the order of visited leaves doesn't matter, the first
+    // leaf that contains the hull ends the traversal.
+    if (!flat_nodes.empty()) {
+        // CreateFlatNodes() made sure that the fixed-size stack never overflows
+        uint32_t node_stack[MAX_FLAT_TRAVERSAL_STACK_SIZE];
+        size_t stack_size = 0;
+        node_stack[stack_size++] = 0; // Root node idx
+        while (stack_size > 0) {
+            uint32_t flat_node_idx = node_stack[--stack_size];
+            const FlatNode& flat_node = flat_nodes[flat_node_idx];
+            if (!(flat_node.contained_contents & contents_mask))
+                continue;
+            if (!AabbIntersectsAabb(hull_mins, hull_maxs, flat_node.mins, flat_node.maxs))
+                continue;
+
+            if (flat_node.is_leaf) {
+                if (IsHullInSolidAtLeaf(hull, leaves[flat_node.leaf_idx], c_world))
+                    return true;
+                continue;
+            }
+            assert(stack_size + 2 <= MAX_FLAT_TRAVERSAL_STACK_SIZE);
+            node_stack[stack_size++] = flat_node.child_r_idx;
+            node_stack[stack_size++] = flat_node_idx + 1; // Left child, depth-first order
+        }
+        return false;
+    }
+
+    // Slower traversal of the nodes array, like DoSweptTrace_NodeHierarchy()
+    const Node& root_node = nodes[0];
+    if (!(root_node.contained_contents & contents_mask))
+        return false;
+    if (!AabbIntersectsAabb(hull_mins, hull_maxs, root_node.mins, root_node.maxs))
+        return false;
+
+    std::stack<int32_t> nodes_to_traverse;
+    nodes_to_traverse.push(0); // Root node idx
+    while (!nodes_to_traverse.empty()) {
+        const Node& parent_node = nodes[nodes_to_traverse.top()];
+        nodes_to_traverse.pop();
+
+        for (int32_t child_idx : { parent_node.child_r, parent_node.child_l }) {
+            if (child_idx >= 0) { // If child is a node
+                const Node& child_node = nodes[child_idx];
+                if ((child_node.contained_contents & contents_mask)
+                        && AabbIntersectsAabb(hull_mins, hull_maxs,
+                                              child_node.mins, child_node.maxs))
+                    nodes_to_traverse.push(child_idx);
+            }
+            else { // If child is a leaf
+                const Leaf& leaf = leaves[-child_idx];
+                if (!AabbIntersectsAabb(hull_mins, hull_maxs, leaf.mins, leaf.maxs))
+                    continue;
+                if (IsHullInSolidAtLeaf(hull, leaf, c_world))
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
 bool BVH::DoesAabbIntersectAnyDisplacement(
     const Vector3& aabb_mins, const Vector3& aabb_maxs, CollidableWorld& c_world)
 {
@@ -315,6 +1263,21 @@ float BVH::CalcAabbSurfaceArea(const Vector3& mins, const Vector3& maxs)
     ); // Surface area calculation of a rectangular cuboid
 }
 
+float BVH::CalcSahSurfaceArea(const Vector3& mins, const Vector3& maxs) const
+{
+    if (!build_options.sah_bloat_by_player_hull)
+        return CalcAabbSurfaceArea(mins, maxs);
+
+    // A player hull sweep hits an AABB exactly when a ray from the hull's
+    // center hits the AABB bloated by the hull's half extents.
+    const Vector3 hull_half_extents = {
+        0.5f * CSGO_PLAYER_WIDTH,
+        0.5f * CSGO_PLAYER_WIDTH,
+        0.5f * CSGO_PLAYER_HEIGHT_STANDING
+    };
+    return CalcAabbSurfaceArea(mins - hull_half_extents, maxs + hull_half_extents);
+}
+
 void BVH::CalcAabbOfBvhLeaves(std::span<const uint32_t> leaf_refs,
     Vector3* aabb_mins, Vector3* aabb_maxs) const
 {
@@ -344,8 +1307,11 @@ uint64_t BVH::GetSweptLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world)
     // E.g.: Adding many small costs to a large cost sum can cause significant
     // inaccuracies when using floating-point types.
 
-    // @Optimization Develop relative leaf trace cost heuristics and use them
-    //               here. Do they reduce total trace time?
+    // The GetSweptTraceCost_*() functions estimate costs from the complexity
+    // of the map object. Their constants were picked by reasoning about what
+    // each leaf trace does, they are NOT calibrated against measurements yet!
+    // Benchmark::BvhSahCostModels() measures actual trace durations per leaf
+    // type and fits them to these estimates, use it to calibrate them.
     // @Optimization On leaf trace cost heuristics: Is it beneficial to estimate
     //               average or worst case trace cost? What exactly do we
     //               optimize? Test both!
@@ -354,12 +1320,15 @@ uint64_t BVH::GetSweptLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world)
         return c_world.GetSweptTraceCost_Brush       (leaf.brush_idx);
     case Leaf::Type::Displacement:
         return c_world.GetSweptTraceCost_Displacement(leaf.disp_coll_idx);
-    case Leaf::Type::FuncBrush:
-        return c_world.GetSweptTraceCost_FuncBrush   (leaf.funcbrush_idx);
     case Leaf::Type::StaticProp:
         return c_world.GetSweptTraceCost_StaticProp  (leaf.sprop_idx);
     case Leaf::Type::DynamicProp:
         return c_world.GetSweptTraceCost_DynamicProp (leaf.dprop_idx);
+    case Leaf::Type::FuncBrush:
+        // func_brush entities are part of coll::DynamicBVH, which isn't built
+        // with SAH, see CreateLeaves()
+        assert(false && "func_brush leaves aren't part of this BVH");
+        return 1;
     default: // Unknown type
         assert(false && "Unknown Leaf type. Did you forget to add a switch case?");
         return 1;
@@ -367,8 +1336,7 @@ uint64_t BVH::GetSweptLeafTraceCost(const Leaf& leaf, CollidableWorld& c_world)
 }
 
 BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_split,
-    std::span<uint32_t> leaf_refs_sorted_along_axis[3],
-    CollidableWorld& c_world) const
+    std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const
 {
     const size_t leaf_cnt = leaf_refs_sorted_along_axis[0].size();
     assert(leaf_cnt >= 2);
@@ -405,31 +1373,55 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
     //                of their surface areas:  p(L | P) = SA(L) / SA(P)
     //                See: https://en.wikipedia.org/wiki/Crofton_formula
 
-    // @Optimization Most traces are done with the player's hull. This SAH
-    //     method relies on the Crofton formula which applies to random rays
-    //     passing through convex objects, not random hull sweeps. Therefor,
-    //     during these SAH calculations, it might be beneficial to view the
-    //     hull trace as a ray trace by bloating all AABBs by half the player's
-    //     hull extents before calculating their surface areas.
-    // @Optimization To reduce BVH creation time while slightly worsening BVH
-    //     quality: Use binning/bucket SAH, with whatever bin size. Instead of
-    //     computing SAH cost for a split at every leaf, compute SAH cost for a
-    //     split at every bin. Allegedly a good performance/quality compromise.
-    //     Another option is to perform SAH on only the largest axis, not all 3.
+    // Most traces are done with the player's hull. This SAH method relies on
+    // the Crofton formula which applies to random rays passing through convex
+    // objects, not random hull sweeps. Therefor, the build options can make
+    // SAH calculations view the hull trace as a ray trace by bloating all
+    // AABBs by half the player's hull extents before calculating their
+    // surface areas. See CalcSahSurfaceArea().
+    // To reduce BVH creation time while slightly worsening BVH quality, the
+    // build options can select binned SAH (cost is only computed at bin
+    // boundaries instead of at every leaf) and/or restrict SAH to the axis
+    // with the largest extent.
 
     float node_aabb_surface_area =
-        CalcAabbSurfaceArea(node_to_split.mins, node_to_split.maxs);
+        CalcSahSurfaceArea(node_to_split.mins, node_to_split.maxs);
 
     NodeSplitDetails split_details = {}; // Irrelevant init vals
 
-    // Determine split with lowest cost across all 3 axes
+    // Determine split with lowest cost across all considered axes
     float cur_lowest_sah_cost = HUGE_VALF;
 
     uint64_t total_leaf_trace_cost = 0;
     for (uint32_t leaf_idx : leaf_refs_sorted_along_axis[0])
-        total_leaf_trace_cost += GetSweptLeafTraceCost(leaves[leaf_idx], c_world);
+        total_leaf_trace_cost += leaf_trace_costs[leaf_idx];
+
+    // Determine axis with the largest extent of leaf centroids
+    int largest_axis = 0;
+    float largest_centroid_extent = -HUGE_VALF;
+    for (int axis = 0; axis < 3; axis++) {
+        const Leaf& first_leaf = leaves[leaf_refs_sorted_along_axis[axis].front()];
+        const Leaf& last_leaf  = leaves[leaf_refs_sorted_along_axis[axis].back()];
+        float centroid_extent =
+            0.5f * (last_leaf.mins[axis] + last_leaf.maxs[axis]) -
+            0.5f * (first_leaf.mins[axis] + first_leaf.maxs[axis]);
+        if (centroid_extent > largest_centroid_extent) {
+            largest_centroid_extent = centroid_extent;
+            largest_axis = axis;
+        }
+    }
 
     for (int axis = 0; axis < 3; axis++) {
+        if (build_options.sah_largest_axis_only && axis != largest_axis)
+            continue;
+
+        if (build_options.split_method == BuildOptions::SplitMethod::BinnedSah) {
+            DetermineBinnedSahSplitAlongAxis(axis, leaf_refs_sorted_along_axis[axis],
+                node_aabb_surface_area, total_leaf_trace_cost,
+                &cur_lowest_sah_cost, &split_details);
+            continue;
+        }
+
         // Precompute AABB surface area of right child for every split position
         std::vector<float> r_child_aabb_surface_areas(leaf_cnt); // idx is element to split on
         Vector3 r_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
@@ -445,7 +1437,7 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
             }
             // Calculate and store AABB surface area of right child at this point
             r_child_aabb_surface_areas[split_pos] =
-                CalcAabbSurfaceArea(r_child_mins, r_child_maxs);
+                CalcSahSurfaceArea(r_child_mins, r_child_maxs);
         }
         r_child_aabb_surface_areas[0] = node_aabb_surface_area;
 
@@ -461,7 +1453,7 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
             // Skip SAH at split_pos 0 because it's illegal and the left child's
             // AABB doesn't exist yet
             if (split_pos > 0) {
-                float l_child_aabb_surface_area = CalcAabbSurfaceArea(l_child_mins, l_child_maxs);
+                float l_child_aabb_surface_area = CalcSahSurfaceArea(l_child_mins, l_child_maxs);
                 float r_child_aabb_surface_area = r_child_aabb_surface_areas[split_pos]; // Lookup
 
                 // Likelihood of a trace hitting a child AABB, given that the
@@ -488,8 +1480,7 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
             // Move left-most leaf of right child over to the left child
             uint32_t moved_over_leaf_idx = leaf_refs_sorted_along_axis[axis][split_pos];
             const Leaf& moved_over_leaf = leaves[moved_over_leaf_idx];
-            uint64_t moved_over_leaf_cost =
-                GetSweptLeafTraceCost(moved_over_leaf, c_world);
+            uint64_t moved_over_leaf_cost = leaf_trace_costs[moved_over_leaf_idx];
             total_l_child_cost += moved_over_leaf_cost;
             total_r_child_cost -= moved_over_leaf_cost;
 
@@ -500,6 +1491,12 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
             }
         }
     }
+
+    // No split was found if binning couldn't separate the leaves (all leaf
+    // centroids coincide) or if all SAH costs were NaN (degenerate AABBs).
+    // Fall back to median split.
+    if (!(cur_lowest_sah_cost < HUGE_VALF))
+        split_details = { .axis = largest_axis, .elem_idx = leaf_cnt / 2 };
 #endif
 
     assert(split_details.axis >= 0 && split_details.axis <= 2);
@@ -508,29 +1505,153 @@ BVH::NodeSplitDetails BVH::DetermineBeneficialNodeSplit(const Node& node_to_spli
     return split_details;
 }
 
+void BVH::DetermineBinnedSahSplitAlongAxis(int axis,
+    std::span<const uint32_t> leaf_refs_sorted_along_this_axis,
+    float node_aabb_surface_area, uint64_t total_leaf_trace_cost,
+    float* cur_lowest_sah_cost, NodeSplitDetails* cur_best_split) const
+{
+    const size_t leaf_cnt = leaf_refs_sorted_along_this_axis.size();
+    const size_t bin_cnt = Math::clamp(build_options.sah_bin_cnt,
+        (size_t)2, MAX_SAH_BIN_CNT);
+
+    // Must be computed like in the initial leaf sort
+    auto get_leaf_centroid = [&](uint32_t leaf_idx) {
+        const Leaf& leaf = leaves[leaf_idx];
+        return 0.5f * (leaf.mins[axis] + leaf.maxs[axis]);
+    };
+    const float centroid_min = get_leaf_centroid(leaf_refs_sorted_along_this_axis.front());
+    const float centroid_max = get_leaf_centroid(leaf_refs_sorted_along_this_axis.back());
+    if (!(centroid_max > centroid_min))
+        return; // All leaves are in the same bin, no split possible
+
+    struct Bin {
+        Vector3 mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        size_t leaf_cnt = 0;
+        uint64_t leaf_trace_cost = 0; // Sum of leaf trace costs
+    };
+    Bin bins[MAX_SAH_BIN_CNT];
+
+    // Bin index never decreases with leaf centroid position. Since leaves are
+    // sorted by centroid, each bin covers a contiguous range of leaf refs and
+    // every split between two bins is a split at a leaf ref index.
+    const float bin_scale = (float)bin_cnt / (centroid_max - centroid_min);
+    if (!std::isfinite(bin_scale))
+        return; // Centroids are too close together to be binned
+    for (uint32_t leaf_idx : leaf_refs_sorted_along_this_axis) {
+        const Leaf& leaf = leaves[leaf_idx];
+        size_t bin_idx = (size_t)((get_leaf_centroid(leaf_idx) - centroid_min) * bin_scale);
+        Bin& bin = bins[Math::min(bin_idx, bin_cnt - 1)];
+        for (int i = 0; i < 3; i++) {
+            bin.mins[i] = Math::min(bin.mins[i], leaf.mins[i]);
+            bin.maxs[i] = Math::max(bin.maxs[i], leaf.maxs[i]);
+        }
+        bin.leaf_cnt++;
+        bin.leaf_trace_cost += leaf_trace_costs[leaf_idx];
+    }
+
+    // Precompute AABB surface area of right child for every split position.
+    // idx is the first bin of the right child.
+    float r_child_aabb_surface_areas[MAX_SAH_BIN_CNT];
+    Vector3 r_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+    Vector3 r_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    for (size_t split_bin = bin_cnt - 1; split_bin > 0; split_bin--) {
+        for (int i = 0; i < 3; i++) {
+            r_child_mins[i] = Math::min(r_child_mins[i], bins[split_bin].mins[i]);
+            r_child_maxs[i] = Math::max(r_child_maxs[i], bins[split_bin].maxs[i]);
+        }
+        r_child_aabb_surface_areas[split_bin] =
+            CalcSahSurfaceArea(r_child_mins, r_child_maxs);
+    }
+
+    Vector3 l_child_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+    Vector3 l_child_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    size_t l_child_leaf_cnt = 0;
+    uint64_t total_l_child_cost = 0;
+    uint64_t total_r_child_cost = total_leaf_trace_cost;
+    for (size_t split_bin = 1; split_bin < bin_cnt; split_bin++) {
+        // Move bin left of split position over to the left child
+        const Bin& moved_over_bin = bins[split_bin - 1];
+        for (int i = 0; i < 3; i++) {
+            l_child_mins[i] = Math::min(l_child_mins[i], moved_over_bin.mins[i]);
+            l_child_maxs[i] = Math::max(l_child_maxs[i], moved_over_bin.maxs[i]);
+        }
+        l_child_leaf_cnt   += moved_over_bin.leaf_cnt;
+        total_l_child_cost += moved_over_bin.leaf_trace_cost;
+        total_r_child_cost -= moved_over_bin.leaf_trace_cost;
+
+        // Skip splits that leave a child with no leaves
+        if (l_child_leaf_cnt == 0 || l_child_leaf_cnt == leaf_cnt)
+            continue;
+
+        float l_child_aabb_hit_likelihood =
+            CalcSahSurfaceArea(l_child_mins, l_child_maxs) / node_aabb_surface_area;
+        float r_child_aabb_hit_likelihood =
+            r_child_aabb_surface_areas[split_bin] / node_aabb_surface_area;
+
+        float sah_cost =
+            (float)total_l_child_cost * l_child_aabb_hit_likelihood +
+            (float)total_r_child_cost * r_child_aabb_hit_likelihood;
+
+        if (sah_cost < *cur_lowest_sah_cost) { // Remember best split
+            *cur_lowest_sah_cost = sah_cost;
+            *cur_best_split = { .axis = axis, .elem_idx = l_child_leaf_cnt };
+        }
+    }
+}
+
+template<class Shape>
 void BVH::DoSweptTraceAgainstLeaf(SweptTrace* trace, const Leaf& leaf,
     CollidableWorld& c_world) const
 {
     ZoneScoped;
 
+    // Leaves whose contents the trace doesn't collide with are skipped here,
+    // so the narrow phase doesn't need to check them again.
+    if (!(leaf.contents & trace->info.contents_mask))
+        return;
+
     switch (leaf.type) {
     case Leaf::Type::Brush:
         // @Optimization Is the AABB check before tracing against *every* brush bad?
-        c_world.DoSweptTrace_Brush       (trace, leaf.brush_idx    ); break;
+        c_world.DoSweptTrace_Brush<Shape>       (trace, leaf.brush_idx    ); break;
     case Leaf::Type::Displacement:
-        c_world.DoSweptTrace_Displacement(trace, leaf.disp_coll_idx); break;
+        c_world.DoSweptTrace_Displacement<Shape>(trace, leaf.disp_coll_idx); break;
     case Leaf::Type::FuncBrush:
-        c_world.DoSweptTrace_FuncBrush   (trace, leaf.funcbrush_idx); break;
+        c_world.DoSweptTrace_FuncBrush          (trace, leaf.funcbrush_idx); break;
     case Leaf::Type::StaticProp:
-        c_world.DoSweptTrace_StaticProp  (trace, leaf.sprop_idx    ); break;
+        c_world.DoSweptTrace_StaticProp<Shape>  (trace, leaf.sprop_idx    ); break;
     case Leaf::Type::DynamicProp:
-        c_world.DoSweptTrace_DynamicProp (trace, leaf.dprop_idx    ); break;
+        c_world.DoSweptTrace_DynamicProp<Shape> (trace, leaf.dprop_idx    ); break;
     default: // Unknown type
         assert(false && "Unknown Leaf type. Did you forget to add a switch case?");
         break;
     }
 }
 
+bool BVH::IsHullInSolidAtLeaf(const SweptTrace::Info& hull, const Leaf& leaf,
+    CollidableWorld& c_world) const
+{
+    if (!(leaf.contents & hull.contents_mask))
+        return false;
+
+    switch (leaf.type) {
+    case Leaf::Type::Brush:
+        return c_world.IsHullInSolid_Brush       (hull, leaf.brush_idx    );
+    case Leaf::Type::Displacement:
+        return c_world.IsHullInSolid_Displacement(hull, leaf.disp_coll_idx);
+    case Leaf::Type::FuncBrush:
+        return c_world.IsHullInSolid_FuncBrush   (hull, leaf.funcbrush_idx);
+    case Leaf::Type::StaticProp:
+        return c_world.IsHullInSolid_StaticProp  (hull, leaf.sprop_idx    );
+    case Leaf::Type::DynamicProp:
+        return c_world.IsHullInSolid_DynamicProp (hull, leaf.dprop_idx    );
+    default: // Unknown type
+        assert(false && "Unknown Leaf type. Did you forget to add a switch case?");
+        return false;
+    }
+}
+
 bool BVH::CreateLeaves(CollidableWorld& c_world)
 {
     std::shared_ptr<const BspMap> bsp_map = c_world.pImpl->origin_bsp_map;
@@ -539,17 +1660,17 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
     leaves.clear();
     leaves.push_back({}); // Add a dummy leaf at index 0. Needed due to node indexing.
 
-    auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-    auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-    auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
-    auto test_f_4 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
-    auto test_f_5 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::WATER);
-
     Debug{} << PRINT_PREFIX << "Beginning creation...";
 
     // @Optimization Collect leaf types in a different order?
 
     // Collect relevant brushes
+    // Test if brush collision data has been compiled
+    if (c_world.pImpl->compiled_brushes == Corrade::Containers::NullOpt) {
+        assert(false && "BVH creation FAILED: Brush collision data is not "
+                        "compiled yet.");
+        return false; // Leaf creation failed
+    }
     Debug{} << PRINT_PREFIX << "Collecting AABBs of brushes";
     // @Optimization Collect worldspawn model brush indices only once ever?
     for (size_t brush_idx : bsp_map->GetModelBrushIndices_worldspawn()) {
@@ -557,14 +1678,11 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
         if (!brush.num_sides)
             continue;
 
-        bool relevant = false;
-        if (test_f_1.first && test_f_1.first(brush)) relevant = true;
-        if (test_f_2.first && test_f_2.first(brush)) relevant = true;
-        if (test_f_3.first && test_f_3.first(brush)) relevant = true;
-        if (test_f_4.first && test_f_4.first(brush)) relevant = true;
-        if (test_f_5.first && test_f_5.first(brush)) relevant = true;
-        if (!relevant)
-            continue;
+        // Brush contents are determined once here, traces only compare them
+        // against their contents mask.
+        ContentsMask contents = GetBrushContents(brush);
+        if (contents == 0)
+            continue; // Brush is irrelevant
 
         Vector3 mins, maxs;
         bool valid_aabb = bsp_map->GetBrushAABB(brush_idx, &mins, &maxs);
@@ -579,36 +1697,14 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
             .mins = mins,
             .maxs = maxs,
             .type = Leaf::Type::Brush,
-            .funcbrush_idx = (uint32_t)brush_idx,
+            .contents = contents,
+            .brush_idx = (uint32_t)brush_idx,
         };
         leaves.push_back(bvh_leaf);
     }
 
-    // Collect relevant func_brush entities
-    Debug{} << PRINT_PREFIX << "Collecting AABBs of func_brush entities";
-    // If func_brush uses collision caches: TODO Test if fb coll cache exists!
-    for (size_t fb_idx = 0; fb_idx < bsp_map->entities_func_brush.size(); fb_idx++) {
-        const BspMap::Ent_func_brush& func_brush = bsp_map->entities_func_brush[fb_idx];
-        if (!func_brush.IsSolid())
-            continue;
-
-        Vector3 mins, maxs;
-        bool valid_aabb = CalcAabb_FuncBrush(fb_idx, *bsp_map, &mins, &maxs);
-        if (!valid_aabb)
-            continue;
-
-        // Bloat AABB a little to account for collision calculation tolerances
-        mins -= Vector3{ 1.0f, 1.0f, 1.0f };
-        maxs += Vector3{ 1.0f, 1.0f, 1.0f };
-
-        Leaf bvh_leaf{
-            .mins = mins,
-            .maxs = maxs,
-            .type = Leaf::Type::FuncBrush,
-            .funcbrush_idx = (uint32_t)fb_idx,
-        };
-        leaves.push_back(bvh_leaf);
-    }
+    // NOTE: func_brush entities are collected by coll::DynamicBVH instead,
+    //       their solidity can change at runtime.
 
     // Collect relevant displacements
     Debug{} << PRINT_PREFIX << "Collecting AABBs of displacements";
@@ -628,6 +1724,7 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
             .mins = aabb_mins,
             .maxs = aabb_maxs,
             .type = Leaf::Type::Displacement,
+            .contents = CONTENTS_SOLID,
             .disp_coll_idx = (uint32_t)disp_coll_idx,
         };
         leaves.push_back(bvh_leaf);
@@ -671,67 +1768,183 @@ bool BVH::CreateLeaves(CollidableWorld& c_world)
             .mins = aabb_mins,
             .maxs = aabb_maxs,
             .type = Leaf::Type::StaticProp,
+            .contents = CONTENTS_SOLID,
             .sprop_idx = (uint32_t)sprop_idx,
         };
         leaves.push_back(bvh_leaf);
     }
 
-    // Collect relevant dynamic props
-    // Test if dynamic prop collision caches have been constructed
-    if (c_world.pImpl->coll_caches_dprop == Corrade::Containers::NullOpt) {
-        assert(false && "BVH creation FAILED: Dynamic prop collision caches are"
-                        " not created yet.");
-        return false; // Leaf creation failed
+    // NOTE: Dynamic props are collected by coll::DynamicBVH instead, they can
+    //       be toggled or moved at runtime.
+
+    return true; // Leaf creation succeeded
+}
+
+void BVH::CreateNodeHierarchy(
+    std::span<uint32_t> leaf_refs_sorted_along_axis[3], unsigned int thread_cnt)
+{
+    // The entire node hierarchy is one big subtree
+    SubtreeBuildTask root_task{
+        .leaf_refs_sorted_along_axis = {
+            leaf_refs_sorted_along_axis[0],
+            leaf_refs_sorted_along_axis[1],
+            leaf_refs_sorted_along_axis[2]
+        },
+        .nodes = {},
+        .forks = {}
+    };
+    root_task.nodes.push_back({});
+    Node& root_node = root_task.nodes[0];
+    // Calc all-encompassing AABB
+    CalcAabbOfBvhLeaves(leaf_refs_sorted_along_axis[0],
+        &root_node.mins, &root_node.maxs);
+
+    RunSubtreeBuildTasks(&root_task, thread_cnt);
+
+    // Combine nodes of all subtrees
+    nodes.push_back({}); // Root node
+    AppendSubtreeNodes(root_task, 0);
+}
+
+void BVH::RunSubtreeBuildTasks(SubtreeBuildTask* root_task,
+    unsigned int thread_cnt) const
+{
+    if (thread_cnt <= 1) {
+        std::vector<bool> leaf_lut(leaves.size());
+        std::stack<SubtreeBuildTask*> task_stack;
+        task_stack.push(root_task);
+        while (!task_stack.empty()) {
+            SubtreeBuildTask* task = task_stack.top();
+            task_stack.pop();
+            BuildSubtree(task, leaf_lut,
+                [&task_stack](SubtreeBuildTask* t) { task_stack.push(t); });
+        }
+        return;
     }
-    const std::map<uint32_t, CollisionCache_XProp>& dprop_coll_caches =
-        *c_world.pImpl->coll_caches_dprop;
-    Debug{} << PRINT_PREFIX << "Collecting AABBs of dynamic props";
-    for (size_t dprop_idx = 0;
-         dprop_idx < bsp_map->relevant_dynamic_props.size();
-         dprop_idx++)
-    {
-        const BspMap::Ent_prop_dynamic& dprop =
-            bsp_map->relevant_dynamic_props[dprop_idx];
 
-        // Get collision cache of this dynamic prop
-        const auto& iter = dprop_coll_caches.find(dprop_idx);
-        if (iter == dprop_coll_caches.end())
-            continue; // Dynamic prop has no collision cache, skip
-        const CollisionCache_XProp& dprop_coll_cache = iter->second;
+    // Each thread has its own task queue. Threads take their newest task first
+    // and, if they run out of tasks, steal the oldest task of another thread.
+    // Oldest tasks usually have the most leaves left to split.
+    struct TaskQueue {
+        std::mutex mutex;
+        std::deque<SubtreeBuildTask*> tasks;
+    };
+    std::vector<TaskQueue> task_queues(thread_cnt);
+    task_queues[0].tasks.push_back(root_task);
+
+    // Number of tasks that were scheduled but are not built yet
+    std::atomic<size_t> unfinished_task_cnt = 1;
+    // Number of tasks that sit in a queue, not taken by any thread yet
+    std::atomic<size_t> queued_task_cnt = 1;
+
+    // Threads without tasks sleep until a task gets queued or all are built.
+    // NOTE: Increments of queued_task_cnt and the last decrement of
+    //       unfinished_task_cnt happen with idle_mutex locked, otherwise a
+    //       thread that's about to sleep could miss their notification.
+    // NOTE: queued_task_cnt is incremented before a task gets pushed and
+    //       decremented after it got popped, so it never drops below the
+    //       number of queued tasks, even if a task gets stolen right away.
+    std::mutex              idle_mutex;
+    std::condition_variable idle_cond;
+
+    auto worker_func = [&, this](size_t worker_idx) {
+        ZoneScoped;
+        std::vector<bool> leaf_lut(leaves.size());
+        TaskQueue& own_queue = task_queues[worker_idx];
+        auto schedule_task = [&](SubtreeBuildTask* t) {
+            unfinished_task_cnt++; // Increment before the current task is done
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                queued_task_cnt++; // Increment before the task can be taken
+            }
+            {
+                std::lock_guard<std::mutex> lock(own_queue.mutex);
+                own_queue.tasks.push_back(t);
+            }
+            idle_cond.notify_one();
+        };
 
-        // Get exact, non-bloated AABB of dynamic prop
-        Vector3 aabb_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
-        Vector3 aabb_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
-        for (const auto& dprop_section_aabb : dprop_coll_cache.section_aabbs) {
-            for (int axis = 0; axis < 3; axis++) {
-                aabb_mins[axis] = Math::min(aabb_mins[axis], dprop_section_aabb.mins[axis]);
-                aabb_maxs[axis] = Math::max(aabb_maxs[axis], dprop_section_aabb.maxs[axis]);
+        while (unfinished_task_cnt > 0) {
+            SubtreeBuildTask* task = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(own_queue.mutex);
+                if (!own_queue.tasks.empty()) {
+                    task = own_queue.tasks.back();
+                    own_queue.tasks.pop_back();
+                }
+            }
+            for (size_t i = 1; i < thread_cnt && !task; i++) {
+                TaskQueue& victim_queue = task_queues[(worker_idx + i) % thread_cnt];
+                std::lock_guard<std::mutex> lock(victim_queue.mutex);
+                if (!victim_queue.tasks.empty()) {
+                    task = victim_queue.tasks.front();
+                    victim_queue.tasks.pop_front();
+                }
+            }
+            if (!task) { // Nothing to do until another thread schedules a task
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                idle_cond.wait(lock, [&] {
+                    return queued_task_cnt > 0 || unfinished_task_cnt == 0;
+                });
+                continue;
+            }
+            queued_task_cnt--;
+            BuildSubtree(task, leaf_lut, schedule_task);
+
+            bool was_last_task;
+            {
+                std::lock_guard<std::mutex> lock(idle_mutex);
+                was_last_task = --unfinished_task_cnt == 0;
             }
+            if (was_last_task) // Wake up idle threads so they can exit
+                idle_cond.notify_all();
         }
-        // Bloat AABB a little to account for collision calculation tolerances
-        aabb_mins -= Vector3{ 1.0f, 1.0f, 1.0f };
-        aabb_maxs += Vector3{ 1.0f, 1.0f, 1.0f };
+    };
 
-        Leaf bvh_leaf{
-            .mins = aabb_mins,
-            .maxs = aabb_maxs,
-            .type = Leaf::Type::DynamicProp,
-            .dprop_idx = (uint32_t)dprop_idx,
-        };
-        leaves.push_back(bvh_leaf);
+    // Calling thread works as well
+    std::vector<std::thread> worker_threads;
+    for (size_t i = 1; i < thread_cnt; i++)
+        worker_threads.emplace_back(worker_func, i);
+    worker_func(0);
+    for (std::thread& t : worker_threads)
+        t.join();
+}
+
+void BVH::AppendSubtreeNodes(const SubtreeBuildTask& task, uint32_t root_node_idx)
+{
+    // Task's nodes, except its root node, are placed at the end of the nodes array
+    const uint32_t first_appended_node_idx = nodes.size();
+    auto get_new_node_idx = [&](int32_t task_node_idx) -> int32_t {
+        if (task_node_idx == 0)
+            return root_node_idx;
+        return first_appended_node_idx + task_node_idx - 1;
+    };
+
+    for (size_t i = 0; i < task.nodes.size(); i++) {
+        Node node = task.nodes[i];
+        if (node.child_l >= 0) node.child_l = get_new_node_idx(node.child_l);
+        if (node.child_r >= 0) node.child_r = get_new_node_idx(node.child_r);
+        if (i == 0) nodes[root_node_idx] = node;
+        else        nodes.push_back(node);
     }
 
-    return true; // Leaf creation succeeded
+    // Forked subtrees replace their placeholder nodes
+    for (const SubtreeBuildTask::Fork& fork : task.forks)
+        AppendSubtreeNodes(*fork.task, get_new_node_idx(fork.node_idx));
 }
 
-void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
-    std::span<uint32_t> start_node_leaf_refs_sorted_along_axis[3],
-    CollidableWorld& c_world)
+void BVH::BuildSubtree(SubtreeBuildTask* task, std::vector<bool>& leaf_lut,
+    const std::function<void(SubtreeBuildTask*)>& schedule_task) const
 {
+    ZoneScoped;
+
+    assert(leaf_lut.size() == leaves.size());
+    std::vector<Node>& task_nodes = task->nodes;
+
     struct UnsplitNodeStackEntry {
-        // Node in nodes array that needs to be split.
+        // Node in task_nodes array that needs to be split.
         // Its AABB is set, its children are yet to be determined.
-        uint32_t unsplit_node_idx; // idx into nodes
+        uint32_t unsplit_node_idx; // idx into task_nodes
 
         // Leafs assigned to this node, sorted along all 3 axes.
         std::span<uint32_t> leaf_refs_sorted_along_axis[3];
@@ -740,20 +1953,62 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
     std::stack<UnsplitNodeStackEntry> unsplit_node_stack;
 
     UnsplitNodeStackEntry first_entry{
-        .unsplit_node_idx = start_node_idx,
+        .unsplit_node_idx = 0,
         .leaf_refs_sorted_along_axis = {
-            start_node_leaf_refs_sorted_along_axis[0],
-            start_node_leaf_refs_sorted_along_axis[1],
-            start_node_leaf_refs_sorted_along_axis[2]
+            task->leaf_refs_sorted_along_axis[0],
+            task->leaf_refs_sorted_along_axis[1],
+            task->leaf_refs_sorted_along_axis[2]
         }
     };
     unsplit_node_stack.push(first_entry);
 
+    // Create child node with given leaves. Returns its index.
+    auto create_child_node = [&](
+        std::span<uint32_t> child_leaf_refs_sorted_along_axis[3]) -> uint32_t
+    {
+        uint32_t child_node_idx = task_nodes.size();
+        task_nodes.push_back({});
+        Node& child_node = task_nodes.back();
+        // Compute AABB of child node
+        // @Optimization DetermineBeneficialNodeSplit() already calculated
+        //               AABBs of children, no need to calculate again.
+        CalcAabbOfBvhLeaves(child_leaf_refs_sorted_along_axis[0],
+            &child_node.mins, &child_node.maxs);
+
+        size_t child_leaf_cnt = child_leaf_refs_sorted_along_axis[0].size();
+        if (child_leaf_cnt >= build_options.parallel_subtree_min_leaf_cnt) {
+            // Split child off into its own task. Child node remains as a
+            // placeholder for the task's root node.
+            auto child_task = std::make_unique<SubtreeBuildTask>();
+            for (int axis = 0; axis < 3; axis++)
+                child_task->leaf_refs_sorted_along_axis[axis] =
+                    child_leaf_refs_sorted_along_axis[axis];
+            child_task->nodes.push_back(child_node);
+            SubtreeBuildTask* child_task_ptr = child_task.get();
+            task->forks.push_back({
+                .node_idx = child_node_idx,
+                .task = std::move(child_task)
+            });
+            schedule_task(child_task_ptr);
+        }
+        else {
+            UnsplitNodeStackEntry new_entry{
+                .unsplit_node_idx = child_node_idx,
+                .leaf_refs_sorted_along_axis = {
+                    child_leaf_refs_sorted_along_axis[0],
+                    child_leaf_refs_sorted_along_axis[1],
+                    child_leaf_refs_sorted_along_axis[2]
+                }
+            };
+            unsplit_node_stack.push(new_entry);
+        }
+        return child_node_idx;
+    };
+
     while (!unsplit_node_stack.empty()) {
         UnsplitNodeStackEntry next = unsplit_node_stack.top();
         unsplit_node_stack.pop();
 
-        Node& current_node = nodes[next.unsplit_node_idx];
         std::span<uint32_t> leaf_refs_sorted_along_axis[3] = {
             next.leaf_refs_sorted_along_axis[0],
             next.leaf_refs_sorted_along_axis[1],
@@ -766,7 +2021,7 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
         // ---- Split this node ----
 
         NodeSplitDetails split_details = DetermineBeneficialNodeSplit(
-            current_node, leaf_refs_sorted_along_axis, c_world);
+            task_nodes[next.unsplit_node_idx], leaf_refs_sorted_along_axis);
 
         // Select axis to split on
         int split_axis = split_details.axis;
@@ -792,13 +2047,14 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             r_child_leaf_cnt
         };
 
-        // Create LUT to quickly figure out which side a leaf is on.
+        // Use LUT to quickly figure out which side a leaf is on. The LUT is
+        // reused across splits, only entries of this node's leaves are set.
         const bool L_CHILD = true;
         const bool R_CHILD = false;
-        // @Optimization Only allocate this once? Use BitArray?
-        std::vector<bool> leaf_lut(leaves.size(), R_CHILD);
         for (uint32_t leaf_idx : l_child_leaf_refs_sorted_along_axis[split_axis])
             leaf_lut[leaf_idx] = L_CHILD;
+        for (uint32_t leaf_idx : r_child_leaf_refs_sorted_along_axis[split_axis])
+            leaf_lut[leaf_idx] = R_CHILD;
 
         // On non-split axes, copy leaf refs and first copy back l_child leaves,
         // then r_child leaves, while keeping the sorted order within both children.
@@ -832,59 +2088,23 @@ void BVH::CreateNodeHierarchy(uint32_t start_node_idx,
             };
         }
 
+        // CAUTION: Creating child nodes invalidates references into task_nodes!
         assert(l_child_leaf_cnt > 0);
-        if (l_child_leaf_cnt == 1) { // Make left child a leaf 
-            uint32_t l_child_leaf_idx = l_child_leaf_refs_sorted_along_axis[0][0];
-            current_node.child_l = -((int32_t)l_child_leaf_idx);
-        }
-        else if (l_child_leaf_cnt >= 2) { // Make left child a node
-            uint32_t l_child_node_idx = nodes.size();
-            nodes.push_back({});
-            Node& l_child_node = nodes.back();
-            current_node.child_l = l_child_node_idx;
-            // Compute AABB of l_child node
-            // @Optimization DetermineBeneficialNodeSplit() already calculated
-            //               AABBs of children, no need to calculate again.
-            CalcAabbOfBvhLeaves(l_child_leaf_refs_sorted_along_axis[0],
-                &l_child_node.mins, &l_child_node.maxs);
-
-            UnsplitNodeStackEntry new_entry{
-                .unsplit_node_idx = l_child_node_idx,
-                .leaf_refs_sorted_along_axis = {
-                    l_child_leaf_refs_sorted_along_axis[0],
-                    l_child_leaf_refs_sorted_along_axis[1],
-                    l_child_leaf_refs_sorted_along_axis[2]
-                }
-            };
-            unsplit_node_stack.push(new_entry);
-        }
+        int32_t child_l;
+        if (l_child_leaf_cnt == 1) // Make left child a leaf
+            child_l = -((int32_t)l_child_leaf_refs_sorted_along_axis[0][0]);
+        else // Make left child a node
+            child_l = create_child_node(l_child_leaf_refs_sorted_along_axis);
 
         assert(r_child_leaf_cnt > 0);
-        if (r_child_leaf_cnt == 1) { // Make right child a leaf 
-            uint32_t r_child_leaf_idx = r_child_leaf_refs_sorted_along_axis[0][0];
-            current_node.child_r = -((int32_t)r_child_leaf_idx);
-        }
-        else if (r_child_leaf_cnt >= 2) { // Make right child a node
-            uint32_t r_child_node_idx = nodes.size();
-            nodes.push_back({});
-            Node& r_child_node = nodes.back();
-            current_node.child_r = r_child_node_idx;
-            // Compute AABB of r_child node
-            // @Optimization DetermineBeneficialNodeSplit() already calculated
-            //               AABBs of children, no need to calculate again.
-            CalcAabbOfBvhLeaves(r_child_leaf_refs_sorted_along_axis[0],
-                &r_child_node.mins, &r_child_node.maxs);
-
-            UnsplitNodeStackEntry new_entry{
-                .unsplit_node_idx = r_child_node_idx,
-                .leaf_refs_sorted_along_axis = {
-                    r_child_leaf_refs_sorted_along_axis[0],
-                    r_child_leaf_refs_sorted_along_axis[1],
-                    r_child_leaf_refs_sorted_along_axis[2]
-                }
-            };
-            unsplit_node_stack.push(new_entry);
-        }
+        int32_t child_r;
+        if (r_child_leaf_cnt == 1) // Make right child a leaf
+            child_r = -((int32_t)r_child_leaf_refs_sorted_along_axis[0][0]);
+        else // Make right child a node
+            child_r = create_child_node(r_child_leaf_refs_sorted_along_axis);
+
+        task_nodes[next.unsplit_node_idx].child_l = child_l;
+        task_nodes[next.unsplit_node_idx].child_r = child_r;
     }
 }
 
@@ -923,10 +2143,12 @@ void BVH::SetNodeContentsInfo()
                 if (child_idx < 0) {
                     const Leaf& leaf = leaves[-child_idx];
                     node.contained_leaf_types.set(leaf.type);
+                    node.contained_contents |= leaf.contents;
                 }
                 else {
                     const Node& child_node = nodes[child_idx];
                     node.contained_leaf_types |= child_node.contained_leaf_types;
+                    node.contained_contents   |= child_node.contained_contents;
                 }
             }
 
@@ -936,6 +2158,199 @@ void BVH::SetNodeContentsInfo()
     }
 }
 
+bool BVH::CreateNodes4()
+{
+    nodes4.clear();
+    nodes4_child_contents.clear();
+    nodes4_max_depth = 0;
+    if (!WasConstructedSuccessfully()) {
+        assert(0);
+        return false;
+    }
+
+    struct CollapseStackEntry {
+        uint32_t node4_idx; // idx into nodes4, node whose children must be set
+        int32_t  node_idx;  // idx into nodes, node that gets collapsed into it
+        size_t   depth;     // Root node has depth 1
+    };
+    std::stack<CollapseStackEntry> collapse_stack;
+
+    // Every 4-ary node replaces at least one binary node
+    nodes4.reserve(nodes.size());
+    nodes4.push_back({}); // Root node
+    nodes4_child_contents.reserve(nodes.size());
+    nodes4_child_contents.push_back({});
+    collapse_stack.push({ .node4_idx = 0, .node_idx = 0, .depth = 1 });
+
+    while (!collapse_stack.empty()) {
+        CollapseStackEntry entry = collapse_stack.top();
+        collapse_stack.pop();
+        nodes4_max_depth = Math::max(nodes4_max_depth, entry.depth);
+
+        // Gather up to 4 children from the binary node's subtree by
+        // repeatedly replacing the largest child node with its 2 children.
+        const Node& node = nodes[entry.node_idx];
+        int32_t children[4] = { node.child_l, node.child_r, 0, 0 };
+        size_t child_cnt = 2;
+        while (child_cnt < 4) {
+            int largest_child = -1;
+            float largest_child_area = -1.0f;
+            for (size_t i = 0; i < child_cnt; i++) {
+                if (children[i] < 0)
+                    continue; // Leaves can't be opened up
+                const Node& child_node = nodes[children[i]];
+                float area = CalcSahSurfaceArea(child_node.mins, child_node.maxs);
+                if (area > largest_child_area) {
+                    largest_child = i;
+                    largest_child_area = area;
+                }
+            }
+            if (largest_child == -1)
+                break; // All children are leaves
+            const Node& opened_node = nodes[children[largest_child]];
+            children[largest_child] = opened_node.child_l;
+            children[child_cnt++]   = opened_node.child_r;
+        }
+
+        // Set up 4-ary node. Only index into nodes4 from here on, since
+        // references get invalidated when adding new nodes.
+        nodes4[entry.node4_idx].child_cnt = child_cnt;
+        nodes4[entry.node4_idx].contained_leaf_types = node.contained_leaf_types;
+        for (size_t i = 0; i < 4; i++) {
+            Vector3 child_mins = { 0.0f, 0.0f, 0.0f }; // Unused slot values
+            Vector3 child_maxs = { 0.0f, 0.0f, 0.0f };
+            int32_t child_ref = 0; // Unused slot value
+            ContentsMask child_contents = 0;
+            if (i < child_cnt) {
+                if (children[i] < 0) { // If child is a leaf
+                    child_mins = leaves[-children[i]].mins;
+                    child_maxs = leaves[-children[i]].maxs;
+                    child_ref = children[i];
+                    child_contents = leaves[-children[i]].contents;
+                }
+                else { // If child is a node
+                    child_mins = nodes[children[i]].mins;
+                    child_maxs = nodes[children[i]].maxs;
+                    child_ref = nodes4.size();
+                    child_contents = nodes[children[i]].contained_contents;
+                    nodes4.push_back({});
+                    nodes4_child_contents.push_back({});
+                    collapse_stack.push({ (uint32_t)child_ref, children[i], entry.depth + 1 });
+                }
+            }
+            Node4& node4 = nodes4[entry.node4_idx];
+            for (int axis = 0; axis < 3; axis++) {
+                node4.child_mins[axis][i] = child_mins[axis];
+                node4.child_maxs[axis][i] = child_maxs[axis];
+            }
+            node4.children[i] = child_ref;
+            nodes4_child_contents[entry.node4_idx][i] = child_contents;
+        }
+    }
+
+    // During traversal, every visited level leaves at most 3 candidates on
+    // the stack, plus the 4 children of the deepest visited node.
+    if (3 * nodes4_max_depth + 1 > MAX_NODE4_TRAVERSAL_STACK_SIZE) {
+        nodes4.clear();
+        nodes4_child_contents.clear();
+        return false;
+    }
+    return true;
+}
+
+bool BVH::CreateQNodes4()
+{
+    qnodes4.clear();
+    qnodes4.reserve(nodes4.size());
+    for (const Node4& node4 : nodes4) {
+        QNode4 qnode4;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int i = 0; i < 4; i++) {
+                // Round outwards so that quantized AABBs enclose original AABBs
+                float q_min = std::floor(node4.child_mins[axis][i]);
+                float q_max = std::ceil (node4.child_maxs[axis][i]);
+                if (!(q_min >= INT16_MIN && q_max <= INT16_MAX)) {
+                    qnodes4.clear();
+                    return false;
+                }
+                qnode4.child_mins[axis][i] = (int16_t)q_min;
+                qnode4.child_maxs[axis][i] = (int16_t)q_max;
+            }
+        }
+        for (int i = 0; i < 4; i++)
+            qnode4.children[i] = node4.children[i];
+        qnodes4.push_back(qnode4);
+    }
+    return true;
+}
+
+bool BVH::CreateFlatNodes()
+{
+    flat_nodes.clear();
+    flat_max_depth = 0;
+    if (!WasConstructedSuccessfully()) {
+        assert(0);
+        return false;
+    }
+
+    struct FlattenStackEntry {
+        int32_t node_or_leaf_idx; // See Node struct for details
+        // Index into flat_nodes of parent whose right child index must be set
+        // to this entry's flat index. UINT32_MAX if there is no such parent.
+        uint32_t flat_parent_idx;
+        size_t depth; // Root node has depth 1
+    };
+    std::stack<FlattenStackEntry> flatten_stack;
+    flatten_stack.push({ .node_or_leaf_idx = 0, .flat_parent_idx = UINT32_MAX, .depth = 1 });
+
+    flat_nodes.reserve(nodes.size() + total_leaf_cnt);
+    while (!flatten_stack.empty()) {
+        FlattenStackEntry entry = flatten_stack.top();
+        flatten_stack.pop();
+
+        uint32_t flat_idx = flat_nodes.size();
+        if (entry.flat_parent_idx != UINT32_MAX)
+            flat_nodes[entry.flat_parent_idx].child_r_idx = flat_idx;
+        flat_max_depth = Math::max(flat_max_depth, entry.depth);
+
+        FlatNode flat_node{};
+        if (entry.node_or_leaf_idx < 0) { // If entry is a leaf
+            uint32_t leaf_idx = -entry.node_or_leaf_idx;
+            const Leaf& leaf = leaves[leaf_idx];
+            flat_node.mins = leaf.mins;
+            flat_node.maxs = leaf.maxs;
+            flat_node.leaf_idx = leaf_idx;
+            flat_node.is_leaf = 1;
+            flat_node.contained_leaf_types.set(leaf.type);
+            flat_node.contained_contents = leaf.contents;
+            flat_nodes.push_back(flat_node);
+        }
+        else { // If entry is a node
+            const Node& node = nodes[entry.node_or_leaf_idx];
+            flat_node.mins = node.mins;
+            flat_node.maxs = node.maxs;
+            flat_node.child_r_idx = 0; // Set once right child gets flattened
+            flat_node.is_leaf = 0;
+            flat_node.contained_leaf_types = node.contained_leaf_types;
+            flat_node.contained_contents = node.contained_contents;
+            flat_nodes.push_back(flat_node);
+
+            // Left child is pushed last so it's placed right after this node
+            flatten_stack.push({ node.child_r, flat_idx, entry.depth + 1 });
+            flatten_stack.push({ node.child_l, UINT32_MAX, entry.depth + 1 });
+        }
+    }
+    assert(flat_nodes.size() == nodes.size() + total_leaf_cnt);
+
+    // During traversal, every visited level leaves at most one candidate on the
+    // stack, plus the 2 children of the deepest visited node.
+    if (flat_max_depth + 1 > MAX_FLAT_TRAVERSAL_STACK_SIZE) {
+        flat_nodes.clear();
+        return false;
+    }
+    return true;
+}
+
 void BVH::_GetAabbsContainingPoint_r(const Node& node, const Vector3& pt,
     std::vector<Vector3>* aabb_mins_list,
     std::vector<Vector3>* aabb_maxs_list)
@@ -966,3 +2381,10 @@ void BVH::_GetAabbsContainingPoint_r(const Node& node, const Vector3& pt,
     if (l_idx >= 0) _GetAabbsContainingPoint_r(nodes[l_idx], pt, aabb_mins_list, aabb_maxs_list);
     if (r_idx >= 0) _GetAabbsContainingPoint_r(nodes[r_idx], pt, aabb_mins_list, aabb_maxs_list);
 }
+
+template void BVH::DoSweptTrace_Nodes4<BVH::Node4>(SweptTrace*, CollidableWorld&,
+    const std::vector<BVH::Node4>&, TraversalStats*) const;
+template void BVH::DoSweptTrace_Nodes4<BVH::QNode4>(SweptTrace*, CollidableWorld&,
+    const std::vector<BVH::QNode4>&, TraversalStats*) const;
+template void BVH::DoSweptTraceAgainstLeaf<RuntimeShape>(SweptTrace*,
+    const Leaf&, CollidableWorld&) const;
@@ -1,7 +1,10 @@
 #ifndef COLL_BVH_H_
 #define COLL_BVH_H_
 
+#include <array>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <span>
 #include <vector>
 
@@ -9,25 +12,118 @@
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/CollidableWorld.h"
+#include "coll/Simd.h"
+#include "coll/SweptTrace.h"
+#include "coll/TraceQueryContext.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BspMap.h"
 
 namespace coll {
 
 class BVH {
 public:
+    // Settings that affect BVH construction
+    struct BuildOptions {
+        // Store child AABBs of the 4-ary BVH as int16 instead of float values,
+        // halving its memory size and the memory traffic of traces. Quantized
+        // AABBs are rounded outwards to integers, so traces might need to test
+        // slightly more leaves. Falls back to float values if map coordinates
+        // exceed the int16 range.
+        bool quantize_node_bounds = false;
+
+        // Number of threads that build the binary node hierarchy, 0 means one
+        // thread per hardware thread. The resulting BVH is identical for any
+        // thread count. Ignored in the web build, which always uses 1 thread.
+        unsigned int num_threads = 0;
+
+        // Subtrees with at least this many leaves are built as separate tasks
+        // that threads can take over. Only affects the order of the nodes
+        // array, not the shape of the node hierarchy.
+        size_t parallel_subtree_min_leaf_cnt = 4096;
+
+        // How the SAH cost of node splits is evaluated
+        enum class SplitMethod {
+            // Cost of splitting at every leaf is computed. Best BVH quality,
+            // slowest build. Meant for offline builds.
+            ExactSah,
+            // Leaves are put into sah_bin_cnt bins by their centroid and only
+            // the cost of splitting between bins is computed. Faster build,
+            // slightly worse BVH quality. Meant for interactive map loads.
+            BinnedSah,
+        };
+        SplitMethod split_method = SplitMethod::ExactSah;
+        size_t sah_bin_cnt = 16; // Only used by BinnedSah, 2 to MAX_SAH_BIN_CNT
+
+        // Only consider splitting nodes along the axis with the largest
+        // extent of leaf centroids instead of along all 3 axes.
+        bool sah_largest_axis_only = false;
+
+        // Compute SAH surface areas of AABBs that are bloated by the standing
+        // player hull's half extents. Nearly all traces are player hull
+        // sweeps, which hit an AABB with a probability proportional to the
+        // surface area of the bloated AABB rather than the AABB itself.
+        bool sah_bloat_by_player_hull = false;
+
+        // Weigh leaves by their estimated trace cost during SAH calculations.
+        // If false, all leaves are assumed to have the same trace cost.
+        bool sah_use_leaf_trace_costs = true;
+    };
+    static constexpr size_t MAX_SAH_BIN_CNT = 64;
+
     // Construct BVH of CollidableWorld. It must contain at least 2 collidable
     // objects.
     // CAUTION: BVH must only be created after all other collision data in
     //          CollidableWorld was created!
-    BVH(CollidableWorld& c_world);
+    BVH(CollidableWorld& c_world, const BuildOptions& options);
+    BVH(CollidableWorld& c_world); // Uses default build options
 
     // Check whether an error occurred during BVH construction.
     // If construction failed, traces cannot be performed.
-    bool WasConstructedSuccessfully();
+    bool WasConstructedSuccessfully() const;
 
     // Does nothing if WasConstructedSuccessfully() returns false.
-    // CAUTION: Not thread-safe yet!
-    void DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world);
+    // Thread-safe: Multiple threads can trace concurrently, as long as neither
+    // this BVH nor c_world is modified in the meantime.
+    void DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world) const;
+
+    // Like DoSweptTrace(), but stops at the first leaf that is hit instead of
+    // searching for the closest hit. Meant for occlusion queries that only
+    // need trace->results.DidHit(). If something is hit, the trace's
+    // fraction and plane normal are those of *a* hit, not necessarily the
+    // closest one. Only the 4-ary BVH supports early termination, other node
+    // layouts fall back to DoSweptTrace().
+    // Thread-safe, same conditions as DoSweptTrace().
+    void DoSweptTraceAnyHit(SweptTrace* trace, CollidableWorld& c_world) const;
+
+    // Performs multiple swept traces with the exact same results as calling
+    // DoSweptTrace() on each of them. Traces are grouped into packets of
+    // traces with similar start positions and directions. Each packet
+    // traverses the 4-ary BVH together and then traces against the found
+    // leaves, grouped by leaf type.
+    // Traces of this function are not visualized by coll::Debugger.
+    // Does nothing if WasConstructedSuccessfully() returns false.
+    // Thread-safe, same conditions as DoSweptTrace().
+    void DoSweptTraces(std::span<SweptTrace> traces, CollidableWorld& c_world) const;
+    void DoSweptTraces(std::span<SweptTrace* const> traces, CollidableWorld& c_world) const;
+
+    // Fills context with all leaves whose AABB intersects the given region.
+    // Clears context if WasConstructedSuccessfully() returns false.
+    void GatherTraceCandidates(const Magnum::Vector3& region_mins,
+        const Magnum::Vector3& region_maxs, TraceQueryContext* context) const;
+
+    // Traces only against the leaves gathered into context, in ascending order
+    // of their AABB hit fractions. The trace's swept volume must lie inside
+    // the context's region, see TraceQueryContext::ContainsSweep().
+    void DoSweptTraceAgainstCandidates(SweptTrace* trace,
+        TraceQueryContext* context, CollidableWorld& c_world) const;
+
+    // Returns true if the unswept box (or point) at the start of the given
+    // hull lies in any leaf whose contents match the hull's contents mask,
+    // see CollidableWorld::IsHullInSolid(). Traverses all nodes whose AABB
+    // overlaps the box and stops at the first leaf that contains it.
+    // Returns false if WasConstructedSuccessfully() returns false.
+    // Thread-safe, same conditions as DoSweptTrace().
+    bool IsHullInSolid(const SweptTrace::Info& hull, CollidableWorld& c_world) const;
 
     // Returns false if WasConstructedSuccessfully() returns false.
     // Only displacements that don't have the NO_HULL_COLL flag are considered.
@@ -60,6 +156,10 @@ private:
             COUNT
         } type;
 
+        // What the referenced map object is solid to. Traces skip leaves
+        // whose contents don't match their contents mask.
+        ContentsMask contents;
+
         // Index of referenced map object
         union {
             uint32_t     brush_idx; // if type == Brush:        idx into BspMap.brushes
@@ -85,15 +185,158 @@ private:
         // A leaf type's enum value signifies its bit position in this BitVector.
         BitVector<Leaf::Type::COUNT> contained_leaf_types{ Magnum::Math::ZeroInit };
 
-        // @Optimization To speed up BVH traversal, we could add further node
-        //               content information to this structure such as OR-ed
-        //               'contents' flags of contained brushes.
+        // OR-ed contents flags of all contained leaves. Traces skip the entire
+        // node if none of these match their contents mask.
+        ContentsMask contained_contents = 0;
+    };
+
+    // Compact node used for trace traversal. Nodes and leaves of the node
+    // hierarchy are stored together in a single array in depth-first order.
+    // The left child of an inner node is always located directly after it.
+    struct FlatNode {
+        // AABB of this node or leaf. Equal to the corresponding Node/Leaf AABB.
+        Magnum::Vector3 mins;
+        Magnum::Vector3 maxs;
+
+        union {
+            uint32_t child_r_idx; // if !is_leaf: idx into flat_nodes of right child
+            uint32_t    leaf_idx; // if  is_leaf: idx into leaves
+        };
+
+        uint8_t is_leaf; // 1 if this is a leaf, 0 if this is an inner node
+
+        // Same meaning as Node::contained_leaf_types. Leaves only have their
+        // own type flag set.
+        BitVector<Leaf::Type::COUNT> contained_leaf_types{ Magnum::Math::ZeroInit };
+
+        // Same meaning as Node::contained_contents. Leaves only have their own
+        // contents flags set.
+        ContentsMask contained_contents;
+
+        uint8_t _padding[1];
     };
+    static_assert(sizeof(FlatNode) == 32, "FlatNode is meant to be 32 bytes");
+
+    // Part of the node hierarchy that gets built separately from the rest of
+    // it, possibly in parallel to other subtrees.
+    struct SubtreeBuildTask {
+        // Leaves of the subtree's root node, sorted along all 3 axes. Leaf
+        // ranges of different tasks never overlap.
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3];
+
+        // Nodes of this subtree, root node at index 0 with its AABB set.
+        // Child node indices of these nodes are indices into this array.
+        std::vector<Node> nodes;
+
+        // Subtrees that were split off from this one, in creation order. Each
+        // one's root node takes the place of the placeholder node at node_idx.
+        struct Fork {
+            uint32_t node_idx; // idx into nodes
+            std::unique_ptr<SubtreeBuildTask> task;
+        };
+        std::vector<Fork> forks;
+    };
+
+    // Max number of entries on the fixed-size traversal stack of
+    // DoSweptTrace_FlatNodes().
+    static constexpr size_t MAX_FLAT_TRAVERSAL_STACK_SIZE = 64;
+
+    // Node of the 4-ary BVH that is primarily used for trace traversal. It's
+    // created by collapsing the binary node hierarchy. Child AABBs are stored
+    // in a structure-of-arrays layout so that a trace can be tested against
+    // all 4 of them at once using SIMD instructions.
+    struct alignas(simd::FLOAT4_ALIGNMENT) Node4 {
+        float child_mins[3][4]; // Indexed by [axis][child slot]
+        float child_maxs[3][4]; // Indexed by [axis][child slot]
+
+        // Child indices:
+        //   Index into nodes4 if (idx > 0).   =>  nodes4[idx]
+        //   Index into leaves if (idx < 0).   =>  leaves[-idx]
+        //   Unused child slot if (idx == 0). Root node is never a child.
+        int32_t children[4];
+
+        // Number of used child slots (2 to 4), used slots come first.
+        uint8_t child_cnt;
+
+        // Same meaning as Node::contained_leaf_types.
+        BitVector<Leaf::Type::COUNT> contained_leaf_types{ Magnum::Math::ZeroInit };
+    };
+    static_assert(sizeof(Node4) == 128, "Node4 is meant to be 2 cache lines");
+
+    // Same as Node4, but with quantized child AABBs. Fits into one cache line.
+    struct alignas(64) QNode4 {
+        // Integer child AABBs, rounded outwards. Indexed by [axis][child slot]
+        int16_t child_mins[3][4];
+        int16_t child_maxs[3][4];
+
+        // Same meaning as Node4::children.
+        int32_t children[4];
+    };
+    static_assert(sizeof(QNode4) == 64, "QNode4 is meant to be 1 cache line");
+
+    // Max number of entries on the fixed-size traversal stack of the 4-ary BVH
+    // traversal. Each level of the 4-ary BVH leaves at most 3 candidates
+    // behind on it.
+    static constexpr size_t MAX_NODE4_TRAVERSAL_STACK_SIZE = 96;
+
+    // Max number of traces that traverse the 4-ary BVH together in
+    // DoSweptTraces(). Must not exceed the bit count of trace masks.
+    static constexpr size_t TRACE_PACKET_SIZE = 16;
+
+    // Leaf that a trace of a packet needs to be traced against, found during
+    // packet traversal of the 4-ary BVH.
+    struct PacketLeafCandidate {
+        // Position of this leaf in the order in which DoSweptTrace_Nodes4()
+        // would visit the leaves if this were the only trace. At each 4-ary
+        // node level, 2 bits encode the traversal rank of the taken child,
+        // most significant bits first.
+        uint64_t traversal_order_key;
+        int32_t  leaf_idx; // idx into leaves
+        float    aabb_hit_fraction; // When trace hits this leaf's AABB
+        uint32_t packet_trace_idx; // idx into the trace packet
+    };
+
+    // Counters that benchmarks can collect during a 4-ary BVH traversal
+    struct TraversalStats {
+        uint64_t visited_nodes  = 0; // 4-ary nodes whose children were tested
+        uint64_t visited_leaves = 0; // Leaves that were traced against
+    };
+
+    BuildOptions build_options;
+
+    // Time it took to sort the leaves and build the binary node hierarchy
+    float hierarchy_build_duration_ms = 0.0f;
 
     std::vector<Leaf> leaves; // Has a dummy leaf at index 0
+
+    // Estimated trace cost of each leaf, same indexing as leaves array. Only
+    // filled during construction of the node hierarchy.
+    std::vector<uint64_t> leaf_trace_costs;
     std::vector<Node> nodes;
     size_t total_leaf_cnt; // Not counting dummy leaf, equal to (leaves.size()-1)
 
+    // Depth-first representation of nodes and leaves, used for trace traversal.
+    // Left empty if the node hierarchy is too deep for the fixed-size
+    // traversal stack, in which case traces traverse the nodes array instead.
+    std::vector<FlatNode> flat_nodes;
+    size_t flat_max_depth = 0; // Number of levels of the node hierarchy
+
+    // 4-ary BVH used for trace traversal, root node at index 0. Left empty if
+    // it's too deep for the fixed-size traversal stack, in which case traces
+    // traverse the flat_nodes array instead.
+    // Also left empty if qnodes4 is used instead.
+    std::vector<Node4> nodes4;
+    size_t nodes4_max_depth = 0; // Number of levels of the 4-ary BVH
+
+    // Quantized version of nodes4, only created if the build options ask for
+    // it. Same node order as nodes4.
+    std::vector<QNode4> qnodes4;
+
+    // Contents flags of each child of a 4-ary node, indexed by
+    // [nodes4 or qnodes4 idx][child slot]. Unused child slots have no flags
+    // set. Kept separate so QNode4 still fits into one cache line.
+    std::vector<std::array<ContentsMask, 4>> nodes4_child_contents;
+
 private:
     static bool IsPointInAabb(const Magnum::Vector3& pt,
         const Magnum::Vector3& mins, const Magnum::Vector3& maxs);
@@ -101,6 +344,10 @@ private:
     static float CalcAabbSurfaceArea(
         const Magnum::Vector3& mins, const Magnum::Vector3& maxs);
 
+    // Surface area used by SAH calculations, depends on build options.
+    float CalcSahSurfaceArea(
+        const Magnum::Vector3& mins, const Magnum::Vector3& maxs) const;
+
     // leaf_refs is an array of indices into leaves. At least one leaf must be given.
     void CalcAabbOfBvhLeaves(std::span<const uint32_t> leaf_refs,
         Magnum::Vector3* aabb_mins, Magnum::Vector3* aabb_maxs) const;
@@ -121,26 +368,108 @@ private:
     // Splits are always determined in a way that ensures that the resulting
     // children have at least one leaf.
     NodeSplitDetails DetermineBeneficialNodeSplit(const Node& node_to_split,
-        std::span<uint32_t> leaf_refs_sorted_along_axis[3],
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3]) const;
+
+    // Part of DetermineBeneficialNodeSplit() when using binned SAH. Updates
+    // cur_lowest_sah_cost and cur_best_split if a split along the given axis
+    // has a lower cost than cur_lowest_sah_cost.
+    void DetermineBinnedSahSplitAlongAxis(int axis,
+        std::span<const uint32_t> leaf_refs_sorted_along_this_axis,
+        float node_aabb_surface_area, uint64_t total_leaf_trace_cost,
+        float* cur_lowest_sah_cost, NodeSplitDetails* cur_best_split) const;
+
+    // Shape is the trace's shape, see coll/TraceShape.h.
+    template<class Shape = RuntimeShape>
+    void DoSweptTraceAgainstLeaf(SweptTrace* trace, const Leaf& leaf,
         CollidableWorld& c_world) const;
 
-    void DoSweptTraceAgainstLeaf(SweptTrace* trace, const Leaf& leaf,
+    bool IsHullInSolidAtLeaf(const SweptTrace::Info& hull, const Leaf& leaf,
         CollidableWorld& c_world) const;
 
     // Fills leaves array with one dummy leaf and further leafs.
     // Returns false if leaf creation failed, true otherwise.
     bool CreateLeaves(CollidableWorld& c_world);
 
-    // start_node_idx is an index into nodes.
-    // Given start node has its AABB set. Start node must have at least 2 leaves.
-    void CreateNodeHierarchy(uint32_t start_node_idx,
-        std::span<uint32_t> start_node_leaf_refs_sorted_along_axis[3],
-        CollidableWorld& c_world);
+    // Fills nodes array with the node hierarchy of the given leaves, root node
+    // at index 0. At least 2 leaves must be given.
+    void CreateNodeHierarchy(
+        std::span<uint32_t> leaf_refs_sorted_along_axis[3], unsigned int thread_cnt);
+
+    // Splits the task's nodes down to the BVH leaves. Child nodes with at
+    // least build_options.parallel_subtree_min_leaf_cnt leaves are split off
+    // into new tasks that are passed to schedule_task.
+    // leaf_lut must have as many entries as the leaves array. Multiple threads
+    // can build different tasks at once if they use different leaf_luts.
+    void BuildSubtree(SubtreeBuildTask* task, std::vector<bool>& leaf_lut,
+        const std::function<void(SubtreeBuildTask*)>& schedule_task) const;
+
+    // Builds given task and all tasks that get split off from it, using a
+    // work-stealing pool of thread_cnt threads.
+    void RunSubtreeBuildTasks(SubtreeBuildTask* root_task,
+        unsigned int thread_cnt) const;
+
+    // Copies nodes of a built task and of its forks into the nodes array. The
+    // task's root node is stored at root_node_idx, which must already exist.
+    // The order only depends on the tasks, not on the threads that built them.
+    void AppendSubtreeNodes(const SubtreeBuildTask& task, uint32_t root_node_idx);
 
     // This function assumes that all leaves and nodes have been created and
     // stored in the nodes and leaves arrays.
     void SetNodeContentsInfo();
 
+    // Fills flat_nodes array using the nodes and leaves arrays. Must be called
+    // after SetNodeContentsInfo(). Returns false if the node hierarchy is too
+    // deep for the fixed-size traversal stack, true otherwise.
+    bool CreateFlatNodes();
+
+    // Fills nodes4 array by collapsing the binary node hierarchy. Must be
+    // called after SetNodeContentsInfo(). Returns false if the resulting 4-ary
+    // BVH is too deep for the fixed-size traversal stack, true otherwise.
+    bool CreateNodes4();
+
+    // Fills qnodes4 array using the nodes4 array. Returns false if some AABB
+    // values can't be represented as int16, true otherwise.
+    bool CreateQNodes4();
+
+    // Load the child AABB bounds of a 4-ary node along one axis.
+    static void LoadChildBoundsAlongAxis(const Node4& node, int axis,
+        simd::Float4* child_mins, simd::Float4* child_maxs);
+    static void LoadChildBoundsAlongAxis(const QNode4& node, int axis,
+        simd::Float4* child_mins, simd::Float4* child_maxs);
+
+    // DoSweptTraceAgainstCandidates() with compile-time trace shape, see
+    // coll/TraceShape.h.
+    template<class Shape>
+    void DoSweptTraceAgainstCandidates_OfShape(SweptTrace* trace,
+        TraceQueryContext* context, CollidableWorld& c_world) const;
+
+    // Traverses the 4-ary BVH that is stored in nodes4 or qnodes4.
+    // stats is optional, it's incremented during traversal if given.
+    // If ANY_HIT is true, hit children aren't sorted by their hit fraction and
+    // traversal stops at the first leaf that is hit, see DoSweptTraceAnyHit().
+    // Shape is the trace's shape, see coll/TraceShape.h. Ray shapes skip all
+    // extent math in child AABB tests and leaf tests, fixed hull shapes have
+    // constant extents.
+    template<class Node4Type, bool ANY_HIT = false, class Shape = RuntimeShape>
+    void DoSweptTrace_Nodes4(SweptTrace* trace, CollidableWorld& c_world,
+        const std::vector<Node4Type>& node4_arr, TraversalStats* stats) const;
+
+    // Traverses the 4-ary BVH stored in nodes4 or qnodes4 with a packet of
+    // traces that share node visits, then traces each of them against its
+    // found leaves in single-trace traversal order. candidates is a scratch
+    // buffer that gets overwritten.
+    template<class Node4Type>
+    void DoSweptTracePacket_Nodes4(std::span<SweptTrace* const> packet,
+        CollidableWorld& c_world, const std::vector<Node4Type>& node4_arr,
+        std::vector<PacketLeafCandidate>* candidates) const;
+
+    // Trace traversal of the flat_nodes array, used if nodes4 is empty.
+    // Produces identical results to DoSweptTrace_NodeHierarchy().
+    void DoSweptTrace_FlatNodes(SweptTrace* trace, CollidableWorld& c_world) const;
+
+    // Slower trace traversal of the nodes array, used if flat_nodes is empty.
+    void DoSweptTrace_NodeHierarchy(SweptTrace* trace, CollidableWorld& c_world) const;
+
     void _GetAabbsContainingPoint_r(const Node& node, const Magnum::Vector3& pt,
         std::vector<Magnum::Vector3>* aabb_mins_list,
         std::vector<Magnum::Vector3>* aabb_maxs_list);
@@ -148,6 +477,8 @@ private:
 private:
     // Debugger needs to debug, let it access private members.
     friend class Debugger;
+    // DynamicBVH reports its leaf hits to the Debugger as leaves of this BVH.
+    friend class DynamicBVH;
     // Benchmarks needs to benchmark, let them access private members.
     friend class Benchmark;
 };
@@ -15,9 +15,15 @@
 #include <chrono>
 #include <cmath>
 #include <cstdio>
+#include <cstring>
+#include <iterator>
 #include <optional>
 #include <random>
+#include <span>
+#include <string>
+#include <utility>
 
+#include <Corrade/Containers/Optional.h>
 #include <Corrade/Containers/StringView.h>
 #include <Corrade/Utility/DebugStl.h>
 #include <Magnum/Magnum.h>
@@ -25,6 +31,9 @@
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/CollidableWorld_Impl.h"
+#include "coll/TraceQueryContext.h"
+#include "coll/TraceRecorder.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BspMap.h"
 #include "GlobalVars.h"
 
@@ -286,12 +295,15 @@ static std::vector<Plane> GenAllBevelPlanesOfSPropSection(
 
 void Benchmark::StaticPropBevelPlaneGen()
 {
-    if (!g_coll_world || !g_coll_world->pImpl->sprop_coll_models) {
+    if (!g_coll_world || !g_coll_world->pImpl->xprop_coll_models) {
         assert(false);
         return;
     }
 
-    constexpr size_t NUM_BENCHMARKED_METHODS = 1;
+    // Method 0: Generate bevel planes with the section's LUT (regular path)
+    // Method 1: Read fully precomputed bevel planes (path of hot sections, see
+    //           CollidableWorld::UpdateHotXPropBevelPlanes())
+    constexpr size_t NUM_BENCHMARKED_METHODS = 2;
     constexpr size_t NUM_ITERATIONS = 200;
     std::vector<unsigned long long> method_durations_ns(NUM_BENCHMARKED_METHODS, 0);
     std::vector<size_t> method_num_planes(NUM_BENCHMARKED_METHODS, 0);
@@ -299,6 +311,7 @@ void Benchmark::StaticPropBevelPlaneGen()
 
     size_t total_num_sprop_tris = 0; // # of triangles of all solid sprops in map
     size_t total_num_sprop_sections = 0; // # of sections of all solid sprops in map
+    size_t total_lut_memory_size = 0; // Of all bevel plane LUTs, without sharing
 
     // For each static prop
     const bool START_WITH_BIG_SPROPS = true; //false;
@@ -309,8 +322,8 @@ void Benchmark::StaticPropBevelPlaneGen()
         const BspMap::StaticProp& sprop    = g_coll_world->pImpl->origin_bsp_map->static_props[leaf.sprop_idx];
         const std::string&        mdl_path = g_coll_world->pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
 
-        const auto& iter = g_coll_world->pImpl->sprop_coll_models->find(mdl_path);
-        if (iter == g_coll_world->pImpl->sprop_coll_models->end())
+        const auto& iter = g_coll_world->pImpl->xprop_coll_models->find(mdl_path);
+        if (iter == g_coll_world->pImpl->xprop_coll_models->end())
             continue; // This static prop has no collision model, skip
         const CollisionModel& collmodel = iter->second;
         const size_t num_sections = collmodel.section_tri_meshes.size();
@@ -323,6 +336,11 @@ void Benchmark::StaticPropBevelPlaneGen()
         for (size_t section_idx = 0; section_idx < num_sections; section_idx++) {
             total_num_sprop_tris += collmodel.section_tri_meshes[section_idx].tris.size();
             total_num_sprop_sections++;
+            total_lut_memory_size += coll_cache.section_bevel_luts[section_idx]->GetMemorySize();
+
+            // Precomputed bevel planes of method 1, like those of hot sections
+            std::vector<Plane> precomputed_planes =
+                GenerateXPropSectionBevelPlanes(collmodel, coll_cache, section_idx);
 
             // For each method, generate section's bevel planes
             std::vector<std::vector<Plane>> method_results(NUM_BENCHMARKED_METHODS); // Results of each method
@@ -336,9 +354,9 @@ void Benchmark::StaticPropBevelPlaneGen()
                         case 0:
                             results = GenAllBevelPlanesOfSPropSection(collmodel, coll_cache, section_idx);
                             break;
-                        //case 1:
-                        //    results = GenAllBevelPlanesOfSPropSection_New1(collmodel, coll_cache, section_idx);
-                        //    break;
+                        case 1:
+                            results.assign(precomputed_planes.begin(), precomputed_planes.end());
+                            break;
                         //case 2:
                         //    results = GenAllBevelPlanesOfSPropSection_New2(collmodel, coll_cache, section_idx);
                         //    break;
@@ -429,6 +447,8 @@ void Benchmark::StaticPropBevelPlaneGen()
         Debug{} << "Method" << method_idx << "generated" << method_num_planes[method_idx] << "bevel planes";
         Debug{} << "  -> Total bevel plane array size:" << ((float)method_num_planes[method_idx] * 16.0f / 1048576.0f) << "MiB";
     }
+    Debug{} << "Bevel plane LUTs of all sections (method 0) take up"
+        << ((float)total_lut_memory_size / 1048576.0f) << "MiB without sharing";
     // Print other details
     Debug{} << "- Total # of solid sprops in map:" << sprop_leaf_indices.size();
     Debug{} << "- Total # of solid sprop sections in map:" << total_num_sprop_sections;
@@ -447,6 +467,1194 @@ void Benchmark::StaticPropBevelPlaneGen()
         " timing errors!";
 }
 
+void Benchmark::BvhNodeFormats()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhNodeFormats] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_TRACES = 20000;
+    constexpr size_t NUM_ITERATIONS = 20; // How often all traces are repeated per method
+
+    // Method 0: 4-ary BVH with float AABBs
+    // Method 1: 4-ary BVH with quantized int16 AABBs
+    constexpr size_t NUM_BENCHMARKED_METHODS = 2;
+    std::vector<BVH> bvhs;
+    bvhs.reserve(NUM_BENCHMARKED_METHODS);
+    for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++) {
+        BVH::BuildOptions options;
+        options.quantize_node_bounds = (method_idx == 1);
+        bvhs.emplace_back(*g_coll_world, options);
+    }
+
+    std::vector<SweptTrace::Info> trace_infos =
+        GenHullTracesNearLeaves(gen, bvhs[0], NUM_TRACES);
+
+    // Correct results are determined by the BVH that's used by the simulation
+    std::vector<SweptTrace::Results> correct_results =
+        ComputeReferenceResults(trace_infos);
+
+    for (size_t method_idx = 0; method_idx < NUM_BENCHMARKED_METHODS; method_idx++) {
+        BVH& bvh = bvhs[method_idx];
+        bool is_quantized = !bvh.qnodes4.empty();
+        size_t node4_size = is_quantized ? sizeof(BVH::QNode4) : sizeof(BVH::Node4);
+        size_t node4_cnt  = is_quantized ? bvh.qnodes4.size()  : bvh.nodes4.size();
+        if (node4_cnt == 0) {
+            Debug{} << "Method" << method_idx << "has no 4-ary BVH, skipping";
+            continue;
+        }
+
+        // Count visited nodes and validate results
+        BVH::TraversalStats stats;
+        size_t num_incorrect = CountIncorrectResults(trace_infos, correct_results,
+            [&](SweptTrace* trace) {
+                if (is_quantized) bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.qnodes4, &stats);
+                else              bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.nodes4,  &stats);
+            });
+
+        float mean_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(bvh, trace_infos, NUM_ITERATIONS);
+
+        // Hardware cache miss counters can't be read from here. As a proxy,
+        // print how much 4-ary node data a trace reads on average. Node arrays
+        // that fit into the L2 cache cause far fewer misses.
+        float mean_visited_nodes  = (float)stats.visited_nodes  / (float)trace_infos.size();
+        float mean_visited_leaves = (float)stats.visited_leaves / (float)trace_infos.size();
+        float mean_node_cache_lines = mean_visited_nodes * (float)node4_size / 64.0f;
+
+        Debug{} << "Method" << method_idx << (is_quantized ? "(quantized int16 AABBs):" : "(float AABBs):");
+        Debug{} << "  -> Total BVH memory size:" << ((float)GetBvhMemorySize(bvh) / 1048576.0f) << "MiB";
+        Debug{} << "  -> 4-ary node array size:" << ((float)(node4_cnt * node4_size) / 1048576.0f)
+            << "MiB (" << node4_cnt << "nodes of" << node4_size << "bytes)";
+        Debug{} << "  -> Mean trace duration:" << GetDurationStr(mean_trace_duration_ns);
+        Debug{} << "  -> Mean visited nodes per trace:" << mean_visited_nodes
+            << ", mean traced leaves per trace:" << mean_visited_leaves;
+        Debug{} << "  -> Mean node cache lines read per trace:" << mean_node_cache_lines;
+        if (num_incorrect != 0)
+            Debug{} << Debug::color(Debug::Color::Red) << "Method" << method_idx
+                << "produced incorrect trace results!" << num_incorrect << "/" << trace_infos.size();
+    }
+    Debug{} << "[Benchmark::BvhNodeFormats] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhBuildMethods()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhBuildMethods] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_TRACES = 20000;
+    constexpr size_t NUM_BUILDS = 3; // How often each BVH is built per method
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+
+    using SplitMethod = BVH::BuildOptions::SplitMethod;
+    struct BuildMethod {
+        const char* name;
+        SplitMethod split_method;
+        size_t sah_bin_cnt;
+        bool sah_largest_axis_only;
+    };
+    const BuildMethod build_methods[] = {
+        { "Exact SAH, all axes           ", SplitMethod::ExactSah,   0, false },
+        { "Exact SAH, largest axis       ", SplitMethod::ExactSah,   0, true  },
+        { "Binned SAH (16), all axes     ", SplitMethod::BinnedSah, 16, false },
+        { "Binned SAH (16), largest axis ", SplitMethod::BinnedSah, 16, true  },
+        { "Binned SAH (32), all axes     ", SplitMethod::BinnedSah, 32, false },
+        { "Binned SAH (32), largest axis ", SplitMethod::BinnedSah, 32, true  },
+    };
+
+    std::vector<SweptTrace::Info> trace_infos =
+        GenHullTracesNearLeaves(gen, *g_coll_world->pImpl->bvh, NUM_TRACES);
+
+    // Correct results are determined by the BVH that's used by the simulation
+    std::vector<SweptTrace::Results> correct_results =
+        ComputeReferenceResults(trace_infos);
+
+    float exact_build_duration_ms = 0.0f;
+    float exact_trace_duration_ns = 0.0f;
+    for (size_t method_idx = 0; method_idx < std::size(build_methods); method_idx++) {
+        const BuildMethod& method = build_methods[method_idx];
+        BVH::BuildOptions options;
+        options.split_method          = method.split_method;
+        options.sah_bin_cnt           = method.sah_bin_cnt;
+        options.sah_largest_axis_only = method.sah_largest_axis_only;
+
+        // Measure the fastest of multiple builds. Only the node hierarchy
+        // build is affected by the build method, leaf creation is not.
+        Containers::Optional<BVH> bvh;
+        float build_duration_ms = HUGE_VALF;
+        for (size_t build = 0; build < NUM_BUILDS; build++) {
+            bvh = BVH(*g_coll_world, options);
+            build_duration_ms = Math::min(build_duration_ms, bvh->hierarchy_build_duration_ms);
+        }
+        if (!bvh->WasConstructedSuccessfully()) {
+            Debug{} << "Method" << method_idx << "failed to build BVH, skipping";
+            continue;
+        }
+
+        // Count visited nodes and validate results
+        BVH::TraversalStats stats;
+        size_t num_incorrect = CountIncorrectResults(trace_infos, correct_results,
+            [&](SweptTrace* trace) {
+                if (!bvh->nodes4.empty()) bvh->DoSweptTrace_Nodes4(trace, *g_coll_world, bvh->nodes4, &stats);
+                else                      bvh->DoSweptTrace(trace, *g_coll_world);
+            });
+
+        float mean_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(*bvh, trace_infos, NUM_ITERATIONS);
+        if (method_idx == 0) {
+            exact_build_duration_ms = build_duration_ms;
+            exact_trace_duration_ns = mean_trace_duration_ns;
+        }
+
+        Debug{} << "Method" << method_idx << method.name
+            << "| build:" << GetDurationStr(1e6f * build_duration_ms)
+            << GetPercentStr(build_duration_ms / exact_build_duration_ms - 1.0f, true)
+            << "| mean trace:" << GetDurationStr(mean_trace_duration_ns)
+            << GetPercentStr(mean_trace_duration_ns / exact_trace_duration_ns - 1.0f, true)
+            << "| mean visited nodes:" << (float)stats.visited_nodes / (float)trace_infos.size()
+            << ", leaves:" << (float)stats.visited_leaves / (float)trace_infos.size();
+        if (num_incorrect != 0)
+            Debug{} << Debug::color(Debug::Color::Red) << "Method" << method_idx
+                << "produced incorrect trace results!" << num_incorrect << "/" << trace_infos.size();
+    }
+    Debug{} << "Build times are relative to method 0. A faster build method only"
+        " pays off if its saved build time outweighs its added trace time over"
+        " the number of traces expected on this map.";
+    Debug{} << "[Benchmark::BvhBuildMethods] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhSahCostModels()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+    BVH& sim_bvh = *g_coll_world->pImpl->bvh;
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhSahCostModels] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+    constexpr size_t NUM_LEAVES_PER_TYPE = 500; // Leaves whose trace durations are measured
+    constexpr size_t NUM_TRACES_PER_LEAF = 20;
+
+    std::vector<SweptTrace::Info> trace_infos = GetRecordedOrGeneratedHullTraces(gen, sim_bvh);
+
+    // ---- Part 1: Measured vs. estimated trace cost of each leaf type
+
+    // Cost units of all leaf types should take roughly the same time. If they
+    // don't, GetSweptTraceCost_*() estimates need to be adjusted.
+    const char* leaf_type_names[BVH::Leaf::Type::COUNT] = {
+        "Brush       ", "Displacement", "StaticProp  ", "DynamicProp ", "FuncBrush   "
+    };
+    const Vector3 hull_extents = { 16.0f, 16.0f, 36.0f }; // Traced hull's half extents
+    std::uniform_real_distribution<float> trace_len_dis(0.01f, 95.0f);
+    for (int type = 0; type < BVH::Leaf::Type::COUNT; type++) {
+        std::vector<size_t> leaf_indices;
+        for (size_t i = 1; i < sim_bvh.leaves.size(); i++)
+            if (sim_bvh.leaves[i].type == type)
+                leaf_indices.push_back(i);
+        std::shuffle(leaf_indices.begin(), leaf_indices.end(), gen);
+        if (leaf_indices.size() > NUM_LEAVES_PER_TYPE)
+            leaf_indices.resize(NUM_LEAVES_PER_TYPE);
+
+        uint64_t estimated_cost_sum = 0;
+        unsigned long long duration_sum_ns = 0;
+        size_t num_leaf_traces = 0;
+        std::vector<SweptTrace> leaf_traces;
+        // Per leaf: estimated cost and measured mean trace duration
+        std::vector<std::pair<float, float>> leaf_cost_samples;
+        for (size_t leaf_idx : leaf_indices) {
+            const BVH::Leaf& leaf = sim_bvh.leaves[leaf_idx];
+
+            // Generate traces that hit the leaf's AABB
+            leaf_traces.clear();
+            for (size_t attempt = 0; attempt < 50 * NUM_TRACES_PER_LEAF
+                && leaf_traces.size() < NUM_TRACES_PER_LEAF; attempt++)
+            {
+                float trace_len = trace_len_dis(gen);
+                Vector3 trace_start;
+                for (int axis = 0; axis < 3; axis++) {
+                    std::uniform_real_distribution<float> distr(
+                        leaf.mins[axis] - hull_extents[axis] - trace_len,
+                        leaf.maxs[axis] + hull_extents[axis] + trace_len);
+                    trace_start[axis] = distr(gen);
+                }
+                SweptTrace tr{ trace_start, trace_start + trace_len * GenRandomDir(gen),
+                    -hull_extents, +hull_extents };
+                if (IsAabbHitByFullSweptTrace(tr.info.startpos, tr.info.invdelta,
+                                              tr.info.extents, leaf.mins, leaf.maxs))
+                    leaf_traces.push_back(tr);
+            }
+
+            // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+            auto start = std::chrono::high_resolution_clock::now();
+            for (SweptTrace& trace : leaf_traces)
+                sim_bvh.DoSweptTraceAgainstLeaf(&trace, leaf, *g_coll_world);
+            auto end = std::chrono::high_resolution_clock::now();
+            unsigned long long leaf_duration_ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            duration_sum_ns += leaf_duration_ns;
+
+            uint64_t leaf_cost = BVH::GetSweptLeafTraceCost(leaf, *g_coll_world);
+            estimated_cost_sum += leaf_traces.size() * leaf_cost;
+            num_leaf_traces += leaf_traces.size();
+            if (!leaf_traces.empty())
+                leaf_cost_samples.emplace_back((float)leaf_cost,
+                    (float)leaf_duration_ns / (float)leaf_traces.size());
+        }
+        if (num_leaf_traces == 0)
+            continue;
+
+        float mean_duration_ns = (float)duration_sum_ns / (float)num_leaf_traces;
+        float mean_estimated_cost = (float)estimated_cost_sum / (float)num_leaf_traces;
+        Debug{} << leaf_type_names[type] << "| mean leaf trace:" << GetDurationStr(mean_duration_ns)
+            << "| mean estimated cost:" << mean_estimated_cost
+            << "| per cost unit:" << GetDurationStr(mean_duration_ns / mean_estimated_cost);
+
+        // Least-squares fit of: duration = fixed_ns + estimated cost * unit_ns
+        // If the estimates are right, unit_ns is the same for all leaf types
+        // and fixed_ns is close to zero. Otherwise, fixed_ns / unit_ns is the
+        // amount of cost units that GetSweptTraceCost_*() should add or
+        // subtract, and the ratio of unit_ns between leaf types is the factor
+        // that its cost should be scaled by.
+        double n = (double)leaf_cost_samples.size();
+        double sum_x = 0.0, sum_y = 0.0, sum_xx = 0.0, sum_xy = 0.0;
+        for (const auto& [cost, duration_ns] : leaf_cost_samples) {
+            sum_x  += cost;
+            sum_y  += duration_ns;
+            sum_xx += (double)cost * cost;
+            sum_xy += (double)cost * duration_ns;
+        }
+        double denom = n * sum_xx - sum_x * sum_x;
+        if (denom == 0.0) { // All sampled leaves have the same estimated cost
+            Debug{} << leaf_type_names[type] << "| cost fit: not possible, all"
+                " sampled leaves have the same estimated cost";
+            continue;
+        }
+        float unit_ns  = (float)((n * sum_xy - sum_x * sum_y) / denom);
+        float fixed_ns = (float)((sum_y - unit_ns * sum_x) / n);
+        Debug{} << leaf_type_names[type] << "| cost fit:" << GetDurationStr(fixed_ns)
+            << "+ cost *" << GetDurationStr(unit_ns)
+            << "| fixed part in cost units:" << fixed_ns / unit_ns;
+    }
+
+    // ---- Part 2: A/B comparison of SAH cost models
+
+    // Correct results are determined by the BVH that's used by the simulation
+    std::vector<SweptTrace::Results> correct_results =
+        ComputeReferenceResults(trace_infos);
+
+    struct CostModel {
+        const char* name;
+        bool sah_bloat_by_player_hull;
+        bool sah_use_leaf_trace_costs;
+    };
+    const CostModel cost_models[] = {
+        { "Plain AABBs,  equal leaf costs    ", false, false },
+        { "Plain AABBs,  estimated leaf costs", false, true  },
+        { "Hull-bloated, equal leaf costs    ", true,  false },
+        { "Hull-bloated, estimated leaf costs", true,  true  },
+    };
+
+    float method_0_trace_duration_ns = 0.0f;
+    for (size_t method_idx = 0; method_idx < std::size(cost_models); method_idx++) {
+        const CostModel& cost_model = cost_models[method_idx];
+        BVH::BuildOptions options = sim_bvh.build_options;
+        options.sah_bloat_by_player_hull = cost_model.sah_bloat_by_player_hull;
+        options.sah_use_leaf_trace_costs = cost_model.sah_use_leaf_trace_costs;
+        BVH bvh{ *g_coll_world, options };
+        if (!bvh.WasConstructedSuccessfully()) {
+            Debug{} << "Method" << method_idx << "failed to build BVH, skipping";
+            continue;
+        }
+
+        // Count visited nodes and validate results
+        BVH::TraversalStats stats;
+        size_t num_incorrect = CountIncorrectResults(trace_infos, correct_results,
+            [&](SweptTrace* trace) {
+                if      (!bvh.qnodes4.empty()) bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.qnodes4, &stats);
+                else if (!bvh.nodes4 .empty()) bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.nodes4,  &stats);
+                else                           bvh.DoSweptTrace(trace, *g_coll_world);
+            });
+
+        float mean_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(bvh, trace_infos, NUM_ITERATIONS);
+        if (method_idx == 0)
+            method_0_trace_duration_ns = mean_trace_duration_ns;
+
+        Debug{} << "Method" << method_idx << cost_model.name
+            << "| mean trace:" << GetDurationStr(mean_trace_duration_ns)
+            << GetPercentStr(mean_trace_duration_ns / method_0_trace_duration_ns - 1.0f, true)
+            << "| mean visited nodes:" << (float)stats.visited_nodes / (float)trace_infos.size()
+            << ", leaves:" << (float)stats.visited_leaves / (float)trace_infos.size();
+        if (num_incorrect != 0)
+            Debug{} << Debug::color(Debug::Color::Red) << "Method" << method_idx
+                << "produced incorrect trace results!" << num_incorrect << "/" << trace_infos.size();
+    }
+    Debug{} << "[Benchmark::BvhSahCostModels] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhBatchedTraces()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhBatchedTraces] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+
+    std::vector<SweptTrace::Info> trace_infos = GetRecordedOrGeneratedHullTraces(gen, bvh);
+
+    // Validate results of batched traces against single traces
+    std::vector<SweptTrace::Results> correct_results =
+        ComputeReferenceResults(trace_infos);
+    std::vector<SweptTrace> batched_traces(trace_infos.begin(), trace_infos.end());
+    bvh.DoSweptTraces(std::span<SweptTrace>(batched_traces), *g_coll_world);
+    size_t num_incorrect = 0;
+    for (size_t i = 0; i < trace_infos.size(); i++)
+        if (!CompareTraceResults(trace_infos[i], correct_results[i], batched_traces[i].results))
+            num_incorrect++;
+
+    // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+    float single_trace_duration_ns =
+        MeasureMeanBvhTraceDuration(bvh, trace_infos, NUM_ITERATIONS);
+
+    unsigned long long batched_duration_sum_ns = 0;
+    for (size_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        // Precreate traces with info and empty results
+        std::vector<SweptTrace> iter_traces(trace_infos.begin(), trace_infos.end());
+
+        // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+        auto iter_start = std::chrono::high_resolution_clock::now();
+        bvh.DoSweptTraces(std::span<SweptTrace>(iter_traces), *g_coll_world);
+        auto iter_end = std::chrono::high_resolution_clock::now();
+        batched_duration_sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(iter_end - iter_start).count();
+    }
+    float batched_trace_duration_ns =
+        (float)batched_duration_sum_ns / (float)(NUM_ITERATIONS * trace_infos.size());
+
+    Debug{} << "Single  traces | mean trace:" << GetDurationStr(single_trace_duration_ns);
+    Debug{} << "Batched traces | mean trace:" << GetDurationStr(batched_trace_duration_ns)
+        << GetPercentStr(batched_trace_duration_ns / single_trace_duration_ns - 1.0f, true);
+    if (num_incorrect != 0)
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "Batched traces produced incorrect trace results!" << num_incorrect << "/" << trace_infos.size();
+    Debug{} << "[Benchmark::BvhBatchedTraces] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhAnyHitTraces()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhAnyHitTraces] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+    constexpr float LONG_TRACE_SCALE = 20.0f; // Length multiplier of long traces
+
+    std::vector<SweptTrace::Info> short_trace_infos = GetRecordedOrGeneratedHullTraces(gen, bvh);
+
+    // Occlusion queries like line-of-sight checks usually sweep much further
+    // than player movement does, so also test longer versions of the traces
+    std::vector<SweptTrace::Info> long_trace_infos;
+    long_trace_infos.reserve(short_trace_infos.size());
+    for (const SweptTrace::Info& info : short_trace_infos) {
+        Vector3 start = info.startpos + info.startoffset;
+        Vector3 end   = start + LONG_TRACE_SCALE * info.delta;
+        Vector3 hull_mins = -info.startoffset - info.extents;
+        Vector3 hull_maxs = -info.startoffset + info.extents;
+        SweptTrace long_trace{ start, end, hull_mins, hull_maxs, info.contents_mask };
+        long_trace_infos.push_back(long_trace.info);
+    }
+
+    for (bool is_long : { false, true }) {
+        const std::vector<SweptTrace::Info>& trace_infos =
+            is_long ? long_trace_infos : short_trace_infos;
+        const char* name = is_long ? "Long  traces" : "Short traces";
+
+        // Any-hit traces must hit something exactly when closest-hit traces do
+        size_t num_hits = 0;
+        size_t num_incorrect = 0;
+        for (const SweptTrace::Info& trace_info : trace_infos) {
+            SweptTrace closest_trace{ trace_info };
+            SweptTrace any_trace    { trace_info };
+            bvh.DoSweptTrace      (&closest_trace, *g_coll_world);
+            bvh.DoSweptTraceAnyHit(&any_trace,     *g_coll_world);
+            if (closest_trace.results.DidHit())
+                num_hits++;
+            if (closest_trace.results.DidHit() != any_trace.results.DidHit())
+                num_incorrect++;
+        }
+
+        // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+        float closest_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(bvh, trace_infos, NUM_ITERATIONS);
+
+        float any_trace_duration_ns = MeasureMeanBvhTraceDuration(trace_infos, NUM_ITERATIONS,
+            [&](SweptTrace* trace) { bvh.DoSweptTraceAnyHit(trace, *g_coll_world); });
+
+        Debug{} << name << "| hit:" << GetPercentStr((float)num_hits / (float)trace_infos.size())
+            << "| closest-hit mean trace:" << GetDurationStr(closest_trace_duration_ns)
+            << "| any-hit mean trace:" << GetDurationStr(any_trace_duration_ns)
+            << GetPercentStr(any_trace_duration_ns / closest_trace_duration_ns - 1.0f, true)
+            << "| throughput:" << closest_trace_duration_ns / any_trace_duration_ns << "x";
+        if (num_incorrect != 0)
+            Debug{} << Debug::color(Debug::Color::Red) << name
+                << "| any-hit traces disagreed on whether something was hit!"
+                << num_incorrect << "/" << trace_infos.size();
+    }
+    Debug{} << "[Benchmark::BvhAnyHitTraces] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhRayTraces()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (bvh.qnodes4.empty() && bvh.nodes4.empty()) {
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "[Benchmark::BvhRayTraces] BVH has no 4-ary nodes, aborting";
+        return;
+    }
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhRayTraces] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+
+    std::vector<SweptTrace::Info> hull_trace_infos = GetRecordedOrGeneratedHullTraces(gen, bvh);
+
+    // Ray versions of the hull traces, swept from the hull's center
+    std::vector<SweptTrace::Info> ray_trace_infos;
+    ray_trace_infos.reserve(hull_trace_infos.size());
+    for (const SweptTrace::Info& info : hull_trace_infos) {
+        SweptTrace ray_trace{ info.startpos, info.startpos + info.delta,
+                              info.contents_mask };
+        ray_trace_infos.push_back(ray_trace.info);
+    }
+
+    // The ray-specialized traversal must produce identical results to the
+    // generic traversal
+    auto DoGenericRayTrace = [&](SweptTrace* trace) {
+        if (!bvh.qnodes4.empty()) bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.qnodes4, nullptr);
+        else                      bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.nodes4,  nullptr);
+    };
+    size_t num_discrepancies = CountIncorrectResults(ray_trace_infos,
+        ComputeReferenceResults(ray_trace_infos), DoGenericRayTrace);
+
+    // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+    float hull_trace_duration_ns =
+        MeasureMeanBvhTraceDuration(bvh, hull_trace_infos, NUM_ITERATIONS);
+    float ray_trace_duration_ns =
+        MeasureMeanBvhTraceDuration(bvh, ray_trace_infos, NUM_ITERATIONS);
+
+    float generic_ray_trace_duration_ns =
+        MeasureMeanBvhTraceDuration(ray_trace_infos, NUM_ITERATIONS, DoGenericRayTrace);
+
+    Debug{} << "Hull traces            | mean trace:" << GetDurationStr(hull_trace_duration_ns);
+    Debug{} << "Rays, generic kernel   | mean trace:" << GetDurationStr(generic_ray_trace_duration_ns)
+        << GetPercentStr(generic_ray_trace_duration_ns / hull_trace_duration_ns - 1.0f, true);
+    Debug{} << "Rays, ray kernel       | mean trace:" << GetDurationStr(ray_trace_duration_ns)
+        << GetPercentStr(ray_trace_duration_ns / hull_trace_duration_ns - 1.0f, true)
+        << "| vs generic kernel:"
+        << GetPercentStr(ray_trace_duration_ns / generic_ray_trace_duration_ns - 1.0f, true);
+    if (num_discrepancies != 0)
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "Ray kernel results differed from generic kernel results!"
+            << num_discrepancies << "/" << ray_trace_infos.size();
+    Debug{} << "[Benchmark::BvhRayTraces] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::BvhHullShapeKernels()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+    BVH& bvh = *g_coll_world->pImpl->bvh;
+    if (bvh.qnodes4.empty() && bvh.nodes4.empty()) {
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "[Benchmark::BvhHullShapeKernels] BVH has no 4-ary nodes, aborting";
+        return;
+    }
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::BvhHullShapeKernels] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_ITERATIONS = 10; // How often all traces are repeated per method
+
+    std::vector<SweptTrace::Info> base_trace_infos = GetRecordedOrGeneratedHullTraces(gen, bvh);
+
+    // Every hull type sweeps along the same paths, only their extents differ
+    struct HullType {
+        const char* name;
+        Vector3 extents;
+    };
+    const SweptTrace::Info dummy_info{};
+    const HullType HULL_TYPES[] = {
+        { "Standing hull", StandingHullShape::GetExtents(dummy_info) },
+        { "Ducked hull  ", DuckedHullShape  ::GetExtents(dummy_info) },
+        { "Quadrant hull", QuadrantHullShape::GetExtents(dummy_info) },
+        { "Other hull   ", { 10.0f, 10.0f, 20.0f } }, // Uses RuntimeShape
+    };
+
+    auto DoGenericTrace = [&](SweptTrace* trace) {
+        if (!bvh.qnodes4.empty()) bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.qnodes4, nullptr);
+        else                      bvh.DoSweptTrace_Nodes4(trace, *g_coll_world, bvh.nodes4,  nullptr);
+    };
+
+    for (const HullType& hull_type : HULL_TYPES) {
+        std::vector<SweptTrace::Info> trace_infos = base_trace_infos;
+        for (SweptTrace::Info& info : trace_infos) {
+            info.extents = hull_type.extents;
+            info.isray   = false;
+        }
+
+        // Shape-specialized kernels must produce identical results to the
+        // generic kernels
+        size_t num_discrepancies = CountIncorrectResults(trace_infos,
+            ComputeReferenceResults(trace_infos), DoGenericTrace);
+
+        // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+        float special_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(bvh, trace_infos, NUM_ITERATIONS);
+
+        float generic_trace_duration_ns =
+            MeasureMeanBvhTraceDuration(trace_infos, NUM_ITERATIONS, DoGenericTrace);
+
+        Debug{} << hull_type.name
+            << "| generic kernel mean trace:" << GetDurationStr(generic_trace_duration_ns)
+            << "| specialized kernel mean trace:" << GetDurationStr(special_trace_duration_ns)
+            << GetPercentStr(special_trace_duration_ns / generic_trace_duration_ns - 1.0f, true);
+        if (num_discrepancies != 0)
+            Debug{} << Debug::color(Debug::Color::Red) << hull_type.name
+                << "| specialized kernel results differed from generic kernel results!"
+                << num_discrepancies << "/" << trace_infos.size();
+    }
+    Debug{} << "[Benchmark::BvhHullShapeKernels] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::DispCollTreeTraversal()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->hull_disp_coll_trees) {
+        assert(false);
+        return;
+    }
+    std::vector<CDispCollTree>& disp_trees = *g_coll_world->pImpl->hull_disp_coll_trees;
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::DispCollTreeTraversal] Used seed:" << seed; // To let user reproduce this benchmark
+    std::mt19937 gen{seed};
+
+    constexpr size_t NUM_TRACES = 20000; // Per displacement power
+    constexpr size_t NUM_ITERATIONS = 50; // How often all traces are repeated per method
+    const Vector3 trace_extents = {16.0f, 16.0f, 36.0f}; // Traced hull's half extents
+
+    for (int power : { 3, 4 }) {
+        std::vector<size_t> power_disp_indices;
+        for (size_t i = 0; i < disp_trees.size(); i++)
+            if (disp_trees[i].GetWidth() == (1 << power) + 1)
+                power_disp_indices.push_back(i);
+
+        if (power_disp_indices.empty()) {
+            Debug{} << Debug::color(Debug::Color::Yellow)
+                << "Map has no displacements of power" << power << Debug::nospace << ", skipping them";
+            continue;
+        }
+
+        // Generate traces that hit the bounds of random displacements
+        std::vector<size_t> trace_disp_indices;
+        std::vector<SweptTrace::Info> trace_infos;
+        trace_disp_indices.reserve(NUM_TRACES);
+        trace_infos.reserve(NUM_TRACES);
+        std::uniform_int_distribution<size_t> disp_dis(0, power_disp_indices.size() - 1);
+        std::uniform_real_distribution<float> trace_len_dis(0.01f, 95.0f);
+        while (trace_infos.size() < NUM_TRACES) {
+            size_t disp_idx = power_disp_indices[disp_dis(gen)];
+            const CDispCollTree& disp = disp_trees[disp_idx];
+
+            float trace_len = trace_len_dis(gen);
+            Vector3 trace_delta = trace_len * GenRandomDir(gen);
+            Vector3 trace_start;
+            for (int axis = 0; axis < 3; axis++) {
+                std::uniform_real_distribution<float> distr(
+                    disp.m_mins[axis] - trace_extents[axis] - trace_len,
+                    disp.m_maxs[axis] + trace_extents[axis] + trace_len);
+                trace_start[axis] = distr(gen);
+            }
+            SweptTrace tr{ trace_start, trace_start + trace_delta, -trace_extents, +trace_extents };
+            if (!IsAabbHitByFullSweptTrace(tr.info.startpos, tr.info.invdelta,
+                                           tr.info.extents, disp.m_mins, disp.m_maxs))
+                continue;
+
+            trace_disp_indices.push_back(disp_idx);
+            trace_infos.push_back(tr.info);
+        }
+
+        // Validate that both traversals visit identical nodes
+        size_t num_incorrect = 0;
+        for (size_t i = 0; i < trace_infos.size(); i++) {
+            rayleaflist_t list_ref, list_simd;
+            CDispCollTree& disp = disp_trees[trace_disp_indices[i]];
+            int leaf_idx_ref  = disp.Benchmark_BuildRayLeafList(trace_infos[i], list_ref,  false);
+            int leaf_idx_simd = disp.Benchmark_BuildRayLeafList(trace_infos[i], list_simd, true);
+            if (leaf_idx_ref != leaf_idx_simd || list_ref.maxIndex != list_simd.maxIndex
+                || !std::equal(list_ref.nodeList, list_ref.nodeList + list_ref.maxIndex + 1,
+                               list_simd.nodeList))
+                num_incorrect++;
+        }
+
+        // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+        float duration_ns[2]; // Indexed by use_simd
+        size_t leaf_count_sum = 0; // Used so the compiler can't discard traversals
+        for (bool use_simd : { false, true }) {
+            rayleaflist_t list;
+            // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+            auto start = std::chrono::high_resolution_clock::now();
+            for (size_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+                for (size_t i = 0; i < trace_infos.size(); i++) {
+                    CDispCollTree& disp = disp_trees[trace_disp_indices[i]];
+                    int leaf_idx = disp.Benchmark_BuildRayLeafList(trace_infos[i], list, use_simd);
+                    leaf_count_sum += list.maxIndex + 1 - leaf_idx;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            unsigned long long duration_sum_ns =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            duration_ns[use_simd] =
+                (float)duration_sum_ns / (float)(NUM_ITERATIONS * trace_infos.size());
+        }
+
+        Debug{} << "Power" << power << "displacements:" << power_disp_indices.size()
+            << "| mean leaves hit per trace:"
+            << (float)leaf_count_sum / (float)(2 * NUM_ITERATIONS * trace_infos.size());
+        Debug{} << "  Scalar traversal | mean trace:" << GetDurationStr(duration_ns[0]);
+        Debug{} << "  SIMD   traversal | mean trace:" << GetDurationStr(duration_ns[1])
+            << GetPercentStr(duration_ns[1] / duration_ns[0] - 1.0f, true);
+        if (num_incorrect != 0)
+            Debug{} << Debug::color(Debug::Color::Red)
+                << "SIMD traversal visited different nodes!" << num_incorrect << "/" << trace_infos.size();
+    }
+    Debug{} << "[Benchmark::DispCollTreeTraversal] Used seed:" << seed; // To let user reproduce this benchmark
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::DispCollCacheCreation()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->hull_disp_coll_trees) {
+        assert(false);
+        return;
+    }
+    std::vector<CDispCollTree>& disp_trees = *g_coll_world->pImpl->hull_disp_coll_trees;
+    if (disp_trees.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow) << "Map has no displacements";
+        return;
+    }
+
+    constexpr size_t NUM_ITERATIONS = 20; // How often all caches are recreated
+
+    // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+    std::vector<unsigned long long> iter_durations;
+    for (size_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        for (CDispCollTree& disp : disp_trees)
+            disp.Uncache();
+
+        // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+        auto iter_start = std::chrono::high_resolution_clock::now();
+        for (CDispCollTree& disp : disp_trees)
+            disp.EnsureCacheIsCreated();
+        auto iter_end = std::chrono::high_resolution_clock::now();
+        iter_durations.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(iter_end - iter_start).count());
+    }
+
+    size_t total_tri_cnt = 0;
+    size_t total_cache_size = 0;
+    for (const CDispCollTree& disp : disp_trees) {
+        total_tri_cnt += disp.GetTriSize();
+        total_cache_size += disp.GetCacheMemorySize();
+    }
+
+    BenchmarkStatistics stats = CalcDurationStats(iter_durations);
+    Debug{} << "Created caches of" << disp_trees.size() << "displacements with"
+        << total_tri_cnt << "triangles, taking up" << total_cache_size << "bytes";
+    Debug{} << "All displacements | mean:" << GetDurationStr(stats.mean)
+        << "| median:" << GetDurationStr((float)stats.median)
+        << "| 5th percentile:" << GetDurationStr((float)stats._5th_percentile)
+        << "| 95th percentile:" << GetDurationStr((float)stats._95th_percentile);
+    Debug{} << "Per displacement  | mean:" << GetDurationStr(stats.mean / (float)disp_trees.size());
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::ReplayTraceCorpus(const std::string& file_path)
+{
+    if (!g_coll_world || !g_coll_world->pImpl->bvh) {
+        assert(false);
+        return;
+    }
+
+    TraceRecorder::Corpus corpus;
+    if (!TraceRecorder::ReadCorpus(file_path, &corpus))
+        return;
+
+    TraceRecorder::MapIdentity loaded_map =
+        TraceRecorder::GetMapIdentity(*g_coll_world->pImpl->origin_bsp_map);
+    if (corpus.map != loaded_map) {
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "[Benchmark::ReplayTraceCorpus] Corpus was recorded on map"
+            << corpus.map.name << "with revision" << corpus.map.map_revision
+            << "but the loaded map is" << loaded_map.name << "with revision"
+            << loaded_map.map_revision << Debug::nospace << ", aborting";
+        return;
+    }
+    if (corpus.traces.empty()) {
+        Debug{} << Debug::color(Debug::Color::Yellow)
+            << "[Benchmark::ReplayTraceCorpus] Corpus has no traces";
+        return;
+    }
+
+    size_t num_candidate_traces = 0;
+    for (const TraceRecorder::Record& record : corpus.traces)
+        if (record.used_candidates)
+            num_candidate_traces++;
+
+    Debug{} << "Replaying" << corpus.traces.size() << "traces recorded on map"
+        << corpus.map.name << "with revision" << corpus.map.map_revision
+        << Debug::nospace << "," << num_candidate_traces << "of them against"
+        << "gathered candidates," << corpus.object_state_changes.size()
+        << "object state changes";
+
+    // Don't record the replayed traces and object state changes, and restore
+    // the enabled objects afterwards
+    TraceRecorder& trace_recorder = g_coll_world->pImpl->trace_recorder;
+    trace_recorder.SetPaused(true);
+    std::vector<DynamicBVH::ObjectState> prev_object_states;
+    if (g_coll_world->pImpl->dynamic_bvh)
+        prev_object_states = g_coll_world->pImpl->dynamic_bvh->GetObjectStates();
+
+    auto ApplyObjectState = [](const DynamicBVH::ObjectState& state) {
+        switch (state.type) {
+        case DynamicBVH::ObjectType::FuncBrush:
+            g_coll_world->SetFuncBrushEnabled(state.object_idx, state.enabled);
+            break;
+        case DynamicBVH::ObjectType::DynamicProp:
+            g_coll_world->SetDynamicPropEnabled(state.object_idx, state.enabled);
+            break;
+        }
+    };
+
+    // Candidates are only gathered again when the recorded region changes.
+    // Gathering isn't part of the measured trace durations.
+    TraceQueryContext context;
+    Vector3 gathered_region_mins;
+    Vector3 gathered_region_maxs;
+    auto IsGatheredRegion = [&](const TraceRecorder::Record& record) {
+        // Exact comparison, Magnum's Vector3 comparison is fuzzy
+        for (size_t axis = 0; axis < 3; axis++) {
+            if (record.candidate_region_mins[axis] != gathered_region_mins[axis]) return false;
+            if (record.candidate_region_maxs[axis] != gathered_region_maxs[axis]) return false;
+        }
+        return context.IsGathered();
+    };
+
+    // Replays all traces in recording order, with the recorded object state
+    // changes in between. Calls on_trace_done(record, trace, duration_ns)
+    // after each trace.
+    auto ReplayCorpus = [&](auto&& on_trace_done) {
+        size_t next_change_idx = 0;
+        for (size_t i = 0; i < corpus.traces.size(); i++) {
+            while (next_change_idx < corpus.object_state_changes.size()
+                && corpus.object_state_changes[next_change_idx].next_trace_idx <= i) {
+                ApplyObjectState(corpus.object_state_changes[next_change_idx].state);
+                next_change_idx++;
+            }
+
+            const TraceRecorder::Record& record = corpus.traces[i];
+            if (record.used_candidates && !IsGatheredRegion(record)) {
+                g_coll_world->GatherTraceCandidates(record.candidate_region_mins,
+                    record.candidate_region_maxs, &context);
+                gathered_region_mins = record.candidate_region_mins;
+                gathered_region_maxs = record.candidate_region_maxs;
+            }
+
+            SweptTrace trace{ record.info };
+            // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+            auto trace_start = std::chrono::high_resolution_clock::now();
+            if (record.used_candidates) g_coll_world->DoSweptTrace(&trace, &context);
+            else                        g_coll_world->DoSweptTrace(&trace);
+            auto trace_end = std::chrono::high_resolution_clock::now();
+            on_trace_done(record, trace,
+                std::chrono::duration_cast<std::chrono::nanoseconds>(trace_end - trace_start).count());
+        }
+    };
+
+    constexpr size_t NUM_ITERATIONS = 5; // How often all traces are repeated
+
+    // Results must be bit-identical to the recorded results, not just close
+    auto AreBitIdentical = [](float a, float b) {
+        return std::memcmp(&a, &b, sizeof(float)) == 0;
+    };
+    size_t num_mismatches = 0;
+    ReplayCorpus([&](const TraceRecorder::Record& record,
+                     const SweptTrace& trace, unsigned long long) {
+        const SweptTrace::Results& expected = record.results;
+        const SweptTrace::Results& actual   = trace.results;
+        if (AreBitIdentical(expected.fraction,         actual.fraction)
+            && AreBitIdentical(expected.plane_normal.x(), actual.plane_normal.x())
+            && AreBitIdentical(expected.plane_normal.y(), actual.plane_normal.y())
+            && AreBitIdentical(expected.plane_normal.z(), actual.plane_normal.z())
+            && expected.surface    == actual.surface
+            && expected.startsolid == actual.startsolid
+            && expected.allsolid   == actual.allsolid)
+            return;
+
+        constexpr size_t MAX_PRINTED_MISMATCHES = 10;
+        if (num_mismatches < MAX_PRINTED_MISMATCHES) {
+            Debug{} << Debug::color(Debug::Color::Red) << "Mismatch:"
+                << "startpos =" << record.info.startpos
+                << "delta =" << record.info.delta
+                << "extents =" << record.info.extents
+                << "isray =" << record.info.isray
+                << "used_candidates =" << record.used_candidates;
+            Debug{} << Debug::color(Debug::Color::Red) << "  recorded: fraction ="
+                << expected.fraction << "normal =" << expected.plane_normal
+                << "surface =" << expected.surface << "startsolid ="
+                << expected.startsolid << "allsolid =" << expected.allsolid;
+            Debug{} << Debug::color(Debug::Color::Red) << "  replayed: fraction ="
+                << actual.fraction << "normal =" << actual.plane_normal
+                << "surface =" << actual.surface << "startsolid ="
+                << actual.startsolid << "allsolid =" << actual.allsolid;
+        }
+        num_mismatches++;
+    });
+
+    // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+    // Each trace is timed individually to get the distribution of trace
+    // durations. Durations include the clock's overhead.
+    std::vector<unsigned long long> trace_durations;
+    trace_durations.reserve(NUM_ITERATIONS * corpus.traces.size());
+    for (size_t iter = 0; iter < NUM_ITERATIONS; iter++) {
+        ReplayCorpus([&](const TraceRecorder::Record&, const SweptTrace&,
+                         unsigned long long duration_ns) {
+            trace_durations.push_back(duration_ns);
+        });
+    }
+
+    for (const DynamicBVH::ObjectState& state : prev_object_states)
+        ApplyObjectState(state);
+    trace_recorder.SetPaused(false);
+
+    BenchmarkStatistics stats = CalcDurationStats(trace_durations);
+    Debug{} << "Per trace | mean:" << GetDurationStr(stats.mean)
+        << "| median:" << GetDurationStr((float)stats.median)
+        << "| 5th percentile:" << GetDurationStr((float)stats._5th_percentile)
+        << "| 95th percentile:" << GetDurationStr((float)stats._95th_percentile)
+        << "| min:" << GetDurationStr((float)stats.min)
+        << "| max:" << GetDurationStr((float)stats.max);
+    if (num_mismatches == 0)
+        Debug{} << Debug::color(Debug::Color::Green)
+            << "All replayed results are bit-identical to the recorded results";
+    else
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "Replayed results differed from recorded results!"
+            << num_mismatches << "/" << corpus.traces.size();
+
+    // Give user a reminder
+    Debug{} << Debug::color(Debug::Color::Yellow) <<
+        "If you're doing micro benchmarks, make sure you closed as many other "
+        "desktop apps as possible and increased benchmark iterations to minimize"
+        " timing errors!";
+}
+
+void Benchmark::FuncBrushToggling()
+{
+    if (!g_coll_world || !g_coll_world->pImpl->dynamic_bvh) {
+        assert(false);
+        return;
+    }
+
+    unsigned int seed = std::random_device{}();
+    Debug{} << "[Benchmark::FuncBrushToggling] Used seed:" << seed; // To let user reproduce this check
+    std::mt19937 gen{seed};
+
+    // Don't record the toggles and traces, and restore the enabled objects
+    // afterwards
+    TraceRecorder& trace_recorder = g_coll_world->pImpl->trace_recorder;
+    trace_recorder.SetPaused(true);
+    std::vector<DynamicBVH::ObjectState> prev_object_states =
+        g_coll_world->pImpl->dynamic_bvh->GetObjectStates();
+
+    const BspMap& bsp_map = *g_coll_world->pImpl->origin_bsp_map;
+    constexpr size_t MAX_RAYS_PER_FUNC_BRUSH = 100;
+    size_t num_checked = 0;
+    size_t num_skipped = 0; // func_brush entities no ray hit before anything else
+    size_t num_failed  = 0;
+    for (const DynamicBVH::ObjectState& state : prev_object_states) {
+        if (state.type != DynamicBVH::ObjectType::FuncBrush || !state.enabled)
+            continue;
+
+        Vector3 mins, maxs;
+        if (!CalcAabb_FuncBrush(state.object_idx, bsp_map, &mins, &maxs))
+            continue;
+        Vector3 center = 0.5f * (mins + maxs);
+        float ray_len = (maxs - mins).length() + 16.0f;
+        ContentsMask contents = GetContents_FuncBrush(state.object_idx, bsp_map);
+
+        // Find a ray from outside the func_brush's AABB towards its center
+        // that hits the func_brush before anything else
+        std::optional<SweptTrace> hitting_ray;
+        for (size_t i = 0; i < MAX_RAYS_PER_FUNC_BRUSH; i++) {
+            Vector3 ray_start = center + ray_len * GenRandomDir(gen);
+            SweptTrace fb_ray{ ray_start, center, contents };
+            g_coll_world->DoSweptTrace_FuncBrush(&fb_ray, state.object_idx);
+            if (fb_ray.results.fraction >= 1.0f || fb_ray.results.startsolid)
+                continue;
+
+            SweptTrace world_ray{ ray_start, center, contents };
+            g_coll_world->DoSweptTrace(&world_ray);
+            if (world_ray.results.fraction != fb_ray.results.fraction)
+                continue; // Something else was hit first
+
+            hitting_ray.emplace(world_ray);
+            break;
+        }
+        if (!hitting_ray) {
+            num_skipped++;
+            continue;
+        }
+
+        SweptTrace disabled_ray{ hitting_ray->info };
+        g_coll_world->SetFuncBrushEnabled(state.object_idx, false);
+        g_coll_world->DoSweptTrace(&disabled_ray);
+
+        SweptTrace reenabled_ray{ hitting_ray->info };
+        g_coll_world->SetFuncBrushEnabled(state.object_idx, true);
+        g_coll_world->DoSweptTrace(&reenabled_ray);
+
+        num_checked++;
+        bool hit_while_disabled =
+            disabled_ray.results.fraction <= hitting_ray->results.fraction;
+        bool missed_after_reenabling =
+            reenabled_ray.results.fraction != hitting_ray->results.fraction;
+        if (!hit_while_disabled && !missed_after_reenabling)
+            continue;
+
+        num_failed++;
+        Debug{} << Debug::color(Debug::Color::Red) << "func_brush"
+            << state.object_idx << Debug::nospace << ": ray from"
+            << hitting_ray->info.startpos << "to" << center << "hit it at fraction"
+            << hitting_ray->results.fraction << Debug::nospace
+            << ", disabled fraction =" << disabled_ray.results.fraction
+            << Debug::nospace << ", re-enabled fraction ="
+            << reenabled_ray.results.fraction;
+    }
+
+    for (const DynamicBVH::ObjectState& state : prev_object_states)
+        if (state.type == DynamicBVH::ObjectType::FuncBrush)
+            g_coll_world->SetFuncBrushEnabled(state.object_idx, state.enabled);
+    trace_recorder.SetPaused(false);
+
+    Debug{} << "Checked" << num_checked << "enabled func_brush entities,"
+        << num_skipped << "skipped because no ray hit them before anything else";
+    if (num_failed == 0)
+        Debug{} << Debug::color(Debug::Color::Green)
+            << "All func_brush entities stopped being hit when disabled and"
+               " were hit again when re-enabled";
+    else
+        Debug{} << Debug::color(Debug::Color::Red)
+            << "Toggling func_brush entities didn't take effect!"
+            << num_failed << "/" << num_checked;
+}
+
+std::vector<SweptTrace::Info> Benchmark::GetRecordedTraces()
+{
+    if (!g_coll_world)
+        return {};
+    return g_coll_world->pImpl->trace_recorder.GetRecentTraces();
+}
+
+float Benchmark::MeasureMeanBvhTraceDuration(BVH& bvh,
+    const std::vector<SweptTrace::Info>& trace_infos, size_t num_iterations)
+{
+    return MeasureMeanBvhTraceDuration(trace_infos, num_iterations,
+        [&](SweptTrace* trace) { bvh.DoSweptTrace(trace, *g_coll_world); });
+}
+
+template<class Generator>
+std::vector<SweptTrace::Info> Benchmark::GetRecordedOrGeneratedHullTraces(
+    Generator& gen, const BVH& bvh)
+{
+    constexpr size_t MIN_RECORDED_TRACES = 10000;
+    constexpr size_t NUM_GENERATED_TRACES = 20000; // If not enough were recorded
+
+    std::vector<SweptTrace::Info> trace_infos = GetRecordedTraces();
+    if (trace_infos.size() >= MIN_RECORDED_TRACES) {
+        Debug{} << "Replaying" << trace_infos.size() << "recorded traces";
+        return trace_infos;
+    }
+    Debug{} << Debug::color(Debug::Color::Yellow) << "Only" << trace_infos.size()
+        << "traces were recorded, move around on the map to record more."
+        " Using generated traces instead.";
+    return GenHullTracesNearLeaves(gen, bvh, NUM_GENERATED_TRACES);
+}
+
+std::vector<SweptTrace::Results> Benchmark::ComputeReferenceResults(
+    const std::vector<SweptTrace::Info>& trace_infos)
+{
+    std::vector<SweptTrace::Results> results;
+    results.reserve(trace_infos.size());
+    for (const SweptTrace::Info& trace_info : trace_infos) {
+        SweptTrace trace{ trace_info };
+        g_coll_world->pImpl->bvh->DoSweptTrace(&trace, *g_coll_world);
+        results.push_back(trace.results);
+    }
+    return results;
+}
+
+template<class TraceFunc>
+size_t Benchmark::CountIncorrectResults(
+    const std::vector<SweptTrace::Info>& trace_infos,
+    const std::vector<SweptTrace::Results>& reference_results,
+    TraceFunc&& do_trace)
+{
+    size_t num_incorrect = 0;
+    for (size_t i = 0; i < trace_infos.size(); i++) {
+        SweptTrace trace{ trace_infos[i] };
+        do_trace(&trace);
+        if (!CompareTraceResults(trace.info, reference_results[i], trace.results))
+            num_incorrect++;
+    }
+    return num_incorrect;
+}
+
+template<class TraceFunc>
+float Benchmark::MeasureMeanBvhTraceDuration(
+    const std::vector<SweptTrace::Info>& trace_infos, size_t num_iterations,
+    TraceFunc&& do_trace)
+{
+    // Set up iterations
+    std::vector<SweptTrace> iter_traces;
+    iter_traces.reserve(trace_infos.size());
+
+    // Run iterations and measure CPU time precisely (Not wall time!) (If possible)
+#ifndef _WIN32
+#error [DZSimulator Benchmarking] This benchmark code was written only for Windows. To get precise benchmarks, you should use your OS's most precise CPU time methods in this place.
+#endif
+    unsigned long long duration_sum_ns = 0;
+    for (size_t iter = 0; iter < num_iterations; iter++) {
+        iter_traces.clear();
+        for (const SweptTrace::Info& trace_info : trace_infos) // Precreate traces with info and empty results
+            iter_traces.emplace_back(trace_info);
+
+        // On Windows, std::chrono::high_resolution_clock is the most precise clock, but sadly wall time.
+        auto iter_start = std::chrono::high_resolution_clock::now();
+        for (SweptTrace& trace : iter_traces)
+            do_trace(&trace);
+        auto iter_end = std::chrono::high_resolution_clock::now();
+        duration_sum_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(iter_end - iter_start).count();
+    }
+    return (float)duration_sum_ns / (float)(num_iterations * trace_infos.size());
+}
+
 // Format nanosecond duration. Examples: " 2.82s", "978.0ms", " 12.3µs", "811.9ns"
 // TODO This function should be useful elsewhere too, move it out of here.
 Containers::String Benchmark::GetDurationStr(float duration_ns) {
@@ -534,7 +1742,7 @@ std::vector<size_t> Benchmark::GetBvhLeafIndicesOfStaticPropsByTriCount(bool big
         const std::string& mdlpath =
             g_coll_world->pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
         const CollisionModel& collmodel =
-            g_coll_world->pImpl->sprop_coll_models->at(mdlpath);
+            g_coll_world->pImpl->xprop_coll_models->at(mdlpath);
 
         size_t num_tris = 0;
         for (const auto& section_tri_mesh : collmodel.section_tri_meshes)
@@ -620,6 +1828,48 @@ std::optional<SweptTrace> Benchmark::GenRealisticTrace(
     return tr;
 }
 
+template<class Generator>
+std::vector<SweptTrace::Info> Benchmark::GenHullTracesNearLeaves(
+    Generator& gen, const BVH& bvh, size_t count)
+{
+    std::vector<SweptTrace::Info> trace_infos;
+    if (bvh.leaves.size() < 2)
+        return trace_infos;
+    trace_infos.reserve(count);
+
+    const Vector3 trace_extents = {16.0f, 16.0f, 36.0f}; // Traced hull's half extents
+
+    std::uniform_int_distribution<size_t> leaf_idx_dis(1, bvh.leaves.size() - 1); // Skip dummy leaf
+    std::uniform_real_distribution<float> trace_len_dis(0.01f, 95.0f);
+    while (trace_infos.size() < count) {
+        const BVH::Leaf& leaf = bvh.leaves[leaf_idx_dis(gen)];
+        float trace_len = trace_len_dis(gen);
+        Vector3 trace_delta = trace_len * GenRandomDir(gen);
+
+        // Pick random start point in leaf's AABB, extended by the trace
+        Vector3 trace_start;
+        for (int axis = 0; axis < 3; axis++) {
+            std::uniform_real_distribution<float> distr(
+                leaf.mins[axis] - trace_extents[axis] - trace_len,
+                leaf.maxs[axis] + trace_extents[axis] + trace_len);
+            trace_start[axis] = distr(gen);
+        }
+
+        SweptTrace tr{trace_start, trace_start + trace_delta, -trace_extents, +trace_extents};
+        trace_infos.push_back(tr.info);
+    }
+    return trace_infos;
+}
+
+size_t Benchmark::GetBvhMemorySize(const BVH& bvh)
+{
+    return bvh.leaves    .capacity() * sizeof(BVH::Leaf)
+        +  bvh.nodes     .capacity() * sizeof(BVH::Node)
+        +  bvh.flat_nodes.capacity() * sizeof(BVH::FlatNode)
+        +  bvh.nodes4    .capacity() * sizeof(BVH::Node4)
+        +  bvh.qnodes4   .capacity() * sizeof(BVH::QNode4);
+}
+
 // Returns true if the results are (near) identical, false otherwise.
 bool Benchmark::CompareTraceResults(
     const SweptTrace::Info& trace_info,
@@ -7,6 +7,7 @@
 #if COLL_BENCHMARK_ENABLED
 
 #include <optional>
+#include <string>
 #include <vector>
 
 #include <Corrade/Containers/String.h>
@@ -30,6 +31,95 @@ public:
     // NOTE: Other threads shouldn't be running, they might mess up measurements.
     static void StaticPropBevelPlaneGen();
 
+    // Compare memory size and trace performance of the BVH's float and
+    // quantized 4-ary node formats. Builds both BVH versions from the
+    // currently loaded map.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhNodeFormats();
+
+    // Compare BVH build time against trace time of the available node split
+    // methods (exact and binned SAH, all axes or largest axis only). Builds
+    // BVHs from the currently loaded map.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhBuildMethods();
+
+    // Compare trace performance of BVHs built with different SAH cost models
+    // (plain or player hull bloated surface areas, equal or estimated leaf
+    // trace costs). Also measures actual trace durations of each leaf type to
+    // check the estimated leaf trace costs, and fits them to the estimates to
+    // calibrate GetSweptTraceCost_*(). Replays recorded traces if enough were
+    // recorded, see GetRecordedTraces().
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhSahCostModels();
+
+    // Compare trace performance of BVH::DoSweptTraces() against single traces
+    // done with BVH::DoSweptTrace(), and check that their results are
+    // identical. Replays recorded traces if enough were recorded, see
+    // GetRecordedTraces().
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhBatchedTraces();
+
+    // Compare trace performance of any-hit traces (BVH::DoSweptTraceAnyHit())
+    // against closest-hit traces (BVH::DoSweptTrace()) on the same traces, and
+    // check that both agree on whether something was hit. Replays recorded
+    // traces if enough were recorded (see GetRecordedTraces()), and longer versions
+    // of them.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhAnyHitTraces();
+
+    // Compare trace performance of hull traces against ray traces along the
+    // same sweeps, and of the ray-specialized 4-ary BVH traversal against the
+    // generic one. Also checks that both traversals produce identical results.
+    // Replays recorded traces if enough were recorded, see GetRecordedTraces().
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhRayTraces();
+
+    // Compare trace performance of the BVH's traversal and leaf kernels that
+    // are specialized for the standing, ducked and quadrant player hulls (see
+    // coll/TraceShape.h) against the generic ones, per hull type. Also checks
+    // that both produce identical results. Replays recorded traces if enough
+    // were recorded (see GetRecordedTraces()), with each hull type's extents.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void BvhHullShapeKernels();
+
+    // Compare the SIMD traversal of displacement collision trees against
+    // testing each node's child boxes one by one, separately for power-3 and
+    // power-4 displacements of the currently loaded map. Also checks that both
+    // traversals visit identical nodes.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void DispCollTreeTraversal();
+
+    // Measure collision cache creation time of all displacements of the
+    // currently loaded map. Frees and recreates their caches multiple times.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void DispCollCacheCreation();
+
+    // Replays a trace corpus recorded with
+    // CollidableWorld::StartTraceRecording() on the currently loaded map,
+    // which must be the map the corpus was recorded on. Traces are done the
+    // same way they were recorded (against gathered candidates or not) and
+    // with the same func_brush entities and dynamic props enabled. Checks that
+    // every trace's results are bit-identical to the recorded ones and reports
+    // the distribution of trace durations. Replayed traces aren't recorded and
+    // the enabled objects are restored afterwards.
+    // NOTE: Other threads shouldn't be running, they might mess up measurements.
+    static void ReplayTraceCorpus(const std::string& file_path);
+
+    // Checks that toggling func_brush entities of the currently loaded map
+    // takes effect: For each enabled func_brush, a ray that hits it before
+    // anything else must not hit it once it's disabled and must give the same
+    // results again once it's re-enabled. Toggles aren't recorded and the
+    // enabled objects are restored afterwards.
+    static void FuncBrushToggling();
+
+    // Number of most recent traces of CollidableWorld::DoSweptTrace() that are
+    // kept for benchmarks, see coll::TraceRecorder
+    static constexpr size_t MAX_RECORDED_TRACES = 200000;
+
+    // Returns the most recent traces done by the simulation (e.g. by player
+    // movement), oldest first. Thread-safe.
+    static std::vector<SweptTrace::Info> GetRecordedTraces();
+
     ////////////////////////////////////////////////////////////////////////////
 
     // TODO This function should be useful elsewhere too, move it out of here.
@@ -60,6 +150,47 @@ public:
     static std::optional<SweptTrace> GenRealisticTrace(Generator& gen,
                                                        const BVH::Leaf& leaf);
 
+    // Generates player hull traces of random direction and length that start
+    // close to random BVH leaves. Doesn't perform any traces.
+    template<class Generator>
+    static std::vector<SweptTrace::Info> GenHullTracesNearLeaves(Generator& gen,
+                                                  const BVH& bvh, size_t count);
+
+    // Returns recorded traces (see GetRecordedTraces()) if enough were
+    // recorded. Otherwise, tells the user and returns traces generated near
+    // leaves of the given BVH, see GenHullTracesNearLeaves().
+    template<class Generator>
+    static std::vector<SweptTrace::Info> GetRecordedOrGeneratedHullTraces(
+        Generator& gen, const BVH& bvh);
+
+    // Returns the results of the given traces done by the BVH that's used by
+    // the simulation. Other trace methods are validated against them.
+    static std::vector<SweptTrace::Results> ComputeReferenceResults(
+        const std::vector<SweptTrace::Info>& trace_infos);
+
+    // Does each given trace by calling do_trace(SweptTrace*) and returns how
+    // many results differ from the given reference results, see
+    // CompareTraceResults().
+    template<class TraceFunc>
+    static size_t CountIncorrectResults(
+        const std::vector<SweptTrace::Info>& trace_infos,
+        const std::vector<SweptTrace::Results>& reference_results,
+        TraceFunc&& do_trace);
+
+    // Returns the mean duration of a single trace in nanoseconds, measured
+    // over multiple iterations of all given traces.
+    static float MeasureMeanBvhTraceDuration(BVH& bvh,
+        const std::vector<SweptTrace::Info>& trace_infos, size_t num_iterations);
+    // Same, but each trace is done by calling do_trace(SweptTrace*), e.g. to
+    // measure other trace kernels than BVH::DoSweptTrace().
+    template<class TraceFunc>
+    static float MeasureMeanBvhTraceDuration(
+        const std::vector<SweptTrace::Info>& trace_infos, size_t num_iterations,
+        TraceFunc&& do_trace);
+
+    // Returns memory size of all BVH node and leaf arrays, in bytes.
+    static size_t GetBvhMemorySize(const BVH& bvh);
+
     static bool CompareTraceResults(
         const SweptTrace::Info& trace_info,
         const SweptTrace::Results& ground_truth,
@@ -1,12 +1,20 @@
 #include "coll/CollidableWorld-brush.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
 #include <Tracy.hpp>
 
+#include <Corrade/Containers/Optional.h>
 #include <Magnum/Magnum.h>
 
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
+#include "coll/Simd.h"
 #include "coll/SweptTrace.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BrushSeparation.h"
 #include "csgo_parsing/BspMap.h"
 
@@ -17,26 +25,111 @@ using Plane     = BspMap::Plane;
 using Brush     = BspMap::Brush;
 using BrushSide = BspMap::BrushSide;
 
+ContentsMask coll::GetBrushContents(const Brush& brush)
+{
+    static auto test_f_solid       = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
+    static auto test_f_playerclip  = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
+    static auto test_f_grenadeclip = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
+    static auto test_f_ladder      = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
+    static auto test_f_water       = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::WATER);
+
+    ContentsMask contents = 0;
+    if (test_f_solid      .first && test_f_solid      .first(brush)) contents |= CONTENTS_SOLID;
+    if (test_f_playerclip .first && test_f_playerclip .first(brush)) contents |= CONTENTS_PLAYERCLIP;
+    if (test_f_grenadeclip.first && test_f_grenadeclip.first(brush)) contents |= CONTENTS_GRENADECLIP;
+    if (test_f_ladder     .first && test_f_ladder     .first(brush)) contents |= CONTENTS_LADDER;
+    if (test_f_water      .first && test_f_water      .first(brush)) contents |= CONTENTS_WATER;
+    return contents;
+}
+
 uint64_t CollidableWorld::GetSweptTraceCost_Brush(uint32_t brush_idx)
 {
     // See BVH::GetSweptLeafTraceCost() for details and considerations.
-    return 1; // Is brush trace cost dependent on brushside count?
+    // Cost unit of all GetSweptTraceCost_*() functions: Roughly the cost of
+    // clipping a trace against one plane.
+    // Brush traces clip the trace against every brushside, plus some overhead.
+    // The overhead of 2 units is a guess, not a measured value.
+    const Brush& brush = pImpl->origin_bsp_map->brushes[brush_idx];
+    return 2 + brush.num_sides;
 }
 
+size_t CompiledBrushes::GetMemorySize() const
+{
+    return sizeof(CompiledBrushes)
+        + brushes.capacity()     * sizeof(Brush)
+        + plane_packs.capacity() * sizeof(PlanePack);
+}
+
+// Returns true if the plane is perpendicular to one of the coordinate axes
+static bool IsAxialPlane(const Plane& plane)
+{
+    int zero_component_cnt = 0;
+    for (int axis = 0; axis < 3; axis++)
+        if (plane.normal[axis] == 0.0f)
+            zero_component_cnt++;
+    return zero_component_cnt == 2;
+}
+
+CompiledBrushes coll::Create_CompiledBrushes(const BspMap& bsp_map)
+{
+    ZoneScoped;
+
+    CompiledBrushes compiled;
+    compiled.brushes.resize(bsp_map.brushes.size(), { .first_pack = 0, .num_packs = 0 });
+
+    std::vector<uint32_t> side_order; // Reused for every brush
+    for (size_t brush_idx : bsp_map.GetModelBrushIndices_worldspawn()) {
+        const Brush& brush = bsp_map.brushes[brush_idx];
+        if (brush.num_sides == 0 || GetBrushContents(brush) == 0)
+            continue; // Brush doesn't take part in collision
+        assert(brush.num_sides <= UINT16_MAX);
+
+        // Axial planes first, otherwise keep the brushside order
+        side_order.resize(brush.num_sides);
+        for (uint32_t i = 0; i < brush.num_sides; i++)
+            side_order[i] = i;
+        std::stable_partition(side_order.begin(), side_order.end(),
+            [&](uint32_t i) {
+                const BrushSide& side = bsp_map.brushsides[brush.first_side + i];
+                return IsAxialPlane(bsp_map.planes[side.plane_num]);
+            });
+
+        uint32_t first_pack = compiled.plane_packs.size();
+        for (uint32_t i = 0; i < brush.num_sides; i++) {
+            size_t slot = i % 4;
+            if (slot == 0)
+                compiled.plane_packs.push_back({}); // Zero-initialized, all slots unused
+            CompiledBrushes::PlanePack& pack = compiled.plane_packs.back();
+
+            const BrushSide& side  = bsp_map.brushsides[brush.first_side + side_order[i]];
+            const Plane&     plane = bsp_map.planes[side.plane_num];
+            for (int axis = 0; axis < 3; axis++)
+                pack.normal[axis][slot] = plane.normal[axis];
+            pack.dist    [slot] = plane.dist;
+            pack.texinfo [slot] = side.texinfo;
+            pack.side_pos[slot] = side_order[i];
+            pack.used_slots |= 1 << slot;
+            if (side.bevel != 1)
+                pack.nonbevel_slots |= 1 << slot;
+        }
+        compiled.brushes[brush_idx] = {
+            .first_pack = first_pack,
+            .num_packs  = (uint32_t)compiled.plane_packs.size() - first_pack
+        };
+    }
+    return compiled;
+}
+
+template<class Shape>
 void CollidableWorld::DoSweptTrace_Brush(SweptTrace* trace, uint32_t brush_idx)
 {
     ZoneScoped;
 
-    const Brush& brush = pImpl->origin_bsp_map->brushes[brush_idx];
-    static auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-    static auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-    static auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
-    bool solid_to_player = false;
-    if (test_f_1.first && test_f_1.first(brush)) solid_to_player = true;
-    if (test_f_2.first && test_f_2.first(brush)) solid_to_player = true;
-    if (test_f_3.first && test_f_3.first(brush)) solid_to_player = true;
-    if (!solid_to_player)
-        return;
+    // NOTE: The brush's contents are not checked against the trace's contents
+    //       mask here, the BVH already skipped the brush if they don't match.
+    assert(pImpl->compiled_brushes != Corrade::Containers::NullOpt);
+    const CompiledBrushes& compiled = *pImpl->compiled_brushes;
+    const CompiledBrushes::Brush& brush = compiled.brushes[brush_idx];
 
     // -------- start of source-sdk-2013 code --------
     // (taken and modified from source-sdk-2013/<...>/src/utils/vrad/trace.cpp)
@@ -46,80 +139,107 @@ void CollidableWorld::DoSweptTrace_Brush(SweptTrace* trace, uint32_t brush_idx)
     const float DIST_EPSILON = 0.03125f; // 1/32 epsilon to keep floating point happy
     const float NEVER_UPDATED = -9999.0f;
 
-    const Vector3 start = trace->info.startpos;
-    const Vector3 end   = trace->info.startpos + trace->info.delta;
-    const Vector3 mins = -trace->info.extents; // Box case only (!trace->info.isray)
-    const Vector3 maxs = +trace->info.extents; // Box case only (!trace->info.isray)
+    const Vector3 start   = trace->info.startpos;
+    const Vector3 end     = trace->info.startpos + trace->info.delta;
+    const Vector3 extents = Shape::GetExtents(trace->info);
+    const bool    is_ray  = Shape::IsRay(trace->info); // Constant for most shapes
 
-    if (!brush.num_sides)
+    if (brush.num_packs == 0)
         return;
 
-    const BrushSide* leadside  = nullptr;
-    const Plane*     clipplane = nullptr;
+    // Trace values that are used with every plane pack, for each axis
+    simd::Float4 start_v[3], end_v[3], extents_v[3];
+    for (int axis = 0; axis < 3; axis++) {
+        start_v  [axis] = simd::Splat4(start[axis]);
+        end_v    [axis] = simd::Splat4(end  [axis]);
+        extents_v[axis] = simd::Splat4(extents[axis]);
+    }
+    const simd::Float4 zero_v = simd::Splat4(0.0f);
+
+    // Plane that the trace enters the brush through last
+    const CompiledBrushes::PlanePack* clip_pack = nullptr;
+    int clip_slot = 0;
+
     float enterfrac = NEVER_UPDATED;
     float leavefrac = 1.0f;
     bool  getout    = false;
     bool  startout  = false;
 
-    float   dist;
-    Vector3 ofs;
-    float   d1, d2;
-    float   f;
-
-    // @Optimization Ensure the 6 axial brushsides/planes are processed first
-    for (int i = 0; i < brush.num_sides; i++)
+    for (uint32_t p = 0; p < brush.num_packs; p++)
     {
-        const BrushSide& side = pImpl->origin_bsp_map->brushsides[brush.first_side + i];
-        const Plane& plane    = pImpl->origin_bsp_map->planes[side.plane_num];
+        const CompiledBrushes::PlanePack& pack = compiled.plane_packs[brush.first_pack + p];
 
-        if (trace->info.isray) // Special point case
-        {
-            if (side.bevel == 1) // Don't ray trace against bevel planes
-                continue;
+        // Don't ray trace against bevel planes
+        int slots = is_ray ? pack.nonbevel_slots : pack.used_slots;
+
+        simd::Float4 normal[3];
+        for (int axis = 0; axis < 3; axis++)
+            normal[axis] = simd::Load4(pack.normal[axis]);
 
-            dist = plane.dist;
+        simd::Float4 dist = simd::Load4(pack.dist);
+        if (!is_ray) { // General box case
+            // Push the plane out apropriately for mins/maxs. Picking mins or
+            // maxs by the sign of the normal makes every product negative:
+            // dist - dot(ofs, normal) == dist + dot(extents, abs(normal))
+            simd::Float4 ofs_dist = simd::Mul(extents_v[0], simd::Abs(normal[0]));
+            ofs_dist = simd::Add(ofs_dist, simd::Mul(extents_v[1], simd::Abs(normal[1])));
+            ofs_dist = simd::Add(ofs_dist, simd::Mul(extents_v[2], simd::Abs(normal[2])));
+            dist = simd::Add(dist, ofs_dist);
         }
-        else // General box case
-        {
-            // Push the plane out apropriately for mins/maxs
-            ofs.x() = (plane.normal.x() < 0.0f) ? maxs.x() : mins.x();
-            ofs.y() = (plane.normal.y() < 0.0f) ? maxs.y() : mins.y();
-            ofs.z() = (plane.normal.z() < 0.0f) ? maxs.z() : mins.z();
-
-            dist = Math::dot(ofs, plane.normal);
-            dist = plane.dist - dist;
+
+        simd::Float4 d1 = simd::Mul(start_v[0], normal[0]);
+        simd::Float4 d2 = simd::Mul(  end_v[0], normal[0]);
+        for (int axis = 1; axis < 3; axis++) {
+            d1 = simd::Add(d1, simd::Mul(start_v[axis], normal[axis]));
+            d2 = simd::Add(d2, simd::Mul(  end_v[axis], normal[axis]));
         }
+        d1 = simd::Sub(d1, dist);
+        d2 = simd::Sub(d2, dist);
 
-        d1 = Math::dot(start, plane.normal) - dist;
-        d2 = Math::dot(  end, plane.normal) - dist;
+        int d1_out_mask = simd::CmpLtMask(zero_v, d1) & slots; // d1 > 0.0f
+        int d2_out_mask = simd::CmpLtMask(zero_v, d2) & slots; // d2 > 0.0f
 
         // If completely in front of face, no intersection
-        if (d1 > 0.0f && d2 > 0.0f)
+        if (d1_out_mask & d2_out_mask)
             return;
 
-        if (d2 > 0.0f)
+        if (d2_out_mask)
             getout = true; // Endpoint is not in solid
-        if (d1 > 0.0f)
+        if (d1_out_mask)
             startout = true;
 
-        if (d1 <= 0.0f && d2 <= 0.0f)
+        // Planes where (d1 <= 0.0f && d2 <= 0.0f) are skipped
+        int crossing_mask = d1_out_mask | d2_out_mask;
+        if (crossing_mask == 0)
             continue;
 
+        alignas(simd::FLOAT4_ALIGNMENT) float d1_arr[4];
+        alignas(simd::FLOAT4_ALIGNMENT) float d2_arr[4];
+        simd::Store4(d1_arr, d1);
+        simd::Store4(d2_arr, d2);
+
         // Crosses face
-        if (d1 > d2) {
-            // Enter
-            f = (d1 - DIST_EPSILON) / (d1 - d2);
-            if (f > enterfrac) {
-                enterfrac = f;
-                clipplane = &plane;
-                leadside = &side;
+        for (int i = 0; i < 4; i++) {
+            if (!(crossing_mask & (1 << i)))
+                continue;
+            float f;
+            if (d1_arr[i] > d2_arr[i]) {
+                // Enter
+                f = (d1_arr[i] - DIST_EPSILON) / (d1_arr[i] - d2_arr[i]);
+                bool is_earlier_side = !clip_pack
+                    || pack.side_pos[i] < clip_pack->side_pos[clip_slot];
+                if (f > enterfrac || (f == enterfrac && is_earlier_side)) {
+                    enterfrac = f;
+                    clip_pack = &pack;
+                    clip_slot = i;
+                }
+            }
+            else {
+                // Leave
+                f = (d1_arr[i] + DIST_EPSILON) / (d1_arr[i] - d2_arr[i]);
+                if (f < leavefrac)
+                    leavefrac = f;
             }
-        }
-        else {
-            // Leave
-            f = (d1 + DIST_EPSILON) / (d1 - d2);
-            if (f < leavefrac)
-                leavefrac = f;
         }
     }
 
@@ -136,10 +256,65 @@ void CollidableWorld::DoSweptTrace_Brush(SweptTrace* trace, uint32_t brush_idx)
             if (enterfrac < 0.0f)
                 enterfrac = 0.0f;
             trace->results.fraction     = enterfrac;
-            trace->results.plane_normal = clipplane->normal;
-            trace->results.surface      = leadside->texinfo; // Might be -1
+            trace->results.plane_normal = {
+                clip_pack->normal[0][clip_slot],
+                clip_pack->normal[1][clip_slot],
+                clip_pack->normal[2][clip_slot]
+            };
+            trace->results.surface      = clip_pack->texinfo[clip_slot]; // Might be -1
             //trace->contents = brush.contents; // TODO: Return hit contents in a better way
         }
     }
     // --------- end of source-sdk-2013 code ---------
 }
+
+template void CollidableWorld::DoSweptTrace_Brush<RuntimeShape     >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Brush<RayShape         >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Brush<StandingHullShape>(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Brush<DuckedHullShape  >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Brush<QuadrantHullShape>(SweptTrace*, uint32_t);
+
+bool CollidableWorld::IsHullInSolid_Brush(const SweptTrace::Info& hull,
+    uint32_t brush_idx)
+{
+    assert(pImpl->compiled_brushes != Corrade::Containers::NullOpt);
+    const CompiledBrushes& compiled = *pImpl->compiled_brushes;
+    const CompiledBrushes::Brush& brush = compiled.brushes[brush_idx];
+    if (brush.num_packs == 0)
+        return false;
+
+    // Same plane tests as DoSweptTrace_Brush() with identical start and end
+    // points: The hull is in the brush if it isn't in front of any plane.
+    simd::Float4 center_v[3], extents_v[3];
+    for (int axis = 0; axis < 3; axis++) {
+        center_v [axis] = simd::Splat4(hull.startpos[axis]);
+        extents_v[axis] = simd::Splat4(hull.extents [axis]);
+    }
+    const simd::Float4 zero_v = simd::Splat4(0.0f);
+
+    for (uint32_t p = 0; p < brush.num_packs; p++) {
+        const CompiledBrushes::PlanePack& pack = compiled.plane_packs[brush.first_pack + p];
+        int slots = hull.isray ? pack.nonbevel_slots : pack.used_slots;
+
+        simd::Float4 normal[3];
+        for (int axis = 0; axis < 3; axis++)
+            normal[axis] = simd::Load4(pack.normal[axis]);
+
+        simd::Float4 dist = simd::Load4(pack.dist);
+        if (!hull.isray) {
+            simd::Float4 ofs_dist = simd::Mul(extents_v[0], simd::Abs(normal[0]));
+            ofs_dist = simd::Add(ofs_dist, simd::Mul(extents_v[1], simd::Abs(normal[1])));
+            ofs_dist = simd::Add(ofs_dist, simd::Mul(extents_v[2], simd::Abs(normal[2])));
+            dist = simd::Add(dist, ofs_dist);
+        }
+
+        simd::Float4 d = simd::Mul(center_v[0], normal[0]);
+        for (int axis = 1; axis < 3; axis++)
+            d = simd::Add(d, simd::Mul(center_v[axis], normal[axis]));
+        d = simd::Sub(d, dist);
+
+        if (simd::CmpLtMask(zero_v, d) & slots) // d > 0.0f
+            return false; // In front of a plane, hull is outside
+    }
+    return true;
+}
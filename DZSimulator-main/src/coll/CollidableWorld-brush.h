@@ -1,8 +1,60 @@
 #ifndef COLL_COLLIDABLEWORLD_BRUSH_H_
 #define COLL_COLLIDABLEWORLD_BRUSH_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "coll/Simd.h"
+#include "coll/SweptTrace.h"
+#include "csgo_parsing/BspMap.h"
+
 namespace coll {
 
+    // Returns the contents flags of a brush, determined with the same brush
+    // category tests that are used to separate brushes for rendering.
+    // Returns 0 if the brush has no collision-relevant contents.
+    ContentsMask GetBrushContents(const csgo_parsing::BspMap::Brush& brush);
+
+    // Collision data of worldspawn brushes, compiled once at world creation.
+    // Brush traces read all planes of a brush from one contiguous array instead
+    // of following brushside and plane indices into the BspMap.
+    struct CompiledBrushes {
+        // 4 planes of a brush, stored in a structure-of-arrays layout so that
+        // a trace can be clipped against all of them at once using SIMD
+        // instructions. Unused slots are zeroed.
+        struct alignas(simd::FLOAT4_ALIGNMENT) PlanePack {
+            float normal[3][4]; // Indexed by [axis][slot]
+            float dist[4];
+            int16_t texinfo[4]; // idx into BspMap.texinfos, might be -1
+
+            // Position of the plane's brushside within the brush. If multiple
+            // planes are hit at the same fraction, the one with the lowest
+            // position gets reported, like when iterating the brushsides.
+            uint16_t side_pos[4];
+
+            uint8_t used_slots;     // Bit i is set if slot i holds a plane
+            uint8_t nonbevel_slots; // Bit i is set if slot i holds a non-bevel plane
+        };
+
+        struct Brush {
+            uint32_t first_pack; // idx into plane_packs
+            uint32_t num_packs;  // 0 if the brush doesn't take part in collision
+        };
+
+        // Indexed like BspMap.brushes. Brushes that aren't part of worldspawn
+        // or that have no collision-relevant contents have no planes.
+        std::vector<Brush> brushes;
+
+        // Planes of each brush are contiguous. The brush's axial planes come
+        // first, they reject most traces that don't touch the brush.
+        std::vector<PlanePack> plane_packs;
+
+        size_t GetMemorySize() const;
+    };
+
+    CompiledBrushes Create_CompiledBrushes(const csgo_parsing::BspMap& bsp_map);
+
 
     // ... (Add further brush-related collision code here)
 
@@ -2,9 +2,9 @@
 
 #include <cassert>
 #include <cmath>
-#include <functional> // for std::hash
-#include <string_view>
-#include <unordered_set>
+#include <cstdint>
+#include <mutex>
+#include <vector>
 
 #include <Tracy.hpp>
 
@@ -16,6 +16,8 @@
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/Debugger.h"
+#include "coll/DispCollCacheManager.h"
+#include "coll/Simd.h"
 #include "coll/SweptTrace.h"
 #include "csgo_parsing/BspMap.h"
 #include "utils_3d.h"
@@ -55,9 +57,16 @@ static bool SourceSdkVectorEqual(const Vector3& vec1, const Vector3& vec2) {
 uint64_t CollidableWorld::GetSweptTraceCost_Displacement(uint32_t dispcoll_idx)
 {
     // See BVH::GetSweptLeafTraceCost() for details and considerations.
-    return 1; // Is displacement trace cost dependent on triangle count?
+    // Traces descend the displacement's AABB tree and only test triangles
+    // below AABB tree nodes they hit. That's a small fraction of all
+    // triangles, but it grows with the displacement's tessellation power.
+    // Unmeasured guess: 8 units to enter the tree, 1 per 16 triangles.
+    assert(pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
+    const CDispCollTree& disp = (*pImpl->hull_disp_coll_trees)[dispcoll_idx];
+    return 8 + disp.GetTriSize() / 16;
 }
 
+template<class Shape>
 void CollidableWorld::DoSweptTrace_Displacement(SweptTrace* trace,
     uint32_t dispcoll_idx)
 {
@@ -68,27 +77,84 @@ void CollidableWorld::DoSweptTrace_Displacement(SweptTrace* trace,
 
     CDispCollTree& hull_dispcoll = hull_disp_coll_trees[dispcoll_idx];
 
-    if (trace->info.isray) { // ray trace
-        // NOTE: Right now, only collision structures of displacements required
-        //       for *hull* collision are initialized! Once you need to perform
-        //       *ray* collisions on displacements, initialize the displacements
-        //       that don't have the NO_RAY_COLL flag as well and use them here!
-        assert(0 && "ERROR: Unable to perform ray traces on displacements! See "
-            "surrounding comment.");
-        return;
-
-        // Displacements with NO_RAY_COLL flag are not considered by AABBTree_Ray
-        //hull_dispcoll.AABBTree_Ray(trace); // Returns true on hit
+    if (Shape::IsRay(trace->info)) { // ray trace
+        // Displacements with NO_RAY_COLL flag are not considered by AABBTree_Ray.
+        // Displacements with NO_HULL_COLL flag aren't in this array, ray traces
+        // against them are done by DoSweptTrace_RayOnlyDisplacements().
+        hull_dispcoll.AABBTree_Ray(trace); // Returns true on hit
     }
     else { // hull trace
         // Displacements with NO_HULL_COLL flag are not considered by
         // AABBTree_SweepAABB.
         // Displacement collision cache might be created.
-        // CAUTION: Not thread-safe yet!
-        hull_dispcoll.AABBTree_SweepAABB(trace); // Returns true on hit
+        bool used_cache    = false;
+        bool created_cache = false;
+        hull_dispcoll.AABBTree_SweepAABB<Shape>(trace, &used_cache, &created_cache); // Returns true on hit
+
+        // Let the cache manager know which caches are in use. Only count a
+        // miss if this trace had to create the cache itself, not if another
+        // trace or the warm-up thread created it in the meantime.
+        if (used_cache && pImpl->disp_coll_cache_manager)
+            pImpl->disp_coll_cache_manager->OnCacheUsed(dispcoll_idx, !created_cache);
+    }
+}
+
+template void CollidableWorld::DoSweptTrace_Displacement<RuntimeShape     >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Displacement<RayShape         >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Displacement<StandingHullShape>(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Displacement<DuckedHullShape  >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_Displacement<QuadrantHullShape>(SweptTrace*, uint32_t);
+
+void CollidableWorld::DoSweptTrace_RayOnlyDisplacements(SweptTrace* trace)
+{
+    ZoneScoped;
+
+    assert(trace->info.isray);
+    // Same contents as the BVH's displacement leaves
+    if (!(CONTENTS_SOLID & trace->info.contents_mask))
+        return;
+
+    // Create collision structures on the first ray trace, hull traces (i.e.
+    // player movement) never need them
+    std::call_once(pImpl->ray_only_disp_coll_trees_init, [this]() {
+        const BspMap& bsp_map = *pImpl->origin_bsp_map;
+        std::vector<CDispCollTree> ray_only_disp_coll_trees;
+        for (size_t i = 0; i < bsp_map.dispinfos.size(); i++) {
+            const BspMap::DispInfo& dispinfo = bsp_map.dispinfos[i];
+            if (!dispinfo.HasFlag_NO_HULL_COLL() || dispinfo.HasFlag_NO_RAY_COLL())
+                continue;
+            ray_only_disp_coll_trees.emplace_back(i, bsp_map);
+        }
+        pImpl->ray_only_disp_coll_trees = std::move(ray_only_disp_coll_trees);
+    });
+
+    // @Optimization These displacements aren't part of the BVH. Maps only have
+    //               few of them, so test each one's AABB.
+    for (CDispCollTree& ray_dispcoll : *pImpl->ray_only_disp_coll_trees) {
+        Vector3 aabb_mins, aabb_maxs;
+        ray_dispcoll.GetBounds(aabb_mins, aabb_maxs); // Returns bloated AABB
+        if (!trace->HitsAabbOnFullSweep(aabb_mins, aabb_maxs))
+            continue;
+        ray_dispcoll.AABBTree_Ray(trace); // Returns true on hit
     }
 }
 
+bool CollidableWorld::IsHullInSolid_Displacement(const SweptTrace::Info& hull,
+    uint32_t dispcoll_idx)
+{
+    // Points can't be inside of displacements, they have no volume.
+    if (hull.isray)
+        return false;
+
+    assert(pImpl->hull_disp_coll_trees != Corrade::Containers::NullOpt);
+    CDispCollTree& hull_dispcoll = (*pImpl->hull_disp_coll_trees)[dispcoll_idx];
+
+    // Like source-sdk-2013's CM_TestInDispTree(), test the hull's box against
+    // the displacement's triangles. Doesn't need the collision cache.
+    return hull_dispcoll.AABBTree_IntersectAABB(
+        hull.startpos - hull.extents, hull.startpos + hull.extents);
+}
+
 
 // -------- start of source-sdk-2013 code --------
 // (taken and modified from source-sdk-2013/<...>/src/public/mathlib/mathlib.h)
@@ -637,43 +703,83 @@ static const Vector3 g_Vec3DispCollEpsilons{
     DISPCOLL_DIST_EPSILON
 };
 
-struct DispCollPlaneIndex_t
-{
-    Vector3 vecPlane;
-    int index;
-
-    // Compare
-    bool operator==(const DispCollPlaneIndex_t& other) const {
-        return (SourceSdkVectorEqual(this->vecPlane,  other.vecPlane) ||
-                SourceSdkVectorEqual(this->vecPlane, -other.vecPlane));
-    }
-};
+// ==== The following is a replacement of source-sdk-2013's CUtlHash of
+//      DispCollPlaneIndex_t, which deduplicated edge planes in a global table.
 
-class CPlaneIndexHashFuncs
+// Open-addressing hash table that deduplicates the edge planes of a single
+// displacement while its collision cache is created. Each slot holds an index
+// into the displacement's edge plane list. Two planes are duplicates if they
+// are exactly equal or exactly opposite.
+class coll::CDispCollPlaneTable
 {
 public:
-    // Hash
-    size_t operator()(const DispCollPlaneIndex_t& item) const {
-        return HashVector3(item.vecPlane) ^ HashVector3(-item.vecPlane);
+    // Known maximum of unique edge planes a displacement can have
+    static constexpr int MAX_PLANES = 672;
+    // Power of 2, keeps the load factor below 2/3
+    static constexpr int TABLE_SIZE = 1024;
+
+    CDispCollPlaneTable() {
+        for (int i = 0; i < TABLE_SIZE; i++)
+            m_slots[i] = EMPTY_SLOT;
+    }
+
+    // Looks for a plane equal or opposite to vecPlane in aPlanes. Returns its
+    // index, with 0x8000 added if it's opposite. If there is none, returns -1
+    // and remembers that vecPlane will be stored at index newIndex.
+    int FindOrInsert(const Vector3& vecPlane, const std::vector<Vector3>& aPlanes,
+        int newIndex)
+    {
+        // Should the known maximum ever be wrong, stop deduplicating rather
+        // than filling the table up
+        if (m_count >= TABLE_SIZE * 3 / 4)
+            return -1;
+
+        for (uint32_t i = Hash(vecPlane); ; i++) {
+            uint16_t& slot = m_slots[i & (TABLE_SIZE - 1)];
+            if (slot == EMPTY_SLOT) {
+                slot = static_cast<uint16_t>(newIndex);
+                m_count++;
+                return -1;
+            }
+            if (SourceSdkVectorEqual(aPlanes[slot],  vecPlane)) return slot;
+            if (SourceSdkVectorEqual(aPlanes[slot], -vecPlane)) return slot | 0x8000;
+        }
     }
+
 private:
-    size_t HashVector3(const Vector3& vec) const {
-        // Create std::string_view of the vector's values
-        const char* ptr = reinterpret_cast<const char*>(vec.data());
-        constexpr size_t byte_count = Vector3::Size * sizeof(Vector3::Type);
-        std::string_view sv{ ptr, byte_count };
-
-        // Compute vector hash value using std::hash specialization for
-        // std::string_view
-        return std::hash<std::string_view>{}(sv);
+    // Equal and opposite planes must get equal hashes. Keys are quantized
+    // plane components, negated if needed so that their first nonzero
+    // component is positive. Truncation keeps quantization symmetric.
+    // NOTE: Edge planes store their distance in the x component, see
+    //       Cache_EdgeCrossAxisX(). It doesn't exceed the int32 range either.
+    static uint32_t Hash(const Vector3& vecPlane) {
+        int32_t q[3];
+        for (int axis = 0; axis < 3; axis++)
+            q[axis] = static_cast<int32_t>(vecPlane[axis] * 1024.0f);
+        if (q[0] < 0 || (q[0] == 0 && (q[1] < 0 || (q[1] == 0 && q[2] < 0))))
+            for (int axis = 0; axis < 3; axis++)
+                q[axis] = -q[axis];
+        return (static_cast<uint32_t>(q[0]) * 73856093u)
+             ^ (static_cast<uint32_t>(q[1]) * 19349663u)
+             ^ (static_cast<uint32_t>(q[2]) * 83492791u);
     }
+
+    static constexpr uint16_t EMPTY_SLOT = 0xFFFF;
+    uint16_t m_slots[TABLE_SIZE];
+    int m_count = 0;
 };
+// ==== end of replacement
 
-// @Optimization Is 512 a good default bucket count?
-//               Theoretical max of unique keys during current usage is 672.
-//               Test if 512 are enough buckets? Do allocations occur?
-static std::unordered_set<DispCollPlaneIndex_t, CPlaneIndexHashFuncs>
-                                                  g_DispCollPlaneIndexHash(512);
+// Serializes collision cache creation of each displacement. Displacements are
+// spread across multiple mutexes so that different displacements can create
+// their caches concurrently.
+static constexpr size_t NUM_DISPCOLL_CACHE_CREATION_MUTEXES = 16;
+static std::mutex g_DispCollCacheCreationMutexes[NUM_DISPCOLL_CACHE_CREATION_MUTEXES];
+
+static std::mutex& GetCacheCreationMutex(const CDispCollTree* pTree) {
+    uintptr_t idx = reinterpret_cast<uintptr_t>(pTree) / sizeof(CDispCollTree);
+    return g_DispCollCacheCreationMutexes[idx % NUM_DISPCOLL_CACHE_CREATION_MUTEXES];
+}
 
 
 // Displacement Collision Triangle
@@ -749,9 +855,9 @@ void CDispCollTri::FindMinMax(std::vector<Vector3>& m_aVerts)
     SetMax(2, iMax);
 }
 
-// NOTE: DZSimulator does not support SIMD for now. Furthermore, all CDispVector
-//       that were 16-aligned have been replaced with unaligned std::vector. Is
-//       their alignment necessary for SIMD?
+// NOTE: The SIMD code below uses coll/Simd.h instead of source-sdk-2013's
+//       FourVectors. Node AABBs are loaded with aligned loads, CDispCollNode
+//       is aligned accordingly.
 
 // Intersecting with the quad tree. Returned value explanation:
 // if (retval & 1) then box of SW node child was hit
@@ -763,61 +869,56 @@ static FORCEINLINE int IntersectRayWithFourBoxes(
     ////const FourVectors& rayStart, const FourVectors& invDelta,
     ////const FourVectors& rayExtents,
     ////const FourVectors& boxMins, const FourVectors& boxMaxs
-    // ==== Non-SIMD replacements of the arguments above
-    const Vector3& rayStart, const Vector3& invDelta, const Vector3& rayExtents,
-    const Vector3(&boxMins)[4], const Vector3(&boxMaxs)[4]
+    // ==== Replacements of the arguments above, see rayleaflist_t and
+    //      CDispCollNode
+    const simd::Float4(&rayStart)[3], const simd::Float4(&invDelta)[3],
+    const simd::Float4(&rayExtents)[3],
+    const float(&boxMins)[3][4], const float(&boxMaxs)[3][4]
     // ==== end of replacement
 )
 {
-    // ==== The following code is the original function body from source-sdk-2013
-    //      that utilizes SIMD.
-    
-    ////// SIMD Test ray against all four boxes at once.
-    ////// Each node stores the bboxes of its four children.
-    ////FourVectors hitMins = boxMins;
-    ////FourVectors hitMaxs = boxMaxs;
-    ////hitMins -= rayStart;
-    ////hitMaxs -= rayStart;
-    ////
-    ////// Adjust for swept box by enlarging the child bounds to shrink the sweep
-    ////// down to a point
-    ////hitMins -= rayExtents;
-    ////hitMaxs += rayExtents;
-    ////
-    ////// Compute the parametric distance along the ray of intersection in each
-    ////// dimension
-    ////hitMins *= invDelta;
-    ////hitMaxs *= invDelta;
-    ////
-    ////// Find the exit parametric intersection distance in each dimension, for each box
-    ////FourVectors exitT = maximum(hitMins, hitMaxs);
-    ////// Find the entry parametric intersection distance in each dimension, for each box
-    ////FourVectors entryT = minimum(hitMins, hitMaxs);
-    ////
-    ////// Now find the max overall entry distance across all dimensions for each box
-    ////fltx4 minTemp = MaxSIMD(entryT.x, entryT.y);
-    ////fltx4 boxEntryT = MaxSIMD(minTemp, entryT.z);
-    ////// Now find the min overall exit distance across all dimensions for each box
-    ////fltx4 maxTemp = MinSIMD(exitT.x, exitT.y);
-    ////fltx4 boxExitT = MinSIMD(maxTemp, exitT.z);
-    ////
-    ////boxEntryT = MaxSIMD(boxEntryT, Four_Zeros);
-    ////boxExitT  = MinSIMD(boxExitT,  Four_Ones );
-    ////
-    ////// If entry<=exit for the box, we've got a hit.
-    ////fltx4 active = CmpLeSIMD(boxEntryT, boxExitT); // Mask of which boxes are active
-    ////
-    ////// Hit at least one box?
-    ////return TestSignSIMD(active);
-
-    // ==== The following code is the non-SIMD replacement of the code above.
-    int hit_mask = 0;
-    for (int child_idx = 0; child_idx < 4; child_idx++) {
-        if (IsAabbHitByFullSweptTrace(rayStart, invDelta, rayExtents,
-                                        boxMins[child_idx], boxMaxs[child_idx]))
-            hit_mask |= 1 << child_idx;
+    // SIMD Test ray against all four boxes at once.
+    // Each node stores the bboxes of its four children.
+    // NOTE: Same computation as IsAabbHitByFullSweptTrace(), producing
+    //       identical results on every coll/Simd.h backend.
+    simd::Float4 boxEntryT, boxExitT;
+    for (int axis = 0; axis < 3; axis++) {
+        simd::Float4 hitMins = simd::Load4(boxMins[axis]);
+        simd::Float4 hitMaxs = simd::Load4(boxMaxs[axis]);
+        hitMins = simd::Sub(hitMins, rayStart[axis]);
+        hitMaxs = simd::Sub(hitMaxs, rayStart[axis]);
+
+        // Adjust for swept box by enlarging the child bounds to shrink the
+        // sweep down to a point
+        hitMins = simd::Sub(hitMins, rayExtents[axis]);
+        hitMaxs = simd::Add(hitMaxs, rayExtents[axis]);
+
+        // Compute the parametric distance along the ray of intersection in
+        // this dimension
+        hitMins = simd::Mul(hitMins, invDelta[axis]);
+        hitMaxs = simd::Mul(hitMaxs, invDelta[axis]);
+
+        // Find the entry and exit parametric intersection distance in this
+        // dimension, for each box
+        simd::Float4 entryT = simd::Min(hitMins, hitMaxs);
+        simd::Float4 exitT  = simd::Max(hitMins, hitMaxs);
+
+        // Find the max overall entry distance and the min overall exit
+        // distance across all dimensions for each box
+        if (axis == 0) {
+            boxEntryT = entryT;
+            boxExitT  = exitT;
+        }
+        else {
+            boxEntryT = simd::Max(boxEntryT, entryT);
+            boxExitT  = simd::Min(boxExitT,  exitT);
+        }
     }
-    return hit_mask;
+    boxEntryT = simd::Max(boxEntryT, simd::Splat4(0.0f));
+    boxExitT  = simd::Min(boxExitT,  simd::Splat4(1.0f));
+
+    // If entry<=exit for the box, we've got a hit.
+    return simd::CmpLeMask(boxEntryT, boxExitT);
 }
 
 // This does 4 simultaneous box intersections
@@ -827,37 +928,25 @@ static FORCEINLINE int IntersectFourBoxPairs(
     // ==== Original arguments from source-sdk-2013 that utilize SIMD
     ////const FourVectors& mins0, const FourVectors& maxs0,
     ////const FourVectors& mins1, const FourVectors& maxs1
-    // ==== Non-SIMD replacements of the arguments above
-    const Vector3& mins0, const Vector3& maxs0,
-    const Vector3(&mins1)[4], const Vector3(&maxs1)[4]
+    // ==== Replacements of the arguments above. mins0 and maxs0 hold a single
+    //      box, splatted across all 4 lanes and indexed by axis.
+    const simd::Float4(&mins0)[3], const simd::Float4(&maxs0)[3],
+    const float(&mins1)[3][4], const float(&maxs1)[3][4]
     // ==== end of replacement
 )
 {
-    // ==== The following code is the original function body from source-sdk-2013
-    //      that utilizes SIMD.
-
-    ////// Find the max mins and min maxs in each dimension
-    ////FourVectors intersectMins = maximum(mins0, mins1);
-    ////FourVectors intersectMaxs = minimum(maxs0, maxs1);
-    //// 
-    ////// If intersectMins <= intersectMaxs then the boxes overlap in this dimension
-    ////fltx4 overlapX = CmpLeSIMD(intersectMins.x, intersectMaxs.x);
-    ////fltx4 overlapY = CmpLeSIMD(intersectMins.y, intersectMaxs.y);
-    ////fltx4 overlapZ = CmpLeSIMD(intersectMins.z, intersectMaxs.z);
-    //// 
-    ////// If the boxes overlap in all three dimensions, they intersect
-    ////fltx4 tmp = AndSIMD(overlapX, overlapY);
-    ////fltx4 active = AndSIMD(tmp, overlapZ);
-    //// 
-    ////// Hit at least one box?
-    ////return TestSignSIMD(active);
-
-    // ==== The following code is the non-SIMD replacement of the code above.
-    int hit_mask = 0;
-    for (int child_idx = 0; child_idx < 4; child_idx++)
-        if (AabbIntersectsAabb(mins0, maxs0, mins1[child_idx], maxs1[child_idx]))
-            hit_mask |= 1 << child_idx;
-    return hit_mask;
+    int active = 0xF;
+    for (int axis = 0; axis < 3; axis++) {
+        // Find the max mins and min maxs in this dimension
+        simd::Float4 intersectMins = simd::Max(mins0[axis], simd::Load4(mins1[axis]));
+        simd::Float4 intersectMaxs = simd::Min(maxs0[axis], simd::Load4(maxs1[axis]));
+
+        // If intersectMins <= intersectMaxs then the boxes overlap in this
+        // dimension. If the boxes overlap in all three dimensions, they
+        // intersect.
+        active &= simd::CmpLeMask(intersectMins, intersectMaxs);
+    }
+    return active;
 }
 
 int FORCEINLINE CDispCollTree::BuildRayLeafList(int iNode, rayleaflist_t& list)
@@ -898,6 +987,46 @@ int FORCEINLINE CDispCollTree::BuildRayLeafList(int iNode, rayleaflist_t& list)
     return listIndex;
 }
 
+#if COLL_BENCHMARK_ENABLED
+int CDispCollTree::Benchmark_BuildRayLeafList(const SweptTrace::Info& info,
+    rayleaflist_t& list, bool use_simd)
+{
+    Vector3 rayExtents = info.extents + g_Vec3DispCollEpsilons;
+    for (int axis = 0; axis < 3; axis++) {
+        list.invDelta  [axis] = simd::Splat4(info.invdelta[axis]);
+        list.rayStart  [axis] = simd::Splat4(info.startpos[axis]);
+        list.rayExtents[axis] = simd::Splat4(rayExtents[axis]);
+    }
+
+    if (use_simd)
+        return BuildRayLeafList(0, list);
+
+    // Same traversal as BuildRayLeafList(), but testing one child box at a time
+    list.nodeList[0] = 0;
+    int listIndex = 0;
+    list.maxIndex = 0;
+    while (listIndex <= list.maxIndex) {
+        int iNode = list.nodeList[listIndex];
+        if (IsLeafNode(iNode))
+            return listIndex;
+        listIndex++;
+        const CDispCollNode& node = m_nodes[iNode];
+        int child = Nodes_GetChild(iNode, 0);
+        for (int i = 0; i < 4; i++) {
+            Vector3 childMins{ node.m_mins[0][i], node.m_mins[1][i], node.m_mins[2][i] };
+            Vector3 childMaxs{ node.m_maxs[0][i], node.m_maxs[1][i], node.m_maxs[2][i] };
+            if (IsAabbHitByFullSweptTrace(info.startpos, info.invdelta,
+                                          rayExtents, childMins, childMaxs)) {
+                list.maxIndex++;
+                list.nodeList[list.maxIndex] = child + i;
+            }
+        }
+        assert(list.maxIndex < MAX_AABB_LIST);
+    }
+    return listIndex;
+}
+#endif
+
 void CDispCollTree::AABBTree_Create(const std::vector<Vector3>& disp_vertices)
 {
     // Copy necessary displacement data.
@@ -1022,10 +1151,12 @@ void CDispCollTree::AABBTree_GenerateBoxes_r(int nodeIndex,
         ////                                         childMins[2], childMins[3]);
         ////m_nodes[nodeIndex].m_maxs.LoadAndSwizzle(childMaxs[0], childMaxs[1],
         ////                                         childMaxs[2], childMaxs[3]);
-        // ==== The following is the non-SIMD replacement of the code above.
+        // ==== The following is the replacement of the code above.
         for (int i = 0; i < 4; i++) {
-            m_nodes[nodeIndex].m_mins[i] = childMins[i];
-            m_nodes[nodeIndex].m_maxs[i] = childMaxs[i];
+            for (int axis = 0; axis < 3; axis++) {
+                m_nodes[nodeIndex].m_mins[axis][i] = childMins[i][axis];
+                m_nodes[nodeIndex].m_maxs[axis][i] = childMaxs[i][axis];
+            }
         }
     }
 }
@@ -1047,31 +1178,47 @@ void CDispCollTree::AABBTree_CalcBounds()
 
 bool CDispCollTree::IsCacheGenerated() const
 {
-    return m_aTrisCache.size() == GetTriSize();
+    return m_bCacheCreated.val.load(std::memory_order_acquire);
 }
 
-void CDispCollTree::EnsureCacheIsCreated()
+bool CDispCollTree::EnsureCacheIsCreated()
 {
-    if (m_aTrisCache.size() == GetTriSize())
-        return;
+    if (m_bCacheCreated.val.load(std::memory_order_acquire))
+        return false;
+
+    std::lock_guard<std::mutex> lock(GetCacheCreationMutex(this));
+    // Another thread might have created the cache while we were waiting
+    if (m_bCacheCreated.val.load(std::memory_order_relaxed))
+        return false;
 
     // Alloc.
     //int nSize = sizeof( CDispCollTriCache ) * GetTriSize();
     int nTriCount = GetTriSize();
     m_aTrisCache = std::vector<CDispCollTriCache>(nTriCount);
 
+    CDispCollPlaneTable planeTable;
     for (int iTri = 0; iTri < nTriCount; iTri++)
-        Cache_Create(&m_aTris[iTri], iTri);
+        Cache_Create(&m_aTris[iTri], iTri, planeTable);
 
-    // Clear temporary lookup table that was used by Cache_Create()
-    g_DispCollPlaneIndexHash.clear();
+    // Let other threads use the cache
+    m_bCacheCreated.val.store(true, std::memory_order_release);
+    return true;
 }
 
 void CDispCollTree::Uncache() {
+    m_bCacheCreated.val.store(false, std::memory_order_relaxed);
     m_aTrisCache  = {};
     m_aEdgePlanes = {};
 }
 
+size_t CDispCollTree::GetCacheMemorySize() const
+{
+    if (!IsCacheGenerated())
+        return 0;
+    return m_aTrisCache.capacity()  * sizeof(CDispCollTriCache)
+         + m_aEdgePlanes.capacity() * sizeof(Vector3);
+}
+
 bool CDispCollTree::AABBTree_Ray(SweptTrace* trace, bool bSide)
 {
     // Check for ray test.
@@ -1105,10 +1252,13 @@ void CDispCollTree::AABBTree_TreeTrisRayTest(SweptTrace* trace, int iNode,
     ////list.invDelta.DuplicateVector(trace->info.invdelta);
     ////list.rayStart.DuplicateVector(trace->info.startpos);
     ////list.rayExtents.DuplicateVector(trace->info.extents + g_Vec3DispCollEpsilons);
-    // ==== The following is the non-SIMD replacement of the code above.
-    list.invDelta   = trace->info.invdelta;
-    list.rayStart   = trace->info.startpos;
-    list.rayExtents = trace->info.extents + g_Vec3DispCollEpsilons;
+    // ==== The following is the replacement of the code above.
+    Vector3 rayExtents = trace->info.extents + g_Vec3DispCollEpsilons;
+    for (int axis = 0; axis < 3; axis++) {
+        list.invDelta  [axis] = simd::Splat4(trace->info.invdelta[axis]);
+        list.rayStart  [axis] = simd::Splat4(trace->info.startpos[axis]);
+        list.rayExtents[axis] = simd::Splat4(rayExtents[axis]);
+    }
     // ==== end of replacement
     
     int listIndex = BuildRayLeafList(iNode, list);
@@ -1164,9 +1314,12 @@ bool CDispCollTree::AABBTree_IntersectAABB(
     ////FourVectors maxs0;
     ////maxs0.DuplicateVector(absMaxs);
     ////FourVectors rayExtents;
-    // ==== The following is the non-SIMD replacement of the code above.
-    Vector3 mins0 = absMins;
-    Vector3 maxs0 = absMaxs;
+    // ==== The following is the replacement of the code above.
+    simd::Float4 mins0[3], maxs0[3];
+    for (int axis = 0; axis < 3; axis++) {
+        mins0[axis] = simd::Splat4(absMins[axis]);
+        maxs0[axis] = simd::Splat4(absMaxs[axis]);
+    }
     // ==== end of replacement
 
     while (listIndex <= maxIndex) {
@@ -1234,7 +1387,9 @@ bool CDispCollTree::AABBTree_IntersectAABB(
     return false;  // No collision
 }
 
-bool CDispCollTree::AABBTree_SweepAABB(SweptTrace* trace)
+template<class Shape>
+bool CDispCollTree::AABBTree_SweepAABB(SweptTrace* trace, bool* pUsedCache,
+    bool* pCreatedCache)
 {
     // Check for hull test.
     if (CheckFlags(BspMap::DispInfo::FLAG_NO_HULL_COLL))
@@ -1250,16 +1405,23 @@ bool CDispCollTree::AABBTree_SweepAABB(SweptTrace* trace)
     ////list.invDelta.DuplicateVector(trace->info.invdelta);
     ////list.rayStart.DuplicateVector(trace->info.startpos);
     ////list.rayExtents.DuplicateVector(trace->info.extents + g_Vec3DispCollEpsilons);
-    // ==== The following is the non-SIMD replacement of the code above.
-    list.invDelta   = trace->info.invdelta;
-    list.rayStart   = trace->info.startpos;
-    list.rayExtents = trace->info.extents + g_Vec3DispCollEpsilons;
+    // ==== The following is the replacement of the code above.
+    Vector3 rayExtents = Shape::GetExtents(trace->info) + g_Vec3DispCollEpsilons;
+    for (int axis = 0; axis < 3; axis++) {
+        list.invDelta  [axis] = simd::Splat4(trace->info.invdelta[axis]);
+        list.rayStart  [axis] = simd::Splat4(trace->info.startpos[axis]);
+        list.rayExtents[axis] = simd::Splat4(rayExtents[axis]);
+    }
     // ==== end of replacement
 
     int listIndex = BuildRayLeafList(0, list);
 
     if (listIndex <= list.maxIndex) {
-        EnsureCacheIsCreated();
+        bool created_cache = EnsureCacheIsCreated();
+        if (pUsedCache)
+            *pUsedCache = true;
+        if (pCreatedCache)
+            *pCreatedCache = created_cache;
         for (; listIndex <= list.maxIndex; listIndex++) {
             int leafIndex = list.nodeList[listIndex] - m_nodes.size();
             int iTri0 = m_leaves[leafIndex].m_tris[0];
@@ -1268,8 +1430,8 @@ bool CDispCollTree::AABBTree_SweepAABB(SweptTrace* trace)
             CDispCollTri* pTri1 = &m_aTris[iTri1];
 
             coll::Debugger::DebugStart_DispCollLeafHit(*this, leafIndex);
-            SweepAABBTriIntersect(trace, iTri0, pTri0);
-            SweepAABBTriIntersect(trace, iTri1, pTri1);
+            SweepAABBTriIntersect<Shape>(trace, iTri0, pTri0);
+            SweepAABBTriIntersect<Shape>(trace, iTri1, pTri1);
             coll::Debugger::DebugFinish_DispCollLeafHit();
         }
     }
@@ -1308,12 +1470,13 @@ bool CDispCollTree::ResolveRayPlaneIntersect(float flStart, float flEnd,
     return true;
 }
 
+template<class Shape>
 inline bool CDispCollTree::FacePlane(const SweptTrace& trace, CDispCollTri* pTri,
     CDispCollHelper* pHelper)
 {
     // Calculate the closest point on box to plane (get extents in that direction).
     Vector3 vecExtent;
-    CalcClosestExtents(pTri->m_vecNormal, trace.info.extents, vecExtent);
+    CalcClosestExtents(pTri->m_vecNormal, Shape::GetExtents(trace.info), vecExtent);
 
     float flExpandDist =
           pTri->m_flDist
@@ -1329,6 +1492,7 @@ inline bool CDispCollTree::FacePlane(const SweptTrace& trace, CDispCollTri* pTri
         pTri->m_flDist, pHelper);
 }
 
+template<class Shape>
 bool FORCEINLINE CDispCollTree::AxisPlanesXYZ(const SweptTrace& trace,
     CDispCollTri* pTri, CDispCollHelper* pHelper)
 {
@@ -1345,10 +1509,11 @@ bool FORCEINLINE CDispCollTree::AxisPlanesXYZ(const SweptTrace& trace,
         }
     };
 
+    const Vector3 extents = Shape::GetExtents(trace.info);
     float flDist, flExpDist, flStart, flEnd;
     for (int iAxis = 2; iAxis >= 0; iAxis--) {
         const float rayStart  = trace.info.startpos[iAxis];
-        const float rayExtent = trace.info.extents [iAxis];
+        const float rayExtent = extents[iAxis];
         const float rayDelta  = trace.info.delta   [iAxis];
 
         // Min
@@ -1374,7 +1539,8 @@ bool FORCEINLINE CDispCollTree::AxisPlanesXYZ(const SweptTrace& trace,
     return true;
 }
 
-void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri)
+void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri,
+    CDispCollPlaneTable& planeTable)
 {
     Vector3* pVerts[3];
     pVerts[0] = &m_aVerts[pTri->GetVert(0)];
@@ -1386,40 +1552,29 @@ void CDispCollTree::Cache_Create(CDispCollTri* pTri, int iTri)
 
     // Edge 1
     vecEdge = *pVerts[1] - *pVerts[0];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossX[0]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossY[0]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossZ[0]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossX[0], planeTable);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossY[0], planeTable);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[0], *pVerts[2], pTri, pCache->m_iCrossZ[0], planeTable);
     // Edge 2
     vecEdge = *pVerts[2] - * pVerts[1];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossX[1]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossY[1]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossZ[1]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossX[1], planeTable);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossY[1], planeTable);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[1], *pVerts[0], pTri, pCache->m_iCrossZ[1], planeTable);
     // Edge 3
     vecEdge = *pVerts[0] - * pVerts[2];
-    Cache_EdgeCrossAxisX(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossX[2]);
-    Cache_EdgeCrossAxisY(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossY[2]);
-    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossZ[2]);
+    Cache_EdgeCrossAxisX(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossX[2], planeTable);
+    Cache_EdgeCrossAxisY(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossY[2], planeTable);
+    Cache_EdgeCrossAxisZ(vecEdge, *pVerts[2], *pVerts[1], pTri, pCache->m_iCrossZ[2], planeTable);
 }
 
-int CDispCollTree::AddPlane(const Vector3& vecNormal)
+int CDispCollTree::AddPlane(const Vector3& vecNormal,
+    CDispCollPlaneTable& planeTable)
 {
-    DispCollPlaneIndex_t planeIndex;
-
-    planeIndex.vecPlane = vecNormal;
-    planeIndex.index = m_aEdgePlanes.size();
-
-    auto insert_result = g_DispCollPlaneIndexHash.insert(planeIndex);
-    bool bDidInsert = insert_result.second;
-
-    if (!bDidInsert) {
-        const DispCollPlaneIndex_t& existingEntry = *insert_result.first;
-        if (SourceSdkVectorEqual(existingEntry.vecPlane, vecNormal))
-            return existingEntry.index;
-        else
-            return (existingEntry.index | 0x8000);
-    }
-
     int index = m_aEdgePlanes.size();
+    int existingIndex = planeTable.FindOrInsert(vecNormal, m_aEdgePlanes, index);
+    if (existingIndex != -1)
+        return existingIndex;
+
     m_aEdgePlanes.push_back(vecNormal);
     return index;
 }
@@ -1428,7 +1583,7 @@ int CDispCollTree::AddPlane(const Vector3& vecNormal)
 //       used.
 bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, CDispCollPlaneTable& planeTable)
 {
     // Calculate the normal: edge x axisX = ( 0.0, edgeZ, -edgeY )
     Vector3 vecNormal{ 0.0f, vecEdge.z(), -vecEdge.y() };
@@ -1467,7 +1622,7 @@ bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeTable));
     // Created the cached edge.
     return true;
 }
@@ -1476,7 +1631,7 @@ bool CDispCollTree::Cache_EdgeCrossAxisX(const Vector3& vecEdge,
 //       used.
 bool CDispCollTree::Cache_EdgeCrossAxisY(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, CDispCollPlaneTable& planeTable)
 {
     // Calculate the normal: edge x axisY = ( -edgeZ, 0.0, edgeX )
     Vector3 vecNormal{ -vecEdge.z(), 0.0f, vecEdge.x() };
@@ -1515,14 +1670,14 @@ bool CDispCollTree::Cache_EdgeCrossAxisY(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeTable));
     // Created the cached edge.
     return true;
 }
 
 bool CDispCollTree::Cache_EdgeCrossAxisZ(const Vector3& vecEdge,
     const Vector3& vecOnEdge, const Vector3& vecOffEdge, CDispCollTri* pTri,
-    unsigned short& iPlane)
+    unsigned short& iPlane, CDispCollPlaneTable& planeTable)
 {
     // Calculate the normal: edge x axisZ = ( edgeY, -edgeX, 0.0 )
     Vector3 vecNormal{ vecEdge.y(), -vecEdge.x(), 0.0f };
@@ -1561,12 +1716,12 @@ bool CDispCollTree::Cache_EdgeCrossAxisZ(const Vector3& vecEdge,
     }
 
     // Add edge plane to edge plane list.
-    iPlane = static_cast<unsigned short>(AddPlane(vecNormal));
+    iPlane = static_cast<unsigned short>(AddPlane(vecNormal, planeTable));
     // Created the cached edge.
     return true;
 }
 
-template <int AXIS>
+template <int AXIS, class Shape>
 bool CDispCollTree::EdgeCrossAxis(const SweptTrace& trace, unsigned short iPlane,
     CDispCollHelper* pHelper)
 {
@@ -1590,12 +1745,13 @@ bool CDispCollTree::EdgeCrossAxis(const SweptTrace& trace, unsigned short iPlane
     vecNormal[AXIS] = 0.0f;
 
     // Calculate the closest point on box to plane (get extents in that direction).
+    const Vector3 extents = Shape::GetExtents(trace.info);
     Vector3 vecExtent;
     //vecExtent[AXIS] = 0.0f;
-    if (vecNormal[OTHER_AXIS1] < 0.0f) vecExtent[OTHER_AXIS1] = +trace.info.extents[OTHER_AXIS1];
-    else                               vecExtent[OTHER_AXIS1] = -trace.info.extents[OTHER_AXIS1];
-    if (vecNormal[OTHER_AXIS2] < 0.0f) vecExtent[OTHER_AXIS2] = +trace.info.extents[OTHER_AXIS2];
-    else                               vecExtent[OTHER_AXIS2] = -trace.info.extents[OTHER_AXIS2];
+    if (vecNormal[OTHER_AXIS1] < 0.0f) vecExtent[OTHER_AXIS1] = +extents[OTHER_AXIS1];
+    else                               vecExtent[OTHER_AXIS1] = -extents[OTHER_AXIS1];
+    if (vecNormal[OTHER_AXIS2] < 0.0f) vecExtent[OTHER_AXIS2] = +extents[OTHER_AXIS2];
+    else                               vecExtent[OTHER_AXIS2] = -extents[OTHER_AXIS2];
 
     // Expand the plane by the extents of the box to reduce the swept
     // box/triangle test to a ray/extruded triangle test (one of the triangles
@@ -1617,24 +1773,28 @@ bool CDispCollTree::EdgeCrossAxis(const SweptTrace& trace, unsigned short iPlane
     return ResolveRayPlaneIntersect(flStart, flEnd, vecNormal, flDist, pHelper);
 }
 
+template<class Shape>
 inline bool CDispCollTree::EdgeCrossAxisX(const SweptTrace& trace,
     unsigned short iPlane, CDispCollHelper* pHelper)
 {
-    return EdgeCrossAxis<0>(trace, iPlane, pHelper);
+    return EdgeCrossAxis<0, Shape>(trace, iPlane, pHelper);
 }
 
+template<class Shape>
 inline bool CDispCollTree::EdgeCrossAxisY(const SweptTrace& trace,
     unsigned short iPlane, CDispCollHelper* pHelper)
 {
-    return EdgeCrossAxis<1>(trace, iPlane, pHelper);
+    return EdgeCrossAxis<1, Shape>(trace, iPlane, pHelper);
 }
 
+template<class Shape>
 inline bool CDispCollTree::EdgeCrossAxisZ(const SweptTrace& trace,
     unsigned short iPlane, CDispCollHelper* pHelper)
 {
-    return EdgeCrossAxis<2>(trace, iPlane, pHelper);
+    return EdgeCrossAxis<2, Shape>(trace, iPlane, pHelper);
 }
 
+template<class Shape>
 void CDispCollTree::SweepAABBTriIntersect(SweptTrace* trace, int iTri,
     CDispCollTri* pTri)
 {
@@ -1649,7 +1809,7 @@ void CDispCollTree::SweepAABBTriIntersect(SweptTrace* trace, int iTri,
         return;
 
     // Test against the axis planes.
-    if (!AxisPlanesXYZ(*trace, pTri, &helper))
+    if (!AxisPlanesXYZ<Shape>(*trace, pTri, &helper))
         return;
 
     // There are 9 edge tests - edges 1, 2, 3 cross with the box edge
@@ -1664,20 +1824,20 @@ void CDispCollTree::SweepAABBTriIntersect(SweptTrace* trace, int iTri,
     CDispCollTriCache* pCache = &m_aTrisCache[iTri];
 
     // Edges 1-3, interleaved - axis tests are 2d tests
-    if (!EdgeCrossAxisX(*trace, pCache->m_iCrossX[0], &helper)) return;
-    if (!EdgeCrossAxisX(*trace, pCache->m_iCrossX[1], &helper)) return;
-    if (!EdgeCrossAxisX(*trace, pCache->m_iCrossX[2], &helper)) return;
+    if (!EdgeCrossAxisX<Shape>(*trace, pCache->m_iCrossX[0], &helper)) return;
+    if (!EdgeCrossAxisX<Shape>(*trace, pCache->m_iCrossX[1], &helper)) return;
+    if (!EdgeCrossAxisX<Shape>(*trace, pCache->m_iCrossX[2], &helper)) return;
 
-    if (!EdgeCrossAxisY(*trace, pCache->m_iCrossY[0], &helper)) return;
-    if (!EdgeCrossAxisY(*trace, pCache->m_iCrossY[1], &helper)) return;
-    if (!EdgeCrossAxisY(*trace, pCache->m_iCrossY[2], &helper)) return;
+    if (!EdgeCrossAxisY<Shape>(*trace, pCache->m_iCrossY[0], &helper)) return;
+    if (!EdgeCrossAxisY<Shape>(*trace, pCache->m_iCrossY[1], &helper)) return;
+    if (!EdgeCrossAxisY<Shape>(*trace, pCache->m_iCrossY[2], &helper)) return;
 
-    if (!EdgeCrossAxisZ(*trace, pCache->m_iCrossZ[0], &helper)) return;
-    if (!EdgeCrossAxisZ(*trace, pCache->m_iCrossZ[1], &helper)) return;
-    if (!EdgeCrossAxisZ(*trace, pCache->m_iCrossZ[2], &helper)) return;
+    if (!EdgeCrossAxisZ<Shape>(*trace, pCache->m_iCrossZ[0], &helper)) return;
+    if (!EdgeCrossAxisZ<Shape>(*trace, pCache->m_iCrossZ[1], &helper)) return;
+    if (!EdgeCrossAxisZ<Shape>(*trace, pCache->m_iCrossZ[2], &helper)) return;
 
     // Test against the triangle face plane.
-    if (!FacePlane(*trace, pTri, &helper))
+    if (!FacePlane<Shape>(*trace, pTri, &helper))
         return;
 
     if ((helper.m_flStartFrac < helper.m_flEndFrac) ||
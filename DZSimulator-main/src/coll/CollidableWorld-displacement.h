@@ -1,14 +1,19 @@
 #ifndef COLL_COLLIDABLEWORLD_DISPLACEMENT_H_
 #define COLL_COLLIDABLEWORLD_DISPLACEMENT_H_
 
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Vector3.h>
 
+#include "coll/Benchmark.h"
+#include "coll/Simd.h"
 #include "coll/SweptTrace.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BspMap.h"
 
 // @OPTIMIZATION Test impact of __forceinline
@@ -96,10 +101,12 @@ public:
     ////FourVectors m_mins;
     ////FourVectors m_maxs;
     
-    // ==== The following is the non-SIMD replacement of the code above.
-    // AABBs of all 4 node children, index 0=SW, 1=SE, 2=NW, 3=NE
-    Magnum::Vector3 m_mins[4];
-    Magnum::Vector3 m_maxs[4];
+    // ==== The following is the replacement of the code above, using the same
+    //      structure-of-arrays layout that coll/Simd.h loads from.
+    // AABBs of all 4 node children, indexed by [axis][child].
+    // Child index 0=SW, 1=SE, 2=NW, 3=NE
+    alignas(simd::FLOAT4_ALIGNMENT) float m_mins[3][4];
+    alignas(simd::FLOAT4_ALIGNMENT) float m_maxs[3][4];
 };
 
 class CDispCollLeaf
@@ -118,16 +125,19 @@ struct rayleaflist_t
     ////FourVectors rayStart;
     ////FourVectors rayExtents;
     ////FourVectors invDelta;
-    // ==== The following is the non-SIMD replacement of the code above.
-    Magnum::Vector3 rayStart;
-    Magnum::Vector3 rayExtents;
-    Magnum::Vector3 invDelta;
+    // ==== The following is the replacement of the code above. Each value is
+    //      splatted across all 4 lanes, indexed by axis.
+    simd::Float4 rayStart[3];
+    simd::Float4 rayExtents[3];
+    simd::Float4 invDelta[3];
     // ==== end of replacement
 
     int nodeList[MAX_AABB_LIST];
     int maxIndex;
 };
 
+class CDispCollPlaneTable; // Edge plane lookup table, only used during cache creation
+
 // Displacement Collision Tree Data
 class CDispCollTree
 {
@@ -141,8 +151,15 @@ public:
 
     // Hull Sweeps. DOES utilize collision caches and might create one.
     // Does nothing and returns false if displacement has NO_HULL_COLL flag set.
-    // CAUTION: Not thread-safe yet! (Due to unprotected g_DispCollPlaneIndexHash)
-    bool AABBTree_SweepAABB(SweptTrace* trace);
+    // Thread-safe, multiple threads can sweep against the same displacement.
+    // If pUsedCache is given, it's set to true if the collision cache was used.
+    // If pCreatedCache is given, it's set to true if this call created the
+    // collision cache, i.e. if it wasn't created by another thread before.
+    // Shape is the trace's shape, see coll/TraceShape.h. Instantiated for
+    // every hull shape that DispatchTraceShape() uses.
+    template<class Shape = RuntimeShape>
+    bool AABBTree_SweepAABB(SweptTrace* trace, bool* pUsedCache = nullptr,
+                            bool* pCreatedCache = nullptr);
 
     // Hull Intersection. DOES NOT utilize collision caches.
     // Does nothing and returns false if displacement has NO_HULL_COLL flag set.
@@ -167,8 +184,18 @@ public:
     inline int Nodes_GetIndexFromComponents(int x, int y) const;
 
     bool IsCacheGenerated() const;
-    void EnsureCacheIsCreated();
-    void Uncache();
+    bool EnsureCacheIsCreated(); // Thread-safe. Returns true if this call created the cache.
+    void Uncache(); // CAUTION: Must not be called while traces are running!
+    size_t GetCacheMemorySize() const; // In bytes, 0 if no cache is created
+
+#if COLL_BENCHMARK_ENABLED
+    // Builds the list of tree nodes whose boxes are hit by the given hull
+    // trace, starting at the root node. Returns the list index of the first
+    // leaf node. If use_simd is false, child boxes are tested one by one
+    // instead, serving as a reference for benchmarks.
+    int Benchmark_BuildRayLeafList(const SweptTrace::Info& info,
+                                   rayleaflist_t& list, bool use_simd);
+#endif
 
 private:
     void AABBTree_Create      (const std::vector<Magnum::Vector3>& disp_vertices);
@@ -182,25 +209,25 @@ private:
     int FORCEINLINE BuildRayLeafList(int iNode, rayleaflist_t& list);
 
 private:
-    void SweepAABBTriIntersect(SweptTrace* trace, int iTri, CDispCollTri* pTri);
+    template<class Shape> void SweepAABBTriIntersect(SweptTrace* trace, int iTri, CDispCollTri* pTri);
 
-    void Cache_Create(CDispCollTri* pTri, int iTri);
-    bool Cache_EdgeCrossAxisX(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
-    bool Cache_EdgeCrossAxisY(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
-    bool Cache_EdgeCrossAxisZ(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane);
+    void Cache_Create(CDispCollTri* pTri, int iTri, CDispCollPlaneTable& planeTable);
+    bool Cache_EdgeCrossAxisX(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, CDispCollPlaneTable& planeTable);
+    bool Cache_EdgeCrossAxisY(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, CDispCollPlaneTable& planeTable);
+    bool Cache_EdgeCrossAxisZ(const Magnum::Vector3& vecEdge, const Magnum::Vector3& vecOnEdge, const Magnum::Vector3& vecOffEdge, CDispCollTri* pTri, unsigned short& iPlane, CDispCollPlaneTable& planeTable);
 
-    inline bool FacePlane(const SweptTrace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
-    bool FORCEINLINE AxisPlanesXYZ(const SweptTrace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
-    inline bool EdgeCrossAxisX(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
-    inline bool EdgeCrossAxisY(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
-    inline bool EdgeCrossAxisZ(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
+    template<class Shape> inline bool FacePlane(const SweptTrace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
+    template<class Shape> bool FORCEINLINE AxisPlanesXYZ(const SweptTrace& trace, CDispCollTri* pTri, CDispCollHelper* pHelper);
+    template<class Shape> inline bool EdgeCrossAxisX(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
+    template<class Shape> inline bool EdgeCrossAxisY(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
+    template<class Shape> inline bool EdgeCrossAxisZ(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
 
     bool ResolveRayPlaneIntersect(float flStart, float flEnd, const Magnum::Vector3& vecNormal, float flDist, CDispCollHelper* pHelper);
-    template <int AXIS> bool EdgeCrossAxis(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
+    template <int AXIS, class Shape> bool EdgeCrossAxis(const SweptTrace& trace, unsigned short iPlane, CDispCollHelper* pHelper);
 
     // Utility
     inline void CalcClosestExtents(const Magnum::Vector3& vecPlaneNormal, const Magnum::Vector3& vecBoxExtents, Magnum::Vector3& vecBoxPoint);
-    int AddPlane(const Magnum::Vector3& vecNormal);
+    int AddPlane(const Magnum::Vector3& vecNormal, CDispCollPlaneTable& planeTable);
     bool FORCEINLINE IsLeafNode(int iNode);
 
 public:
@@ -222,6 +249,22 @@ private:
     std::vector<CDispCollTriCache> m_aTrisCache;
     std::vector<Magnum::Vector3>   m_aEdgePlanes;
 
+    // std::atomic<bool> that can be copied and moved, which isn't done
+    // atomically. Only copy or move while no other thread accesses it!
+    struct CopyableAtomicBool {
+        std::atomic<bool> val{ false };
+        CopyableAtomicBool() = default;
+        CopyableAtomicBool(const CopyableAtomicBool& other)
+            : val{ other.val.load(std::memory_order_relaxed) } {}
+        CopyableAtomicBool& operator=(const CopyableAtomicBool& other) {
+            val.store(other.val.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            return *this;
+        }
+    };
+    // Set once the collision cache is completely created. Traces must only
+    // read the collision cache after seeing this set.
+    CopyableAtomicBool m_bCacheCreated;
+
 private:
     // Debugger needs to debug, let it access private members.
     friend class Debugger;
@@ -1,5 +1,6 @@
 #include "coll/CollidableWorld-funcbrush.h"
 
+#include <cassert>
 #include <cstdint>
 #include <string>
 #include <vector>
@@ -8,13 +9,15 @@
 
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Angle.h>
+#include <Magnum/Math/Matrix3.h>
 #include <Magnum/Math/Matrix4.h>
 #include <Magnum/Math/Vector3.h>
 
+#include "coll/CollidableWorld-brush.h"
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/SweptTrace.h"
-#include "csgo_parsing/BrushSeparation.h"
+#include "coll/TraceTransform.h"
 #include "csgo_parsing/BspMap.h"
 #include "csgo_parsing/utils.h"
 #include "utils_3d.h"
@@ -27,12 +30,6 @@ using Brush          = BspMap::Brush;
 using BrushSide      = BspMap::BrushSide;
 using Ent_func_brush = BspMap::Ent_func_brush;
 
-uint64_t CollidableWorld::GetSweptTraceCost_FuncBrush(uint32_t func_brush_idx)
-{
-    // See BVH::GetSweptLeafTraceCost() for details and considerations.
-    return 1; // Is func_brush trace cost dependent on total brushside count?
-}
-
 void CollidableWorld::DoSweptTrace_FuncBrush(SweptTrace* trace,
     uint32_t func_brush_idx)
 {
@@ -51,76 +48,23 @@ void CollidableWorld::DoSweptTrace_FuncBrush(SweptTrace* trace,
     //               only very few func_brush entities in DZ maps, so it might
     //               not matter.
 
-    std::shared_ptr<const BspMap> bsp_map = pImpl->origin_bsp_map;
-    const Ent_func_brush& func_brush = bsp_map->entities_func_brush[func_brush_idx];
-    if (!func_brush.IsSolid())
-        return; // Skip this func_brush
-
-    Vector3 translated_trace_start = trace->info.startpos - func_brush.origin;
-
-    // Order of axis rotations is important! First roll, then pitch, then yaw rotation!
-    // @Optimization Use 3x3 rotation matrix, not 4x4, or quaternions
-    Matrix4 rot_transformation =
-        Matrix4::rotationZ(Deg{ func_brush.angles[1] }) * // (yaw)   rotation around z axis
-        Matrix4::rotationY(Deg{ func_brush.angles[0] }) * // (pitch) rotation around y axis
-        Matrix4::rotationX(Deg{ func_brush.angles[2] });  // (roll)  rotation around x axis
-
-    if (func_brush.model.size() == 0 || func_brush.model[0] != '*')
-        return; // Invalid, abort
-    std::string idxStr = func_brush.model.substr(1);
-    int64_t modelIdx = utils::ParseIntFromString(idxStr, -1);
-    if (modelIdx <= 0 || modelIdx >= (int64_t)bsp_map->models.size())
+    // NOTE: Whether this func_brush is currently solid is decided by
+    //       coll::DynamicBVH, it only traces against enabled func_brushes.
+    assert(pImpl->coll_caches_funcbrush != Corrade::Containers::NullOpt);
+    const CollisionCache_FuncBrush& collcache =
+        (*pImpl->coll_caches_funcbrush)[func_brush_idx];
+    if (collcache.model_idx == -1)
         return; // Invalid model index, abort
 
-    // NOTE: Rarely in CSGO maps, brushes have invalid brushsides/planes, i.e.
-    //       they result in an AABB where (maxs[i] <= mins[i]) for some i.
-    //       For the most part, we don't care about these rare cases, except for
-    //       one func_brush in CSGO's "Only Up!" map by leander.
-    //       (https://steamcommunity.com/sharedfiles/filedetails/?id=3012684086)
-    bool are_we_in_csgo_only_up_map =
-        bsp_map->map_version == 2915 && bsp_map->sky_name.compare("vertigoblue_hdr") == 0;
-
-    bool hit = false;
-    for (size_t brush_idx : bsp_map->GetModelBrushIndices(modelIdx)) {
-        const Brush& brush = bsp_map->brushes[brush_idx];
-
-        // Special case: grenadeclip brushes don't work in func_brush entities
-        // (for unknown reasons)
-        static auto test_f_exclude =
-            BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::GRENADECLIP);
-        if (test_f_exclude.first && test_f_exclude.first(brush))
-            continue;
-
-        static auto test_f_1 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::SOLID);
-        static auto test_f_2 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::PLAYERCLIP);
-        static auto test_f_3 = BrushSeparation::getBrushCategoryTestFuncs(BrushSeparation::LADDER);
+    // Transform trace into the coordinate system of the untranslated and
+    // unrotated brush model, brush planes don't need to be transformed then
+    LocalTrace local_trace = TransformTraceToLocalSpace(collcache.inv_transform,
+        trace->info.startpos, trace->info.delta, trace->info.extents);
 
-        bool solid_to_player = false;
-        if (test_f_1.first && test_f_1.first(brush)) solid_to_player = true;
-        if (test_f_2.first && test_f_2.first(brush)) solid_to_player = true;
-        if (test_f_3.first && test_f_3.first(brush)) solid_to_player = true;
-        if (!solid_to_player)
+    for (const CollisionCache_FuncBrush::Brush& brush : collcache.brushes) {
+        if (!(brush.contents & trace->info.contents_mask))
             continue;
 
-        // @Optimization Ensure the 6 axial brushsides/planes are processed first.
-        std::vector<Plane> planes;
-        for (int i = 0; i < brush.num_sides; i++) {
-            const BrushSide& side = bsp_map->brushsides[brush.first_side + i];
-
-            if (trace->info.isray && side.bevel)
-                continue;
-
-            // HACKHACK A specific brush in the CSGO Only Up map (by leander)
-            //          has 2 invalid planes that cause issues, skip these.
-            if (are_we_in_csgo_only_up_map && brush_idx == 2537)
-                if (i == 26 || i == 30)
-                    continue;
-
-            Plane plane = bsp_map->planes[side.plane_num];
-            plane.normal = rot_transformation.transformVector(plane.normal);
-            planes.push_back(plane);
-        }
-
         // -------- start of source-sdk-2013 code --------
         // (taken and modified from source-sdk-2013/<...>/src/utils/vrad/trace.cpp)
         
@@ -129,10 +73,8 @@ void CollidableWorld::DoSweptTrace_FuncBrush(SweptTrace* trace,
         const float DIST_EPSILON = 0.03125; // 1/32 epsilon to keep floating point happy
         const float NEVER_UPDATED = -9999;
 
-        const Vector3 start = translated_trace_start;
-        const Vector3 end   = translated_trace_start + trace->info.delta;
-        const Vector3 mins = -trace->info.extents; // Box case only (!trace->info.isray)
-        const Vector3 maxs = +trace->info.extents; // Box case only (!trace->info.isray)
+        const Vector3 start = local_trace.start;
+        const Vector3 end   = local_trace.start + local_trace.delta;
 
         //const BrushSide* leadside = nullptr;
         Plane clipplane;
@@ -142,27 +84,30 @@ void CollidableWorld::DoSweptTrace_FuncBrush(SweptTrace* trace,
         bool  startout = false;
 
         float   dist;
-        Vector3 ofs;
         float   d1, d2;
         float   f;
 
         bool skip_brush = false;
-        for (const Plane& plane : planes) {
+        for (uint32_t i = 0; i < brush.num_planes; i++) {
+            const CollisionCache_FuncBrush::BrushPlane& brush_plane =
+                collcache.planes[brush.first_plane + i];
+            const Plane& plane = brush_plane.plane;
             if (trace->info.isray) // Special point case
             {
-                // Commented out because bevel planes were sorted out earlier
-                //if (side.bevel == 1) // Don't ray trace against bevel planes
-                //    continue;
+                if (brush_plane.bevel) // Don't ray trace against bevel planes
+                    continue;
 
                 dist = plane.dist;
             }
             else // General box case
             {
-                ofs.x() = (plane.normal.x() < 0.0f) ? maxs.x() : mins.x();
-                ofs.y() = (plane.normal.y() < 0.0f) ? maxs.y() : mins.y();
-                ofs.z() = (plane.normal.z() < 0.0f) ? maxs.z() : mins.z();
-
-                dist = plane.dist - Math::dot(ofs, plane.normal);
+                // Offset the plane by the distance of the trace box's
+                // contact point to its center. The box is oriented in the
+                // brush model's coordinate system.
+                dist = plane.dist
+                    + Math::abs(Math::dot(local_trace.extent_axes[0], plane.normal))
+                    + Math::abs(Math::dot(local_trace.extent_axes[1], plane.normal))
+                    + Math::abs(Math::dot(local_trace.extent_axes[2], plane.normal));
             }
 
             d1 = Math::dot(start, plane.normal) - dist;
@@ -218,13 +163,130 @@ void CollidableWorld::DoSweptTrace_FuncBrush(SweptTrace* trace,
                 trace->results.fraction = enterfrac;
                 //trace->results.surface = leadside->texinfo; // Might be -1
                 //trace->contents = brush.contents; // TODO: Return hit contents in a better way
-                trace->results.plane_normal = clipplane.normal;
+                trace->results.plane_normal = collcache.rotation * clipplane.normal;
             }
         }
         // --------- end of source-sdk-2013 code ---------
     }
 }
 
+bool CollidableWorld::IsHullInSolid_FuncBrush(const SweptTrace::Info& hull,
+    uint32_t func_brush_idx)
+{
+    ZoneScoped;
+
+    assert(pImpl->coll_caches_funcbrush != Corrade::Containers::NullOpt);
+    const CollisionCache_FuncBrush& collcache =
+        (*pImpl->coll_caches_funcbrush)[func_brush_idx];
+    if (collcache.model_idx == -1)
+        return false; // Invalid model index, abort
+
+    LocalTrace local_hull = TransformTraceToLocalSpace(collcache.inv_transform,
+        hull.startpos, Vector3{ 0.0f }, hull.extents);
+
+    // Same plane tests as DoSweptTrace_FuncBrush() with identical start and
+    // end points: The hull is in a brush if it isn't in front of any of the
+    // brush's planes.
+    for (const CollisionCache_FuncBrush::Brush& brush : collcache.brushes) {
+        if (brush.num_planes == 0)
+            continue;
+        if (!(brush.contents & hull.contents_mask))
+            continue;
+
+        bool is_in_brush = true;
+        for (uint32_t i = 0; i < brush.num_planes; i++) {
+            const CollisionCache_FuncBrush::BrushPlane& brush_plane =
+                collcache.planes[brush.first_plane + i];
+            if (hull.isray && brush_plane.bevel)
+                continue;
+
+            const Plane& plane = brush_plane.plane;
+            float dist = plane.dist;
+            if (!hull.isray)
+                dist += Math::abs(Math::dot(local_hull.extent_axes[0], plane.normal))
+                      + Math::abs(Math::dot(local_hull.extent_axes[1], plane.normal))
+                      + Math::abs(Math::dot(local_hull.extent_axes[2], plane.normal));
+
+            if (Math::dot(local_hull.start, plane.normal) - dist > 0.0f) {
+                is_in_brush = false; // In front of a plane, hull is outside
+                break;
+            }
+        }
+        if (is_in_brush)
+            return true;
+    }
+    return false;
+}
+
+std::vector<CollisionCache_FuncBrush> coll::Create_CollisionCaches_FuncBrush(
+    const BspMap& bsp_map)
+{
+    // NOTE: Rarely in CSGO maps, brushes have invalid brushsides/planes, i.e.
+    //       they result in an AABB where (maxs[i] <= mins[i]) for some i.
+    //       For the most part, we don't care about these rare cases, except for
+    //       one func_brush in CSGO's "Only Up!" map by leander.
+    //       (https://steamcommunity.com/sharedfiles/filedetails/?id=3012684086)
+    bool are_we_in_csgo_only_up_map =
+        bsp_map.map_version == 2915 && bsp_map.sky_name.compare("vertigoblue_hdr") == 0;
+
+    std::vector<CollisionCache_FuncBrush> collcaches;
+    collcaches.reserve(bsp_map.entities_func_brush.size());
+    for (const Ent_func_brush& func_brush : bsp_map.entities_func_brush) {
+        int64_t model_idx = -1;
+        if (func_brush.model.size() > 0 && func_brush.model[0] == '*') {
+            model_idx = utils::ParseIntFromString(func_brush.model.substr(1), -1);
+            if (model_idx <= 0 || model_idx >= (int64_t)bsp_map.models.size())
+                model_idx = -1; // Invalid model index
+        }
+
+        // Order of axis rotations is important! First roll, then pitch, then yaw rotation!
+        Matrix3 rotation = (
+            Matrix4::rotationZ(Deg{ func_brush.angles[1] }) * // (yaw)   rotation around z axis
+            Matrix4::rotationY(Deg{ func_brush.angles[0] }) * // (pitch) rotation around y axis
+            Matrix4::rotationX(Deg{ func_brush.angles[2] })    // (roll)  rotation around x axis
+        ).rotationScaling();
+
+        CollisionCache_FuncBrush& collcache = collcaches.emplace_back(CollisionCache_FuncBrush{
+            .model_idx     = model_idx,
+            .inv_transform = TraceTransform::FromInverseOf(rotation, func_brush.origin),
+            .rotation      = rotation,
+            .brushes       = {},
+            .planes        = {}
+        });
+        if (model_idx == -1)
+            continue;
+
+        for (size_t brush_idx : bsp_map.GetModelBrushIndices(model_idx)) {
+            const Brush& brush = bsp_map.brushes[brush_idx];
+
+            ContentsMask contents = GetBrushContents(brush);
+            if (contents == 0 || (contents & CONTENTS_GRENADECLIP))
+                continue; // Brush doesn't take part in collision
+
+            uint32_t first_plane = collcache.planes.size();
+            for (uint32_t i = 0; i < brush.num_sides; i++) {
+                // HACKHACK A specific brush in the CSGO Only Up map (by leander)
+                //          has 2 invalid planes that cause issues, skip these.
+                if (are_we_in_csgo_only_up_map && brush_idx == 2537)
+                    if (i == 26 || i == 30)
+                        continue;
+
+                const BrushSide& side = bsp_map.brushsides[brush.first_side + i];
+                collcache.planes.push_back({
+                    .plane = bsp_map.planes[side.plane_num],
+                    .bevel = side.bevel != 0
+                });
+            }
+            collcache.brushes.push_back({
+                .contents    = contents,
+                .first_plane = first_plane,
+                .num_planes  = (uint32_t)collcache.planes.size() - first_plane
+            });
+        }
+    }
+    return collcaches;
+}
+
 bool coll::CalcAabb_FuncBrush(size_t func_brush_idx, const BspMap& bsp_map,
     Vector3* aabb_mins, Vector3* aabb_maxs)
 {
@@ -274,3 +336,25 @@ bool coll::CalcAabb_FuncBrush(size_t func_brush_idx, const BspMap& bsp_map,
     if (aabb_maxs) *aabb_maxs = maxs;
     return true; // success
 }
+
+ContentsMask coll::GetContents_FuncBrush(size_t func_brush_idx,
+    const BspMap& bsp_map)
+{
+    const Ent_func_brush& func_brush = bsp_map.entities_func_brush[func_brush_idx];
+    if (func_brush.model.size() == 0 || func_brush.model[0] != '*')
+        return 0; // Invalid model
+    int64_t model_idx = utils::ParseIntFromString(func_brush.model.substr(1), -1);
+    if (model_idx <= 0 || model_idx >= (int64_t)bsp_map.models.size())
+        return 0; // Invalid model
+
+    ContentsMask contents = 0;
+    for (size_t brush_idx : bsp_map.GetModelBrushIndices(model_idx)) {
+        ContentsMask brush_contents = GetBrushContents(bsp_map.brushes[brush_idx]);
+        // Grenadeclip brushes don't work in func_brush entities, see
+        // CollidableWorld::DoSweptTrace_FuncBrush()
+        if (brush_contents & CONTENTS_GRENADECLIP)
+            continue;
+        contents |= brush_contents;
+    }
+    return contents;
+}
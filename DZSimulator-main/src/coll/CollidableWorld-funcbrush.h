@@ -1,8 +1,14 @@
 #ifndef COLL_COLLIDABLEWORLD_FUNCBRUSH_H_
 #define COLL_COLLIDABLEWORLD_FUNCBRUSH_H_
 
+#include <cstdint>
+#include <vector>
+
+#include <Magnum/Math/Matrix3.h>
 #include <Magnum/Math/Vector3.h>
 
+#include "coll/SweptTrace.h"
+#include "coll/TraceTransform.h"
 #include "csgo_parsing/BspMap.h"
 
 namespace coll {
@@ -15,6 +21,44 @@ namespace coll {
         Magnum::Vector3* aabb_mins,
         Magnum::Vector3* aabb_maxs);
 
+    // Returns the OR-ed contents flags of all brushes of the func_brush that
+    // take part in collision. func_brush_idx is an index into
+    // bsp_map.entities_func_brush .
+    ContentsMask GetContents_FuncBrush(size_t func_brush_idx,
+        const csgo_parsing::BspMap& bsp_map);
+
+    // Precomputed data per func_brush to speed up collision calculations
+    struct CollisionCache_FuncBrush {
+        int64_t model_idx; // idx into BspMap.models, -1 if func_brush is invalid
+
+        // Reverses func_brush translation and rotation
+        TraceTransform  inv_transform;
+        // func_brush rotation, transforms hit plane normals back
+        Magnum::Matrix3 rotation;
+
+        struct BrushPlane {
+            csgo_parsing::BspMap::Plane plane; // In the brush model's space
+            bool bevel; // Rays don't collide with bevel planes
+        };
+        struct Brush {
+            ContentsMask contents;
+            uint32_t     first_plane; // idx into planes
+            uint32_t     num_planes;
+        };
+        // Brushes of the func_brush's model that take part in collision, in
+        // the model's brush order. Grenadeclip brushes don't work in func_brush
+        // entities (for unknown reasons), even if they have other contents as
+        // well, so they're left out, like brushes without relevant contents.
+        std::vector<Brush> brushes;
+        // Planes of each brush are contiguous and in brushside order
+        std::vector<BrushPlane> planes;
+    };
+
+    // Returns the collision cache of each func_brush, indexed like
+    // bsp_map.entities_func_brush .
+    std::vector<CollisionCache_FuncBrush> Create_CollisionCaches_FuncBrush(
+        const csgo_parsing::BspMap& bsp_map);
+
 
     // ... (Add further func_brush-related collision code here)
 
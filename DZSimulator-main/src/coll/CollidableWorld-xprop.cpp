@@ -2,9 +2,12 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstdint>
 #include <map>
+#include <memory>
 #include <string>
 #include <span>
 #include <vector>
@@ -21,6 +24,7 @@
 #include "coll/CollidableWorld.h"
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/SweptTrace.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BspMap.h"
 #include "utils_3d.h"
 
@@ -69,16 +73,108 @@ static bool PlaneEqual(const Plane& p, const Vector3& normal, float dist,
 ////////////////////////////////////////////////////////////////////////////////
 
 
+// Estimated cost of tracing a static/dynamic prop with the given collision model
+static uint64_t GetSweptTraceCost_XProp(const CollisionModel& cmodel)
+{
+    // See BVH::GetSweptLeafTraceCost() for details and considerations.
+    // XProp traces transform the trace into prop space and test it against
+    // every section AABB, or traverse the model's section BVH if it has one.
+    // Only sections whose AABB was hit get clipped against their planes.
+    // Assume that's the case for half of the sections. The fixed 8 units for
+    // the trace transformation are a guess, like that assumption.
+    uint64_t total_plane_cnt = 0;
+    for (const auto& planes : cmodel.section_planes)
+        total_plane_cnt += planes.size();
+    uint64_t section_aabb_test_cost = 2 * cmodel.section_planes.size();
+    if (!cmodel.section_bvh.empty()) // Assume 2 nodes are tested per BVH level
+        section_aabb_test_cost = 4 * (uint64_t)std::ceil(std::log2(cmodel.section_planes.size()));
+    return 8 + section_aabb_test_cost + total_plane_cnt / 2;
+}
+
 uint64_t CollidableWorld::GetSweptTraceCost_StaticProp(uint32_t sprop_idx)
 {
     // See BVH::GetSweptLeafTraceCost() for details and considerations.
-    return 1; // Is sprop trace cost dependent on triangle count?
+    const BspMap::StaticProp& sprop = pImpl->origin_bsp_map->static_props[sprop_idx];
+    const std::string&     mdl_path = pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
+    assert(pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
+    const auto& collmodel_iter = pImpl->xprop_coll_models->find(mdl_path);
+    if (!sprop.IsSolidWithVPhysics() || collmodel_iter == pImpl->xprop_coll_models->end())
+        return 1; // Trace returns right away
+    return GetSweptTraceCost_XProp(collmodel_iter->second);
 }
 
 uint64_t CollidableWorld::GetSweptTraceCost_DynamicProp(uint32_t dprop_idx)
 {
     // See BVH::GetSweptLeafTraceCost() for details and considerations.
-    return 1; // Is dprop trace cost dependent on triangle count?
+    const BspMap::Ent_prop_dynamic& dprop =
+        pImpl->origin_bsp_map->relevant_dynamic_props[dprop_idx];
+    assert(pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
+    const auto& collmodel_iter = pImpl->xprop_coll_models->find(dprop.model);
+    if (collmodel_iter == pImpl->xprop_coll_models->end())
+        return 1; // Trace returns right away
+    return GetSweptTraceCost_XProp(collmodel_iter->second);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+// Appends the section BVH subtree of the given sections to nodes
+static void CreateSectionBvhSubtree(std::span<uint32_t> section_indices,
+    const std::vector<CollisionModel::AABB>& section_aabbs,
+    std::vector<CollisionModel::SectionBvhNode>& nodes)
+{
+    assert(!section_indices.empty());
+    CollisionModel::AABB aabb = section_aabbs[section_indices[0]];
+    CollisionModel::AABB centroid_bounds = { .mins = aabb.mins + aabb.maxs,
+                                             .maxs = aabb.mins + aabb.maxs };
+    for (uint32_t section_idx : section_indices) {
+        const CollisionModel::AABB& section_aabb = section_aabbs[section_idx];
+        Vector3 centroid = section_aabb.mins + section_aabb.maxs; // Doubled, only compared
+        aabb.mins = Math::min(aabb.mins, section_aabb.mins);
+        aabb.maxs = Math::max(aabb.maxs, section_aabb.maxs);
+        centroid_bounds.mins = Math::min(centroid_bounds.mins, centroid);
+        centroid_bounds.maxs = Math::max(centroid_bounds.maxs, centroid);
+    }
+
+    size_t node_idx = nodes.size();
+    nodes.push_back({ .aabb = aabb, .right_child = 0, .section_idx = section_indices[0] });
+    if (section_indices.size() == 1)
+        return; // Leaf
+
+    // Split sections at their median centroid along the longest axis
+    Vector3 extent = centroid_bounds.maxs - centroid_bounds.mins;
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    size_t half = section_indices.size() / 2;
+    std::nth_element(section_indices.begin(), section_indices.begin() + half,
+        section_indices.end(),
+        [&](uint32_t a, uint32_t b) {
+            return section_aabbs[a].mins[axis] + section_aabbs[a].maxs[axis]
+                 < section_aabbs[b].mins[axis] + section_aabbs[b].maxs[axis];
+        });
+
+    CreateSectionBvhSubtree(section_indices.first(half), section_aabbs, nodes);
+    nodes[node_idx].right_child = (uint32_t)nodes.size();
+    CreateSectionBvhSubtree(section_indices.subspan(half), section_aabbs, nodes);
+}
+
+std::vector<CollisionModel::SectionBvhNode>
+coll::Create_CollisionModelSectionBvh(
+    const std::vector<CollisionModel::AABB>& section_aabbs)
+{
+    std::vector<CollisionModel::SectionBvhNode> nodes;
+    if (section_aabbs.size() < MIN_SECTIONS_FOR_SECTION_BVH)
+        return nodes;
+
+    std::vector<uint32_t> section_indices(section_aabbs.size());
+    for (size_t i = 0; i < section_indices.size(); i++)
+        section_indices[i] = (uint32_t)i;
+
+    nodes.reserve(2 * section_aabbs.size() - 1);
+    CreateSectionBvhSubtree(section_indices, section_aabbs, nodes);
+    return nodes;
 }
 
 
@@ -89,21 +185,25 @@ Containers::Optional<CollisionCache_XProp>
 Create_CollisionCache_XProp(const CollisionModel& cmodel,
                             const Vector3& xprop_origin,
                             const Vector3& xprop_angles,
-                            float          xprop_uniform_scale);
+                            float          xprop_uniform_scale,
+                            XPropSectionBevelPlaneLutPool& lut_pool);
 
 Containers::Optional<CollisionCache_XProp>
 coll::Create_CollisionCache_StaticProp(const BspMap::StaticProp& sprop,
-                                       const CollisionModel& cmodel)
+                                       const CollisionModel& cmodel,
+                                       XPropSectionBevelPlaneLutPool& lut_pool)
 {
     return Create_CollisionCache_XProp(
-        cmodel, sprop.origin, sprop.angles, sprop.uniform_scale);
+        cmodel, sprop.origin, sprop.angles, sprop.uniform_scale, lut_pool);
 }
 
 Corrade::Containers::Optional<CollisionCache_XProp>
 coll::Create_CollisionCache_DynamicProp(const BspMap::Ent_prop_dynamic& dprop,
-                                        const CollisionModel& cmodel)
+                                        const CollisionModel& cmodel,
+                                        XPropSectionBevelPlaneLutPool& lut_pool)
 {
-    return Create_CollisionCache_XProp(cmodel, dprop.origin, dprop.angles, 1.0f);
+    return Create_CollisionCache_XProp(
+        cmodel, dprop.origin, dprop.angles, 1.0f, lut_pool);
 }
 
 
@@ -111,7 +211,8 @@ Containers::Optional<CollisionCache_XProp>
 Create_CollisionCache_XProp(const CollisionModel& cmodel,
                             const Vector3& xprop_origin,
                             const Vector3& xprop_angles,
-                            float          xprop_uniform_scale)
+                            float          xprop_uniform_scale,
+                            XPropSectionBevelPlaneLutPool& lut_pool)
 {
     ZoneScoped;
     const size_t NUM_SECTIONS = cmodel.section_tri_meshes.size();
@@ -151,21 +252,26 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
     }
 
     // Create bevel plane LUT of each section
-    std::vector<XPropSectionBevelPlaneLut> section_bevel_luts;
+    std::vector<std::shared_ptr<const XPropSectionBevelPlaneLut>> section_bevel_luts;
     section_bevel_luts.reserve(NUM_SECTIONS);
     for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++) {
-        // Create LUT of section
-        section_bevel_luts.emplace_back(rotationscaling, inv_rotation, inv_scale,
+        // Create LUT of section, share it if another section has the same one
+        XPropSectionBevelPlaneLut lut(rotationscaling, inv_rotation, inv_scale,
             cmodel.section_tri_meshes[section_idx],
             cmodel.section_planes[section_idx]
         );
+        section_bevel_luts.push_back(lut_pool.GetShared(std::move(lut)));
     }
 
     return CollisionCache_XProp{
-        .inv_rotation = inv_rotation,
-        .inv_scale    = inv_scale,
+        .inv_rotation  = inv_rotation,
+        .inv_scale     = inv_scale,
+        .inv_transform = TraceTransform::FromInverseOf(rotationscaling, xprop_origin),
         .section_aabbs      = std::move(section_aabbs),
-        .section_bevel_luts = std::move(section_bevel_luts)
+        .section_bevel_luts = std::move(section_bevel_luts),
+        .section_trace_counts = std::shared_ptr<std::atomic<uint32_t>[]>(
+            new std::atomic<uint32_t>[NUM_SECTIONS]()),
+        .section_hot_bevel_planes = nullptr
     };
 }
 
@@ -173,11 +279,116 @@ Create_CollisionCache_XProp(const CollisionModel& cmodel,
 ////////////////////////////////////////////////////////////////////////////////
 
 
-void DoSweptTrace_XProp(SweptTrace* trace,
-                        const Vector3&       xprop_origin,
-                        CollisionModel       xprop_collmodel,
-                        CollisionCache_XProp xprop_collcache);
+size_t CollidableWorld::UpdateHotXPropBevelPlanes(size_t memory_budget)
+{
+    ZoneScoped;
+    if (pImpl->xprop_coll_models == Corrade::Containers::NullOpt
+            || pImpl->coll_caches_sprop == Corrade::Containers::NullOpt
+            || pImpl->coll_caches_dprop == Corrade::Containers::NullOpt)
+        return 0;
+
+    // Calls func(collcache, collmodel) for the cache of each static/dynamic prop
+    auto ForEachXPropCache = [this](auto&& func) {
+        const BspMap& bsp_map = *pImpl->origin_bsp_map;
+        for (auto& [sprop_idx, collcache] : *pImpl->coll_caches_sprop) {
+            const BspMap::StaticProp& sprop = bsp_map.static_props[sprop_idx];
+            const std::string& mdl_path = bsp_map.static_prop_model_dict[sprop.model_idx];
+            const auto& collmodel_iter = pImpl->xprop_coll_models->find(mdl_path);
+            if (collmodel_iter != pImpl->xprop_coll_models->end())
+                func(collcache, collmodel_iter->second);
+        }
+        for (auto& [dprop_idx, collcache] : *pImpl->coll_caches_dprop) {
+            const BspMap::Ent_prop_dynamic& dprop = bsp_map.relevant_dynamic_props[dprop_idx];
+            const auto& collmodel_iter = pImpl->xprop_coll_models->find(dprop.model);
+            if (collmodel_iter != pImpl->xprop_coll_models->end())
+                func(collcache, collmodel_iter->second);
+        }
+    };
 
+    // Collect all sections that were traced since they were last cooled down
+    struct TracedSection {
+        uint32_t trace_count;
+        uint32_t section_idx;
+        CollisionCache_XProp* collcache;
+        const CollisionModel* collmodel;
+    };
+    std::vector<TracedSection> traced_sections;
+    ForEachXPropCache([&](CollisionCache_XProp& collcache, const CollisionModel& collmodel) {
+        for (size_t i = 0; i < collcache.section_aabbs.size(); i++) {
+            std::atomic<uint32_t>& trace_count = collcache.section_trace_counts[i];
+            uint32_t count = trace_count.load(std::memory_order_relaxed);
+            if (count == 0)
+                continue;
+            traced_sections.push_back({ .trace_count = count, .section_idx = (uint32_t)i,
+                                        .collcache = &collcache, .collmodel = &collmodel });
+            // Halve the count so that sections that aren't traced anymore cool down
+            trace_count.store(count / 2, std::memory_order_relaxed);
+        }
+    });
+    std::sort(traced_sections.begin(), traced_sections.end(),
+        [](const TracedSection& a, const TracedSection& b) {
+            return a.trace_count > b.trace_count;
+        });
+
+    // Pick the hottest sections whose bevel planes fit into the budget.
+    // Bevel planes that were already precomputed are reused.
+    std::map<CollisionCache_XProp*, std::vector<std::vector<Plane>>> new_hot_bevel_planes;
+    size_t memory_size = 0;
+    for (const TracedSection& traced : traced_sections) {
+        if (memory_size + sizeof(Plane) > memory_budget)
+            break; // Budget is exhausted
+
+        const auto& old_planes = traced.collcache->section_hot_bevel_planes;
+        std::vector<Plane> planes;
+        if (old_planes && !(*old_planes)[traced.section_idx].empty())
+            planes = (*old_planes)[traced.section_idx];
+        else
+            planes = GenerateXPropSectionBevelPlanes(
+                *traced.collmodel, *traced.collcache, traced.section_idx);
+        if (planes.empty())
+            continue; // Nothing to precompute
+
+        const size_t num_sections = traced.collcache->section_aabbs.size();
+        auto iter = new_hot_bevel_planes.find(traced.collcache);
+        size_t size = planes.size() * sizeof(Plane);
+        if (iter == new_hot_bevel_planes.end()) // Prop needs an array of sections
+            size += num_sections * sizeof(std::vector<Plane>);
+        if (memory_size + size > memory_budget)
+            continue; // Too big, try smaller sections
+
+        if (iter == new_hot_bevel_planes.end())
+            iter = new_hot_bevel_planes.emplace(traced.collcache,
+                std::vector<std::vector<Plane>>(num_sections)).first;
+        iter->second[traced.section_idx] = std::move(planes);
+        memory_size += size;
+    }
+
+    // Replace previously precomputed bevel planes of all props
+    ForEachXPropCache([&](CollisionCache_XProp& collcache, const CollisionModel&) {
+        auto iter = new_hot_bevel_planes.find(&collcache);
+        if (iter == new_hot_bevel_planes.end())
+            collcache.section_hot_bevel_planes = nullptr;
+        else
+            collcache.section_hot_bevel_planes =
+                std::make_shared<const std::vector<std::vector<Plane>>>(std::move(iter->second));
+    });
+    return memory_size;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+template<class Shape>
+void DoSweptTrace_XProp(SweptTrace* trace,
+                        const Vector3&              xprop_origin,
+                        const CollisionModel&       xprop_collmodel,
+                        const CollisionCache_XProp& xprop_collcache);
+bool IsHullInSolid_XProp(const SweptTrace::Info& hull,
+                         const CollisionModel&       xprop_collmodel,
+                         const CollisionCache_XProp& xprop_collcache);
+
+template<class Shape>
 void CollidableWorld::DoSweptTrace_StaticProp(SweptTrace* trace, uint32_t sprop_idx)
 {
     const BspMap::StaticProp& sprop = pImpl->origin_bsp_map->static_props[sprop_idx];
@@ -203,9 +414,16 @@ void CollidableWorld::DoSweptTrace_StaticProp(SweptTrace* trace, uint32_t sprop_
     const CollisionCache_XProp& collcache = collcache_iter->second;
 
     // Do trace
-    DoSweptTrace_XProp(trace, sprop.origin, collmodel, collcache);
+    DoSweptTrace_XProp<Shape>(trace, sprop.origin, collmodel, collcache);
 }
 
+template void CollidableWorld::DoSweptTrace_StaticProp<RuntimeShape     >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_StaticProp<RayShape         >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_StaticProp<StandingHullShape>(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_StaticProp<DuckedHullShape  >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_StaticProp<QuadrantHullShape>(SweptTrace*, uint32_t);
+
+template<class Shape>
 void CollidableWorld::DoSweptTrace_DynamicProp(SweptTrace* trace, uint32_t dprop_idx)
 {
     const BspMap::Ent_prop_dynamic& dprop =
@@ -230,49 +448,87 @@ void CollidableWorld::DoSweptTrace_DynamicProp(SweptTrace* trace, uint32_t dprop
     const CollisionCache_XProp& collcache = collcache_iter->second;
 
     // Do trace
-    DoSweptTrace_XProp(trace, dprop.origin, collmodel, collcache);
+    DoSweptTrace_XProp<Shape>(trace, dprop.origin, collmodel, collcache);
+}
+
+template void CollidableWorld::DoSweptTrace_DynamicProp<RuntimeShape     >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_DynamicProp<RayShape         >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_DynamicProp<StandingHullShape>(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_DynamicProp<DuckedHullShape  >(SweptTrace*, uint32_t);
+template void CollidableWorld::DoSweptTrace_DynamicProp<QuadrantHullShape>(SweptTrace*, uint32_t);
+
+bool CollidableWorld::IsHullInSolid_StaticProp(const SweptTrace::Info& hull,
+    uint32_t sprop_idx)
+{
+    const BspMap::StaticProp& sprop = pImpl->origin_bsp_map->static_props[sprop_idx];
+    const std::string&     mdl_path = pImpl->origin_bsp_map->static_prop_model_dict[sprop.model_idx];
+    if (!sprop.IsSolidWithVPhysics()) return false; // Skip this static prop
+
+    assert(pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
+    assert(pImpl->coll_caches_sprop != Corrade::Containers::NullOpt);
+
+    const auto& collmodel_iter = pImpl->xprop_coll_models->find(mdl_path);
+    if (collmodel_iter == pImpl->xprop_coll_models->end())
+        return false; // This static prop has no collision model, skip
+    const auto& collcache_iter = pImpl->coll_caches_sprop->find(sprop_idx);
+    if (collcache_iter == pImpl->coll_caches_sprop->end()) {
+        assert(false); // Shouldn't happen
+        return false; // This static prop has no collision cache, skip
+    }
+
+    return IsHullInSolid_XProp(hull,
+        collmodel_iter->second, collcache_iter->second);
+}
+
+bool CollidableWorld::IsHullInSolid_DynamicProp(const SweptTrace::Info& hull,
+    uint32_t dprop_idx)
+{
+    const BspMap::Ent_prop_dynamic& dprop =
+        pImpl->origin_bsp_map->relevant_dynamic_props[dprop_idx];
+
+    assert(pImpl->xprop_coll_models != Corrade::Containers::NullOpt);
+    assert(pImpl->coll_caches_dprop != Corrade::Containers::NullOpt);
+
+    const auto& collmodel_iter = pImpl->xprop_coll_models->find(dprop.model);
+    if (collmodel_iter == pImpl->xprop_coll_models->end())
+        return false; // This dynamic prop has no collision model, skip
+    const auto& collcache_iter = pImpl->coll_caches_dprop->find(dprop_idx);
+    if (collcache_iter == pImpl->coll_caches_dprop->end()) {
+        assert(false); // Shouldn't happen
+        return false; // This dynamic prop has no collision cache, skip
+    }
+
+    return IsHullInSolid_XProp(hull,
+        collmodel_iter->second, collcache_iter->second);
 }
 
+template<class Shape>
 void DoSweptTrace_XProp(SweptTrace* trace,
-                        const Vector3&       xprop_origin,
-                        CollisionModel       xprop_collmodel,
-                        CollisionCache_XProp xprop_collcache)
+                        const Vector3&              xprop_origin,
+                        const CollisionModel&       xprop_collmodel,
+                        const CollisionCache_XProp& xprop_collcache)
 {
     const size_t NUM_SECTIONS = xprop_collmodel.section_tri_meshes.size();
-
-    // TODO: Look at https://doc.magnum.graphics/magnum/transformations.html to
-    //       possibly improve/optimize the transformations in this method.
+    const Vector3 trace_extents = Shape::GetExtents(trace->info);
+    const bool    is_ray        = Shape::IsRay(trace->info); // Constant for most shapes
 
     // Transform trace's start, dir and extents into the coordinate system of
     // the unscaled, unrotated and untranslated collision model of the prop
     // (static or dynamic). Then perform trace calculations there.
     // Essentially, apply the reverse of the xprop's transformation to the trace.
-    // TODO can probably combine all reverse operations in a single matrix4 mult
-
-    Vector3 transformed_trace_start = trace->info.startpos;
-    Vector3 transformed_trace_dir   = trace->info.delta;
-    Vector3 transformed_extents     = trace->info.extents;
+    LocalTrace local_trace = TransformTraceToLocalSpace(
+        xprop_collcache.inv_transform,
+        trace->info.startpos, trace->info.delta, trace_extents);
+    const Vector3& transformed_trace_start = local_trace.start;
+    const Vector3& transformed_trace_dir   = local_trace.delta;
 
     // Orthogonal basis vectors that can describe any vector in a rotated
-    // coordinate system
-    Vector3 unit_vec_0 = { 1.0f, 0.0f, 0.0f };
-    Vector3 unit_vec_1 = { 0.0f, 1.0f, 0.0f };
-    Vector3 unit_vec_2 = { 0.0f, 0.0f, 1.0f };
-    // @Optimization Can we multiply the trace's extents into the unit vecs?
-
-    // Reverse xprop translation (opposite of CalcModelTransformationMatrix())
-    transformed_trace_start -= xprop_origin;
-    // Reverse xprop rotation (opposite of CalcModelTransformationMatrix())
-    const auto& inv_rot = xprop_collcache.inv_rotation;
-    transformed_trace_start = inv_rot.transformVectorNormalized(transformed_trace_start);
-    transformed_trace_dir   = inv_rot.transformVectorNormalized(transformed_trace_dir);
-    unit_vec_0              = inv_rot.transformVectorNormalized(unit_vec_0);
-    unit_vec_1              = inv_rot.transformVectorNormalized(unit_vec_1);
-    unit_vec_2              = inv_rot.transformVectorNormalized(unit_vec_2);
-    // Reverse xprop scaling (opposite of CalcModelTransformationMatrix())
-    transformed_trace_start *= xprop_collcache.inv_scale;
-    transformed_trace_dir   *= xprop_collcache.inv_scale;
-    transformed_extents     *= xprop_collcache.inv_scale;
+    // coordinate system. They're the inverse transformation's axes without
+    // its scaling.
+    const float xprop_scale = 1.0f / xprop_collcache.inv_scale;
+    Vector3 unit_vec_0 = xprop_collcache.inv_transform.GetAxis(0) * xprop_scale;
+    Vector3 unit_vec_1 = xprop_collcache.inv_transform.GetAxis(1) * xprop_scale;
+    Vector3 unit_vec_2 = xprop_collcache.inv_transform.GetAxis(2) * xprop_scale;
 
 
     enum PlaneCategory {
@@ -292,34 +548,145 @@ void DoSweptTrace_XProp(SweptTrace* trace,
         AABB_NON_TRANSFORMED, AABB_TRANSFORMED, EDGE_BEVELS, MODEL_TRIANGLES
     };
 
-    std::span<const PlaneCategory> plane_categories = trace->info.isray ?
+    std::span<const PlaneCategory> plane_categories = is_ray ?
         std::span<const PlaneCategory>(RAY_TRACE_CAT_LIST.begin(), RAY_TRACE_CAT_LIST.size())
         :
         std::span<const PlaneCategory>(HULL_TRACE_CAT_LIST.begin(), HULL_TRACE_CAT_LIST.size());
 
-    // ======== Go through each section independently ========
-    // @Optimization Process sections front to back? Skip section if AABB hit
-    //               time is past trace's fraction?
-    for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++)
+    // ======== Find sections whose bloated AABB is hit by the trace ========
+    struct SectionHit {
+        float    entry_fraction; // When the trace enters the section's bloated AABB
+        uint32_t section_idx;
+    };
+    // Traces usually hit few sections, only allocate memory if they hit many
+    constexpr size_t MAX_STACK_SECTION_HITS = 32;
+    SectionHit stack_section_hits[MAX_STACK_SECTION_HITS];
+    std::vector<SectionHit> heap_section_hits;
+    size_t num_section_hits = 0;
+    auto AddSectionHit = [&](const SectionHit& hit) {
+        if (num_section_hits == MAX_STACK_SECTION_HITS) // Move to heap memory
+            heap_section_hits.assign(stack_section_hits,
+                                     stack_section_hits + MAX_STACK_SECTION_HITS);
+        if (num_section_hits < MAX_STACK_SECTION_HITS)
+            stack_section_hits[num_section_hits] = hit;
+        else
+            heap_section_hits.push_back(hit);
+        num_section_hits++;
+    };
+
+    if (NUM_SECTIONS == 1) {
+        // The prop's bloated AABB was already hit by the trace (the BVH leaf's
+        // AABB is identical to the bloated AABB of the prop's only section),
+        // skip testing it again
+        AddSectionHit({ .entry_fraction = 0.0f, .section_idx = 0 });
+    }
+    else if (!xprop_collmodel.section_bvh.empty()) {
+        // Traverse the model's section BVH in the collision model's coordinate
+        // system. The trace box is oriented there, so the BVH is tested with
+        // the box's AABB instead. That's conservative, hit sections and their
+        // entry fractions can only be earlier than those of the actual box.
+        Vector3 local_extents =
+            Math::abs(local_trace.extent_axes[0]) +
+            Math::abs(local_trace.extent_axes[1]) +
+            Math::abs(local_trace.extent_axes[2]);
+        Vector3 local_invdelta = SweptTrace::ComputeInverseVec(local_trace.delta);
+        // Bloat AABBs by 1 unit of world space to account for collision
+        // calculation tolerances
+        Vector3 bloat{ xprop_collcache.inv_scale };
+
+        const auto& section_bvh = xprop_collmodel.section_bvh;
+        constexpr size_t MAX_STACK_SIZE = 64; // Median splits keep the BVH balanced
+        uint32_t node_stack[MAX_STACK_SIZE];
+        size_t stack_size = 0;
+        node_stack[stack_size++] = 0; // Start at root
+        while (stack_size > 0) {
+            uint32_t node_idx = node_stack[--stack_size];
+            const CollisionModel::SectionBvhNode& node = section_bvh[node_idx];
+            float entry_fraction;
+            if (!IsAabbHitByFullSweptTrace(local_trace.start, local_invdelta,
+                                           local_extents,
+                                           node.aabb.mins - bloat,
+                                           node.aabb.maxs + bloat,
+                                           &entry_fraction))
+                continue;
+            // Sections entered after the closest hit so far can't be hit earlier
+            if (entry_fraction > trace->results.fraction)
+                continue;
+
+            if (node.right_child == 0) { // Leaf
+                AddSectionHit({ .entry_fraction = entry_fraction,
+                                .section_idx    = node.section_idx });
+                continue;
+            }
+            assert(stack_size + 2 <= MAX_STACK_SIZE);
+            node_stack[stack_size++] = node.right_child;
+            node_stack[stack_size++] = node_idx + 1; // Left child
+        }
+    }
+    else {
+        for (size_t section_idx = 0; section_idx < NUM_SECTIONS; section_idx++) {
+            // Bloat AABB a little to account for collision calculation tolerances
+            const CollisionCache_XProp::AABB& aabb = xprop_collcache.section_aabbs[section_idx];
+            Vector3 bloated_xprop_section_mins = aabb.mins - Vector3{ 1.0f, 1.0f, 1.0f };
+            Vector3 bloated_xprop_section_maxs = aabb.maxs + Vector3{ 1.0f, 1.0f, 1.0f };
+            // Skip section if trace doesn't hit section's bloated AABB
+            float entry_fraction;
+            if (!IsAabbHitByFullSweptTrace(trace->info.startpos,
+                                           trace->info.invdelta,
+                                           trace_extents,
+                                           bloated_xprop_section_mins,
+                                           bloated_xprop_section_maxs,
+                                           &entry_fraction))
+                continue;
+            AddSectionHit({ .entry_fraction = entry_fraction,
+                            .section_idx    = (uint32_t)section_idx });
+        }
+    }
+    SectionHit* section_hits = num_section_hits > MAX_STACK_SECTION_HITS ?
+        heap_section_hits.data() : stack_section_hits;
+
+    // Process sections front to back. Sections with equal entry fractions keep
+    // their storage order, it decides which one is reported if they are hit at
+    // the same fraction.
+    std::sort(section_hits, section_hits + num_section_hits,
+        [](const SectionHit& a, const SectionHit& b) {
+            if (a.entry_fraction != b.entry_fraction)
+                return a.entry_fraction < b.entry_fraction;
+            return a.section_idx < b.section_idx;
+        });
+
+    // ======== Go through each hit section independently, front to back ========
+    for (size_t hit_idx = 0; hit_idx < num_section_hits; hit_idx++)
     {
+        // Sections whose bloated AABB is entered after the closest hit so far
+        // can't be hit any earlier, and neither can the following sections.
+        // NOTE: Sections the trace starts in have an entry fraction of 0 and
+        //       are never skipped, they might set startsolid or allsolid.
+        if (section_hits[hit_idx].entry_fraction > trace->results.fraction)
+            break;
+
+        const size_t section_idx = section_hits[hit_idx].section_idx;
         const Vector3& xprop_section_mins = xprop_collcache.section_aabbs[section_idx].mins;
         const Vector3& xprop_section_maxs = xprop_collcache.section_aabbs[section_idx].maxs;
-        // Bloat AABB a little to account for collision calculation tolerances
-        Vector3 bloated_xprop_section_mins = xprop_section_mins - Vector3{1.0f, 1.0f, 1.0f };
-        Vector3 bloated_xprop_section_maxs = xprop_section_maxs + Vector3{1.0f, 1.0f, 1.0f };
-        // Early-out if trace doesn't hit section's bloated AABB
-        // @Optimization If the xprop only has 1 section, isn't this check
-        //               redundant, as it's already done by BVH code?
-        if (!IsAabbHitByFullSweptTrace(trace->info.startpos,
-                                       trace->info.invdelta,
-                                       trace->info.extents,
-                                       bloated_xprop_section_mins,
-                                       bloated_xprop_section_maxs))
-            continue;
 
         const std::vector<Plane>& tri_planes_of_section =
             xprop_collmodel.section_planes[section_idx];
 
+        // Count hull traces to find the most frequently traced sections.
+        // Concurrent traces might lose a count, that's fine for this purpose
+        // and cheaper than an atomic increment.
+        if (!is_ray) {
+            std::atomic<uint32_t>& trace_count = xprop_collcache.section_trace_counts[section_idx];
+            trace_count.store(trace_count.load(std::memory_order_relaxed) + 1,
+                              std::memory_order_relaxed);
+        }
+
+        // Use precomputed bevel planes if this is a hot section
+        const std::vector<Plane>* hot_bevel_planes = nullptr;
+        if (xprop_collcache.section_hot_bevel_planes
+                && !(*xprop_collcache.section_hot_bevel_planes)[section_idx].empty())
+            hot_bevel_planes = &(*xprop_collcache.section_hot_bevel_planes)[section_idx];
+
         XPropSectionBevelPlaneGenerator bevel_gen(
             xprop_collmodel, xprop_collcache, section_idx);
 
@@ -342,7 +709,6 @@ void DoSweptTrace_XProp(SweptTrace* trace,
         bool  startout = false;
 
         float   dist;
-        Vector3 ofs;
         float   d1, d2;
         float   f;
 
@@ -367,12 +733,23 @@ void DoSweptTrace_XProp(SweptTrace* trace,
                     // @Optimization Note: Precomputing and storing all bevel
                     //                     planes for each prop would require up
                     //                     to a couple megabytes for a CSGO map.
+                    //                     That's why only the hottest sections
+                    //                     get them, see
+                    //                     UpdateHotXPropBevelPlanes().
                     // Note: This bevel plane generation for props doesn't lead
                     //       to hull trace results exactly matching those of
                     //       CSGO, but it should be good enough.
-                    bool success = bevel_gen.GetNext(&next_plane);
-                    if (!success)
-                        break; // Exit this category
+                    if (hot_bevel_planes) {
+                        if (plane_idx < hot_bevel_planes->size())
+                            next_plane = (*hot_bevel_planes)[plane_idx];
+                        else
+                            break; // Exit this category
+                    }
+                    else {
+                        bool success = bevel_gen.GetNext(&next_plane);
+                        if (!success)
+                            break; // Exit this category
+                    }
                 }
                 else if (cur_plane_cat == PlaneCategory::AABB_TRANSFORMED)
                 {
@@ -415,7 +792,7 @@ void DoSweptTrace_XProp(SweptTrace* trace,
                 else assert(0);
 
                 // ======== Process next plane ========
-                if (trace->info.isray) // Special point case
+                if (is_ray) // Special point case
                 {
                     //if (side.bevel == 1) // Don't ray trace against bevel planes
                     //    continue;
@@ -424,19 +801,13 @@ void DoSweptTrace_XProp(SweptTrace* trace,
                 }
                 else // General box case
                 {
-                    // AABB contact point offset in the rotated coordinate system
-                    ofs.x() = (Math::dot(unit_vec_0, next_plane.normal) < 0.0f) ? +transformed_extents.x() : -transformed_extents.x();
-                    ofs.y() = (Math::dot(unit_vec_1, next_plane.normal) < 0.0f) ? +transformed_extents.y() : -transformed_extents.y();
-                    ofs.z() = (Math::dot(unit_vec_2, next_plane.normal) < 0.0f) ? +transformed_extents.z() : -transformed_extents.z();
-
-                    // AABB contact point offset in the regular coordinate system
-                    // TODO can probably rewrite this to a matrix mult
-                    Vector3 offset =
-                        ofs[0] * unit_vec_0 +
-                        ofs[1] * unit_vec_1 +
-                        ofs[2] * unit_vec_2;
-
-                    dist = next_plane.dist - Math::dot(offset, next_plane.normal);
+                    // Offset the plane by the distance of the trace box's
+                    // contact point to its center. The box is oriented in
+                    // the collision model's coordinate system.
+                    dist = next_plane.dist
+                        + Math::abs(Math::dot(local_trace.extent_axes[0], next_plane.normal))
+                        + Math::abs(Math::dot(local_trace.extent_axes[1], next_plane.normal))
+                        + Math::abs(Math::dot(local_trace.extent_axes[2], next_plane.normal));
                 }
 
                 d1 = Math::dot(start, next_plane.normal) - dist;
@@ -511,6 +882,115 @@ void DoSweptTrace_XProp(SweptTrace* trace,
     }
 }
 
+bool IsHullInSolid_XProp(const SweptTrace::Info& hull,
+                         const CollisionModel&       xprop_collmodel,
+                         const CollisionCache_XProp& xprop_collcache)
+{
+    ZoneScoped;
+
+    // Performs the same plane tests as DoSweptTrace_XProp() does with identical
+    // start and end points: The hull is in a section if it isn't in front of
+    // any of the section's planes. Cheap plane categories are tested first.
+    LocalTrace local_hull = TransformTraceToLocalSpace(xprop_collcache.inv_transform,
+        hull.startpos, Vector3{ 0.0f }, hull.extents);
+
+    // Returns true if the hull lies in front of the plane, i.e. outside of it
+    auto IsInFrontOfPlane = [&](const Plane& plane) {
+        float dist = plane.dist;
+        if (!hull.isray)
+            dist += Math::abs(Math::dot(local_hull.extent_axes[0], plane.normal))
+                  + Math::abs(Math::dot(local_hull.extent_axes[1], plane.normal))
+                  + Math::abs(Math::dot(local_hull.extent_axes[2], plane.normal));
+        return Math::dot(local_hull.start, plane.normal) - dist > 0.0f;
+    };
+
+    auto IsHullInSection = [&](size_t section_idx) {
+        // AABB planes of the transformed section. Their plane tests boil down
+        // to an AABB overlap test in world space. Ray traces don't use these
+        // planes, but points outside of this AABB are outside of the section.
+        const CollisionCache_XProp::AABB& aabb = xprop_collcache.section_aabbs[section_idx];
+        for (int axis = 0; axis < 3; axis++)
+            if (hull.startpos[axis] - hull.extents[axis] > aabb.maxs[axis] ||
+                hull.startpos[axis] + hull.extents[axis] < aabb.mins[axis])
+                return false;
+
+        if (!hull.isray) {
+            // AABB planes of the non-transformed section
+            const CollisionModel::AABB& non_transf_aabb = xprop_collmodel.section_aabbs[section_idx];
+            for (int axis = 0; axis < 3; axis++) {
+                Vector3 normal{ 0.0f };
+                normal[axis] = +1.0f;
+                if (IsInFrontOfPlane({ +normal,  non_transf_aabb.maxs[axis] })) return false;
+                if (IsInFrontOfPlane({ -normal, -non_transf_aabb.mins[axis] })) return false;
+            }
+        }
+
+        for (const Plane& plane : xprop_collmodel.section_planes[section_idx])
+            if (IsInFrontOfPlane(plane))
+                return false;
+
+        if (!hull.isray) {
+            // Bevel planes last, they're the most expensive ones unless they
+            // were precomputed
+            if (xprop_collcache.section_hot_bevel_planes
+                    && !(*xprop_collcache.section_hot_bevel_planes)[section_idx].empty()) {
+                for (const Plane& plane : (*xprop_collcache.section_hot_bevel_planes)[section_idx])
+                    if (IsInFrontOfPlane(plane))
+                        return false;
+            }
+            else {
+                XPropSectionBevelPlaneGenerator bevel_gen(
+                    xprop_collmodel, xprop_collcache, section_idx);
+                Plane plane;
+                while (bevel_gen.GetNext(&plane))
+                    if (IsInFrontOfPlane(plane))
+                        return false;
+            }
+        }
+        return true;
+    };
+
+    if (xprop_collmodel.section_bvh.empty()) {
+        for (size_t section_idx = 0; section_idx < xprop_collcache.section_aabbs.size(); section_idx++)
+            if (IsHullInSection(section_idx))
+                return true;
+        return false;
+    }
+
+    // Find sections the hull overlaps with the model's section BVH, see
+    // DoSweptTrace_XProp()
+    Vector3 local_extents =
+        Math::abs(local_hull.extent_axes[0]) +
+        Math::abs(local_hull.extent_axes[1]) +
+        Math::abs(local_hull.extent_axes[2]);
+    Vector3 local_mins = local_hull.start - local_extents;
+    Vector3 local_maxs = local_hull.start + local_extents;
+    Vector3 bloat{ xprop_collcache.inv_scale };
+
+    const auto& section_bvh = xprop_collmodel.section_bvh;
+    constexpr size_t MAX_STACK_SIZE = 64; // Median splits keep the BVH balanced
+    uint32_t node_stack[MAX_STACK_SIZE];
+    size_t stack_size = 0;
+    node_stack[stack_size++] = 0; // Start at root
+    while (stack_size > 0) {
+        uint32_t node_idx = node_stack[--stack_size];
+        const CollisionModel::SectionBvhNode& node = section_bvh[node_idx];
+        if (!AabbIntersectsAabb(local_mins, local_maxs,
+                                node.aabb.mins - bloat, node.aabb.maxs + bloat))
+            continue;
+
+        if (node.right_child == 0) { // Leaf
+            if (IsHullInSection(node.section_idx))
+                return true;
+            continue;
+        }
+        assert(stack_size + 2 <= MAX_STACK_SIZE);
+        node_stack[stack_size++] = node.right_child;
+        node_stack[stack_size++] = node_idx + 1; // Left child
+    }
+    return false;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -715,6 +1195,34 @@ size_t XPropSectionBevelPlaneLut::GetMemorySize() const {
     return valid_candidate_index_steps_recidx.size() * sizeof(RecIdxType);
 }
 
+size_t XPropSectionBevelPlaneLut::GetContentHash() const {
+    // FNV-1a hash
+    uint64_t hash = 14695981039346656037ULL;
+    for (RecIdxType step : valid_candidate_index_steps_recidx) {
+        hash ^= step;
+        hash *= 1099511628211ULL;
+    }
+    return (size_t)hash;
+}
+
+std::shared_ptr<const XPropSectionBevelPlaneLut>
+XPropSectionBevelPlaneLutPool::GetShared(XPropSectionBevelPlaneLut&& lut)
+{
+    num_references++;
+    memory_size_without_sharing += lut.GetMemorySize();
+
+    auto& luts_with_same_hash = luts_by_hash[lut.GetContentHash()];
+    for (const auto& pooled_lut : luts_with_same_hash)
+        if (*pooled_lut == lut)
+            return pooled_lut;
+
+    num_luts++;
+    memory_size += lut.GetMemorySize();
+    luts_with_same_hash.push_back(
+        std::make_shared<const XPropSectionBevelPlaneLut>(std::move(lut)));
+    return luts_with_same_hash.back();
+}
+
 XPropSectionBevelPlaneGenerator::XPropSectionBevelPlaneGenerator(
     const CollisionModel&       xprop_coll_model,
     const CollisionCache_XProp& xprop_coll_cache,
@@ -726,7 +1234,7 @@ XPropSectionBevelPlaneGenerator::XPropSectionBevelPlaneGenerator(
         xprop_coll_model.section_tri_meshes[idx_of_xprop_section]
     }
     , valid_candidate_index_steps_recidx{
-        xprop_coll_cache.section_bevel_luts[idx_of_xprop_section].valid_candidate_index_steps_recidx
+        xprop_coll_cache.section_bevel_luts[idx_of_xprop_section]->valid_candidate_index_steps_recidx
     }
 {
 }
@@ -796,3 +1304,18 @@ bool XPropSectionBevelPlaneGenerator::GetNext(BspMap::Plane* out)
     // --------- end of source-sdk-2013 code ---------
     return true; // Plane generation was successful
 }
+
+std::vector<Plane> coll::GenerateXPropSectionBevelPlanes(
+    const CollisionModel&       xprop_coll_model,
+    const CollisionCache_XProp& xprop_coll_cache,
+    size_t idx_of_xprop_section)
+{
+    XPropSectionBevelPlaneGenerator bevel_gen(xprop_coll_model, xprop_coll_cache,
+                                              idx_of_xprop_section);
+    std::vector<Plane> bevel_planes;
+    Plane next_plane;
+    while (bevel_gen.GetNext(&next_plane))
+        bevel_planes.push_back(next_plane);
+    bevel_planes.shrink_to_fit();
+    return bevel_planes;
+}
@@ -1,6 +1,11 @@
 #ifndef COLL_COLLIDABLEWORLD_XPROP_H_
 #define COLL_COLLIDABLEWORLD_XPROP_H_
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 #include <Corrade/Containers/Optional.h>
@@ -8,6 +13,7 @@
 #include <Magnum/Math/Quaternion.h>
 #include <Magnum/Math/Vector3.h>
 
+#include "coll/TraceTransform.h"
 #include "csgo_parsing/BspMap.h"
 #include "utils_3d.h"
 
@@ -45,8 +51,31 @@ struct CollisionModel {
     // translated.
     struct AABB { Magnum::Vector3 mins, maxs; };
     std::vector<AABB> section_aabbs;
+
+    // Bottom-level BVH over the section AABBs, in the coordinate system of the
+    // unscaled, unrotated and untranslated collision model. It's shared by all
+    // props using this model, the world's BVH acts as top-level BVH over the
+    // prop instances. Prop traces use it to find the sections they hit without
+    // testing every section's AABB.
+    // Empty for models with few sections, see Create_CollisionModelSectionBvh().
+    struct SectionBvhNode {
+        AABB     aabb;        // Of all sections in this node's subtree
+        uint32_t right_child; // idx into section_bvh, 0 for leaves. Left child is the next node
+        uint32_t section_idx; // Section of this leaf, unused for inner nodes
+    };
+    std::vector<SectionBvhNode> section_bvh; // Root node comes first
 };
 
+// Models with fewer sections don't get a section BVH, testing all of their
+// section AABBs is faster than traversing a BVH.
+constexpr size_t MIN_SECTIONS_FOR_SECTION_BVH = 8;
+
+// Returns the section BVH of a collision model with the given section AABBs,
+// see CollisionModel::section_bvh. Returns an empty vector if the model has
+// less than MIN_SECTIONS_FOR_SECTION_BVH sections.
+std::vector<CollisionModel::SectionBvhNode> Create_CollisionModelSectionBvh(
+    const std::vector<CollisionModel::AABB>& section_aabbs);
+
 
 // Lookup table used by XPropSectionBevelPlaneGenerator
 class XPropSectionBevelPlaneLut {
@@ -61,6 +90,14 @@ public:
 
     size_t GetMemorySize() const;
 
+    // Whether both LUTs describe the same valid bevel plane candidates
+    bool operator==(const XPropSectionBevelPlaneLut& other) const {
+        return valid_candidate_index_steps_recidx == other.valid_candidate_index_steps_recidx;
+    }
+
+    // Hash of the LUT's contents, equal LUTs have equal hashes
+    size_t GetContentHash() const;
+
 private:
     // Essentially, this LUT represents the information of whether a 'bevel
     // plane candidate' (identified by its index OR generation parameters) is
@@ -112,6 +149,37 @@ private:
     friend class XPropSectionBevelPlaneGenerator;
 };
 
+// Lets static/dynamic prop sections with identical bevel plane LUTs share a
+// single LUT. Props with identical model, rotation and scale (e.g. crates and
+// rocks) have identical LUTs in each of their sections.
+// Only needed while collision caches are created, shared LUTs are kept alive by
+// the collision caches referencing them.
+class XPropSectionBevelPlaneLutPool {
+public:
+    // If the pool holds a LUT with identical contents, returns that one.
+    // Otherwise adds the given LUT to the pool and returns it.
+    std::shared_ptr<const XPropSectionBevelPlaneLut>
+        GetShared(XPropSectionBevelPlaneLut&& lut);
+
+    size_t GetNumLuts() const { return num_luts; } // Unique LUTs in the pool
+    size_t GetNumReferences() const { return num_references; } // GetShared() calls
+
+    // Memory size of all unique LUTs in the pool
+    size_t GetMemorySize() const { return memory_size; }
+    // Memory size of all LUTs if every GetShared() call kept its own LUT
+    size_t GetMemorySizeWithoutSharing() const { return memory_size_without_sharing; }
+
+private:
+    // Keys are LUT content hashes
+    std::unordered_map<size_t,
+        std::vector<std::shared_ptr<const XPropSectionBevelPlaneLut>>> luts_by_hash;
+
+    size_t num_luts                    = 0;
+    size_t num_references              = 0;
+    size_t memory_size                 = 0;
+    size_t memory_size_without_sharing = 0;
+};
+
 // Precomputed data per static/dynamic prop to speed up collision calculations
 // Note: Up to ~10000 static props in a CSGO map have been encountered.
 // Note: Up to 160000 total static prop sections in a CSGO map have been
@@ -120,6 +188,8 @@ struct CollisionCache_XProp {
     // Transformation data
     Magnum::Quaternion inv_rotation; // Normalized. Reverses xprop rotation
     float              inv_scale;    // (1 / scale)
+    // Reverses xprop translation, rotation and scaling at once
+    TraceTransform     inv_transform;
 
     // Exact, non-bloated AABB of each section of this static/dynamic prop.
     // Note that these are different from a CollisionModel's section AABBs!
@@ -140,22 +210,38 @@ struct CollisionCache_XProp {
     struct AABB { Magnum::Vector3 mins, maxs; };
     std::vector<AABB> section_aabbs;
 
-    // Bevel plane LUT of each section of this static/dynamic prop
-    // @Optimization Memory: There are possibly a number of duplicate LUTs in here
-    std::vector<XPropSectionBevelPlaneLut> section_bevel_luts;
+    // Bevel plane LUT of each section of this static/dynamic prop. Identical
+    // LUTs are shared with other sections, see XPropSectionBevelPlaneLutPool.
+    std::vector<std::shared_ptr<const XPropSectionBevelPlaneLut>> section_bevel_luts;
+
+    // Number of hull traces that hit each section's AABB, used to find the
+    // most frequently traced sections. Counts are halved by every
+    // CollidableWorld::UpdateHotXPropBevelPlanes() call.
+    std::shared_ptr<std::atomic<uint32_t>[]> section_trace_counts;
+
+    // Fully precomputed bevel planes of this prop's most frequently traced
+    // sections, see CollidableWorld::UpdateHotXPropBevelPlanes(). Indexed like
+    // section_aabbs. Sections with an empty array generate their bevel planes
+    // with their LUT instead. Null if no section has precomputed bevel planes.
+    std::shared_ptr<const std::vector<std::vector<csgo_parsing::BspMap::Plane>>>
+        section_hot_bevel_planes;
 };
 
 // Returns an empty Optional if collision cache creation fails.
+// Bevel plane LUTs are shared through the given pool.
 Corrade::Containers::Optional<CollisionCache_XProp>
     Create_CollisionCache_StaticProp(
         const csgo_parsing::BspMap::StaticProp& sprop,
-        const CollisionModel& cmodel);
+        const CollisionModel& cmodel,
+        XPropSectionBevelPlaneLutPool& lut_pool);
 
 // Returns an empty Optional if collision cache creation fails.
+// Bevel plane LUTs are shared through the given pool.
 Corrade::Containers::Optional<CollisionCache_XProp>
     Create_CollisionCache_DynamicProp(
         const csgo_parsing::BspMap::Ent_prop_dynamic& dprop,
-        const CollisionModel& cmodel);
+        const CollisionModel& cmodel,
+        XPropSectionBevelPlaneLutPool& lut_pool);
 
 
 // Responsible for efficiently generating all bevel planes of a specific section
@@ -190,6 +276,15 @@ private:
                                              valid_candidate_index_steps_recidx;
 };
 
+// Generates all bevel planes of a specific section of a specific static/dynamic
+// prop with a XPropSectionBevelPlaneGenerator.
+// CAUTION: The passed collision model must be the one that was used to create
+//          the passed collision cache!
+std::vector<csgo_parsing::BspMap::Plane> GenerateXPropSectionBevelPlanes(
+    const CollisionModel&       xprop_coll_model,
+    const CollisionCache_XProp& xprop_coll_cache,
+    size_t idx_of_xprop_section);
+
 } // namespace coll
 
 #endif // COLL_COLLIDABLEWORLD_XPROP_H_
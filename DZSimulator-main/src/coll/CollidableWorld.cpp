@@ -2,7 +2,9 @@
 
 #include <map>
 #include <memory>
+#include <span>
 #include <string>
+#include <vector>
 
 #include <Tracy.hpp>
 
@@ -10,8 +12,10 @@
 #include <Magnum/Math/Functions.h>
 #include <Magnum/Math/Vector3.h>
 
+#include "coll/Benchmark.h"
 #include "coll/CollidableWorld_Impl.h"
 #include "coll/Debugger.h"
+#include "coll/TraceQueryContext.h"
 
 using namespace coll;
 using namespace Magnum;
@@ -21,47 +25,198 @@ using namespace csgo_parsing;
 CollidableWorld::CollidableWorld(std::shared_ptr<const BspMap> bsp_map)
     : pImpl{ std::make_unique<Impl>(bsp_map) }
 {
+#if COLL_BENCHMARK_ENABLED
+    // Keep recent traces for benchmarks, see Benchmark::GetRecordedTraces()
+    pImpl->trace_recorder.SetRecentTraceCapacity(Benchmark::MAX_RECORDED_TRACES);
+#endif
 }
 
 void CollidableWorld::DoSweptTrace(SweptTrace* trace)
+{
+    DoSweptTrace(trace, nullptr);
+}
+
+void CollidableWorld::DoSweptTrace(SweptTrace* trace, TraceQueryContext* context)
 {
     ZoneScoped;
 
-    if (pImpl->bvh == Corrade::Containers::NullOpt) { // If BVH isn't created
+    if (pImpl->bvh         == Corrade::Containers::NullOpt ||
+        pImpl->dynamic_bvh == Corrade::Containers::NullOpt) { // If BVHs aren't created
         assert(false && "ERROR: Tried to run CollidableWorld::DoSweptTrace() "
-            "before BVH was created!");
+            "before BVHs were created!");
         return;
     }
 
     coll::Debugger::DebugStart_Trace(trace->info);
 
-    // Do nothing if sweep distance of the swept trace is effectively zero.
+    // If sweep distance of the swept trace is effectively zero, only test
+    // whether the trace starts in solid.
+    // Some source-sdk-2013 code (e.g. CGameMovement::CanUnDuckJump() and
+    // CGameMovement::TryPlayerMove()) uses zero-distance swept traces to test
+    // whether the player hull intersects with any map geometry.
     if (trace->info.delta.isZero()) {
-        // Assert here for testing purposes, as it's currently unknown if
-        // ignoring zero-distance swept traces has side effects in
-        // source-sdk-2013's movement code.
-        // TODO Test if movement is processed correctly with this abort. If it
-        //      is, remove this assert.
-        //assert(false);
-
-        // 2024-02-13 Note: Ignoring zero-distance swept traces doesn't seem
-        // to cause any issues in player movement (Note: Only walking and
-        // jumping is implemented so far, no crouching).
-        // But: Some source-sdk-2013 code (e.g. CGameMovement::CanUnDuckJump()
-        // and CGameMovement::TryPlayerMove()) makes it obvious that zero-
-        // distance swept traces are used in the Source engine to test whether
-        // the player hull intersects with any map geometry. Therefor, we
-        // should do these tests here for the "uswept box" case and set
-        // startsolid to true when intersecting. Can this be achieved by simply
-        // calling the DoSweptTrace() routine in these "uswept box" cases?
-        // Commented out the assert because it will be replaced.
-
+        if (IsHullInSolid_Unswept(trace->info)) {
+            trace->results.startsolid = true;
+            trace->results.allsolid   = true; // Trace can't get out of solid
+        }
         coll::Debugger::DebugFinish_Trace(trace->results);
+        if (pImpl->trace_recorder.IsRecording())
+            RecordFinishedTrace(*trace, nullptr);
         return;
     }
 
+    if (context && context->IsGathered()) {
+        if (context->ContainsSweep(trace->info)) {
+            context->stats.num_candidate_traces++;
+            pImpl->bvh->DoSweptTraceAgainstCandidates(trace, context, *this);
+            // Objects of the dynamic BVH aren't part of gathered candidates
+            pImpl->dynamic_bvh->DoSweptTrace(trace, *this);
+            if (trace->info.isray)
+                DoSweptTrace_RayOnlyDisplacements(trace);
+            coll::Debugger::DebugFinish_Trace(trace->results);
+            if (pImpl->trace_recorder.IsRecording())
+                RecordFinishedTrace(*trace, context);
+            return;
+        }
+        context->stats.num_fallback_traces++;
+    }
+
     pImpl->bvh->DoSweptTrace(trace, *this);
+    pImpl->dynamic_bvh->DoSweptTrace(trace, *this);
+    if (trace->info.isray)
+        DoSweptTrace_RayOnlyDisplacements(trace);
     coll::Debugger::DebugFinish_Trace(trace->results);
+    if (pImpl->trace_recorder.IsRecording())
+        RecordFinishedTrace(*trace, nullptr);
+}
+
+void CollidableWorld::RecordFinishedTrace(const SweptTrace& trace,
+    const TraceQueryContext* candidate_context)
+{
+    TraceRecorder::Record record{ .info = trace.info, .results = trace.results };
+    if (candidate_context) {
+        record.used_candidates       = true;
+        record.candidate_region_mins = candidate_context->region_mins;
+        record.candidate_region_maxs = candidate_context->region_maxs;
+    }
+    pImpl->trace_recorder.RecordTrace(record);
+}
+
+bool CollidableWorld::DoSweptTraceAnyHit(SweptTrace* trace)
+{
+    ZoneScoped;
+
+    if (pImpl->bvh         == Corrade::Containers::NullOpt ||
+        pImpl->dynamic_bvh == Corrade::Containers::NullOpt) { // If BVHs aren't created
+        assert(false && "ERROR: Tried to run CollidableWorld::DoSweptTraceAnyHit() "
+            "before BVHs were created!");
+        return false;
+    }
+
+    coll::Debugger::DebugStart_Trace(trace->info);
+
+    // Like DoSweptTrace(), only test whether zero-distance traces start in solid
+    if (trace->info.delta.isZero()) {
+        if (IsHullInSolid_Unswept(trace->info)) {
+            trace->results.startsolid = true;
+            trace->results.allsolid   = true;
+        }
+        coll::Debugger::DebugFinish_Trace(trace->results);
+        return trace->results.DidHit();
+    }
+
+    pImpl->bvh->DoSweptTraceAnyHit(trace, *this);
+    if (!trace->results.DidHit())
+        pImpl->dynamic_bvh->DoSweptTrace(trace, *this);
+    if (!trace->results.DidHit() && trace->info.isray)
+        DoSweptTrace_RayOnlyDisplacements(trace);
+    coll::Debugger::DebugFinish_Trace(trace->results);
+    return trace->results.DidHit();
+}
+
+void CollidableWorld::GatherTraceCandidates(const Vector3& region_mins,
+    const Vector3& region_maxs, TraceQueryContext* context)
+{
+    ZoneScoped;
+
+    if (pImpl->bvh == Corrade::Containers::NullOpt) { // If BVH isn't created
+        assert(false && "ERROR: Tried to run "
+            "CollidableWorld::GatherTraceCandidates() before BVH was created!");
+        context->Clear();
+        return;
+    }
+
+    pImpl->bvh->GatherTraceCandidates(region_mins, region_maxs, context);
+}
+
+void CollidableWorld::DoSweptTraces(std::span<SweptTrace> traces)
+{
+    ZoneScoped;
+
+    if (pImpl->bvh         == Corrade::Containers::NullOpt ||
+        pImpl->dynamic_bvh == Corrade::Containers::NullOpt) { // If BVHs aren't created
+        assert(false && "ERROR: Tried to run CollidableWorld::DoSweptTraces() "
+            "before BVHs were created!");
+        return;
+    }
+
+    // coll::Debugger follows one trace at a time, but batched traces
+    // interleave their leaf tests. When debugging, do single traces instead.
+    if constexpr (coll::Debugger::IS_ENABLED) {
+        for (SweptTrace& trace : traces)
+            DoSweptTrace(&trace);
+        return;
+    }
+
+    // Like DoSweptTrace(), only test whether traces with zero sweep distance
+    // start in solid
+    std::vector<SweptTrace*> nonzero_traces;
+    nonzero_traces.reserve(traces.size());
+    for (SweptTrace& trace : traces) {
+        if (trace.info.delta.isZero()) {
+            if (IsHullInSolid_Unswept(trace.info)) {
+                trace.results.startsolid = true;
+                trace.results.allsolid   = true;
+            }
+            continue;
+        }
+        nonzero_traces.push_back(&trace);
+    }
+
+    pImpl->bvh->DoSweptTraces(std::span<SweptTrace* const>(nonzero_traces), *this);
+    for (SweptTrace* trace : nonzero_traces) {
+        pImpl->dynamic_bvh->DoSweptTrace(trace, *this);
+        if (trace->info.isray)
+            DoSweptTrace_RayOnlyDisplacements(trace);
+    }
+
+    // Record in the given order, like single traces would have been
+    if (pImpl->trace_recorder.IsRecording())
+        for (const SweptTrace& trace : traces)
+            RecordFinishedTrace(trace, nullptr);
+}
+
+bool CollidableWorld::IsHullInSolid(const Vector3& pos,
+    const Vector3& hull_mins, const Vector3& hull_maxs,
+    ContentsMask contents_mask)
+{
+    ZoneScoped;
+
+    if (pImpl->bvh         == Corrade::Containers::NullOpt ||
+        pImpl->dynamic_bvh == Corrade::Containers::NullOpt) { // If BVHs aren't created
+        assert(false && "ERROR: Tried to run CollidableWorld::IsHullInSolid() "
+            "before BVHs were created!");
+        return false;
+    }
+
+    SweptTrace hull{ pos, pos, hull_mins, hull_maxs, contents_mask };
+    return IsHullInSolid_Unswept(hull.info);
+}
+
+bool CollidableWorld::IsHullInSolid_Unswept(const SweptTrace::Info& hull)
+{
+    return pImpl->bvh        ->IsHullInSolid(hull, *this)
+        || pImpl->dynamic_bvh->IsHullInSolid(hull, *this);
 }
 
 bool CollidableWorld::DoesAabbIntersectAnyDisplacement(
@@ -78,6 +233,57 @@ bool CollidableWorld::DoesAabbIntersectAnyDisplacement(
         aabb_mins, aabb_maxs, *this);
 }
 
+DispCollCacheManager* CollidableWorld::GetDispCollCacheManager()
+{
+    return pImpl->disp_coll_cache_manager.get();
+}
+
+bool CollidableWorld::SetFuncBrushEnabled(uint32_t func_brush_idx, bool enabled)
+{
+    if (pImpl->dynamic_bvh == Corrade::Containers::NullOpt)
+        return false;
+    if (!pImpl->dynamic_bvh->SetObjectEnabled(
+            DynamicBVH::ObjectType::FuncBrush, func_brush_idx, enabled))
+        return false;
+    if (pImpl->trace_recorder.IsRecording())
+        pImpl->trace_recorder.RecordObjectState({
+            .type       = DynamicBVH::ObjectType::FuncBrush,
+            .object_idx = func_brush_idx,
+            .enabled    = enabled,
+        });
+    return true;
+}
+
+bool CollidableWorld::SetDynamicPropEnabled(uint32_t dprop_idx, bool enabled)
+{
+    if (pImpl->dynamic_bvh == Corrade::Containers::NullOpt)
+        return false;
+    if (!pImpl->dynamic_bvh->SetObjectEnabled(
+            DynamicBVH::ObjectType::DynamicProp, dprop_idx, enabled))
+        return false;
+    if (pImpl->trace_recorder.IsRecording())
+        pImpl->trace_recorder.RecordObjectState({
+            .type       = DynamicBVH::ObjectType::DynamicProp,
+            .object_idx = dprop_idx,
+            .enabled    = enabled,
+        });
+    return true;
+}
+
+bool CollidableWorld::StartTraceRecording(const std::string& file_path)
+{
+    std::vector<DynamicBVH::ObjectState> object_states;
+    if (pImpl->dynamic_bvh != Corrade::Containers::NullOpt)
+        object_states = pImpl->dynamic_bvh->GetObjectStates();
+    return pImpl->trace_recorder.Start(file_path,
+        TraceRecorder::GetMapIdentity(*pImpl->origin_bsp_map), object_states);
+}
+
+void CollidableWorld::StopTraceRecording()
+{
+    pImpl->trace_recorder.Stop();
+}
+
 bool coll::AabbIntersectsAabb(
     const Vector3& mins0, const Vector3& maxs0,
     const Vector3& mins1, const Vector3& maxs1)
@@ -2,11 +2,14 @@
 #define COLL_COLLIDABLEWORLD_H_
 
 #include <memory>
+#include <span>
+#include <string>
 
 #include <Magnum/Magnum.h>
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/SweptTrace.h"
+#include "coll/TraceShape.h"
 #include "csgo_parsing/BspMap.h"
 
 // Forward-declare WorldCreator outside namespace to avoid ambiguity
@@ -14,6 +17,9 @@ class WorldCreator;
 
 namespace coll {
 
+class DispCollCacheManager;
+class TraceQueryContext;
+
 // Test whether two axis-aligned bounding boxes (AABBs) intersect.
 bool AabbIntersectsAabb(const Magnum::Vector3& mins0, const Magnum::Vector3& maxs0,
                         const Magnum::Vector3& mins1, const Magnum::Vector3& maxs1);
@@ -34,30 +40,136 @@ public:
     CollidableWorld(std::shared_ptr<const csgo_parsing::BspMap> bsp_map);
 
     // Perform a swept trace against the entire world.
-    // Does nothing if sweep distance is zero or nearly zero.
-    // CAUTION: Not thread-safe yet!
+    // If sweep distance is zero or nearly zero, only tests whether the trace's
+    // hull starts in solid (see IsHullInSolid_Unswept()) and if so, sets
+    // startsolid and allsolid.
+    // Thread-safe: Multiple threads can trace concurrently, each with their own
+    // SweptTrace object. In debug builds, only traces of the main thread are
+    // visualized by coll::Debugger.
     void DoSweptTrace(SweptTrace* trace);
 
+    // Same as DoSweptTrace(trace), but if the trace's swept volume lies inside
+    // the region of the given context, the trace is only done against the
+    // context's gathered candidates. context must not be used by other threads.
+    void DoSweptTrace(SweptTrace* trace, TraceQueryContext* context);
+
+    // Same as DoSweptTrace(trace), but stops at the first object that is hit
+    // instead of searching for the closest hit. Meant for queries that only
+    // need to know whether anything is hit, e.g. line-of-sight checks. To
+    // test for hits before a certain fraction, shorten the trace accordingly.
+    // Returns trace->results.DidHit(). If something was hit, the trace's
+    // fraction and plane normal are those of *a* hit, not necessarily the
+    // closest one.
+    // Thread-safe, same conditions as DoSweptTrace().
+    bool DoSweptTraceAnyHit(SweptTrace* trace);
+
+    // Gathers all broad-phase candidates whose AABB intersects the given
+    // region into context, replacing previously gathered candidates.
+    void GatherTraceCandidates(const Magnum::Vector3& region_mins,
+        const Magnum::Vector3& region_maxs, TraceQueryContext* context);
+
+    // Perform multiple swept traces against the entire world, producing the
+    // exact same results as calling DoSweptTrace() on each of them. Faster
+    // than that when doing lots of traces, e.g. in map-wide analyses.
+    // Thread-safe, same conditions as DoSweptTrace(). Traces are recorded like
+    // those of DoSweptTrace(), see StartTraceRecording(). In debug builds,
+    // traces are done one by one with DoSweptTrace() so that coll::Debugger
+    // can visualize them.
+    void DoSweptTraces(std::span<SweptTrace> traces);
+
+    // Tests whether a hull (box from hull_mins to hull_maxs, relative to pos)
+    // placed at pos intersects any object whose contents match contents_mask.
+    // Gives the same result as the startsolid flag of a hull trace from pos to
+    // pos, but stops at the first object the hull is found in. Meant for
+    // checks like source-sdk-2013's CGameMovement::CanUnDuckJump().
+    // Thread-safe, same conditions as DoSweptTrace().
+    bool IsHullInSolid(
+        const Magnum::Vector3& pos,
+        const Magnum::Vector3& hull_mins,
+        const Magnum::Vector3& hull_maxs,
+        ContentsMask contents_mask = MASK_PLAYERSOLID);
+
     // Only displacements that don't have the NO_HULL_COLL flag are considered.
     bool DoesAabbIntersectAnyDisplacement(
         const Magnum::Vector3& aabb_mins,
         const Magnum::Vector3& aabb_maxs);
 
+    // Returns the manager of displacement collision caches, see
+    // DispCollCacheManager. Returns nullptr if it wasn't created yet.
+    DispCollCacheManager* GetDispCollCacheManager();
+
+    // Hull traces against static/dynamic props generate the bevel planes of
+    // each section they hit. This precomputes the bevel planes of the sections
+    // that were traced most often, as long as they fit into the given memory
+    // budget (in bytes, 0 disables precomputation). Sections that were
+    // precomputed earlier but aren't hot anymore are freed.
+    // Returns the memory size of all precomputed bevel planes, in bytes.
+    // CAUTION: Must not be called while traces are running!
+    size_t UpdateHotXPropBevelPlanes(size_t memory_budget);
+
+    // Enables or disables collision with a func_brush entity (idx into
+    // BspMap.entities_func_brush) or dynamic prop (idx into
+    // BspMap.relevant_dynamic_props), e.g. when it gets toggled by map logic.
+    // Only the small BVH of these objects is refitted, see coll::DynamicBVH.
+    // Returns false if the object has no collision model.
+    // CAUTION: Must not be called while traces are running!
+    bool SetFuncBrushEnabled  (uint32_t func_brush_idx, bool enabled);
+    bool SetDynamicPropEnabled(uint32_t      dprop_idx, bool enabled);
+
+    // Starts recording every trace of DoSweptTrace() and its results into a
+    // trace corpus file, together with this world's map identity and every
+    // change of which func_brush entities and dynamic props are enabled. The
+    // corpus can be replayed with coll::Benchmark::ReplayTraceCorpus(), see
+    // coll::TraceRecorder. Returns false if the file can't be written.
+    bool StartTraceRecording(const std::string& file_path);
+    // Writes remaining traces to the corpus file. Does nothing if not recording.
+    void StopTraceRecording();
+
 private:
     // Estimate trace cost of each object type
     uint64_t GetSweptTraceCost_Brush       (uint32_t      brush_idx); // idx into BspMap.brushes
     uint64_t GetSweptTraceCost_Displacement(uint32_t   dispcoll_idx); // idx into CDispCollTree array
-    uint64_t GetSweptTraceCost_FuncBrush   (uint32_t func_brush_idx); // idx into BspMap.entities_func_brush
     uint64_t GetSweptTraceCost_StaticProp  (uint32_t      sprop_idx); // idx into BspMap.static_props
     uint64_t GetSweptTraceCost_DynamicProp (uint32_t      dprop_idx); // idx into BspMap.relevant_dynamic_props
 
-    // Sweep trace against single objects
+    // Sweep trace against single objects. Except for func_brush entities, these
+    // don't check the object's contents against the trace's contents mask,
+    // the BVH already skips objects whose contents don't match.
+    // Some are templated on the trace's shape, see coll/TraceShape.h. They are
+    // instantiated for every shape that DispatchTraceShape() uses.
+    template<class Shape = RuntimeShape>
     void DoSweptTrace_Brush       (SweptTrace* trace, uint32_t      brush_idx); // idx into BspMap.brushes
+    template<class Shape = RuntimeShape>
     void DoSweptTrace_Displacement(SweptTrace* trace, uint32_t   dispcoll_idx); // idx into CDispCollTree array
     void DoSweptTrace_FuncBrush   (SweptTrace* trace, uint32_t func_brush_idx); // idx into BspMap.entities_func_brush
+    template<class Shape = RuntimeShape>
     void DoSweptTrace_StaticProp  (SweptTrace* trace, uint32_t      sprop_idx); // idx into BspMap.static_props
+    template<class Shape = RuntimeShape>
     void DoSweptTrace_DynamicProp (SweptTrace* trace, uint32_t      dprop_idx); // idx into BspMap.relevant_dynamic_props
 
+    // Ray trace against displacements that only collide with rays. These
+    // aren't part of the BVH, see CollidableWorld::Impl.
+    void DoSweptTrace_RayOnlyDisplacements(SweptTrace* trace);
+
+    // Records a finished trace of DoSweptTrace() if trace recording is active.
+    // candidate_context is the context whose candidates the trace was done
+    // against, or nullptr if the trace traversed the BVH.
+    void RecordFinishedTrace(const SweptTrace& trace,
+                             const TraceQueryContext* candidate_context);
+
+    // Same as IsHullInSolid(), but for the unswept box (or point) at the start
+    // of a trace. BVHs must have been created.
+    bool IsHullInSolid_Unswept(const SweptTrace::Info& hull);
+
+    // Test whether the unswept box (or point) at the start of a trace lies in
+    // single objects, i.e. whether a trace with zero sweep distance would
+    // start in solid. Same contents mask handling as DoSweptTrace_*().
+    bool IsHullInSolid_Brush       (const SweptTrace::Info& hull, uint32_t      brush_idx);
+    bool IsHullInSolid_Displacement(const SweptTrace::Info& hull, uint32_t   dispcoll_idx);
+    bool IsHullInSolid_FuncBrush   (const SweptTrace::Info& hull, uint32_t func_brush_idx);
+    bool IsHullInSolid_StaticProp  (const SweptTrace::Info& hull, uint32_t      sprop_idx);
+    bool IsHullInSolid_DynamicProp (const SweptTrace::Info& hull, uint32_t      dprop_idx);
+
 private:
     // Use "pImpl" technique to keep this header file as light as possible.
     struct Impl;
@@ -66,6 +178,7 @@ private:
     // Let some classes access private members:
     friend class ::WorldCreator; // WorldCreator initializes this class
     friend class BVH;            // BVH is heavily tied to this class
+    friend class DynamicBVH;     // Same as BVH
     friend class Debugger;       // Debugger needs to debug
     friend class Benchmark;      // Benchmarks need to benchmark
 };
@@ -3,14 +3,21 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <Corrade/Containers/Optional.h>
 
 #include "coll/BVH.h"
 #include "coll/CollidableWorld.h"
+#include "coll/CollidableWorld-brush.h"
+#include "coll/CollidableWorld-funcbrush.h"
 #include "coll/CollidableWorld-xprop.h"
 #include "coll/CollidableWorld-displacement.h"
+#include "coll/DispCollCacheManager.h"
+#include "coll/DynamicBVH.h"
+#include "coll/TraceRecorder.h"
 #include "csgo_parsing/BspMap.h"
 
 namespace coll {
@@ -29,10 +36,21 @@ struct CollidableWorld::Impl {
     // I.e.:  if (var != Corrade::Containers::NullOpt) { ... }
     template<class T> using Optional = Corrade::Containers::Optional<T>;
 
+    // Compiled collision data of worldspawn brushes.
+    Optional< CompiledBrushes > compiled_brushes =
+                                               { Corrade::Containers::NullOpt };
+
     // Collision structures of displacements without the NO_HULL_COLL flag.
     Optional< std::vector<CDispCollTree> > hull_disp_coll_trees =
                                                { Corrade::Containers::NullOpt };
 
+    // Collision structures of displacements with the NO_HULL_COLL flag, but
+    // without the NO_RAY_COLL flag. Only ray traces collide with them, they're
+    // created on the first ray trace, see DoSweptTrace_RayOnlyDisplacements().
+    Optional< std::vector<CDispCollTree> > ray_only_disp_coll_trees =
+                                               { Corrade::Containers::NullOpt };
+    std::once_flag ray_only_disp_coll_trees_init;
+
     // Collision models used in at least one solid prop (solid or dynamic).
     // Keys are MDL paths, values are collision models.
     Optional< std::map<std::string, CollisionModel> > xprop_coll_models =
@@ -48,11 +66,30 @@ struct CollidableWorld::Impl {
     Optional< std::map<uint32_t, CollisionCache_XProp> > coll_caches_dprop =
                                                { Corrade::Containers::NullOpt };
 
+    // Collision caches of each func_brush entity.
+    // Indexed like BspMap::entities_func_brush.
+    Optional< std::vector<CollisionCache_FuncBrush> > coll_caches_funcbrush =
+                                               { Corrade::Containers::NullOpt };
+
     // Bounding volume hierarchy (BVH) that accelerates traces.
     // NOTE: This BVH must only be created after all other collision data
     //       (collision models, caches, etc., see above) was created!
     Optional< BVH > bvh =
                                                { Corrade::Containers::NullOpt };
+
+    // Small BVH of func_brush entities and dynamic props, which can be enabled
+    // and disabled at runtime. Traces query it after the main BVH.
+    // NOTE: Same creation order requirement as the main BVH.
+    Optional< DynamicBVH > dynamic_bvh =
+                                               { Corrade::Containers::NullOpt };
+
+    // Records traces of DoSweptTrace() into a trace corpus file, if enabled.
+    TraceRecorder trace_recorder;
+
+    // Creates and frees collision caches of hull_disp_coll_trees.
+    // NOTE: Declared last so it's destroyed first, its warm-up thread accesses
+    //       hull_disp_coll_trees.
+    std::unique_ptr<DispCollCacheManager> disp_coll_cache_manager;
 };
 
 } // namespace coll
@@ -5,6 +5,7 @@
 #include <memory>
 #include <optional>
 #include <string>
+#include <thread>
 #include <variant>
 #include <vector>
 
@@ -27,6 +28,16 @@ using namespace coll;
 
 // -----------------------------------------------------------------------------
 
+// Only traces done by the thread that initialized this file's static variables
+// (the main thread) are recorded. Traces from other threads are ignored,
+// keeping all of the debugger's state single-threaded.
+static const std::thread::id g_debugged_thread_id = std::this_thread::get_id();
+static bool IsDebuggedThread() {
+    return std::this_thread::get_id() == g_debugged_thread_id;
+}
+
+// -----------------------------------------------------------------------------
+
 static std::string usage_error_msg = "";
 bool        Debugger::DidUsageErrorOccur() { return !usage_error_msg.empty(); }
 std::string Debugger::GetUsageErrorDesc()  { return usage_error_msg; }
@@ -149,6 +160,7 @@ void Debugger::Reset()
 void Debugger::DebugStart_Trace(const SweptTrace::Info& trace_info)
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be finished
@@ -165,6 +177,7 @@ void Debugger::DebugStart_Trace(const SweptTrace::Info& trace_info)
 void Debugger::DebugStart_BroadPhaseLeafHit(const BVH::Leaf& leaf, int32_t bp_leaf_idx)
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be UNFINISHED
@@ -232,6 +245,7 @@ void Debugger::DebugStart_DispCollLeafHit(const CDispCollTree& dispcoll,
     int dispcoll_leaf_idx)
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be UNFINISHED
@@ -283,6 +297,7 @@ void Debugger::DebugStart_DispCollLeafHit(const CDispCollTree& dispcoll,
 void Debugger::DebugFinish_DispCollLeafHit()
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be UNFINISHED
@@ -330,6 +345,7 @@ void Debugger::DebugFinish_DispCollLeafHit()
 void Debugger::DebugFinish_BroadPhaseLeafHit()
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be UNFINISHED
@@ -366,6 +382,7 @@ void Debugger::DebugFinish_BroadPhaseLeafHit()
 void Debugger::DebugFinish_Trace(const SweptTrace::Results& trace_results)
 {
     if (!Debugger::IS_ENABLED) return;
+    if (!IsDebuggedThread()) return;
     if (DidUsageErrorOccur()) return;
 
     // Previous trace must be UNFINISHED
@@ -616,6 +633,7 @@ void Debugger::DrawImGuiElements(gui::GuiState& gui_state)
         tr_info.extents.z());
     ImGui::SameLine();
     ImGui::Text(tr_info.isray ? "tr.isray = true" : "tr.isray = false");
+    ImGui::Text("tr.contents_mask = 0x%02X", (unsigned int)tr_info.contents_mask);
 
     ImGui::Text(tr_results.startsolid ? "tr.startsolid = true" : "tr.startsolid = false");
     ImGui::Text(tr_results.allsolid ? "tr.allsolid = true" : "tr.allsolid = false");
@@ -641,8 +659,11 @@ void Debugger::DrawImGuiElements(gui::GuiState& gui_state)
     for (size_t i = 0; i < entry.broad_phase_leaf_hits.size(); i++) {
         const BroadPhaseLeafHit& bp_leaf_hit = entry.broad_phase_leaf_hits[i];
 
-        std::string label = "Hit #" + std::to_string(i) + ": Leaf #";
-        label += std::to_string(bp_leaf_hit.bvh_leaf_idx) + ", ";
+        std::string label = "Hit #" + std::to_string(i) + ": ";
+        if (bp_leaf_hit.bvh_leaf_idx >= 0)
+            label += "Leaf #" + std::to_string(bp_leaf_hit.bvh_leaf_idx) + ", ";
+        else
+            label += "Dynamic Leaf, ";
 
         switch (bp_leaf_hit.bvh_leaf_type) {
         case BVH::Leaf::Brush:
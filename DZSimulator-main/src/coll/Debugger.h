@@ -24,7 +24,9 @@ public:
     static constexpr bool IS_ENABLED = true;
 #endif
 
-    // CAUTION: coll::Debugger is not thread-safe yet!
+    // Only traces done on the main thread are debugged, DebugStart_* and
+    // DebugFinish_* calls from other threads are ignored. All other methods
+    // must be called from the main thread.
 
     // You must call this once map data became invalid/non-existent
     static void Reset();
@@ -40,6 +42,7 @@ public:
 
     static void DebugStart_Trace(const SweptTrace::Info& trace_info);
 
+        // bp_leaf_idx is negative if bp_leaf isn't part of the main BVH
         static void DebugStart_BroadPhaseLeafHit(const BVH::Leaf& bp_leaf, int32_t bp_leaf_idx);
 
             // Usable only if hit broad-phase leaf was of type displacement!
@@ -0,0 +1,174 @@
+#include "coll/DispCollCacheManager.h"
+
+#include <algorithm>
+#include <cassert>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <Tracy.hpp>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/CollidableWorld.h"
+#include "coll/CollidableWorld-displacement.h"
+
+using namespace coll;
+using namespace Magnum;
+
+
+DispCollCacheManager::DispCollCacheManager(
+    std::vector<CDispCollTree>& disp_trees)
+    : m_disp_trees{ disp_trees }
+    , m_last_use_epochs{ std::make_unique<std::atomic<uint32_t>[]>(disp_trees.size()) }
+{
+    for (size_t i = 0; i < m_disp_trees.size(); i++)
+        m_last_use_epochs[i].store(0, std::memory_order_relaxed);
+
+#ifndef DZSIM_WEB_PORT
+    // Web build only has a small pool of pthreads that must not be exhausted
+    if (!m_disp_trees.empty())
+        m_warm_up_thread = std::thread(&DispCollCacheManager::WarmUpThreadMain, this);
+#endif
+}
+
+DispCollCacheManager::~DispCollCacheManager()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_warm_up_mutex);
+        m_stop_warm_up_thread = true;
+    }
+    m_warm_up_cv.notify_one();
+    if (m_warm_up_thread.joinable())
+        m_warm_up_thread.join();
+}
+
+void DispCollCacheManager::SetMemoryBudget(size_t budget_in_bytes)
+{
+    m_memory_budget.store(budget_in_bytes, std::memory_order_relaxed);
+}
+
+size_t DispCollCacheManager::GetMemoryBudget() const
+{
+    return m_memory_budget.load(std::memory_order_relaxed);
+}
+
+void DispCollCacheManager::OnCacheUsed(uint32_t dispcoll_idx,
+    bool was_cache_ready)
+{
+    assert(dispcoll_idx < m_disp_trees.size());
+    m_last_use_epochs[dispcoll_idx].store(
+        m_cur_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    if (was_cache_ready)
+        m_num_hits.fetch_add(1, std::memory_order_relaxed);
+    else
+        m_num_misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+void DispCollCacheManager::RequestWarmUp(const Vector3& region_mins,
+    const Vector3& region_maxs)
+{
+    if (!m_warm_up_thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_warm_up_mutex);
+        m_has_warm_up_request = true;
+        m_warm_up_region_mins = region_mins;
+        m_warm_up_region_maxs = region_maxs;
+    }
+    m_warm_up_cv.notify_one();
+}
+
+void DispCollCacheManager::EnforceMemoryBudget()
+{
+    ZoneScoped;
+
+    std::lock_guard<std::mutex> lock(m_cache_lifetime_mutex);
+    uint32_t cur_epoch = m_cur_epoch.load(std::memory_order_relaxed);
+
+    // Collect caches that weren't used during the current epoch
+    size_t total_size = 0;
+    size_t num_caches = 0;
+    std::vector<std::pair<uint32_t, uint32_t>> evictable; // (last use epoch, dispcoll idx)
+    for (size_t i = 0; i < m_disp_trees.size(); i++) {
+        if (!m_disp_trees[i].IsCacheGenerated())
+            continue;
+        total_size += m_disp_trees[i].GetCacheMemorySize();
+        num_caches++;
+        uint32_t last_use_epoch = m_last_use_epochs[i].load(std::memory_order_relaxed);
+        if (last_use_epoch != cur_epoch)
+            evictable.emplace_back(last_use_epoch, (uint32_t)i);
+    }
+
+    // Free least recently used caches first
+    size_t budget = m_memory_budget.load(std::memory_order_relaxed);
+    if (budget != 0 && total_size > budget) {
+        std::sort(evictable.begin(), evictable.end());
+        for (const auto& [last_use_epoch, dispcoll_idx] : evictable) {
+            if (total_size <= budget)
+                break;
+            total_size -= m_disp_trees[dispcoll_idx].GetCacheMemorySize();
+            num_caches--;
+            m_disp_trees[dispcoll_idx].Uncache();
+            m_num_evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    m_cache_memory_size.store(total_size, std::memory_order_relaxed);
+    m_num_caches       .store(num_caches, std::memory_order_relaxed);
+    m_cur_epoch.store(cur_epoch + 1, std::memory_order_relaxed);
+}
+
+DispCollCacheManager::Stats DispCollCacheManager::GetStats() const
+{
+    return {
+        .num_hits          = m_num_hits         .load(std::memory_order_relaxed),
+        .num_misses        = m_num_misses       .load(std::memory_order_relaxed),
+        .num_evictions     = m_num_evictions    .load(std::memory_order_relaxed),
+        .num_warm_ups      = m_num_warm_ups     .load(std::memory_order_relaxed),
+        .cache_memory_size = m_cache_memory_size.load(std::memory_order_relaxed),
+        .num_caches        = m_num_caches       .load(std::memory_order_relaxed),
+    };
+}
+
+void DispCollCacheManager::WarmUpThreadMain()
+{
+    while (true) {
+        Vector3 region_mins, region_maxs;
+        {
+            std::unique_lock<std::mutex> lock(m_warm_up_mutex);
+            m_warm_up_cv.wait(lock, [this] {
+                return m_has_warm_up_request || m_stop_warm_up_thread;
+            });
+            if (m_stop_warm_up_thread)
+                return;
+            m_has_warm_up_request = false;
+            region_mins = m_warm_up_region_mins;
+            region_maxs = m_warm_up_region_maxs;
+        }
+
+        for (size_t i = 0; i < m_disp_trees.size(); i++) {
+            CDispCollTree& disp = m_disp_trees[i];
+            if (!AabbIntersectsAabb(disp.m_mins, disp.m_maxs, region_mins, region_maxs))
+                continue;
+            if (disp.IsCacheGenerated())
+                continue;
+
+            {
+                std::lock_guard<std::mutex> lock(m_cache_lifetime_mutex);
+                // Protect the new cache from eviction until the next epoch
+                m_last_use_epochs[i].store(
+                    m_cur_epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                if (disp.EnsureCacheIsCreated())
+                    m_num_warm_ups.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Stop early when shutting down
+            std::lock_guard<std::mutex> lock(m_warm_up_mutex);
+            if (m_stop_warm_up_thread)
+                return;
+        }
+    }
+}
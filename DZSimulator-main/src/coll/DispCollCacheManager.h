@@ -0,0 +1,114 @@
+#ifndef COLL_DISPCOLLCACHEMANAGER_H_
+#define COLL_DISPCOLLCACHEMANAGER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <Magnum/Math/Vector3.h>
+
+namespace coll {
+
+class CDispCollTree;
+
+// Manages the collision caches of displacements (see
+// CDispCollTree::EnsureCacheIsCreated()). Without it, caches are created on the
+// first hull sweep that needs them, possibly causing stutters, and are never
+// freed.
+// - Caches of displacements near the player's predicted path can be created
+//   ahead of time by a background thread, see RequestWarmUp().
+// - The least recently used caches are freed once their total memory size
+//   exceeds a budget, see EnforceMemoryBudget().
+// - Counters tell how effective the warm-up and the budget are, see GetStats().
+class DispCollCacheManager {
+public:
+    static constexpr size_t DEFAULT_MEMORY_BUDGET = 16 * 1024 * 1024; // In bytes
+
+    // disp_trees must outlive this object.
+    DispCollCacheManager(std::vector<CDispCollTree>& disp_trees);
+    ~DispCollCacheManager(); // Stops the warm-up thread
+
+    DispCollCacheManager(const DispCollCacheManager&) = delete;
+    DispCollCacheManager& operator=(const DispCollCacheManager&) = delete;
+
+    // Sets the memory size all caches may occupy, in bytes. 0 means unlimited.
+    // Only takes effect on the next EnforceMemoryBudget() call. Thread-safe.
+    void   SetMemoryBudget(size_t budget_in_bytes);
+    size_t GetMemoryBudget() const;
+
+    // Must be called by every hull trace that used the cache of a displacement.
+    // was_cache_ready is false if the trace had to create that cache.
+    // Thread-safe.
+    void OnCacheUsed(uint32_t dispcoll_idx, bool was_cache_ready);
+
+    // Makes the warm-up thread create the caches of all displacements whose
+    // bounds intersect the given region, e.g. the region around the player's
+    // predicted path. Replaces a previously requested region if its warm-up
+    // hasn't started yet. Returns immediately. Thread-safe.
+    // NOTE: Does nothing in the web build, it has no threads to spare.
+    void RequestWarmUp(const Magnum::Vector3& region_mins,
+                       const Magnum::Vector3& region_maxs);
+
+    // If the total memory size of all caches exceeds the budget, frees the
+    // least recently used caches until it doesn't. Caches that were used or
+    // warmed up since the previous call are never freed, so the budget might
+    // stay exceeded. Intended to be called once per game tick.
+    // CAUTION: Must not be called while traces are running! Waits for the
+    //          warm-up thread to finish creating its current cache.
+    void EnforceMemoryBudget();
+
+    // Counters, they are never reset.
+    struct Stats {
+        uint64_t num_hits      = 0; // Traces that used an already created cache
+        uint64_t num_misses    = 0; // Traces that had to create a cache
+        uint64_t num_evictions = 0; // Caches freed to meet the memory budget
+        uint64_t num_warm_ups  = 0; // Caches created by the warm-up thread
+
+        // Of all caches, as of the most recent EnforceMemoryBudget() call
+        size_t cache_memory_size = 0; // In bytes
+        size_t num_caches        = 0;
+    };
+    Stats GetStats() const; // Thread-safe
+
+private:
+    void WarmUpThreadMain();
+
+private:
+    std::vector<CDispCollTree>& m_disp_trees;
+
+    // Caches are used in epochs, a new epoch starts with every
+    // EnforceMemoryBudget() call. The least recently used caches are the ones
+    // with the oldest epoch of last use.
+    std::atomic<uint32_t> m_cur_epoch{ 1 };
+    std::unique_ptr<std::atomic<uint32_t>[]> m_last_use_epochs; // Indexed like m_disp_trees
+
+    std::atomic<size_t>   m_memory_budget{ DEFAULT_MEMORY_BUDGET };
+    std::atomic<uint64_t> m_num_hits      { 0 };
+    std::atomic<uint64_t> m_num_misses    { 0 };
+    std::atomic<uint64_t> m_num_evictions { 0 };
+    std::atomic<uint64_t> m_num_warm_ups  { 0 };
+    std::atomic<size_t>   m_cache_memory_size{ 0 };
+    std::atomic<size_t>   m_num_caches       { 0 };
+
+    // Held by the warm-up thread while it creates a cache, and while caches
+    // are freed. Keeps caches from getting freed while they're being created.
+    std::mutex m_cache_lifetime_mutex;
+
+    // Warm-up thread and its requests, protected by m_warm_up_mutex
+    std::thread             m_warm_up_thread;
+    std::mutex              m_warm_up_mutex;
+    std::condition_variable m_warm_up_cv;
+    bool                    m_has_warm_up_request = false;
+    bool                    m_stop_warm_up_thread = false;
+    Magnum::Vector3         m_warm_up_region_mins;
+    Magnum::Vector3         m_warm_up_region_maxs;
+};
+
+} // namespace coll
+
+#endif // COLL_DISPCOLLCACHEMANAGER_H_
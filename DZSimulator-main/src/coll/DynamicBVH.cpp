@@ -0,0 +1,351 @@
+#include "coll/DynamicBVH.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include <Tracy.hpp>
+
+#include <Corrade/Containers/Optional.h>
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Functions.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/BVH.h"
+#include "coll/CollidableWorld.h"
+#include "coll/CollidableWorld_Impl.h"
+#include "coll/CollidableWorld-funcbrush.h"
+#include "coll/CollidableWorld-xprop.h"
+#include "coll/Debugger.h"
+#include "coll/SweptTrace.h"
+#include "csgo_parsing/BspMap.h"
+
+using namespace coll;
+using namespace Magnum;
+using namespace csgo_parsing;
+
+#define PRINT_PREFIX "[DynamicBVH]"
+
+DynamicBVH::DynamicBVH(CollidableWorld& c_world)
+{
+    std::shared_ptr<const BspMap> bsp_map = c_world.pImpl->origin_bsp_map;
+    funcbrush_leaf_indices.assign(bsp_map->entities_func_brush.size(),    NO_LEAF);
+    dprop_leaf_indices    .assign(bsp_map->relevant_dynamic_props.size(), NO_LEAF);
+
+    // Collect func_brush entities, including those that aren't solid yet
+    assert(c_world.pImpl->coll_caches_funcbrush != Corrade::Containers::NullOpt);
+    for (size_t fb_idx = 0; fb_idx < bsp_map->entities_func_brush.size(); fb_idx++) {
+        const BspMap::Ent_func_brush& func_brush = bsp_map->entities_func_brush[fb_idx];
+        if (func_brush.solidity == 1)
+            continue; // Never solid
+        if ((*c_world.pImpl->coll_caches_funcbrush)[fb_idx].model_idx == -1)
+            continue; // Invalid model
+
+        ContentsMask contents = GetContents_FuncBrush(fb_idx, *bsp_map);
+        if (contents == 0)
+            continue; // None of its brushes take part in collision
+
+        Vector3 mins, maxs;
+        bool valid_aabb = CalcAabb_FuncBrush(fb_idx, *bsp_map, &mins, &maxs);
+        if (!valid_aabb)
+            continue;
+
+        funcbrush_leaf_indices[fb_idx] = (uint32_t)leaves.size();
+        leaves.push_back({
+            // Bloat AABB a little to account for collision calculation tolerances
+            .mins = mins - Vector3{ 1.0f, 1.0f, 1.0f },
+            .maxs = maxs + Vector3{ 1.0f, 1.0f, 1.0f },
+            .type       = ObjectType::FuncBrush,
+            .object_idx = (uint32_t)fb_idx,
+            .contents   = contents,
+            .enabled    = func_brush.IsSolid(),
+            .node_idx   = NO_NODE
+        });
+    }
+
+    // Collect dynamic props that have a collision cache
+    assert(c_world.pImpl->coll_caches_dprop != Corrade::Containers::NullOpt);
+    for (const auto& [dprop_idx, dprop_coll_cache] : *c_world.pImpl->coll_caches_dprop) {
+        // Get exact, non-bloated AABB of dynamic prop
+        Vector3 mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+        Vector3 maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+        for (const auto& section_aabb : dprop_coll_cache.section_aabbs) {
+            mins = Math::min(mins, section_aabb.mins);
+            maxs = Math::max(maxs, section_aabb.maxs);
+        }
+
+        dprop_leaf_indices[dprop_idx] = (uint32_t)leaves.size();
+        leaves.push_back({
+            // Bloat AABB a little to account for collision calculation tolerances
+            .mins = mins - Vector3{ 1.0f, 1.0f, 1.0f },
+            .maxs = maxs + Vector3{ 1.0f, 1.0f, 1.0f },
+            .type       = ObjectType::DynamicProp,
+            .object_idx = dprop_idx,
+            .contents   = CONTENTS_SOLID,
+            .enabled    = true,
+            .node_idx   = NO_NODE
+        });
+    }
+
+    Debug{} << PRINT_PREFIX << leaves.size() << "func_brush entities and "
+        "dynamic props were collected";
+    if (leaves.empty())
+        return;
+
+    std::vector<uint32_t> leaf_indices(leaves.size());
+    for (size_t i = 0; i < leaf_indices.size(); i++)
+        leaf_indices[i] = (uint32_t)i;
+    nodes.reserve(2 * leaves.size() - 1);
+    CreateSubtree(leaf_indices, NO_NODE);
+}
+
+uint32_t DynamicBVH::CreateSubtree(std::span<uint32_t> leaf_indices,
+    uint32_t parent)
+{
+    assert(!leaf_indices.empty());
+    uint32_t node_idx = (uint32_t)nodes.size();
+    nodes.push_back({
+        .mins     = { 0.0f, 0.0f, 0.0f }, // Set by RefitNode()
+        .maxs     = { 0.0f, 0.0f, 0.0f },
+        .parent   = parent,
+        .child_r  = NO_NODE,
+        .leaf_idx = leaf_indices[0],
+        .contained_contents = 0,
+    });
+
+    if (leaf_indices.size() == 1) { // Leaf node
+        leaves[leaf_indices[0]].node_idx = node_idx;
+        RefitNode(nodes[node_idx]);
+        return node_idx;
+    }
+
+    // Split leaves at their median centroid along the axis with the largest
+    // extent of leaf centroids. Disabled leaves are included, so that
+    // enabling them later doesn't degrade the BVH.
+    Vector3 centroid_mins = { +HUGE_VALF, +HUGE_VALF, +HUGE_VALF };
+    Vector3 centroid_maxs = { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF };
+    for (uint32_t leaf_idx : leaf_indices) {
+        Vector3 centroid = leaves[leaf_idx].mins + leaves[leaf_idx].maxs; // Doubled, only compared
+        centroid_mins = Math::min(centroid_mins, centroid);
+        centroid_maxs = Math::max(centroid_maxs, centroid);
+    }
+    Vector3 extent = centroid_maxs - centroid_mins;
+    int axis = 0;
+    if (extent[1] > extent[axis]) axis = 1;
+    if (extent[2] > extent[axis]) axis = 2;
+    size_t half = leaf_indices.size() / 2;
+    std::nth_element(leaf_indices.begin(), leaf_indices.begin() + half,
+        leaf_indices.end(),
+        [&](uint32_t a, uint32_t b) {
+            return leaves[a].mins[axis] + leaves[a].maxs[axis]
+                 < leaves[b].mins[axis] + leaves[b].maxs[axis];
+        });
+
+    CreateSubtree(leaf_indices.first(half), node_idx); // Left child is next node
+    uint32_t child_r = CreateSubtree(leaf_indices.subspan(half), node_idx);
+    nodes[node_idx].child_r = child_r;
+    RefitNode(nodes[node_idx]);
+    return node_idx;
+}
+
+void DynamicBVH::RefitNode(Node& node)
+{
+    if (node.child_r == NO_NODE) { // Leaf node
+        const Leaf& leaf = leaves[node.leaf_idx];
+        node.mins = leaf.mins;
+        node.maxs = leaf.maxs;
+        node.contained_contents = leaf.enabled ? leaf.contents : 0;
+        return;
+    }
+
+    // Only enabled leaves contribute to the AABB
+    const Node& child_l = *(&node + 1);
+    const Node& child_r = nodes[node.child_r];
+    node.contained_contents = child_l.contained_contents | child_r.contained_contents;
+    if (child_l.contained_contents && child_r.contained_contents) {
+        node.mins = Math::min(child_l.mins, child_r.mins);
+        node.maxs = Math::max(child_l.maxs, child_r.maxs);
+    }
+    else if (child_l.contained_contents) {
+        node.mins = child_l.mins;
+        node.maxs = child_l.maxs;
+    }
+    else if (child_r.contained_contents) {
+        node.mins = child_r.mins;
+        node.maxs = child_r.maxs;
+    }
+}
+
+void DynamicBVH::RefitFromNode(uint32_t node_idx)
+{
+    while (node_idx != NO_NODE) {
+        RefitNode(nodes[node_idx]);
+        node_idx = nodes[node_idx].parent;
+    }
+}
+
+DynamicBVH::Leaf* DynamicBVH::GetLeaf(ObjectType type, uint32_t object_idx)
+{
+    const std::vector<uint32_t>& leaf_indices =
+        type == ObjectType::FuncBrush ? funcbrush_leaf_indices : dprop_leaf_indices;
+    if (object_idx >= leaf_indices.size() || leaf_indices[object_idx] == NO_LEAF)
+        return nullptr;
+    return &leaves[leaf_indices[object_idx]];
+}
+
+const DynamicBVH::Leaf* DynamicBVH::GetLeaf(ObjectType type,
+    uint32_t object_idx) const
+{
+    return const_cast<DynamicBVH*>(this)->GetLeaf(type, object_idx);
+}
+
+bool DynamicBVH::SetObjectEnabled(ObjectType type, uint32_t object_idx,
+    bool enabled)
+{
+    Leaf* leaf = GetLeaf(type, object_idx);
+    if (!leaf)
+        return false;
+    if (leaf->enabled != enabled) {
+        leaf->enabled = enabled;
+        RefitFromNode(leaf->node_idx);
+    }
+    return true;
+}
+
+bool DynamicBVH::IsObjectEnabled(ObjectType type, uint32_t object_idx) const
+{
+    const Leaf* leaf = GetLeaf(type, object_idx);
+    return leaf && leaf->enabled;
+}
+
+std::vector<DynamicBVH::ObjectState> DynamicBVH::GetObjectStates() const
+{
+    std::vector<ObjectState> states;
+    states.reserve(leaves.size());
+    for (const Leaf& leaf : leaves)
+        states.push_back({
+            .type       = leaf.type,
+            .object_idx = leaf.object_idx,
+            .enabled    = leaf.enabled,
+        });
+    return states;
+}
+
+bool DynamicBVH::SetObjectAabb(ObjectType type, uint32_t object_idx,
+    const Vector3& mins, const Vector3& maxs)
+{
+    Leaf* leaf = GetLeaf(type, object_idx);
+    if (!leaf)
+        return false;
+    leaf->mins = mins;
+    leaf->maxs = maxs;
+    RefitFromNode(leaf->node_idx);
+    return true;
+}
+
+void DynamicBVH::DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (nodes.empty())
+        return;
+
+    uint32_t node_stack[MAX_TRAVERSAL_STACK_SIZE];
+    size_t stack_size = 0;
+    node_stack[stack_size++] = 0; // Start at root
+    while (stack_size > 0) {
+        const Node& node = nodes[node_stack[--stack_size]];
+        // Skip subtrees whose enabled leaves don't match the contents mask
+        if (!(node.contained_contents & trace->info.contents_mask))
+            continue;
+
+        float hit_fraction;
+        if (!IsAabbHitByFullSweptTrace(trace->info.startpos, trace->info.invdelta,
+                trace->info.extents, node.mins, node.maxs, &hit_fraction))
+            continue;
+        // Objects entered after the closest hit so far can't be hit earlier
+        if (hit_fraction > trace->results.fraction)
+            continue;
+
+        if (node.child_r == NO_NODE) { // Leaf node
+            const Leaf& leaf = leaves[node.leaf_idx];
+            if constexpr (coll::Debugger::IS_ENABLED) {
+                // The debugger describes broad-phase hits with the main BVH's
+                // leaf format. This leaf isn't part of the main BVH, hence
+                // there's no main BVH leaf idx to pass.
+                BVH::Leaf bp_leaf = {
+                    .mins = leaf.mins,
+                    .maxs = leaf.maxs,
+                    .type = leaf.type == ObjectType::FuncBrush ?
+                        BVH::Leaf::FuncBrush : BVH::Leaf::DynamicProp,
+                    .contents = leaf.contents,
+                };
+                if (leaf.type == ObjectType::FuncBrush)
+                    bp_leaf.funcbrush_idx = leaf.object_idx;
+                else
+                    bp_leaf.dprop_idx = leaf.object_idx;
+                coll::Debugger::DebugStart_BroadPhaseLeafHit(bp_leaf, -1);
+            }
+            switch (leaf.type) {
+            case ObjectType::FuncBrush:
+                c_world.DoSweptTrace_FuncBrush  (trace, leaf.object_idx); break;
+            case ObjectType::DynamicProp:
+                c_world.DoSweptTrace_DynamicProp(trace, leaf.object_idx); break;
+            }
+            coll::Debugger::DebugFinish_BroadPhaseLeafHit();
+            continue;
+        }
+
+        assert(stack_size + 2 <= MAX_TRAVERSAL_STACK_SIZE);
+        node_stack[stack_size++] = node.child_r;
+        node_stack[stack_size++] = (uint32_t)(&node - nodes.data()) + 1; // Left child
+    }
+}
+
+bool DynamicBVH::IsHullInSolid(const SweptTrace::Info& hull,
+    CollidableWorld& c_world) const
+{
+    ZoneScoped;
+
+    if (nodes.empty())
+        return false;
+
+    const Vector3 hull_mins = hull.startpos - hull.extents;
+    const Vector3 hull_maxs = hull.startpos + hull.extents;
+
+    uint32_t node_stack[MAX_TRAVERSAL_STACK_SIZE];
+    size_t stack_size = 0;
+    node_stack[stack_size++] = 0; // Start at root
+    while (stack_size > 0) {
+        uint32_t node_idx = node_stack[--stack_size];
+        const Node& node = nodes[node_idx];
+        if (!(node.contained_contents & hull.contents_mask))
+            continue;
+        if (!AabbIntersectsAabb(hull_mins, hull_maxs, node.mins, node.maxs))
+            continue;
+
+        if (node.child_r == NO_NODE) { // Leaf node
+            const Leaf& leaf = leaves[node.leaf_idx];
+            bool is_in_solid = false;
+            switch (leaf.type) {
+            case ObjectType::FuncBrush:
+                is_in_solid = c_world.IsHullInSolid_FuncBrush  (hull, leaf.object_idx); break;
+            case ObjectType::DynamicProp:
+                is_in_solid = c_world.IsHullInSolid_DynamicProp(hull, leaf.object_idx); break;
+            }
+            if (is_in_solid)
+                return true;
+            continue;
+        }
+
+        assert(stack_size + 2 <= MAX_TRAVERSAL_STACK_SIZE);
+        node_stack[stack_size++] = node.child_r;
+        node_stack[stack_size++] = node_idx + 1; // Left child
+    }
+    return false;
+}
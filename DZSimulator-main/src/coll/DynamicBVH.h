@@ -0,0 +1,128 @@
+#ifndef COLL_DYNAMICBVH_H_
+#define COLL_DYNAMICBVH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/CollidableWorld.h"
+#include "coll/SweptTrace.h"
+
+namespace coll {
+
+// Small secondary BVH over the collidable objects whose state can change at
+// runtime: func_brush entities and dynamic props. Objects can be enabled,
+// disabled or given a new AABB without rebuilding the world's main BVH (see
+// coll::BVH), only the node AABBs above the changed object get refitted.
+// Traces query both the main BVH and this one.
+class DynamicBVH {
+public:
+    enum class ObjectType {
+        FuncBrush,   // idx into BspMap.entities_func_brush
+        DynamicProp, // idx into BspMap.relevant_dynamic_props
+    };
+
+    // Collects all func_brush entities and dynamic props of c_world that can
+    // be collided with. func_brush entities that aren't solid initially (see
+    // BspMap::Ent_func_brush::IsSolid()) start out disabled.
+    // CAUTION: Must only be created after the collision caches of dynamic
+    //          props and func_brush entities in c_world were created!
+    DynamicBVH(CollidableWorld& c_world);
+
+    // Thread-safe: Multiple threads can trace concurrently, as long as neither
+    // this BVH nor c_world is modified in the meantime.
+    // Leaf hits show up in coll::Debugger as broad-phase leaf hits without a
+    // leaf idx.
+    void DoSweptTrace(SweptTrace* trace, CollidableWorld& c_world) const;
+
+    // Returns true if the unswept box (or point) at the start of the given
+    // hull lies in any enabled object, see CollidableWorld::IsHullInSolid().
+    // Thread-safe, same conditions as DoSweptTrace().
+    bool IsHullInSolid(const SweptTrace::Info& hull, CollidableWorld& c_world) const;
+
+    // Enables or disables collision with an object. Returns false if the
+    // object isn't part of this BVH, e.g. because it has no collision model.
+    // CAUTION: Must not be called while traces are running!
+    bool SetObjectEnabled(ObjectType type, uint32_t object_idx, bool enabled);
+    bool IsObjectEnabled(ObjectType type, uint32_t object_idx) const;
+
+    // Whether an object is enabled, see SetObjectEnabled()
+    struct ObjectState {
+        ObjectType type;
+        uint32_t   object_idx;
+        bool       enabled;
+    };
+    // Returns the state of every object of this BVH
+    std::vector<ObjectState> GetObjectStates() const;
+
+    // Sets the (bloated) AABB of an object, e.g. after it was moved. Returns
+    // false if the object isn't part of this BVH.
+    // NOTE: Only the BVH gets updated, the object's collision cache must be
+    //       updated separately.
+    // CAUTION: Must not be called while traces are running!
+    bool SetObjectAabb(ObjectType type, uint32_t object_idx,
+        const Magnum::Vector3& mins, const Magnum::Vector3& maxs);
+
+    size_t GetObjectCount() const { return leaves.size(); }
+
+private:
+    struct Leaf {
+        // AABB of referenced object, but slightly bloated.
+        Magnum::Vector3 mins;
+        Magnum::Vector3 maxs;
+        ObjectType   type;
+        uint32_t     object_idx;
+        ContentsMask contents; // What the object is solid to
+        bool         enabled;
+        uint32_t     node_idx; // idx into nodes of this leaf's node
+    };
+
+    struct Node {
+        // AABB of all enabled leaves in this node's subtree. Only valid if
+        // contained_contents isn't 0.
+        Magnum::Vector3 mins;
+        Magnum::Vector3 maxs;
+
+        uint32_t parent;      // idx into nodes, NO_NODE for the root node
+        uint32_t child_r;     // idx into nodes, NO_NODE for leaf nodes. Left child is the next node
+        uint32_t leaf_idx;    // idx into leaves, only for leaf nodes
+
+        // OR-ed contents flags of all enabled leaves in this node's subtree.
+        // 0 if they're all disabled, traces skip the node then.
+        ContentsMask contained_contents;
+    };
+    static constexpr uint32_t NO_NODE = UINT32_MAX;
+
+    // Max number of entries on the fixed-size traversal stack. Median splits
+    // keep the BVH balanced.
+    static constexpr size_t MAX_TRAVERSAL_STACK_SIZE = 64;
+
+    // Appends the subtree of the given leaves to nodes, returns its root idx
+    uint32_t CreateSubtree(std::span<uint32_t> leaf_indices, uint32_t parent);
+
+    // Recomputes the AABB and contents of the node and of all its ancestors
+    void RefitFromNode(uint32_t node_idx);
+
+    // Sets a node's AABB and contents using its children or its leaf
+    void RefitNode(Node& node);
+
+    // Returns nullptr if the object isn't part of this BVH
+    Leaf* GetLeaf(ObjectType type, uint32_t object_idx);
+    const Leaf* GetLeaf(ObjectType type, uint32_t object_idx) const;
+
+private:
+    std::vector<Leaf> leaves;
+    std::vector<Node> nodes; // Root node at index 0, if there are any leaves
+
+    // idx into leaves of each object, NO_LEAF if object isn't part of this BVH
+    static constexpr uint32_t NO_LEAF = UINT32_MAX;
+    std::vector<uint32_t> funcbrush_leaf_indices; // Indexed like BspMap.entities_func_brush
+    std::vector<uint32_t> dprop_leaf_indices;     // Indexed like BspMap.relevant_dynamic_props
+};
+
+} // namespace coll
+
+#endif // COLL_DYNAMICBVH_H_
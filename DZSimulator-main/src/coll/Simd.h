@@ -0,0 +1,143 @@
+#ifndef COLL_SIMD_H_
+#define COLL_SIMD_H_
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Functions.h>
+
+// Minimal 4-wide float abstraction used by performance-critical collision code.
+// Uses SSE intrinsics on x86, WebAssembly SIMD intrinsics in the Emscripten
+// build (compiled with -msimd128) and falls back to plain scalar code
+// otherwise. All backends produce identical results.
+// Define COLL_SIMD_SSE or COLL_SIMD_WASM as 0 to test the scalar fallback.
+#ifndef COLL_SIMD_SSE
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLL_SIMD_SSE 1
+#else
+#define COLL_SIMD_SSE 0
+#endif
+#endif
+
+#ifndef COLL_SIMD_WASM
+#if defined(__wasm_simd128__) && !COLL_SIMD_SSE
+#define COLL_SIMD_WASM 1
+#else
+#define COLL_SIMD_WASM 0
+#endif
+#endif
+
+#if COLL_SIMD_SSE
+#include <emmintrin.h>
+#elif COLL_SIMD_WASM
+#include <wasm_simd128.h>
+#endif
+
+namespace coll::simd {
+
+    // Arrays that get loaded with Load4() must have this alignment
+    constexpr size_t FLOAT4_ALIGNMENT = 16;
+
+#if COLL_SIMD_SSE
+    struct Float4 { __m128 v; };
+
+    inline Float4 Load4(const float* aligned_ptr) { return { _mm_load_ps(aligned_ptr) }; }
+    inline Float4 Splat4(float val)               { return { _mm_set1_ps(val) }; }
+    inline void   Store4(float* aligned_ptr, Float4 a) { _mm_store_ps(aligned_ptr, a.v); }
+
+    // Loads and converts 4 consecutive int16 values, no alignment required
+    inline Float4 LoadInt16x4(const int16_t* ptr) {
+        __m128i i16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(ptr));
+        __m128i i32 = _mm_srai_epi32(_mm_unpacklo_epi16(i16, i16), 16); // Sign-extend
+        return { _mm_cvtepi32_ps(i32) };
+    }
+
+    inline Float4 Add(Float4 a, Float4 b) { return { _mm_add_ps(a.v, b.v) }; }
+    inline Float4 Sub(Float4 a, Float4 b) { return { _mm_sub_ps(a.v, b.v) }; }
+    inline Float4 Mul(Float4 a, Float4 b) { return { _mm_mul_ps(a.v, b.v) }; }
+    inline Float4 Abs(Float4 a) { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v) }; }
+
+    // Same results as Magnum::Math::min() and Magnum::Math::max(), including
+    // which operand is returned when both compare equal (relevant for -0/+0).
+    inline Float4 Min(Float4 a, Float4 b) { return { _mm_min_ps(b.v, a.v) }; }
+    inline Float4 Max(Float4 a, Float4 b) { return { _mm_max_ps(b.v, a.v) }; }
+
+    // Returns a 4-bit mask, bit i is set if (a[i] <= b[i])
+    inline int CmpLeMask(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+    // Returns a 4-bit mask, bit i is set if (a[i] < b[i])
+    inline int CmpLtMask(Float4 a, Float4 b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+#elif COLL_SIMD_WASM
+    struct Float4 { v128_t v; };
+
+    inline Float4 Load4(const float* aligned_ptr) { return { wasm_v128_load(aligned_ptr) }; }
+    inline Float4 Splat4(float val)               { return { wasm_f32x4_splat(val) }; }
+    inline void   Store4(float* aligned_ptr, Float4 a) { wasm_v128_store(aligned_ptr, a.v); }
+
+    // Loads and converts 4 consecutive int16 values, no alignment required
+    inline Float4 LoadInt16x4(const int16_t* ptr) {
+        return { wasm_f32x4_convert_i32x4(wasm_i32x4_load16x4(ptr)) };
+    }
+
+    inline Float4 Add(Float4 a, Float4 b) { return { wasm_f32x4_add(a.v, b.v) }; }
+    inline Float4 Sub(Float4 a, Float4 b) { return { wasm_f32x4_sub(a.v, b.v) }; }
+    inline Float4 Mul(Float4 a, Float4 b) { return { wasm_f32x4_mul(a.v, b.v) }; }
+    inline Float4 Abs(Float4 a) { return { wasm_f32x4_abs(a.v) }; }
+
+    // Same results as Magnum::Math::min() and Magnum::Math::max(), the
+    // "pseudo" min/max instructions are defined exactly like them.
+    inline Float4 Min(Float4 a, Float4 b) { return { wasm_f32x4_pmin(a.v, b.v) }; }
+    inline Float4 Max(Float4 a, Float4 b) { return { wasm_f32x4_pmax(a.v, b.v) }; }
+
+    // Returns a 4-bit mask, bit i is set if (a[i] <= b[i])
+    inline int CmpLeMask(Float4 a, Float4 b) { return wasm_i32x4_bitmask(wasm_f32x4_le(a.v, b.v)); }
+    // Returns a 4-bit mask, bit i is set if (a[i] < b[i])
+    inline int CmpLtMask(Float4 a, Float4 b) { return wasm_i32x4_bitmask(wasm_f32x4_lt(a.v, b.v)); }
+#else
+    struct Float4 { float v[4]; };
+
+    inline Float4 Load4(const float* aligned_ptr) {
+        return { aligned_ptr[0], aligned_ptr[1], aligned_ptr[2], aligned_ptr[3] };
+    }
+    inline Float4 Splat4(float val) { return { val, val, val, val }; }
+    inline void   Store4(float* aligned_ptr, Float4 a) {
+        for (int i = 0; i < 4; i++) aligned_ptr[i] = a.v[i];
+    }
+
+    // Loads and converts 4 consecutive int16 values, no alignment required
+    inline Float4 LoadInt16x4(const int16_t* ptr) {
+        return { (float)ptr[0], (float)ptr[1], (float)ptr[2], (float)ptr[3] };
+    }
+
+    inline Float4 Add(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] += b.v[i]; return a; }
+    inline Float4 Sub(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] -= b.v[i]; return a; }
+    inline Float4 Mul(Float4 a, Float4 b) { for (int i = 0; i < 4; i++) a.v[i] *= b.v[i]; return a; }
+    inline Float4 Abs(Float4 a) { for (int i = 0; i < 4; i++) a.v[i] = std::fabs(a.v[i]); return a; }
+
+    inline Float4 Min(Float4 a, Float4 b) {
+        for (int i = 0; i < 4; i++) a.v[i] = Magnum::Math::min(a.v[i], b.v[i]);
+        return a;
+    }
+    inline Float4 Max(Float4 a, Float4 b) {
+        for (int i = 0; i < 4; i++) a.v[i] = Magnum::Math::max(a.v[i], b.v[i]);
+        return a;
+    }
+
+    // Returns a 4-bit mask, bit i is set if (a[i] <= b[i])
+    inline int CmpLeMask(Float4 a, Float4 b) {
+        int mask = 0;
+        for (int i = 0; i < 4; i++) if (a.v[i] <= b.v[i]) mask |= 1 << i;
+        return mask;
+    }
+    // Returns a 4-bit mask, bit i is set if (a[i] < b[i])
+    inline int CmpLtMask(Float4 a, Float4 b) {
+        int mask = 0;
+        for (int i = 0; i < 4; i++) if (a.v[i] < b.v[i]) mask |= 1 << i;
+        return mask;
+    }
+#endif
+
+} // namespace coll::simd
+
+#endif // COLL_SIMD_H_
@@ -9,6 +9,19 @@
 
 namespace coll {
 
+// Bit flags describing what a map object is solid to. Simplified version of
+// the CONTENTS_* flags of the Source engine.
+using ContentsMask = uint8_t;
+const ContentsMask CONTENTS_SOLID       = 1 << 0; // Solid to everything
+const ContentsMask CONTENTS_PLAYERCLIP  = 1 << 1; // Only solid to players
+const ContentsMask CONTENTS_GRENADECLIP = 1 << 2; // Only solid to grenades and bump mines
+const ContentsMask CONTENTS_LADDER      = 1 << 3; // Climbable, solid to players
+const ContentsMask CONTENTS_WATER       = 1 << 4; // Not solid, but detectable
+
+// Trace masks, specifying which contents a trace collides with
+const ContentsMask MASK_PLAYERSOLID  = CONTENTS_SOLID | CONTENTS_PLAYERCLIP | CONTENTS_LADDER;
+const ContentsMask MASK_GRENADESOLID = CONTENTS_SOLID | CONTENTS_GRENADECLIP;
+
 // -------- start of source-sdk-2013 code --------
 // (taken and modified from Ray_t, CBaseTrace and CToolTrace in
 // source-sdk-2013/<...>/src/public/cmodel.h and
@@ -24,7 +37,7 @@ struct SweptTrace
         Magnum::Vector3 invdelta;    // Precomputation for Line-AABB collisions. 1 / delta
         Magnum::Vector3 extents;     // Describes an axis aligned box extruded along a ray
         bool            isray;       // Are the extents zero?
-        //uint32_t        contents;    // Only collide with objects with these contents
+        ContentsMask    contents_mask; // Only collide with objects that have any of these contents
     } info;
 
 
@@ -54,7 +67,8 @@ struct SweptTrace
     // Init a ray trace (aka moving a point through the world until it hits something)
     SweptTrace(
         const Magnum::Vector3& ray_trace_start,
-        const Magnum::Vector3& ray_trace_end)
+        const Magnum::Vector3& ray_trace_end,
+        ContentsMask contents_mask = MASK_PLAYERSOLID)
         : info{
             .startpos    = ray_trace_start,
             .startoffset = { 0.0f, 0.0f, 0.0f },
@@ -62,12 +76,10 @@ struct SweptTrace
             .invdelta    = ComputeInverseVec(ray_trace_end - ray_trace_start),
             .extents     = { 0.0f, 0.0f, 0.0f },
             .isray       = true,
+            .contents_mask = contents_mask,
         }
         , results{}
     {
-        assert(0 && "WARNING: Ray traces are currently not accurate against some"
-            " displacements due to required displacement collision structures "
-            " not being initialized because ray traces are currently not used!");
     }
 
     // Init a hull trace (aka moving an AABB through the world until it hits something)
@@ -75,7 +87,8 @@ struct SweptTrace
         const Magnum::Vector3& hull_trace_start,
         const Magnum::Vector3& hull_trace_end,
         const Magnum::Vector3& hull_mins,
-        const Magnum::Vector3& hull_maxs)
+        const Magnum::Vector3& hull_maxs,
+        ContentsMask contents_mask = MASK_PLAYERSOLID)
         : info{
             // Offset start position to make it centered within the extents
             .startpos    = hull_trace_start + 0.5f * (hull_mins + hull_maxs),
@@ -84,6 +97,7 @@ struct SweptTrace
             .invdelta    = ComputeInverseVec(hull_trace_end - hull_trace_start),
             .extents     = (hull_maxs - hull_mins) * 0.5f,
             .isray       = false,
+            .contents_mask = contents_mask,
         }
         , results{}
     {
@@ -105,7 +119,7 @@ struct SweptTrace
         const Magnum::Vector3& aabb_maxs,
         float* hit_fraction = nullptr) const;
 
-private:
+    // Component-wise 1 / vec, like Info::invdelta. Zero components yield FLT_MAX.
     static Magnum::Vector3 ComputeInverseVec(const Magnum::Vector3& vec);
 };
 // --------- end of source-sdk-2013 code ---------
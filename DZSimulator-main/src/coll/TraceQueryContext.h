@@ -0,0 +1,91 @@
+#ifndef COLL_TRACEQUERYCONTEXT_H_
+#define COLL_TRACEQUERYCONTEXT_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/Simd.h"
+#include "coll/SweptTrace.h"
+
+namespace coll {
+
+// Short list of broad-phase candidates (BVH leaves) of a small region of the
+// world, gathered by CollidableWorld::GatherTraceCandidates(). Traces whose
+// swept volume lies completely inside that region are done against these
+// candidates instead of traversing the BVH from its root. Intended for many
+// traces in the same neighborhood, e.g. all traces of a player movement tick.
+// Candidates of all contents are gathered, so traces with different contents
+// masks can share a context.
+// NOTE: If multiple objects are hit at the exact same fraction, which of them
+//       gets reported might differ from a regular trace.
+// CAUTION: Not thread-safe, every thread needs its own context. Candidates
+//          must be gathered again after the CollidableWorld changed.
+class TraceQueryContext {
+public:
+    // Forget gathered candidates, following traces traverse the BVH again
+    void Clear() {
+        is_gathered = false;
+        candidate_packs.clear();
+        candidate_hits.clear(); // Keeps copies of a cleared context cheap
+    }
+
+    bool IsGathered() const { return is_gathered; }
+
+    // Returns true if the trace's swept volume lies inside the gathered region
+    bool ContainsSweep(const SweptTrace::Info& trace_info) const {
+        if (!is_gathered)
+            return false;
+        Magnum::Vector3 endpos = trace_info.startpos + trace_info.delta;
+        for (int axis = 0; axis < 3; axis++) {
+            float sweep_min = Magnum::Math::min(trace_info.startpos[axis], endpos[axis]);
+            float sweep_max = Magnum::Math::max(trace_info.startpos[axis], endpos[axis]);
+            if (sweep_min - trace_info.extents[axis] < region_mins[axis]) return false;
+            if (sweep_max + trace_info.extents[axis] > region_maxs[axis]) return false;
+        }
+        return true;
+    }
+
+    // Counters, they are never reset by this class.
+    struct Stats {
+        uint64_t num_gathers           = 0; // Times candidates were gathered
+        uint64_t num_candidate_traces  = 0; // Traces that skipped BVH traversal from the root
+        uint64_t num_fallback_traces   = 0; // Traces that left the region, traversing the BVH from the root
+    } stats;
+
+private:
+    // Candidates are gathered in a slightly bigger region than the one that
+    // traces must lie inside of. This makes sure that rounding errors of AABB
+    // hit tests can't let a trace hit a leaf that wasn't gathered.
+    static constexpr float REGION_GATHER_MARGIN = 1.0f;
+
+    // 4 candidate leaves and their AABBs, stored in a structure-of-arrays
+    // layout like BVH::Node4 child AABBs.
+    struct alignas(simd::FLOAT4_ALIGNMENT) CandidatePack {
+        float mins[3][4]; // Indexed by [axis][slot]
+        float maxs[3][4]; // Indexed by [axis][slot]
+        int32_t leaf_indices[4]; // idx into BVH leaves, 0 if slot is unused
+        ContentsMask contents[4]; // Leaf contents, 0 if slot is unused
+    };
+
+    // Candidate whose AABB is hit by the current trace
+    struct CandidateHit {
+        float   aabb_hit_fraction;
+        int32_t leaf_idx; // idx into BVH leaves
+    };
+
+    bool is_gathered = false;
+    Magnum::Vector3 region_mins;
+    Magnum::Vector3 region_maxs;
+    std::vector<CandidatePack> candidate_packs;
+    std::vector<CandidateHit> candidate_hits; // Scratch memory of each trace
+
+    friend class BVH;
+    friend class CollidableWorld;
+};
+
+} // namespace coll
+
+#endif // COLL_TRACEQUERYCONTEXT_H_
@@ -0,0 +1,353 @@
+#include "coll/TraceRecorder.h"
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <Corrade/Containers/Array.h>
+#include <Corrade/Containers/ArrayView.h>
+#include <Corrade/Containers/Optional.h>
+#include <Corrade/Containers/Pair.h>
+#include <Corrade/Containers/StringStl.h>
+#include <Corrade/Containers/StringView.h>
+#include <Corrade/Utility/Debug.h>
+#include <Corrade/Utility/Path.h>
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/SweptTrace.h"
+#include "csgo_parsing/BspMap.h"
+
+using namespace coll;
+using namespace Magnum;
+using namespace Corrade;
+using namespace csgo_parsing;
+
+#define PRINT_PREFIX "[TraceRecorder]"
+
+// NOTE: Values are copied with their in-memory byte order. All platforms
+//       DZSimulator runs on are little-endian.
+static const char CORPUS_MAGIC[4] = { 'D', 'Z', 'T', 'C' };
+
+template<class T>
+static void AppendBytes(std::vector<uint8_t>& buf, const T& value)
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+static void AppendVector3(std::vector<uint8_t>& buf, const Vector3& v)
+{
+    AppendBytes(buf, v.x());
+    AppendBytes(buf, v.y());
+    AppendBytes(buf, v.z());
+}
+
+static void AppendObjectState(std::vector<uint8_t>& buf,
+    const TraceRecorder::ObjectState& state)
+{
+    AppendBytes(buf, TraceRecorder::ENTRY_OBJECT_STATE);
+    AppendBytes(buf, (uint8_t)state.type);
+    AppendBytes(buf, state.object_idx);
+    AppendBytes(buf, (uint8_t)state.enabled);
+}
+
+// Reads values from a byte array, front to back. Reading past the end sets
+// the failed flag and yields zeroed values.
+struct ByteReader {
+    const char* data;
+    size_t      size;
+    size_t      pos    = 0;
+    bool        failed = false;
+
+    template<class T>
+    T Read() {
+        T value{};
+        if (pos + sizeof(T) > size) {
+            failed = true;
+            return value;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    Vector3 ReadVector3() {
+        float x = Read<float>();
+        float y = Read<float>();
+        float z = Read<float>();
+        return { x, y, z };
+    }
+};
+
+TraceRecorder::MapIdentity TraceRecorder::GetMapIdentity(const BspMap& bsp_map)
+{
+    MapIdentity map;
+    if (bsp_map.file_origin.type == BspMap::FileOrigin::FILE_SYSTEM)
+        map.name = Utility::Path::split(bsp_map.file_origin.abs_file_path).second();
+    map.map_revision = bsp_map.header.map_revision;
+    return map;
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    Stop();
+}
+
+bool TraceRecorder::Start(const std::string& file_path, const MapIdentity& map,
+    std::span<const ObjectState> object_states)
+{
+    Stop();
+
+    std::vector<uint8_t> header;
+    header.insert(header.end(), CORPUS_MAGIC, CORPUS_MAGIC + sizeof(CORPUS_MAGIC));
+    AppendBytes(header, FORMAT_VERSION);
+    AppendBytes(header, map.map_revision);
+    AppendBytes(header, (uint16_t)map.name.size());
+    header.insert(header.end(), map.name.begin(), map.name.end());
+
+    if (!Utility::Path::write(file_path,
+            Containers::ArrayView<const uint8_t>{ header.data(), header.size() })) {
+        Utility::Error{} << PRINT_PREFIX << "Failed to create trace corpus file"
+            << file_path;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_is_recording_file = true;
+    m_file_path  = file_path;
+    m_num_traces = 0;
+    m_buffer.clear();
+    m_buffer.reserve(FLUSH_THRESHOLD + TRACE_ENTRY_SIZE + 1);
+    for (const ObjectState& state : object_states)
+        AppendObjectState(m_buffer, state);
+    UpdateIsActive();
+    Utility::Debug{} << PRINT_PREFIX << "Started recording traces into"
+        << file_path;
+    return true;
+}
+
+void TraceRecorder::Stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_is_recording_file)
+        return;
+    m_is_recording_file = false;
+    UpdateIsActive();
+    FlushBuffer();
+    Utility::Debug{} << PRINT_PREFIX << "Recorded" << m_num_traces
+        << "traces into" << m_file_path;
+}
+
+void TraceRecorder::SetRecentTraceCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_recent_trace_capacity = capacity;
+    m_recent_traces.clear();
+    m_recent_traces.shrink_to_fit();
+    m_next_recent_trace_idx = 0;
+    UpdateIsActive();
+}
+
+std::vector<SweptTrace::Info> TraceRecorder::GetRecentTraces() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<SweptTrace::Info> traces;
+    traces.reserve(m_recent_traces.size());
+    traces.insert(traces.end(),
+        m_recent_traces.begin() + m_next_recent_trace_idx, m_recent_traces.end());
+    traces.insert(traces.end(),
+        m_recent_traces.begin(), m_recent_traces.begin() + m_next_recent_trace_idx);
+    return traces;
+}
+
+void TraceRecorder::SetPaused(bool paused)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_is_paused = paused;
+    UpdateIsActive();
+}
+
+void TraceRecorder::RecordTrace(const Record& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_is_active.load(std::memory_order_relaxed))
+        return; // Recording was stopped or paused in the meantime
+
+    // Benchmarks trace directly against BVHs, which can't handle traces with
+    // zero sweep distance, see CollidableWorld::DoSweptTrace()
+    if (m_recent_trace_capacity > 0 && !record.info.delta.isZero()) {
+        if (m_recent_traces.size() < m_recent_trace_capacity) {
+            m_recent_traces.push_back(record.info);
+        }
+        else { // Overwrite oldest trace
+            m_recent_traces[m_next_recent_trace_idx] = record.info;
+            m_next_recent_trace_idx = (m_next_recent_trace_idx + 1) % m_recent_trace_capacity;
+        }
+    }
+
+    if (!m_is_recording_file)
+        return;
+
+    const SweptTrace::Info&    info    = record.info;
+    const SweptTrace::Results& results = record.results;
+    AppendBytes(m_buffer, ENTRY_TRACE);
+    size_t prev_size = m_buffer.size();
+    AppendVector3(m_buffer, info.startpos);
+    AppendVector3(m_buffer, info.startoffset);
+    AppendVector3(m_buffer, info.delta);
+    AppendVector3(m_buffer, info.extents);
+    AppendBytes(m_buffer, (uint8_t)info.isray);
+    AppendBytes(m_buffer, (uint8_t)info.contents_mask);
+    AppendBytes(m_buffer, results.fraction);
+    AppendVector3(m_buffer, results.plane_normal);
+    AppendBytes(m_buffer, results.surface);
+    AppendBytes(m_buffer, (uint8_t)results.startsolid);
+    AppendBytes(m_buffer, (uint8_t)results.allsolid);
+    AppendBytes(m_buffer, (uint8_t)record.used_candidates);
+    AppendVector3(m_buffer, record.candidate_region_mins);
+    AppendVector3(m_buffer, record.candidate_region_maxs);
+    assert(m_buffer.size() - prev_size == TRACE_ENTRY_SIZE);
+    m_num_traces++;
+
+    if (m_buffer.size() >= FLUSH_THRESHOLD)
+        FlushBuffer();
+}
+
+void TraceRecorder::RecordObjectState(const ObjectState& state)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_is_active.load(std::memory_order_relaxed) || !m_is_recording_file)
+        return;
+    AppendObjectState(m_buffer, state);
+}
+
+void TraceRecorder::FlushBuffer()
+{
+    if (m_buffer.empty())
+        return;
+    if (!Utility::Path::append(m_file_path,
+            Containers::ArrayView<const uint8_t>{ m_buffer.data(), m_buffer.size() }))
+        Utility::Error{} << PRINT_PREFIX << "Failed to write" << m_buffer.size()
+            << "bytes to" << m_file_path;
+    m_buffer.clear();
+}
+
+void TraceRecorder::UpdateIsActive()
+{
+    bool is_active = !m_is_paused
+        && (m_is_recording_file || m_recent_trace_capacity > 0);
+    m_is_active.store(is_active, std::memory_order_relaxed);
+}
+
+bool TraceRecorder::ReadCorpus(const std::string& file_path, Corpus* corpus)
+{
+    Containers::Optional<Containers::Array<char>> file_content =
+        Utility::Path::read(file_path);
+    if (!file_content) {
+        Utility::Error{} << PRINT_PREFIX << "Failed to read trace corpus file"
+            << file_path;
+        return false;
+    }
+
+    ByteReader reader{ .data = file_content->data(), .size = file_content->size() };
+
+    // Header
+    char magic[4];
+    for (char& c : magic)
+        c = reader.Read<char>();
+    uint32_t format_version    = reader.Read<uint32_t>();
+    corpus->map.map_revision   = reader.Read<uint32_t>();
+    uint16_t name_len          = reader.Read<uint16_t>();
+    if (reader.failed || std::memcmp(magic, CORPUS_MAGIC, sizeof(magic)) != 0) {
+        Utility::Error{} << PRINT_PREFIX << file_path << "is no trace corpus file";
+        return false;
+    }
+    if (format_version != FORMAT_VERSION) {
+        Utility::Error{} << PRINT_PREFIX << file_path << "has format version"
+            << format_version << "instead of" << FORMAT_VERSION;
+        return false;
+    }
+    if (reader.pos + name_len > reader.size) {
+        Utility::Error{} << PRINT_PREFIX << file_path << "has a truncated header";
+        return false;
+    }
+    corpus->map.name.assign(reader.data + reader.pos, name_len);
+    reader.pos += name_len;
+
+    // Entries
+    corpus->traces.clear();
+    corpus->object_state_changes.clear();
+    while (reader.pos < reader.size) {
+        uint8_t entry_type = reader.Read<uint8_t>();
+        size_t entry_size;
+        switch (entry_type) {
+        case ENTRY_TRACE:        entry_size = TRACE_ENTRY_SIZE;        break;
+        case ENTRY_OBJECT_STATE: entry_size = OBJECT_STATE_ENTRY_SIZE; break;
+        default:
+            Utility::Error{} << PRINT_PREFIX << file_path
+                << "contains an unknown entry type:" << (int)entry_type;
+            return false;
+        }
+        if (reader.pos + entry_size > reader.size) {
+            Utility::Warning{} << PRINT_PREFIX << file_path
+                << "ends with an incomplete entry, skipping it";
+            break;
+        }
+
+        if (entry_type == ENTRY_OBJECT_STATE) {
+            uint8_t  object_type = reader.Read<uint8_t>();
+            uint32_t object_idx  = reader.Read<uint32_t>();
+            bool     enabled     = reader.Read<uint8_t>() != 0;
+            corpus->object_state_changes.push_back({
+                .next_trace_idx = corpus->traces.size(),
+                .state = {
+                    .type       = (DynamicBVH::ObjectType)object_type,
+                    .object_idx = object_idx,
+                    .enabled    = enabled,
+                },
+            });
+            continue;
+        }
+
+        Vector3 startpos    = reader.ReadVector3();
+        Vector3 startoffset = reader.ReadVector3();
+        Vector3 delta       = reader.ReadVector3();
+        Vector3 extents     = reader.ReadVector3();
+        bool isray                 = reader.Read<uint8_t>() != 0;
+        ContentsMask contents_mask = reader.Read<uint8_t>();
+
+        SweptTrace::Results results;
+        results.fraction     = reader.Read<float>();
+        results.plane_normal = reader.ReadVector3();
+        results.surface      = reader.Read<int16_t>();
+        results.startsolid   = reader.Read<uint8_t>() != 0;
+        results.allsolid     = reader.Read<uint8_t>() != 0;
+
+        bool used_candidates          = reader.Read<uint8_t>() != 0;
+        Vector3 candidate_region_mins = reader.ReadVector3();
+        Vector3 candidate_region_maxs = reader.ReadVector3();
+
+        corpus->traces.push_back({
+            .info = {
+                .startpos    = startpos,
+                .startoffset = startoffset,
+                .delta       = delta,
+                .invdelta    = SweptTrace::ComputeInverseVec(delta),
+                .extents     = extents,
+                .isray       = isray,
+                .contents_mask = contents_mask,
+            },
+            .results = results,
+            .used_candidates       = used_candidates,
+            .candidate_region_mins = candidate_region_mins,
+            .candidate_region_maxs = candidate_region_maxs,
+        });
+    }
+    assert(!reader.failed);
+    return true;
+}
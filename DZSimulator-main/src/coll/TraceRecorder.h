@@ -0,0 +1,170 @@
+#ifndef COLL_TRACERECORDER_H_
+#define COLL_TRACERECORDER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/DynamicBVH.h"
+#include "coll/SweptTrace.h"
+#include "csgo_parsing/BspMap.h"
+
+namespace coll {
+
+// Records traces of CollidableWorld::DoSweptTrace(), together with their
+// results, into two optional sinks:
+// - A trace corpus file, e.g. recorded during normal play. The corpus can be
+//   replayed later to check that the collision code still produces
+//   bit-identical results and to benchmark it with a real per-tick trace mix,
+//   see Benchmark::ReplayTraceCorpus(). Besides traces, the corpus contains
+//   every change of which func_brush entities and dynamic props are enabled,
+//   so that replayed traces see the same world.
+// - An in-memory ring buffer of the most recent trace infos, used by
+//   benchmarks, see Benchmark::GetRecordedTraces().
+//
+// Corpus file layout, all values little-endian:
+// - Header: Magic "DZTC", format version (uint32), map_revision of the map's
+//   BSP header (uint32), map name length (uint16), map name (no terminator)
+// - Entries until the end of the file, each starting with its type (uint8):
+//   - ENTRY_TRACE, TRACE_ENTRY_SIZE bytes follow:
+//     Trace info: startpos, startoffset, delta, extents (float x3 each), isray
+//     (uint8), contents_mask (uint8). invdelta isn't stored, it's recomputed
+//     from delta like the SweptTrace constructors do.
+//     Trace results: fraction (float), plane_normal (float x3), surface
+//     (int16), startsolid (uint8), allsolid (uint8).
+//     Candidates: used_candidates (uint8), candidate_region_mins and
+//     candidate_region_maxs (float x3 each, zero if not used).
+//   - ENTRY_OBJECT_STATE, OBJECT_STATE_ENTRY_SIZE bytes follow:
+//     Object type (uint8, DynamicBVH::ObjectType), object idx (uint32),
+//     enabled (uint8). The state of every object is written when recording
+//     starts, later entries are changes of it.
+class TraceRecorder {
+public:
+    static constexpr uint32_t FORMAT_VERSION = 2;
+
+    static constexpr uint8_t ENTRY_TRACE        = 1;
+    static constexpr uint8_t ENTRY_OBJECT_STATE = 2;
+    static constexpr size_t  TRACE_ENTRY_SIZE        = 4 * 12 + 2 + 4 + 12 + 2 + 2 + 1 + 2 * 12;
+    static constexpr size_t  OBJECT_STATE_ENTRY_SIZE = 1 + 4 + 1;
+
+    // Which map a corpus was recorded on
+    struct MapIdentity {
+        std::string name; // File name of the BSP map, empty if unknown
+        uint32_t    map_revision = 0;
+
+        bool operator==(const MapIdentity& other) const = default;
+    };
+    static MapIdentity GetMapIdentity(const csgo_parsing::BspMap& bsp_map);
+
+    struct Record {
+        SweptTrace::Info    info;
+        SweptTrace::Results results;
+
+        // If the trace was only done against the candidates gathered for a
+        // region (see CollidableWorld::GatherTraceCandidates()), that region.
+        // If multiple objects are hit at the same fraction, these traces
+        // might report a different one than traces that traverse the BVH.
+        bool            used_candidates = false;
+        Magnum::Vector3 candidate_region_mins = { 0.0f, 0.0f, 0.0f };
+        Magnum::Vector3 candidate_region_maxs = { 0.0f, 0.0f, 0.0f };
+    };
+
+    // Whether a func_brush entity or dynamic prop is enabled, see
+    // CollidableWorld::SetFuncBrushEnabled()
+    using ObjectState = DynamicBVH::ObjectState;
+
+    struct Corpus {
+        MapIdentity         map;
+        std::vector<Record> traces; // In recording order
+
+        // Object states in recording order. Each one is applied right
+        // before the trace at next_trace_idx (idx into traces).
+        struct ObjectStateChange {
+            size_t      next_trace_idx;
+            ObjectState state;
+        };
+        std::vector<ObjectStateChange> object_state_changes;
+    };
+
+    TraceRecorder() = default;
+    ~TraceRecorder(); // Stops recording into a file
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // Starts recording into the given corpus file, overwriting it. Stops a
+    // previous recording first. object_states must be the current state of
+    // every object. Returns false if the file can't be written.
+    bool Start(const std::string& file_path, const MapIdentity& map,
+               std::span<const ObjectState> object_states);
+
+    // Writes all remaining entries to the file. Does nothing if not recording
+    // into a file.
+    void Stop();
+
+    // Keeps the infos of the given number of most recent traces in memory,
+    // see GetRecentTraces(). 0 disables this and frees them.
+    void SetRecentTraceCapacity(size_t capacity);
+
+    // Returns infos of the most recent traces, oldest first. Traces with
+    // effectively zero sweep distance aren't kept. Thread-safe.
+    std::vector<SweptTrace::Info> GetRecentTraces() const;
+
+    // While paused, traces and object state changes are not recorded, e.g.
+    // while a corpus is being replayed.
+    void SetPaused(bool paused);
+
+    // Returns true if RecordTrace() and RecordObjectState() need to be called
+    bool IsRecording() const {
+        return m_is_active.load(std::memory_order_relaxed);
+    }
+
+    // Records a trace. Does nothing if not recording. Corpus entries are
+    // written to the file in chunks, so this occasionally blocks on file I/O.
+    // Thread-safe.
+    void RecordTrace(const Record& record);
+
+    // Records a change of an object's state. Does nothing if not recording.
+    void RecordObjectState(const ObjectState& state);
+
+    // Reads a corpus file. Returns false if the file can't be read or isn't a
+    // corpus of the current format version. A trailing incomplete entry (e.g.
+    // after a crash during recording) is skipped.
+    static bool ReadCorpus(const std::string& file_path, Corpus* corpus);
+
+private:
+    // Appends buffered entries to the file. m_mutex must be held.
+    void FlushBuffer();
+
+    // Updates m_is_active from the members below. m_mutex must be held.
+    void UpdateIsActive();
+
+private:
+    static constexpr size_t FLUSH_THRESHOLD = 64 * 1024; // In bytes
+
+    std::atomic<bool>  m_is_active{ false }; // See IsRecording()
+    mutable std::mutex m_mutex; // Protects all members below
+    bool               m_is_paused = false;
+
+    // Corpus file
+    bool                 m_is_recording_file = false;
+    std::string          m_file_path;
+    std::vector<uint8_t> m_buffer; // Entries that weren't written yet
+    size_t               m_num_traces = 0;
+
+    // Ring buffer of recent traces
+    size_t                        m_recent_trace_capacity = 0;
+    std::vector<SweptTrace::Info> m_recent_traces;
+    size_t                        m_next_recent_trace_idx = 0; // Position of oldest trace once full
+};
+
+} // namespace coll
+
+#endif // COLL_TRACERECORDER_H_
@@ -0,0 +1,80 @@
+#ifndef COLL_TRACESHAPE_H_
+#define COLL_TRACESHAPE_H_
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/SweptTrace.h"
+
+namespace coll {
+
+// Description of a trace's shape for trace kernels that are templated on it.
+// Shapes that are known at compile time let kernels drop or constant-fold math
+// that depends on the trace's extents, instead of looking at
+// SweptTrace::Info::isray and SweptTrace::Info::extents at runtime.
+// A trace must only be passed to kernels of a shape it matches, see Matches().
+// ALWAYS_RAY lets kernels drop extent math with "if constexpr".
+
+// Ray or hull trace, looked up at runtime. Matches every trace.
+struct RuntimeShape {
+    static constexpr bool ALWAYS_RAY = false;
+    static bool IsRay(const SweptTrace::Info& info) { return info.isray; }
+    static Magnum::Vector3 GetExtents(const SweptTrace::Info& info) {
+        return info.extents;
+    }
+    static bool Matches(const SweptTrace::Info&) { return true; }
+};
+
+// Ray trace, its extents are always zero
+struct RayShape {
+    static constexpr bool ALWAYS_RAY = true;
+    static constexpr bool IsRay(const SweptTrace::Info&) { return true; }
+    static constexpr Magnum::Vector3 GetExtents(const SweptTrace::Info&) {
+        return { 0.0f, 0.0f, 0.0f };
+    }
+    static bool Matches(const SweptTrace::Info& info) { return info.isray; }
+};
+
+// Hull trace whose extents (half the hull's size) are known at compile time.
+// Extents are integers, like those of all player hulls.
+template<int EXTENT_X, int EXTENT_Y, int EXTENT_Z>
+struct FixedHullShape {
+    static constexpr bool ALWAYS_RAY = false;
+    static constexpr bool IsRay(const SweptTrace::Info&) { return false; }
+    static constexpr Magnum::Vector3 GetExtents(const SweptTrace::Info&) {
+        return { (float)EXTENT_X, (float)EXTENT_Y, (float)EXTENT_Z };
+    }
+    static bool Matches(const SweptTrace::Info& info) {
+        // Exact comparison, integer extents are exactly representable
+        return !info.isray
+            && info.extents.x() == (float)EXTENT_X
+            && info.extents.y() == (float)EXTENT_Y
+            && info.extents.z() == (float)EXTENT_Z;
+    }
+};
+
+// Player hulls that most traces of the movement simulation use. Their sizes
+// follow from CSGO_PLAYER_WIDTH, CSGO_PLAYER_HEIGHT_STANDING and
+// CSGO_PLAYER_HEIGHT_CROUCHED.
+using StandingHullShape = FixedHullShape<16, 16, 36>;
+using DuckedHullShape   = FixedHullShape<16, 16, 27>;
+// Quarter of the standing hull, see CsgoMovement::TryTouchGroundInQuadrants()
+using QuadrantHullShape = FixedHullShape< 8,  8, 36>;
+
+// Calls func.template operator()<Shape>() with the first of the above shapes
+// that the given trace matches, or with RuntimeShape if it matches none.
+// Every shape used here must have its kernels instantiated, see
+// CollidableWorld::DoSweptTrace_Brush() for example.
+template<class Func>
+void DispatchTraceShape(const SweptTrace::Info& info, Func&& func)
+{
+    if      (RayShape         ::Matches(info)) func.template operator()<RayShape         >();
+    else if (StandingHullShape::Matches(info)) func.template operator()<StandingHullShape>();
+    else if (DuckedHullShape  ::Matches(info)) func.template operator()<DuckedHullShape  >();
+    else if (QuadrantHullShape::Matches(info)) func.template operator()<QuadrantHullShape>();
+    else                                       func.template operator()<RuntimeShape     >();
+}
+
+} // namespace coll
+
+#endif // COLL_TRACESHAPE_H_
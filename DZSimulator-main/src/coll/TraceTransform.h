@@ -0,0 +1,92 @@
+#ifndef COLL_TRACETRANSFORM_H_
+#define COLL_TRACETRANSFORM_H_
+
+#include <Magnum/Magnum.h>
+#include <Magnum/Math/Matrix3.h>
+#include <Magnum/Math/Vector3.h>
+
+#include "coll/Simd.h"
+
+namespace coll {
+
+// Transformation of traces into the local space of a translated, rotated and
+// scaled object (e.g. a static prop), precomputed once per object.
+// Transforms a point p into local space with:  p' = M * (p + t)
+// Translating first keeps precision for objects far from the world origin.
+// Stored as a 3x4 matrix [ M | t ] in a column-wise SIMD-friendly layout.
+struct alignas(simd::FLOAT4_ALIGNMENT) TraceTransform {
+    float cols[4][4]; // Columns 0-2 hold M, column 3 holds t. Indexed by [col][row], row 3 is 0
+
+    // Creates the transformation into the local space of an object that was
+    // transformed by first applying linear_transformation, then translation.
+    static TraceTransform FromInverseOf(
+        const Magnum::Matrix3& linear_transformation,
+        const Magnum::Vector3& translation)
+    {
+        Magnum::Matrix3 m = linear_transformation.inverted();
+        TraceTransform transf;
+        for (int col = 0; col < 3; col++) {
+            for (int row = 0; row < 3; row++)
+                transf.cols[col][row] = m[col][row];
+            transf.cols[col][3] = 0.0f;
+        }
+        for (int row = 0; row < 3; row++)
+            transf.cols[3][row] = -translation[row];
+        transf.cols[3][3] = 0.0f;
+        return transf;
+    }
+
+    // Column i of M, i.e. where the unit vector along axis i ends up
+    Magnum::Vector3 GetAxis(int i) const {
+        return { cols[i][0], cols[i][1], cols[i][2] };
+    }
+};
+
+// Trace that was transformed into the local space of an object
+struct LocalTrace {
+    Magnum::Vector3 start;
+    Magnum::Vector3 delta;
+    // The trace's box is oriented in local space. These are its half-size
+    // vectors along its 3 edges (i.e. its extents along the world's X, Y and Z
+    // axis) in local space. A plane with normal n is touched by the box at a
+    // distance of  |dot(extent_axes[0], n)| + |dot(extent_axes[1], n)| +
+    // |dot(extent_axes[2], n)|  from the box center.
+    Magnum::Vector3 extent_axes[3];
+};
+
+// Transforms a trace's start, delta and extents into local space at once.
+inline LocalTrace TransformTraceToLocalSpace(const TraceTransform& transf,
+    const Magnum::Vector3& start, const Magnum::Vector3& delta,
+    const Magnum::Vector3& extents)
+{
+    using namespace simd;
+    Float4 col0 = Load4(transf.cols[0]);
+    Float4 col1 = Load4(transf.cols[1]);
+    Float4 col2 = Load4(transf.cols[2]);
+
+    Magnum::Vector3 s = start + transf.GetAxis(3); // Translate first
+    Float4 local_start = Add(Add(Mul(col0, Splat4(s[0])),
+                                 Mul(col1, Splat4(s[1]))),
+                                 Mul(col2, Splat4(s[2])));
+    Float4 local_delta = Add(Add(Mul(col0, Splat4(delta[0])),
+                                 Mul(col1, Splat4(delta[1]))),
+                                 Mul(col2, Splat4(delta[2])));
+
+    alignas(FLOAT4_ALIGNMENT) float out[5][4];
+    Store4(out[0], local_start);
+    Store4(out[1], local_delta);
+    Store4(out[2], Mul(col0, Splat4(extents[0])));
+    Store4(out[3], Mul(col1, Splat4(extents[1])));
+    Store4(out[4], Mul(col2, Splat4(extents[2])));
+
+    LocalTrace local;
+    local.start = { out[0][0], out[0][1], out[0][2] };
+    local.delta = { out[1][0], out[1][1], out[1][2] };
+    for (int i = 0; i < 3; i++)
+        local.extent_axes[i] = { out[2 + i][0], out[2 + i][1], out[2 + i][2] };
+    return local;
+}
+
+} // namespace coll
+
+#endif // COLL_TRACETRANSFORM_H_
@@ -1,6 +1,7 @@
 #ifndef GUI_GUISTATE_H_
 #define GUI_GUISTATE_H_
 
+#include <cstdint>
 #include <deque>
 #include <string>
 #include <vector>
@@ -153,6 +154,26 @@ public:
 
         // Last frame's game simulation calc time (Changes every frame)
         float OUT_last_sim_calc_time_us;
+
+        // Tick-local trace candidate cache of player movement
+        bool IN_use_tick_trace_cache = false; // See CsgoMovement::s_use_tick_trace_cache
+        uint64_t OUT_tick_trace_cache_gathers = 0; // Each gather traverses the BVH once
+        uint64_t OUT_tick_trace_cache_hits    = 0; // Traces that skipped BVH traversal
+        uint64_t OUT_tick_trace_cache_misses  = 0; // Traces that left the gathered region
+
+        // Displacement collision caches, see coll::DispCollCacheManager
+        int IN_disp_coll_cache_budget_mib = 16; // 0 means unlimited
+        uint64_t OUT_disp_coll_cache_hits      = 0; // Traces that used an already created cache
+        uint64_t OUT_disp_coll_cache_misses    = 0; // Traces that had to create a cache
+        uint64_t OUT_disp_coll_cache_evictions = 0;
+        uint64_t OUT_disp_coll_cache_warm_ups  = 0;
+        uint64_t OUT_disp_coll_cache_count     = 0;
+        uint64_t OUT_disp_coll_cache_bytes     = 0;
+
+        // Precomputed bevel planes of frequently traced prop sections, see
+        // coll::CollidableWorld::UpdateHotXPropBevelPlanes()
+        int IN_xprop_bevel_plane_budget_kib = 1024; // 0 disables precomputation
+        uint64_t OUT_xprop_hot_bevel_plane_bytes = 0;
     } perf;
 
     struct CollisionDebugging { // Only available in Debug builds
@@ -669,6 +669,55 @@ void MenuWindow::DrawPerformanceStats()
     ImGui::Text("Game sim calculation time:  %.1f us",
                 _gui_state.perf.OUT_last_sim_calc_time_us);
 
+    ImGui::Checkbox("Cache movement trace candidates per tick",
+        &_gui_state.perf.IN_use_tick_trace_cache);
+    ImGui::SameLine(); _gui.HelpMarker(
+        ">>>> At the start of each game tick, all objects the player can reach\n"
+        "during that tick are gathered. The player's collision checks of that\n"
+        "tick then only look at these objects instead of searching the entire\n"
+        "map each time.\n"
+        "If the player touches multiple objects at the exact same time, a\n"
+        "different one of them might be reported than without this cache.");
+    const auto& perf = _gui_state.perf;
+    uint64_t saved_traversals = perf.OUT_tick_trace_cache_hits > perf.OUT_tick_trace_cache_gathers ?
+        perf.OUT_tick_trace_cache_hits - perf.OUT_tick_trace_cache_gathers : 0;
+    ImGui::Text("Cached traces: %llu, uncached traces: %llu",
+                (unsigned long long)perf.OUT_tick_trace_cache_hits,
+                (unsigned long long)perf.OUT_tick_trace_cache_misses);
+    ImGui::Text("Saved BVH traversals: %llu",
+                (unsigned long long)saved_traversals);
+
+    ImGui::Separator();
+
+    ImGui::SliderInt("Displacement cache budget (MiB)",
+        &_gui_state.perf.IN_disp_coll_cache_budget_mib, 0, 256, "%d");
+    ImGui::SameLine(); _gui.HelpMarker(
+        ">>>> Collision checks against displacements need additional data that\n"
+        "is created the first time the player gets close to them. If all that\n"
+        "data exceeds this memory budget, the least recently used data is\n"
+        "freed. 0 means unlimited.");
+    ImGui::Text("Displacement caches: %llu (%.2f MiB)",
+                (unsigned long long)perf.OUT_disp_coll_cache_count,
+                (double)perf.OUT_disp_coll_cache_bytes / (1024.0 * 1024.0));
+    ImGui::Text("Cache hits: %llu, misses: %llu",
+                (unsigned long long)perf.OUT_disp_coll_cache_hits,
+                (unsigned long long)perf.OUT_disp_coll_cache_misses);
+    ImGui::Text("Evictions: %llu, warm-ups: %llu",
+                (unsigned long long)perf.OUT_disp_coll_cache_evictions,
+                (unsigned long long)perf.OUT_disp_coll_cache_warm_ups);
+
+    ImGui::Separator();
+
+    ImGui::SliderInt("Prop bevel plane budget (KiB)",
+        &_gui_state.perf.IN_xprop_bevel_plane_budget_kib, 0, 8192, "%d");
+    ImGui::SameLine(); _gui.HelpMarker(
+        ">>>> Collision checks against props need additional planes that are\n"
+        "usually recalculated every time. Planes of the props that get checked\n"
+        "most often are stored instead, as long as they fit into this memory\n"
+        "budget. 0 disables this.");
+    ImGui::Text("Stored prop bevel planes: %.2f KiB",
+                (double)perf.OUT_xprop_hot_bevel_plane_bytes / 1024.0);
+
 }
 
 void MenuWindow::DrawVideoSettings()
@@ -27,6 +27,7 @@
 #include "build_info.h"
 #include "coll/Benchmark.h"
 #include "coll/CollidableWorld.h"
+#include "coll/DispCollCacheManager.h"
 #include "coll/SweptTrace.h"
 #include "csgo_integration/Gsi.h"
 #include "csgo_integration/Handler.h"
@@ -43,6 +44,7 @@
 #include "ren/WideLineRenderer.h"
 #include "SavedUserDataHandler.h"
 #include "sim/CsgoGame.h"
+#include "sim/CsgoMovement.h"
 #include "sim/WorldState.h"
 #include "WorldCreator.h"
 
@@ -819,6 +821,10 @@ bool DZSimApplication::LoadBspMap(std::string file_path,
         WorldCreator::InitFromBspMap(_bsp_map, &world_init_errors);
     _ren_world  = initialized_worlds.first;
     g_coll_world = initialized_worlds.second;
+#if COLL_BENCHMARK_ENABLED
+    // Record traces for coll::Benchmark::ReplayTraceCorpus()
+    //if (g_coll_world) g_coll_world->StartTraceRecording("trace_corpus.dztc");
+#endif
 
     if (!world_init_errors.empty()) {
         Debug{} << world_init_errors.c_str();
@@ -925,6 +931,17 @@ void DZSimApplication::ConfigureGameKeyBindings() {
 #if COLL_BENCHMARK_ENABLED
         coll::Benchmark::StaticPropHullTracing();
         //coll::Benchmark::StaticPropBevelPlaneGen();
+        //coll::Benchmark::BvhNodeFormats();
+        //coll::Benchmark::BvhBuildMethods();
+        //coll::Benchmark::BvhSahCostModels();
+        //coll::Benchmark::BvhBatchedTraces();
+        //coll::Benchmark::BvhAnyHitTraces();
+        //coll::Benchmark::BvhRayTraces();
+        //coll::Benchmark::BvhHullShapeKernels();
+        //coll::Benchmark::DispCollTreeTraversal();
+        //coll::Benchmark::DispCollCacheCreation();
+        //coll::Benchmark::ReplayTraceCorpus("trace_corpus.dztc");
+        //coll::Benchmark::FuncBrushToggling();
         return;
 #endif
 
@@ -1504,6 +1521,13 @@ void DZSimApplication::DoUpdate()
     _currentGameInput.viewingAngleYaw = _cam_ang.y();
 
     if (_csgo_game_sim.HasBeenStarted()) {
+        CsgoMovement::s_use_tick_trace_cache = _gui_state.perf.IN_use_tick_trace_cache;
+        coll::DispCollCacheManager* disp_cache_manager =
+            g_coll_world ? g_coll_world->GetDispCollCacheManager() : nullptr;
+        if (disp_cache_manager)
+            disp_cache_manager->SetMemoryBudget(
+                (size_t)_gui_state.perf.IN_disp_coll_cache_budget_mib * 1024 * 1024);
+
         auto game_sim_start_time = std::chrono::high_resolution_clock::now();
 
         // Send game input to simulation and receive the current worldstate to draw
@@ -1514,6 +1538,32 @@ void DZSimApplication::DoUpdate()
         // Maybe add # of simulated ticks to perf stats?
         _gui_state.perf.OUT_last_sim_calc_time_us = std::chrono::duration_cast<std::chrono::microseconds>(
             game_sim_end_time - game_sim_start_time).count();
+
+        const auto& trace_cache_stats = _drawn_worldstate.csgo_mv.m_tick_trace_context.stats;
+        _gui_state.perf.OUT_tick_trace_cache_gathers = trace_cache_stats.num_gathers;
+        _gui_state.perf.OUT_tick_trace_cache_hits    = trace_cache_stats.num_candidate_traces;
+        _gui_state.perf.OUT_tick_trace_cache_misses  = trace_cache_stats.num_fallback_traces;
+
+        if (disp_cache_manager) {
+            coll::DispCollCacheManager::Stats disp_cache_stats = disp_cache_manager->GetStats();
+            _gui_state.perf.OUT_disp_coll_cache_hits      = disp_cache_stats.num_hits;
+            _gui_state.perf.OUT_disp_coll_cache_misses    = disp_cache_stats.num_misses;
+            _gui_state.perf.OUT_disp_coll_cache_evictions = disp_cache_stats.num_evictions;
+            _gui_state.perf.OUT_disp_coll_cache_warm_ups  = disp_cache_stats.num_warm_ups;
+            _gui_state.perf.OUT_disp_coll_cache_count     = disp_cache_stats.num_caches;
+            _gui_state.perf.OUT_disp_coll_cache_bytes     = disp_cache_stats.cache_memory_size;
+        }
+
+        // Precompute bevel planes of the most frequently traced prop sections.
+        // Finding them scans all prop sections, don't do it every frame.
+        static sim::Clock::time_point s_last_hot_xprop_update_time = current_time;
+        const auto HOT_XPROP_UPDATE_INTERVAL = std::chrono::seconds(1);
+        if (g_coll_world && current_time - s_last_hot_xprop_update_time > HOT_XPROP_UPDATE_INTERVAL) {
+            s_last_hot_xprop_update_time = current_time;
+            _gui_state.perf.OUT_xprop_hot_bevel_plane_bytes =
+                g_coll_world->UpdateHotXPropBevelPlanes(
+                    (size_t)_gui_state.perf.IN_xprop_bevel_plane_budget_kib * 1024);
+        }
     }
 
     // Clear game commands for next frame's commands.
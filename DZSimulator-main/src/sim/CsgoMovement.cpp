@@ -7,6 +7,7 @@
 #include <Magnum/Math/Vector3.h>
 #include <Magnum/Math/Functions.h>
 
+#include "coll/DispCollCacheManager.h"
 #include "coll/SweptTrace.h"
 #include "CsgoConstants.h"
 #include "GlobalVars.h"
@@ -16,6 +17,8 @@ using namespace Magnum;
 using namespace utils_3d;
 using namespace coll;
 
+bool CsgoMovement::s_use_tick_trace_cache = false;
+
 //
 // IMPORTANT NOTICE:
 //
@@ -1658,6 +1661,11 @@ void CsgoMovement::PlayerMove(float time_delta)
 
     ReduceTimers(time_delta);
 
+    ManageDispCollCaches();
+
+    if (s_use_tick_trace_cache)
+        GatherTickTraceCandidates(time_delta);
+
     // Viewing direction vectors are used by ladder code for example
     //AngleVectors(m_vecViewAngles, &m_vecForward, &m_vecRight, &m_vecUp);  // Determine movement angles
 
@@ -1754,6 +1762,9 @@ void CsgoMovement::PlayerMove(float time_delta)
         assert(0);
         break;
     }
+
+    // Gathered candidates must not outlive this tick, the map might change
+    m_tick_trace_context.Clear();
 }
 
 // Purpose: Traces player movement + position
@@ -1767,7 +1778,7 @@ SweptTrace CsgoMovement::TracePlayerBBox(const Vector3& start, const Vector3& en
     //   collisionGroup == COLLISION_GROUP_PLAYER_MOVEMENT
 
     SweptTrace tr{ start, end, GetPlayerMins(), GetPlayerMaxs() };
-    g_coll_world->DoSweptTrace(&tr);
+    g_coll_world->DoSweptTrace(&tr, &m_tick_trace_context);
     return tr;
 }
 
@@ -1781,7 +1792,51 @@ SweptTrace CsgoMovement::TryTouchGround(const Vector3& start, const Vector3& end
     //   collisionGroup == COLLISION_GROUP_PLAYER_MOVEMENT
 
     SweptTrace tr{ start, end, mins, maxs };
-    g_coll_world->DoSweptTrace(&tr);
+    g_coll_world->DoSweptTrace(&tr, &m_tick_trace_context);
     return tr;
 }
 // --------- end of source-sdk-2013 code ---------
+
+
+void CsgoMovement::GatherTickTraceCandidates(float time_delta)
+{
+    // Generous upper bound of the player's speed during this tick, in case
+    // the player jumps and accelerates
+    float max_speed = m_vecVelocity.length() + m_vecBaseVelocity.length()
+        + CSGO_CVAR_SV_JUMP_IMPULSE * CSGO_CVAR_SV_JUMP_IMPULSE_EXOJUMP_MULTIPLIER
+        + CSGO_CVAR_SV_GRAVITY * time_delta
+        + CSGO_CVAR_SV_MAXSPEED;
+
+    // Step up/down traces and ground checks reach a bit further than that
+    Vector3 reach{ max_speed * time_delta + 2.0f * CSGO_CVAR_SV_STEPSIZE };
+
+    // Player might duck or unduck during this tick
+    Vector3 hull_mins = Math::min(GetPlayerMins(false), GetPlayerMins(true));
+    Vector3 hull_maxs = Math::max(GetPlayerMaxs(false), GetPlayerMaxs(true));
+
+    g_coll_world->GatherTraceCandidates(
+        m_vecAbsOrigin + hull_mins - reach,
+        m_vecAbsOrigin + hull_maxs + reach,
+        &m_tick_trace_context);
+}
+
+void CsgoMovement::ManageDispCollCaches()
+{
+    DispCollCacheManager* cache_manager = g_coll_world->GetDispCollCacheManager();
+    if (!cache_manager)
+        return;
+
+    // Traces of the previous tick are done, unused caches can be freed now
+    cache_manager->EnforceMemoryBudget();
+
+    // Predict the player's path by assuming the current velocity persists
+    Vector3 path_end = m_vecAbsOrigin
+        + DISP_COLL_CACHE_WARM_UP_TIME * (m_vecVelocity + m_vecBaseVelocity);
+    Vector3 hull_mins = Math::min(GetPlayerMins(false), GetPlayerMins(true));
+    Vector3 hull_maxs = Math::max(GetPlayerMaxs(false), GetPlayerMaxs(true));
+    Vector3 reach{ CSGO_CVAR_SV_STEPSIZE };
+
+    cache_manager->RequestWarmUp(
+        Math::min(m_vecAbsOrigin, path_end) + hull_mins - reach,
+        Math::max(m_vecAbsOrigin, path_end) + hull_maxs + reach);
+}
@@ -5,6 +5,7 @@
 #include <Magnum/Math/Vector3.h>
 
 #include "coll/SweptTrace.h"
+#include "coll/TraceQueryContext.h"
 
 
 // -------- start of source-sdk-2013 code --------
@@ -113,6 +114,33 @@ public:
     Magnum::Vector3 GetPlayerMins(bool ducked) const;
     Magnum::Vector3 GetPlayerMaxs(bool ducked) const;
 
+    // Tick-local broad-phase candidate cache: At the start of PlayerMove(),
+    // all objects the player can reach during that tick are gathered. Player
+    // traces of that tick are done against them instead of traversing the BVH
+    // from its root. Traces that leave the gathered region still traverse it.
+    // Off by default: If multiple objects are hit at the exact same fraction,
+    // cached traces might report a different one than uncached traces, see
+    // coll::TraceQueryContext.
+    // NOTE: This setting applies to all CsgoMovement objects, but each object
+    //       has its own candidates in m_tick_trace_context.
+    static bool s_use_tick_trace_cache;
+    // Candidates of the current tick, cleared at the end of PlayerMove().
+    // Its counters are carried along when this object is copied, e.g. with
+    // its WorldState.
+    coll::TraceQueryContext m_tick_trace_context;
+
+    // Gathers the broad-phase candidates of this tick into m_tick_trace_context
+    void GatherTickTraceCandidates(float time_delta);
+
+    // Seconds of the player's predicted path whose displacement collision
+    // caches are created ahead of time by a background thread
+    static constexpr float DISP_COLL_CACHE_WARM_UP_TIME = 0.5f;
+
+    // Frees displacement collision caches that exceed the memory budget and
+    // requests warm-up of the caches along the player's predicted path.
+    // CAUTION: No other thread must be doing traces while this is called.
+    void ManageDispCollCaches();
+
     coll::SweptTrace TracePlayerBBox(
         const Magnum::Vector3& start, const Magnum::Vector3& end);
     coll::SweptTrace TryTouchGround(